@@ -36,7 +36,7 @@ constexpr static bool disableSequencing = false;
 namespace multicast {
 
 RtpStreamListener::RtpStreamListener() : mFd(0), mExitRequested(false),
-        mPHandler(nullptr), mNextSequenceNumber (-1) {
+        mPHandler(nullptr), mNextSequenceNumber (-1), mPendingLostPackets(0) {
 
     mReaderThread = std::shared_ptr<std::thread>(
             new std::thread(&RtpStreamListener::readLoop, this));
@@ -255,11 +255,34 @@ void RtpStreamListener::processRtpPacket(const char *buf, const size_t len) {
 }
 
 void RtpStreamListener::pushBuffertoBQ(const char *buf, const size_t len, int sequenceNumber) {
+    bool discontinuity = false;
+    if (mNextSequenceNumber != -1 && sequenceNumber != mNextSequenceNumber) {
+        int diff = diffSequenceNumber(mNextSequenceNumber, sequenceNumber);
+        // Negative difference: packets between expected and received are lost
+        if (diff < 0) {
+            mPendingLostPackets += -diff;
+        }
+        discontinuity = true;
+    }
+    discontinuity |= (mPendingLostPackets > 0);
+
     if (mPHandler != nullptr) {
         bq_buffer *cBuf = (*mPHandler)->acquireBuffer(0);
-        memcpy(cBuf->buffer, buf, len);
-        cBuf->size = len;
-        (*mPHandler)->pushBuffertoBQ(cBuf, 0);
+        // cBuf is null if the packet was dropped by the ingest overflow policy.
+        // The sequence number still advances so the reorder cache keeps draining.
+        if (cBuf != nullptr) {
+            memcpy(cBuf->buffer, buf, len);
+            cBuf->size = len;
+            auto &meta = bq_buffer_meta(cBuf);
+            meta.seqFirst = sequenceNumber;
+            meta.seqLast = sequenceNumber;
+            meta.lostPackets = mPendingLostPackets;
+            if (discontinuity) {
+                meta.flags |= BUFFER_FLAG_DISCONTINUITY;
+            }
+            mPendingLostPackets = 0;
+            (*mPHandler)->pushBuffertoBQ(cBuf, 0);
+        }
         (*mPHandler)->reportTSBufferQueued();
     }
     mNextSequenceNumber = (sequenceNumber + 1) & 0xFFFF;
@@ -285,6 +308,7 @@ void RtpStreamListener::processCachedBuffers() {
         else if (mBufferCache.size() == MAX_RTP_BUFFER_CACHE) {
             LOG(WARNING) << "Cache is full, unavailable seq : " << mNextSequenceNumber;
             mNextSequenceNumber = (mNextSequenceNumber + 1) & 0xFFFF;
+            mPendingLostPackets++;
             continueLoop = true;
         }
         else {
@@ -62,6 +62,8 @@ private:
     std::mutex mLock;
     MediaSourceHandler **mPHandler;
     int mNextSequenceNumber;
+    // Packets skipped since the last queued buffer
+    uint32_t mPendingLostPackets;
     std::list<BufferInfo> mBufferCache;
 
 };
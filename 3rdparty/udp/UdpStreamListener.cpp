@@ -115,9 +115,12 @@ int UdpStreamListener::readLoop() {
             //fwrite(buf, n, 1, f);
             if (mPHandler != nullptr ) {
                 cBuf = (*mPHandler)->acquireBuffer(0);
-                memcpy(cBuf->buffer, buf, BUF_SIZE);
-                cBuf->size = n;
-                (*mPHandler)->pushBuffertoBQ(cBuf, 0);
+                // cBuf is null if the packet was dropped by the ingest overflow policy
+                if (cBuf != nullptr) {
+                    memcpy(cBuf->buffer, buf, BUF_SIZE);
+                    cBuf->size = n;
+                    (*mPHandler)->pushBuffertoBQ(cBuf, 0);
+                }
                 (*mPHandler)->reportTSBufferQueued();
             }
         }
@@ -0,0 +1,51 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE
+ * file the following copyright and licenses apply:
+ *
+ * Copyright (c) 2022 Nuuday.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+// Data is generated stuffing. The source is lost.
+#define BUFFER_FLAG_SOURCE_LOSS    0x01
+// Data is missing directly before this buffer
+#define BUFFER_FLAG_DISCONTINUITY  0x02
+// First data of a new channel
+#define BUFFER_FLAG_SOURCE_SWITCH  0x04
+
+/**
+ * Metadata carried with ingest buffers (bq_buffer_meta) and with
+ * the chunks posted to the stream consumers (StreamParser::Buffer).
+ *
+ * For chunks the values are aggregated over all ingest buffers
+ * contributing to the chunk.
+ */
+struct BufferMeta {
+    uint64_t ingestTimeUs;  // reception time of the first byte in us, see bufferMetaTimeNowUs
+    uint32_t seqFirst;      // source sequence number of the first packet (RTP only)
+    uint32_t seqLast;       // source sequence number of the last packet (RTP only)
+    uint32_t lostPackets;   // source packets lost directly before this data
+    uint32_t flags;         // BUFFER_FLAG_*
+} __attribute__((packed));
+
+/**
+ * Get the current time on the BufferMeta::ingestTimeUs clock: the
+ * monotonic steady_clock, not the wall clock. It does not step with NTP
+ * and is shared by the processes of the host until reboot.
+ */
+uint64_t bufferMetaTimeNowUs();
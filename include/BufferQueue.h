@@ -22,10 +22,32 @@
 
 #include <cstdint>
 #include <queue>
+#include <mutex>
+#include <chrono>
 #include <condition_variable>
 
 #define QUEUE_SIZE    2
 
+/**
+ * Behaviour of BufferQueue::acquire when all buffers are queued
+ * for consumption and no free buffer is available.
+ */
+enum class OverflowPolicy {
+    BLOCK,        // Wait until the consumer releases a buffer
+    DROP_NEWEST,  // Fail the acquire. The producer drops the new data.
+    DROP_OLDEST   // Reclaim the oldest buffer queued for consumption
+};
+
+/**
+ * Overflow counters. Counters are never reset while the queue exists.
+ */
+struct OverflowStats {
+    uint64_t blockedCount {0};     // Number of acquires that waited for a buffer (BLOCK)
+    uint64_t blockedTimeUs {0};    // Accumulated wait time in acquire (BLOCK)
+    uint64_t droppedNewest {0};    // Number of failed acquires (DROP_NEWEST)
+    uint64_t droppedOldest {0};    // Number of reclaimed queued buffers (DROP_OLDEST)
+};
+
 /**
  * Generic producer/consumer queue
  * @tparam T
@@ -34,19 +56,46 @@
 
 template<typename T, unsigned long queueSize = QUEUE_SIZE>
 class BufferQueue {
+    // Consumer queue entry. dropsBefore is the number of buffers
+    // dropped in the stream directly before this buffer.
+    struct Entry {
+        T *item;
+        uint32_t dropsBefore;
+    };
+
     std::condition_variable fillBuffCond;
     std::condition_variable emptyBuffCond;
     std::mutex fillM;
     std::mutex emptyM;
-    std::queue<T *> consumerQueue;
+    std::queue<Entry> consumerQueue;
     std::queue<T *> producerQueue;
     size_t mMaxDepth;
     bool exitPending = false;
+    OverflowPolicy mPolicy = OverflowPolicy::BLOCK;
+    OverflowStats mStats;
+    // Drops not yet attributed to a queued buffer
+    uint32_t mPendingDrops = 0;
 public:
     BufferQueue() : mMaxDepth(queueSize) {}
 
     uint32_t getQueueSize() { return mMaxDepth; }
 
+    void setOverflowPolicy(OverflowPolicy policy) {
+        std::lock_guard<std::mutex> lock(emptyM);
+        mPolicy = policy;
+    }
+
+    OverflowPolicy getOverflowPolicy() {
+        std::lock_guard<std::mutex> lock(emptyM);
+        return mPolicy;
+    }
+
+    OverflowStats getOverflowStats() {
+        std::lock_guard<std::mutex> emptyLock(emptyM);
+        std::lock_guard<std::mutex> fillLock(fillM);
+        return mStats;
+    }
+
     void queue(T *req) {
         std::unique_lock<std::mutex> lock(fillM);
         fillBuffCond.wait(lock, [this]() { return !isConsumerQueueFull() || exitPending; });
@@ -54,22 +103,98 @@ public:
         if (exitPending)
             return;
 
-        consumerQueue.push(req);
+        consumerQueue.push({req, mPendingDrops});
+        mPendingDrops = 0;
         lock.unlock();
         fillBuffCond.notify_all();
     }
 
     void acquire(T **req) {
+        acquire(req, true);
+    }
+
+    /**
+     * Acquire a free buffer applying the configured overflow policy.
+     * @param req - acquired buffer
+     * @param forceBlocking - ignore the policy and wait for a free buffer.
+     *                        Use it for sources that are flow controlled.
+     * @return false if no buffer was acquired. In that case *req is not modified.
+     */
+    bool acquire(T **req, bool forceBlocking) {
         std::unique_lock<std::mutex> lock(emptyM);
-        emptyBuffCond.wait(lock, [this]() { return !isProducerQueueEmpty() || exitPending; });
+        auto policy = forceBlocking ? OverflowPolicy::BLOCK : mPolicy;
+
+        if (isProducerQueueEmpty() && !exitPending) {
+            switch (policy) {
+                case OverflowPolicy::BLOCK: {
+                    auto waitStart = std::chrono::steady_clock::now();
+                    emptyBuffCond.wait(lock, [this]() { return !isProducerQueueEmpty() || exitPending; });
+                    // Waits ended by shutdown are not stalls
+                    if (exitPending) {
+                        return false;
+                    }
+                    std::lock_guard<std::mutex> fillLock(fillM);
+                    mStats.blockedCount++;
+                    mStats.blockedTimeUs += std::chrono::duration_cast<std::chrono::microseconds>(
+                            std::chrono::steady_clock::now() - waitStart).count();
+                    break;
+                }
+                case OverflowPolicy::DROP_NEWEST: {
+                    std::lock_guard<std::mutex> fillLock(fillM);
+                    mStats.droppedNewest++;
+                    mPendingDrops++;
+                    return false;
+                }
+                case OverflowPolicy::DROP_OLDEST: {
+                    std::lock_guard<std::mutex> fillLock(fillM);
+                    if (isConsumerQueueEmpty()) {
+                        // All buffers are held by the consumer. Nothing to reclaim.
+                        mStats.droppedNewest++;
+                        mPendingDrops++;
+                        return false;
+                    }
+                    auto oldest = consumerQueue.front();
+                    consumerQueue.pop();
+                    mStats.droppedOldest++;
+                    auto drops = oldest.dropsBefore + 1;
+                    if (isConsumerQueueEmpty()) {
+                        mPendingDrops += drops;
+                    } else {
+                        consumerQueue.front().dropsBefore += drops;
+                    }
+                    *req = oldest.item;
+                    return true;
+                }
+            }
+        }
 
         if (exitPending)
-            return;
+            return false;
 
         *req = producerQueue.front();
         producerQueue.pop();
         lock.unlock();
         emptyBuffCond.notify_all();
+        return true;
+    }
+
+    /**
+     * Acquire a free buffer if one is available. Never waits or reclaims
+     * queued buffers and is not counted as overflow.
+     * @param req - acquired buffer
+     * @return false if no buffer is free. In that case *req is not modified.
+     */
+    bool tryAcquire(T **req) {
+        std::unique_lock<std::mutex> lock(emptyM);
+        if (isProducerQueueEmpty() || exitPending) {
+            return false;
+        }
+
+        *req = producerQueue.front();
+        producerQueue.pop();
+        lock.unlock();
+        emptyBuffCond.notify_all();
+        return true;
     }
 
     void consume(T **req) {
@@ -79,13 +204,21 @@ public:
         if (exitPending)
             return;
 
-        *req = consumerQueue.front();
+        *req = consumerQueue.front().item;
         consumerQueue.pop();
         lock.unlock();
         fillBuffCond.notify_all();
     }
 
-    bool consume(T **req, std::chrono::duration<int64_t> timeout) {
+    /**
+     * Consume a buffer
+     * @param req - consumed buffer
+     * @param timeout - maximum wait time
+     * @param dropsBefore - if not null, set to the number of buffers dropped
+     *                      in the stream directly before *req
+     * @return true if a buffer was consumed
+     */
+    bool consume(T **req, std::chrono::duration<int64_t> timeout, uint32_t *dropsBefore = nullptr) {
         std::unique_lock<std::mutex> lock(fillM);
 
         bool done = fillBuffCond.wait_for(lock, timeout, [this]() { return !isConsumerQueueEmpty() || exitPending; });
@@ -95,7 +228,10 @@ public:
 
         if (!done)
             return false;
-        *req = consumerQueue.front();
+        *req = consumerQueue.front().item;
+        if (dropsBefore != nullptr) {
+            *dropsBefore = consumerQueue.front().dropsBefore;
+        }
         consumerQueue.pop();
         lock.unlock();
         fillBuffCond.notify_all();
@@ -132,6 +268,7 @@ public:
         while (!isConsumerQueueEmpty()) {
             consumerQueue.pop();
         }
+        mPendingDrops = 0;
         fillBuffCond.notify_all();
         while (!isProducerQueueEmpty()) {
             producerQueue.pop();
@@ -22,11 +22,13 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <cctype>
 #include <string>
 #include <boost/regex.hpp>
 #include <boost/algorithm/string/case_conv.hpp>
 
 #define SOURCE_IP_STR "sourceip"
+#define SERVICE_ID_STR "serviceid"
 
 using namespace boost::algorithm;
 
@@ -44,13 +46,19 @@ public:
      */
     ChannelConfig(const std::string& uri, uint16_t defaultPort = DEFAULT_SOCKET_PORT) {
         int portIn = 0;
-        std::string dstIp, dstPort, srcIp;
+        std::string dstIp, dstPort, srcIp, query;
 
-        extract(uri, dstIp, dstPort, srcIp);
+        extract(uri, dstIp, dstPort, query);
+        srcIp = getParameter(query, SOURCE_IP_STR);
+        if (!boost::regex_match(srcIp, boost::regex("\\d+\\.\\d+\\.\\d+\\.\\d+"))) {
+            srcIp.clear();
+        }
+        serviceId = getServiceId(uri);
 
         LOG(INFO) << "Destination IP = " << dstIp
             << " port = " << dstPort
-            << " srcIp = " << srcIp;
+            << " srcIp = " << srcIp
+            << " serviceId = " << serviceId;
 
         if (dstIp.length() == 0) {
             LOG(ERROR) << "Invalid URI:" << uri;
@@ -96,23 +104,51 @@ public:
         return mIsValid;
     }
 
+    /**
+     * Get the service (program_number) selected with the serviceId parameter
+     * @param uri - channel URI
+     * @return service id or 0 to select the first service in the PAT, also
+     *         if the parameter is not a decimal number within 1..65535
+     */
+    static uint16_t getServiceId(const std::string &uri) {
+        std::string address, p, query;
+        extract(uri, address, p, query);
+
+        auto value = getParameter(query, SERVICE_ID_STR);
+        if (value.empty()) {
+            return 0;
+        }
+
+        // Decimal digits only, stoul would skip blanks and take a sign
+        try {
+            size_t pos = 0;
+            auto id = std::stoul(value, &pos);
+            if (isdigit((unsigned char) value[0]) && pos == value.size() && id > 0 && id <= 0xFFFF) {
+                return id;
+            }
+        } catch (std::exception const &e) {
+        }
+        LOG(WARNING) << "Invalid service id: " << value;
+        return 0;
+    }
+
 private:
     /**
-     * Extract IP, port and sourceIp for IGMP3
+     * Extract IP, port and query parameters
      * Example inputs:
      *
+     *   234.80.160.204:5900/?sourceIp=2.3.4.5&serviceId=1001
      *   234.80.160.204:5900/?sourceIp=2.3.4.5
      *   234.80.160.204:5900
      *
      * @param URI     - input URI
      * @param address - IP address
      * @param p       - port
-     * @param sIp     - source IP address
+     * @param query   - path and query parameters
      */
-    void extract(std::string const& URI, std::string& address, std::string& p, std::string& sIp) {
+    static void extract(std::string const& URI, std::string& address, std::string& p, std::string& query) {
         boost::regex e("(\\d+\\.\\d+\\.\\d+\\.\\d+)(:[0-9]+)?(/[^\\r\\n]*)?");
         boost::smatch what;
-        std::string srcS;
 
         if (boost::regex_match(URI, what, e, boost::match_extra)) {
             boost::smatch::iterator it = what.begin();
@@ -126,23 +162,27 @@ private:
                 p = tmp.substr(1, tmp.length() - 1);
             }
             ++it;
-            srcS = *it;
+            query = *it;
         }
+    }
 
-        boost::regex matchSourceIp("\\/\\?(\\w+)=(\\d+\\.\\d+\\.\\d+\\.\\d+)");
-
-        if (boost::regex_match(srcS, what, matchSourceIp, boost::match_extra)) {
-            boost::smatch::iterator it = what.begin();
-            ++it;
-            std::string sip = *it;
-            to_lower(sip);
-            if (sip == SOURCE_IP_STR) {
-                ++it;
-                if (it != what.end()) {
-                    sIp = *it;
-                }
+    /**
+     * Get a query parameter value
+     * @param query - query as returned by extract
+     * @param name  - lower case parameter name. Names are case insensitive.
+     * @return value or empty string
+     */
+    static std::string getParameter(const std::string &query, const std::string &name) {
+        boost::regex param("[?&](\\w+)=([^&]*)");
+
+        for (boost::sregex_iterator it(query.begin(), query.end(), param), end; it != end; ++it) {
+            std::string key = (*it)[1];
+            to_lower(key);
+            if (key == name) {
+                return (*it)[2];
             }
         }
+        return std::string();
     }
     static uint32_t parseIPV4string(const char *ipAddress) {
         in_addr addr;
@@ -175,5 +215,10 @@ public:
      */
     std::string srcIPDotDecimal {};
 
+    /**
+     * Selected service of a multi program stream, 0 for the first service
+     */
+    uint16_t serviceId = 0;
+
 };
 
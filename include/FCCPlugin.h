@@ -100,6 +100,8 @@ private:
     std::shared_ptr<ConstDelayDefHandler> mDefferalHandler;
     std::shared_ptr<StreamParser::StreamProcessor> mStreamProcessor;
     std::shared_ptr<StreamParser::TimeShiftBufferConsumer> mTsbConsumer;
+    std::shared_ptr<StreamParser::PcrTracker> mPcrTracker;
+    std::shared_ptr<StreamParser::StreamAnalyzer> mStreamAnalyzer;
 
     std::map<uint64_t, HandleContext> mHandles;
 
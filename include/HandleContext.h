@@ -22,7 +22,8 @@
 
 #include <cstdint>
 
-// Individual context for file descriptor handles
+// Individual context for file descriptor handles. Each handle reads
+// the shared TSB at its own position: mReadOffset - mSeekOffset.
 
 class HandleContext {
 
@@ -37,7 +38,16 @@ public:
         mReadOffset = readOffset;
     }
 
+    uint64_t getSeekOffset() const { return mSeekOffset; }
+
+    void setSeekOffset(uint64_t seekOffset) {
+        mSeekOffset = seekOffset;
+    }
+
+    uint64_t getPosition() const { return mReadOffset - mSeekOffset; }
+
 private:
 
     uint64_t mReadOffset = 0;
+    uint64_t mSeekOffset = 0;
 };
@@ -35,6 +35,7 @@
 #include "DemuxerStatusCallback.h"
 #include "DemuxerCallbackHandler.h"
 #include "ReadDefferHandler.h"
+#include "StuffingGenerator.h"
 #include "network/NetworkRouteObserver.h"
 #ifdef TS_PACKAGE_DUMP
 #include "SocketServer.h"
@@ -43,6 +44,7 @@
 #include "utils/MonitoredVariable.h"
 #include "StreamParser/StreamSource.h"
 #include "StreamParser/StreamProtectionConfig.h"
+#include "StreamParser/PersistentTsb.h"
 #include "ChannelConfig.h"
 
 #include <chrono>
@@ -146,7 +148,15 @@ public:
      */
     void pushBuffertoBQ(bq_buffer *pBuffer, int demuxId);
 
-    bq_buffer *acquireBuffer(int demuxId);
+    /**
+     * Acquire a free buffer for queuing.
+     * When no buffer is free the ingest overflow policy is applied.
+     * @param demuxId
+     * @param forceBlocking - wait for a free buffer regardless of the overflow
+     *                        policy. Use it for flow controlled sources (HTTP).
+     * @return buffer or nullptr if the buffer was dropped by the overflow policy
+     */
+    bq_buffer *acquireBuffer(int demuxId, bool forceBlocking = false);
 
     /**
      * Release unused buffer. Buffer will be not queued for display
@@ -165,6 +175,46 @@ public:
         return mCurrentUri;
     }
 
+    /**
+     * Set ingest queue overflow policy
+     * @param policy
+     */
+    void setIngestOverflowPolicy(OverflowPolicy policy) {
+        mFccBufferQueue.setOverflowPolicy(policy);
+    }
+
+    OverflowPolicy getIngestOverflowPolicy() {
+        return mFccBufferQueue.getOverflowPolicy();
+    }
+
+    OverflowStats getIngestOverflowStats() {
+        return mFccBufferQueue.getOverflowStats();
+    }
+
+    /**
+     * Get number of discontinuity markers inserted in the stream
+     * due to dropped ingest buffers
+     */
+    uint64_t getIngestDiscontinuityCount() const {
+        return mIngestDiscontinuities;
+    }
+
+    /**
+     * Set the shared memory TSB replayed on the first channel open.
+     * Call before the first open.
+     */
+    void setPersistentTsb(std::shared_ptr<StreamParser::PersistentTsb> persistentTsb) {
+        mPersistentTsb = std::move(persistentTsb);
+    }
+
+    /**
+     * Set the tracker giving the PCR PID and the bitrate of the
+     * stuffing. Call before the first open.
+     */
+    void setPcrTracker(std::shared_ptr<StreamParser::PcrTracker> pcrTracker) {
+        mStuffing.setPcrTracker(std::move(pcrTracker));
+    }
+
     /**
      * Check if we have an active channel set
      * @return
@@ -199,11 +249,60 @@ private:
      */
     void messageLoop();
 
+    /**
+     * Copy input data to the current chunk and post
+     * the chunk once it is complete. A chunk ending within a TS
+     * packet is posted once the packet is complete.
+     * Called from the consumer thread only.
+     */
+    void writeToChunk(const uint8_t *data, uint32_t size, const char *channelInfo,
+                      const BufferMeta &meta);
+
+    /**
+     * Handle a gap in the ingest stream caused by dropped buffers.
+     * Discards the incomplete TS packet preceding the gap and
+     * inserts a discontinuity marker packet. The loss reported in
+     * meta is moved to the marker packet.
+     * Called from the consumer thread only.
+     */
+    void insertDiscontinuity(const char *channelInfo, BufferMeta &meta);
+
+    /**
+     * Discard the incomplete TS packet at the end of the written data.
+     * Called from the consumer thread only.
+     */
+    void alignToTsPacket();
+
+    /**
+     * Replay the chunks kept by the previous plugin instance.
+     * Called from open before the source is opened.
+     * @return true if chunks were replayed
+     */
+    bool restorePersistentTsb();
+
 private:
     BufferQueue<bq_buffer, FEIP_DEFAULT_BUFFER_COUNT> mFccBufferQueue;
     std::map<uint32_t, session_ptr_t> mSessions;
     bool mExitRequested;
     std::shared_ptr<std::thread> mConsumerThread;
+
+    // Consumer thread chunk assembly state
+    // Chunks are shared with the async consumers without copying
+    std::shared_ptr<StreamParser::ChunkPool> mChunkPool =
+            StreamParser::ChunkPool::create(CHUNK_POOL_INITIAL_SIZE, CHUNK_POOL_MAX_SIZE);
+    StreamParser::ChunkRef mChunk = mChunkPool->acquire();
+    size_t mChunkOffset = 0;
+    BufferMeta mChunkMeta = {};
+    // Full chunk ending with the first mPendingTail bytes of a TS packet
+    StreamParser::ChunkRef mPendingChunk;
+    BufferMeta mPendingMeta = {};
+    uint32_t mPendingTail = 0;
+    // Bytes written since the last TS packet boundary
+    uint32_t mTsPacketPhase = 0;
+    std::atomic<uint64_t> mIngestDiscontinuities = {0};
+
+    // Stuffing generator used while the source is lost
+    StuffingGenerator mStuffing {STUFFING_FALLBACK_BITRATE};
     bool mIsFeipConnected;
     std::mutex mFeipConfMutex;
 
@@ -238,13 +337,21 @@ private:
 
     void dataMonitorLoop();
 
-    // Inject fixed number of null TS buffers
-    void injectNullBuffers();
+    // Inject the stuffing due since the last call
+    void injectStuffing();
 
     ChannelConfig mCurrentChannelConfig;
 
     std::atomic<bool> mBufferSourceLost = {false};
 
+    // Flag the next received buffer as first buffer of a new channel
+    std::atomic<bool> mPendingSourceSwitch = {false};
+
+    // Replayed on the first channel open and released, the next
+    // received buffer is flagged as a discontinuity
+    std::shared_ptr<StreamParser::PersistentTsb> mPersistentTsb;
+    std::atomic<bool> mRestored = {false};
+
     // Times we lost the source due to unknown error
     unsigned int mSourceLostCounter = {0};
 
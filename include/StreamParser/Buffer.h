@@ -22,12 +22,38 @@
 
 #include "streamfs/config.h"
 #include "config_options.h"
+#include "BufferMeta.h"
+#include "StreamParser/ChunkPool.h"
 
 namespace StreamParser {
 
 struct Buffer {
     const char* channelInfo {nullptr};
     buffer_chunk* chunk {nullptr};
+    BufferMeta meta {};
+    // Pool reference of chunk. May be empty if the chunk is not pooled.
+    // Consumers may keep a copy to hold on to the chunk after post.
+    ChunkRef ref {};
 };
 
+/**
+ * Get a buffer with a pooled chunk for async consumers.
+ * Buffers without a pooled chunk are copied once into the pool.
+ * @param buf - posted buffer
+ * @param copy - storage of the copy, reused if already filled
+ * @param pool - pool used for the copy
+ * @return buf if pooled, otherwise copy
+ */
+inline const Buffer &pooledBuffer(const Buffer &buf, Buffer &copy, ChunkPool &pool) {
+    if (buf.ref) {
+        return buf;
+    }
+    if (!copy.ref) {
+        copy = {buf.channelInfo, nullptr, buf.meta, pool.acquire()};
+        copy.chunk = copy.ref.get();
+        *copy.chunk = *buf.chunk;
+    }
+    return copy;
+}
+
 }
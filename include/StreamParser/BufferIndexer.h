@@ -36,6 +36,12 @@ enum BuffErr {
 
 typedef std::pair<uint64_t, uint64_t> index_pair; // <time in us, accumulated buffer size>
 
+// PCR steps above this start a new media time segment
+#define MEDIA_INDEX_MAX_GAP_US 1000000
+
+// Seeks only snap to random access points this close in arrival time
+#define RAP_MAX_SNAP_US 5000000
+
 class BufferIndexer {
 
 public:
@@ -69,8 +75,58 @@ public:
      */
     std::pair<bool, uint64_t> registerBufferCount(uint64_t bufferCount);
 
+    /**
+     * Register a given timestamp for a particular buffer count.
+     * Timestamps older than the last registered one are clamped to
+     * keep the index monotonic.
+     *
+     * @param size        - the accumulated buffer count in bytes.
+     * @param timestampUs - steady_clock timestamp in us (e.g. ingest time of
+     *                      the buffer, see bufferMetaTimeNowUs).
+     * @return            - see registerBufferCount(uint64_t)
+     */
+    std::pair<bool, uint64_t> registerBufferCount(uint64_t bufferCount, uint64_t timestampUs);
+
+    /**
+     * Register the PCR at a byte index to the media time index.
+     *
+     * PCRs are unwrapped into a continuous media time. A discontinuity,
+     * or a PCR step beyond MEDIA_INDEX_MAX_GAP_US, starts a new segment
+     * joined to the previous one using the arrival time in between.
+     * Seek times resolve against media time while the PCRs cover the
+     * seek position and fall back to arrival time otherwise.
+     *
+     * @param byteIndex     - absolute byte index of the PCR packet, at or
+     *                        below the last registered buffer count.
+     * @param pcr           - 27 MHz PCR
+     * @param discontinuity - the PCR does not continue the previous one
+     */
+    void registerPcr(uint64_t byteIndex, uint64_t pcr, bool discontinuity);
+
+    /**
+     * Register a random access point of the video.
+     *
+     * @param byteIndex - absolute byte index of the packet starting the
+     *                    random access point, at or below the last
+     *                    registered buffer count.
+     */
+    void registerRandomAccessPoint(uint64_t byteIndex);
+
+    /**
+     * Snap a byte offset to a random access point within RAP_MAX_SNAP_US.
+     *
+     * @param byteOffset - byte offset as from getByteOffsetFromTimeUs,
+     *                     set to the offset of the random access point.
+     * @param forward    - snap to the following random access point
+     *                     rather than the preceding one.
+     * @return           - BUF_OK if snapped, BUF_OUT_OF_RANGE if no random
+     *                     access point is close enough.
+     */
+    BuffErr snapToRandomAccessPoint(uint64_t& byteOffset, bool forward);
+
     /**
      * Get the interpolated byte offset for a certain seek time, in microseconds.
+     * The seek time is media time where PCRs are registered.
      *
      * @param time       - seek time in us
      * @param byteOffset - byte offset associated with the seek time
@@ -80,6 +136,7 @@ public:
 
     /**
      * Get the interpolated seek time, in microseconds, for a certain byte offset.
+     * The seek time is media time where PCRs are registered.
      *
      * @param byteOffset - byte offset
      * @param timeS      - seek time in us associated with the byte offset
@@ -87,6 +144,20 @@ public:
      */
     BuffErr getTimeUsFromByteOffset(uint64_t byteOffset, uint64_t& time);
 
+    /**
+     * Get the bytes following a byte offset that cover a media time, to
+     * pace reads. The media time is taken from the PCRs where they cover
+     * the position and from arrival time otherwise. Does not log, as it
+     * is called per read.
+     *
+     * @param byteOffset - byte offset of the read position
+     * @param time       - media time in us
+     * @param size       - bytes covering time, up to the live point
+     * @return           - BUF_OK, or BUF_OUT_OF_RANGE if the position is
+     *                     not indexed
+     */
+    BuffErr getByteSizeForTimeUs(uint64_t byteOffset, uint64_t time, uint64_t& size);
+
     /**
      * Get interpolated EPOC sample timestamp, in microseconds, for a certain
      * absolute byte index.
@@ -118,6 +189,41 @@ public:
      */
     uint64_t getBufferCapacity();
 
+    /**
+     * Resize the indexer to a new TSB BufferPool and clear it.
+     * Allocates, not to be called on the data path.
+     *
+     * @param tsbSize  - the TSB size. Must match the size of TSB BufferPool.
+     * @param tailSize - the tail size of the TSB size, see the constructor.
+     */
+    void resize(uint64_t tsbSize, uint64_t tailSize);
+
+    /**
+     * Limit the indexed window to fewer chunks than the TSB holds,
+     * e.g. to a duration at the measured bitrate. Does not allocate.
+     *
+     * @param chunks - window size in number of chunks, capped to the
+     *                 TSB size less its tail.
+     */
+    void setWindowSize(uint64_t chunks);
+
+    /**
+     * Limit the indexed window to a duration. The duration is media time
+     * where the PCRs cover it and arrival time otherwise, so variable
+     * bitrate streams keep it as the bitrate changes. Does not allocate.
+     *
+     * @param timeUs - window duration in us, 0 for no limit.
+     */
+    void setWindowTimeUs(uint64_t timeUs);
+
+    /**
+     * Drop the samples of the data before a byte index, e.g. when the
+     * TSB releases its oldest part. Does not allocate.
+     *
+     * @param byteIndex - absolute byte index of the oldest data kept
+     */
+    void trimFront(uint64_t byteIndex);
+
     /**
      * Clear the buffer indexer and associated member variables.
      *
@@ -129,11 +235,35 @@ private:
     uint8_t mSamplingRatio;
     uint64_t mBufferCount;
     uint64_t mTsbSize;
+    // mTsbSize without a window set
+    uint64_t mMaxTsbSize;
     boost::circular_buffer<index_pair> mBufInd;
     index_pair mLastByteOffsetFromTimeUs;    // used in getByteOffsetFromTimeUs
     index_pair mLastTimeUsFromByteOffset;    // used in getTimeUsFromByteOffset
+    // Last registration, also when discarded by down-sampling
+    uint64_t mLastBufferCount;
+    uint64_t mLastTimestampUs;
+    // <media time in 27 MHz ticks, byte index>
+    boost::circular_buffer<index_pair> mMediaInd;
+    uint64_t mLastPcr;
+    uint64_t mLastPcrTimestampUs;
+    // <arrival time in us, byte index>
+    boost::circular_buffer<index_pair> mRapInd;
+    // Duration limit and the samples of mBufInd within it
+    uint64_t mWindowUs;
+    uint64_t mWindowCount;
     std::mutex mIndexMutex;
 
+    /**
+     * Clear the index, called with mIndexMutex held.
+     */
+    void clearIndex();
+
+    /**
+     * Update mWindowCount from mWindowUs, called with mIndexMutex held
+     * after a sample is added to mBufInd.
+     */
+    void updateTimeWindow();
 
     /**
      * Returns the size of the index buffer excluding the
@@ -159,6 +289,30 @@ private:
      */
     inline index_pair getFront() const;
 
+    /**
+     * Media time at the last registered buffer count, extrapolated
+     * from the last two PCRs.
+     *
+     * @param ticks - media time in 27 MHz ticks
+     * @return      - false if the PCRs do not reach the live point
+     */
+    bool getLiveMediaTicks(uint64_t& ticks) const;
+
+    /**
+     * Media time counterparts of getByteOffsetFromTimeUs and
+     * getTimeUsFromByteOffset.
+     *
+     * @return - false if the PCRs do not cover the position
+     */
+    bool getByteOffsetFromMediaTimeUs(uint64_t time, uint64_t& byteOffset) const;
+
+    bool getMediaTimeUsFromByteOffset(uint64_t byteOffset, uint64_t& time) const;
+
+    /**
+     * @return - oldest media index entry inside the exposed TSB range
+     */
+    boost::circular_buffer<index_pair>::const_iterator getMediaFront() const;
+
 };
 
 }
@@ -0,0 +1,130 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE
+ * file the following copyright and licenses apply:
+ *
+ * Copyright (c) 2022 Nuuday.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <config_fcc.h>
+#include "streamfs/config.h"
+
+namespace StreamParser {
+
+class ChunkPool;
+
+/**
+ * Pooled chunk storage
+ */
+struct ChunkSlot {
+    buffer_chunk data;
+    std::atomic<uint32_t> refs {0};
+    // Keeps the pool alive while the slot is in use
+    std::shared_ptr<ChunkPool> owner;
+};
+
+/**
+ * Reference counted handle to a pooled chunk.
+ * The chunk is returned to its pool when the last handle is dropped.
+ * A chunk is shared read-only once it is posted; only the
+ * producer holding the single handle may write to it.
+ */
+class ChunkRef {
+public:
+    ChunkRef() = default;
+
+    ChunkRef(const ChunkRef &other);
+
+    ChunkRef(ChunkRef &&other) noexcept;
+
+    ChunkRef &operator=(const ChunkRef &other);
+
+    ChunkRef &operator=(ChunkRef &&other) noexcept;
+
+    ~ChunkRef();
+
+    /**
+     * @return chunk or nullptr for an empty handle
+     */
+    buffer_chunk *get() const { return mSlot != nullptr ? &mSlot->data : nullptr; }
+
+    explicit operator bool() const { return mSlot != nullptr; }
+
+    /**
+     * Drop the reference
+     */
+    void reset();
+
+private:
+    friend class ChunkPool;
+
+    explicit ChunkRef(ChunkSlot *slot) : mSlot(slot) {}
+
+    ChunkSlot *mSlot {nullptr};
+};
+
+/**
+ * Pool of chunks shared between the stream source and the stream
+ * consumers. Slots are allocated on demand up to a maximum and
+ * reused afterwards.
+ */
+class ChunkPool : public std::enable_shared_from_this<ChunkPool> {
+    CLASS_NO_COPY_OR_ASSIGN(ChunkPool);
+
+public:
+    /**
+     * @param initialSize - number of chunks allocated upfront
+     * @param maxSize - maximum number of chunks
+     */
+    static std::shared_ptr<ChunkPool> create(size_t initialSize, size_t maxSize);
+
+    /**
+     * Get a free chunk. Blocks while all maxSize chunks are in use.
+     * @return handle holding the only reference to the chunk
+     */
+    ChunkRef acquire();
+
+    /**
+     * @return number of allocated chunks
+     */
+    size_t getAllocatedCount();
+
+    /**
+     * @return number of allocated chunks not in use
+     */
+    size_t getFreeCount();
+
+private:
+    friend class ChunkRef;
+
+    ChunkPool(size_t initialSize, size_t maxSize);
+
+    void release(ChunkSlot *slot);
+
+    std::mutex mMutex;
+    std::condition_variable mFreeCond;
+    std::vector<std::unique_ptr<ChunkSlot>> mSlots;
+    std::vector<ChunkSlot *> mFree;
+    const size_t mMaxSize;
+};
+
+} //namespace StreamParser
@@ -0,0 +1,158 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE
+ * file the following copyright and licenses apply:
+ *
+ * Copyright (c) 2022 Nuuday.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <config_fcc.h>
+#include "StreamParser/StreamConsumer.h"
+
+namespace StreamParser {
+
+/**
+ * Queue statistics of an async consumer
+ */
+struct ConsumerQueueStats {
+    std::string name;
+    QueuePolicy policy {QueuePolicy::LOSSLESS};
+    size_t capacity {0};
+    size_t depth {0};           // queued items, including the one in progress
+    size_t maxDepth {0};
+    uint64_t lagUs {0};         // ingest to processing delay of the last buffer
+    uint64_t maxLagUs {0};
+    uint64_t dropped {0};       // buffers dropped by a lossy queue
+    uint64_t blockedCount {0};  // posts waiting on a full lossless queue
+    uint64_t blockedTimeUs {0};
+};
+
+/**
+ * Runs an asynchronous StreamConsumer on its own thread.
+ *
+ * Buffers and stream events are delivered to the consumer in posting
+ * order through a bounded queue. Queued buffers hold a reference to
+ * the pooled chunk; the chunk is not copied. The worker sleeps while
+ * the queue is empty and is woken up by the first queued item, so a
+ * buffer or event posted to an idle worker is handled without delay.
+ *
+ * With a full queue, a lossless worker blocks the caller and a lossy
+ * worker drops the posted buffer. The next buffer queued after a drop is
+ * flagged BUFFER_FLAG_DISCONTINUITY. Stream events are never dropped.
+ */
+class ConsumerWorker {
+    CLASS_NO_COPY_OR_ASSIGN(ConsumerWorker);
+
+public:
+    /**
+     * @param consumer - consumer run by the worker
+     * @param queueSize - maximum number of queued buffers and events
+     */
+    ConsumerWorker(std::shared_ptr<StreamConsumer> consumer, size_t queueSize);
+
+    ~ConsumerWorker();
+
+    /**
+     * Queue a buffer. With a full queue, blocks (lossless) or
+     * drops the buffer (lossy).
+     * @param buf - buffer with a pooled chunk (buf.ref must be set)
+     */
+    void post(const Buffer &buf);
+
+    /**
+     * Queue end of stream notification
+     */
+    void onEndOfStream(const char *channelId);
+
+    /**
+     * Discard the buffers not yet processed and queue
+     * the open notification. Data of the previous channel
+     * is of no use to the consumer.
+     */
+    void onOpen(const char *channelId);
+
+    /**
+     * Wait until all queued buffers and events are processed
+     */
+    void join();
+
+    /**
+     * @return queue statistics
+     */
+    ConsumerQueueStats getStats();
+
+private:
+    enum class ItemType {
+        DATA,
+        END_OF_STREAM,
+        OPEN
+    };
+
+    struct Item {
+        ItemType type {ItemType::DATA};
+        bool hasChannel {false};
+        std::string channel;
+        ChunkRef ref;
+        BufferMeta meta {};
+    };
+
+    /**
+     * Reserve the next free slot. Called with mMutex held.
+     * @return slot or nullptr if the worker is exiting
+     */
+    Item *reserveSlot(std::unique_lock<std::mutex> &lock);
+
+    void queueEvent(ItemType type, const char *channelId);
+
+    /**
+     * Queue the reserved slot and wake up the worker if idle.
+     * Called with mMutex held, returns with mMutex released.
+     */
+    void commitSlot(std::unique_lock<std::mutex> &lock);
+
+    /**
+     * Wait on mSpaceCond until pred is true. Called with mMutex held.
+     */
+    template<class Predicate>
+    void waitForSpace(std::unique_lock<std::mutex> &lock, Predicate pred);
+
+    void threadLoop();
+
+    std::shared_ptr<StreamConsumer> mConsumer;
+    const QueuePolicy mPolicy;
+    std::vector<Item> mSlots;
+    size_t mHead {0};
+    size_t mCount {0};      // queued items, including the one in progress
+    bool mExitRequested {false};
+    bool mPendingDiscontinuity {false};
+    ConsumerQueueStats mStats;
+    std::mutex mMutex;
+    // Signalled when the queue becomes non-empty
+    std::condition_variable mDataCond;
+    // Signalled when items are completed while someone waits for space or join
+    std::condition_variable mSpaceCond;
+    size_t mSpaceWaiters {0};
+    std::thread mThread;
+};
+
+} //namespace StreamParser
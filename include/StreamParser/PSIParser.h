@@ -19,17 +19,18 @@
 
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <map>
 #include <memory>
-#include <boost/lockfree/queue.hpp>
 #include "StreamConsumer.h"
 #include "utils/MonVarObserver.h"
 #include "utils/MonitoredVariable.h"
 #include "confighandler/ConfigHandler.h"
 #include "StreamProtectionConfig.h"
+#include "SectionAssembler.h"
 #include <vector>
 #include <confighandler/ConfigHandlerMVarCb.h>
-#include <thread>
-#include <boost/circular_buffer.hpp>
 
 
 #define PSI_INVALID_PID  0xFFFF
@@ -40,6 +41,8 @@
 #define IS_TSC_EVEN(p)     ((p[3] & 0xC0) == 0x80)
 
 #define CA_DESC_LEN 6
+// Long section header (8 bytes) and CRC_32
+#define PSI_SECTION_MIN_SIZE 12
 
 
 static std::map<ConfigVariableId, const char *> ConfigMAP_StreamInfoToPath = {
@@ -57,7 +60,9 @@ private:
     unsigned mVersion;
     bool mPidValid;
     bool mVersionValid;
-    StreamPacketT mTsPacket;
+    // PSI section starting with the table_id
+    ByteVectorType mSection;
+    SectionAssembler mAssembler;
     bool Valid() { return mPidValid; }
 
 public:
@@ -65,8 +70,7 @@ public:
             mPid(pid),
             mVersion(0),
             mPidValid(pid <= PSI_MAX_PID),
-            mVersionValid(false),
-            mTsPacket {0} {}
+            mVersionValid(false) {}
 
     explicit PidInfo() : PidInfo(PSI_INVALID_PID) {}
 
@@ -74,21 +78,25 @@ public:
 
     bool setPid(unsigned pid);
 
-    void setPacket(const StreamPacketT& p) {
-        mTsPacket = p;
-    }
+    /**
+     * Store the section. Only the section_length bytes of
+     * the section are kept.
+     * @param section - section start (table_id)
+     * @param available - bytes available from section start
+     */
+    void setSection(const unsigned char *section, size_t available);
 
-    bool getPmtData(StreamPacketT& p) {
-        if (mPid == PSI_INVALID_PID || mTsPacket[0] != 0x2)
+    bool getPmtData(ByteVectorType& p) const {
+        if (mPid == PSI_INVALID_PID || mSection.empty() || mSection[0] != 0x2)
             return false;
-        p = mTsPacket;
+        p = mSection;
         return true;
     }
 
-    bool getPatData(StreamPacketT& p) {
-        if (mPid == PSI_INVALID_PID || mTsPacket[0] != 0x0)
+    bool getPatData(ByteVectorType& p) const {
+        if (mPid == PSI_INVALID_PID || mSection.empty() || mSection[0] != 0x0)
             return false;
-        p = mTsPacket;
+        p = mSection;
         return true;
     }
 
@@ -102,6 +110,11 @@ public:
 
     bool processed() const { return mVersionValid; };
 
+    /**
+     * Reassembles the sections of the PID. Reset with the PID.
+     */
+    SectionAssembler &assembler() { return mAssembler; }
+
     unsigned getPid();
 };
 
@@ -111,6 +124,7 @@ public:
  */
 class PSIParser : public StreamConsumer, public MonVarObserver<ByteVectorType> {
 public:
+    // Ordered by significance, see parseSections
     typedef enum {
         ERROR,
         IGNORE,
@@ -118,7 +132,6 @@ public:
         DECRYPT_ODD,
         DECRYPT_EVEN,
         NEW_ECM,
-        NEW_ECMT,
         NEW_PAT_PMT
     } ParserActionT;
 
@@ -134,27 +147,59 @@ public:
 
 public:
 
-    PSIParser() : StreamConsumer("PSIParser", true),
+    PSIParser() : StreamConsumer("PSIParser", true, QueuePolicy::LOSSY),
                   mCbFunc(MVar<ByteVectorType>::getWatcher(this, ConfigMAP_StreamInfoToPath)),
-                  mTsStream(), mParserThread(nullptr) {
+                  mTsStream() {
         mDrm = &MVar<StreamProtectionConfig>::getVariable(kDrm0);
         mIsCdmSetupDone = &MVar<bool>::getVariable(kCdm0);
+        mPmtVar = &MVar<ByteVectorType>::getVariable(kPmt0);
+        mPatVar = &MVar<ByteVectorType>::getVariable(kPat0);
         *mIsCdmSetupDone = true;
+        updatePidTable();
     };
 
     virtual ~PSIParser() override;
 
     void post(const Buffer &buf) override;
 
-    void join() override;
-    void joinParserThread();
-
     void notifyConfigurationChanged(const std::string &var, const ByteVectorType &value) override;
 
     void onEndOfStream(const char *channelId) override;
 
     void onOpen(const char* channelId) override;
 
+    /**
+     * Time from channel open until the PSI gating drm0 was found
+     */
+    struct ZapTiming {
+        bool hasPatPmt {false};
+        uint64_t patPmtUs {0};  // open to NEW_PAT_PMT
+        bool hasEcm {false};
+        uint64_t ecmUs {0};     // open to NEW_ECM
+    };
+
+    /**
+     * @return timing of the current zap
+     */
+    ZapTiming getZapTiming();
+
+    /**
+     * @return program_number to PMT PID map of the current PAT
+     */
+    std::map<unsigned, unsigned> getProgramMap();
+
+    /**
+     * @return PMT PID of the selected service or PSI_INVALID_PID
+     */
+    unsigned getPmtPid();
+
+    /**
+     * Splits chunks into TS packets.
+     *
+     * Packets are returned as views into the chunks. Only a packet
+     * spanning two chunks is assembled in a scratch buffer; the bytes
+     * at the end of a chunk are kept there until the next chunk arrives.
+     */
     class TSStream {
     public:
         enum TSDataError {
@@ -163,41 +208,62 @@ public:
             DATA_CC_ERROR,      // Data continuity error
         };
     public:
-        explicit TSStream() : mCircBuf(2), mPointer(0) {
-        };
+        explicit TSStream() = default;
 
         /**
          * Read the next TS packet
+         * @param packet - set to the packet. Valid until the next call
+         *                 and while the chunks holding it are valid.
          * @return -
          */
+        TSDataError getNextPacket(const unsigned char *&packet);
+
+        /**
+         * Read the next TS packet into a copy
+         */
         TSDataError getNextPacket(StreamPacketT &packet);
 
-        // Insert a new chunk
+        // Insert a copy of a new chunk
+        // @param chunk - input data
+        // @result - insert will fail if tail package is not processed
+        bool insertChunk(const buffer_chunk &chunk);
+
+        // Insert a new chunk without copying. The chunk must stay
+        // valid until getNextPacket returns NOT_ENOUGH_DATA or reset.
         // @param chunk - input data
         // @result - insert will fail if tail package is not processed
-         bool insertChunk(const buffer_chunk &chunk);
+        bool attachChunk(const buffer_chunk &chunk);
 
         // Tail chunk is processed, more data is needed
         // Use this method to check when to insert a new
         // chunk
         inline bool needsNewChunk() {
-            return (mCircBuf.size() < 2);
+            return (mCount < 2);
         }
 
+        /**
+         * Drop all data
+         */
+        void reset();
+
         virtual ~TSStream() = default;
 
     private:
-        boost::circular_buffer<buffer_chunk> mCircBuf;
-        int mPointer;
+        void popChunk();
+
+        std::array<const buffer_chunk *, 2> mChunks {};
+        size_t mCount {0};
+        size_t mPointer {0};
+        // Storage of inserted chunk copies, allocated on first use
+        std::array<std::unique_ptr<buffer_chunk>, 2> mCopies;
+        // Head of a packet spanning two chunks
+        StreamPacketT mScratch {};
+        size_t mScratchLen {0};
     };
 
-private:
-    void threadLoop();
-
 private:
     std::shared_ptr<MVar<ByteVectorType>::watcher_function> mCbFunc{};
     std::atomic<bool> mPsiParserRunning{false};
-    boost::lockfree::queue<buffer_chunk> mQueue{100};
     std::string mChannel{};
     std::mutex mStreamMtx;
     std::mutex mConsumerMtx;
@@ -209,24 +275,42 @@ private:
     TSStream mTsStream;
 
 private:
-    // Clear queue.
-    void clearQueue();
+    void processChunk(const buffer_chunk &array, const BufferMeta &meta);
 
-    void processChunk(const buffer_chunk &array);
+    /**
+     * Record the first occurrence of action in the current zap
+     */
+    void recordZapTiming(ParserActionT action);
 
-private:
-    std::unique_ptr<std::thread> mParserThread;
+    /**
+     * Set drm0 from the current PSI
+     */
+    void publishProtectionConfig();
 
+private:
     PidInfo mPat{0};
+    PidInfo mCat{1};
     PidInfo mPmt{0};
     PidInfo mEcm{0};
     bool mIsClearStream{false};
+    // A PMT was processed since open
+    bool mPmtBaseline{false};
+    // PMT version or PID changed after the baseline, drm0 not yet updated
+    bool mPsiChanged{false};
+    // Service selected with the channel URI, 0 for the first one
+    unsigned mServiceId{0};
+    std::map<unsigned, unsigned> mPrograms;
     PsiParserState_t mParserState{PSIParser::NEEDS_PAT};
     unsigned char mOpid{0};
-    std::atomic<bool> mExitParserThread{false};
 
 private:
-    ParserActionT parseTsPacket(const StreamPacketT &packet);
+    ParserActionT parseTsPacket(const unsigned char *packet);
+
+    /**
+     * Mark the current PAT, CAT, PMT and ECM PIDs in mPidTable.
+     * Called with mPidInfoMtx held.
+     */
+    void updatePidTable();
 
     bool patProcessed() { return mPat.processed(); };
 
@@ -242,27 +326,46 @@ private:
     ByteVectorType getCurrentPmt();
     ByteVectorType getCurrentPat();
 
-    ParserActionT parsePat(const StreamPacketT &packet);
+    typedef ParserActionT (PSIParser::*SectionParserT)(const unsigned char *section, size_t length);
 
-    ParserActionT parsePmt(const StreamPacketT &packet);
+    /**
+     * Pass a packet to the section assembler of the PID and
+     * parse the completed sections
+     */
+    ParserActionT parseSections(PidInfo &pidInfo, const unsigned char *packet, SectionParserT parser);
 
-    ParserActionT parseEcm(const StreamPacketT &packet);
+    ParserActionT parsePat(const unsigned char *section, size_t length);
 
-    ParserActionT ParseOther(const StreamPacketT &packet);
+    ParserActionT parseCat(const unsigned char *section, size_t length);
 
-    ParserActionT collectEcm(const StreamPacketT &packet);
+    ParserActionT parsePmt(const unsigned char *section, size_t length);
 
-    void resetCollectionState();
+    ParserActionT parseEcm(const unsigned char *section, size_t length);
 
-    ByteVectorType mEcmTable;
-    ByteVectorType mTempCollectedEcmData;
+    ParserActionT ParseOther(const unsigned char *packet);
+
+    /**
+     * Drop partially collected sections
+     */
+    void resetSections();
 
-    bool mEcmCollectionInProgress{false};
-    unsigned int mCollectedEcmDataExpected{0};
-    unsigned int mCollectedDataLength{0};
+    ByteVectorType mEcmTable;
     uint64_t mPacketCounter{0};
 
+    // Non zero for PIDs passed to parseTsPacket. Only used on the consumer
+    // thread, all other packets are counted without taking mPidInfoMtx.
+    std::array<uint8_t, PSI_MAX_PID + 1> mPidTable{};
+    typedef std::array<unsigned, 4> PidTableT;
+    PidTableT mTablePids{PSI_INVALID_PID, PSI_INVALID_PID, PSI_INVALID_PID, PSI_INVALID_PID};
+    uint64_t mSkippedPackets{0};
+
+    std::mutex mZapTimingMtx;
+    uint64_t mOpenTimeUs{0};
+    ZapTiming mZapTiming{};
+
     MVar<bool> *mIsCdmSetupDone;
+    MVar<ByteVectorType> *mPmtVar;
+    MVar<ByteVectorType> *mPatVar;
 
 };
 
@@ -0,0 +1,168 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE
+ * file the following copyright and licenses apply:
+ *
+ * Copyright (c) 2022 Nuuday.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <array>
+#include <mutex>
+
+#include <config_fcc.h>
+#include "StreamConsumer.h"
+#include "PSIParser.h"
+#include "SectionAssembler.h"
+
+// Number of PCRs kept for the bitrate and the offset mapping
+#define PCR_TRACKER_HISTORY 64
+
+namespace StreamParser {
+
+// PCR clock and wrap-around (33 bit base * 300 + extension)
+constexpr uint64_t PCR_CLOCK_HZ = 27000000;
+constexpr uint64_t PCR_WRAP = (1ULL << 33) * 300;
+
+/**
+ * Tracks the PCR and the video stream of the selected service.
+ *
+ * The PCR PID is taken from the PMT of the service selected with the
+ * channel URI; until the PMT is found, the first PID carrying a PCR is
+ * used. The video stream is the first MPEG-2, H.264 or HEVC stream of
+ * the PMT. The bitrate is measured over the last PCR_TRACKER_HISTORY PCRs
+ * and the same PCRs map stream offsets to PCR values.
+ *
+ * Stream offsets count the bytes posted since channel open. Gaps and
+ * generated stuffing drop the PCR history; the last bitrate is kept.
+ *
+ * Runs inline on the ingest thread, queries may come from any thread.
+ */
+class PcrTracker : public StreamConsumer {
+    CLASS_NO_COPY_OR_ASSIGN(PcrTracker);
+
+public:
+    struct PcrSample {
+        uint64_t pcr {0};       // 27 MHz, continued across the 33 bit wrap
+        uint64_t offset {0};    // stream offset of the PCR packet
+    };
+
+    PcrTracker();
+
+    ~PcrTracker() override = default;
+
+    void post(const Buffer &buf) override;
+
+    void onOpen(const char *channelId) override;
+
+    /**
+     * @return bitrate in bits/s or 0 if not measured yet
+     */
+    uint64_t getBitrate();
+
+    /**
+     * @return PCR PID or PSI_INVALID_PID if no PCR was found
+     */
+    unsigned getPcrPid();
+
+    /**
+     * @param pid - set to the video PID
+     * @param streamType - set to the PMT stream_type of the video
+     * @return false if the PMT has no supported video stream
+     */
+    bool getVideoStream(unsigned &pid, unsigned &streamType);
+
+    /**
+     * @return true if the last video packet with payload was scrambled
+     */
+    bool isVideoScrambled();
+
+    /**
+     * @return offset following the posted data
+     */
+    uint64_t getOffset();
+
+    /**
+     * @param sample - set to the last PCR
+     * @return false if there is no PCR since the last gap
+     */
+    bool getLastSample(PcrSample &sample);
+
+    /**
+     * Estimate the PCR at a stream offset. Interpolated between the kept
+     * PCRs and extrapolated with the bitrate outside of them.
+     * @param offset - stream offset
+     * @param pcr - set to the PCR on the scale of PcrSample::pcr
+     * @return false without PCR history
+     */
+    bool offsetToPcr(uint64_t offset, uint64_t &pcr);
+
+    /**
+     * Read the PCR of a TS packet
+     * @param packet - TS packet
+     * @param pcr - set to the 27 MHz PCR
+     * @param discontinuity - set to the discontinuity_indicator
+     * @return false if the packet carries no PCR
+     */
+    static bool readPcr(const unsigned char *packet, uint64_t &pcr, bool &discontinuity);
+
+    /**
+     * Check if a video packet starts a random access point: the
+     * random_access_indicator is set, or the first PES payload has the
+     * start code of a key frame (MPEG-2 sequence or GOP header,
+     * H.264 IDR or SPS, HEVC IRAP or VPS). Scrambled payloads are not
+     * parsed, only the indicator is used.
+     * @param packet - TS packet of the video PID
+     * @param streamType - PMT stream_type of the video
+     * @return true if decoding can start at the packet
+     */
+    static bool isRandomAccessPoint(const unsigned char *packet, unsigned streamType);
+
+private:
+    void processPacket(const unsigned char *packet, uint64_t offset);
+
+    void parsePat(const unsigned char *section, size_t length);
+
+    void parsePmt(const unsigned char *section, size_t length);
+
+    void addSample(uint64_t pcr, uint64_t offset, bool discontinuity);
+
+    void clearSamples();
+
+    uint64_t bytesToTicks(uint64_t bytes) const;
+
+    const PcrSample &sample(size_t index) const;
+
+    std::mutex mMutex;
+    PSIParser::TSStream mTsStream;
+    // Service selected with the channel URI, 0 for the first one
+    unsigned mServiceId {0};
+    unsigned mPmtPid {PSI_INVALID_PID};
+    unsigned mPcrPid {PSI_INVALID_PID};
+    unsigned mVideoPid {PSI_INVALID_PID};
+    unsigned mVideoStreamType {0};
+    bool mVideoScrambled {false};
+    SectionAssembler mPatAssembler;
+    SectionAssembler mPmtAssembler;
+    // Offset of the next packet
+    uint64_t mOffset {0};
+    // Oldest first
+    std::array<PcrSample, PCR_TRACKER_HISTORY> mSamples {};
+    size_t mFirstSample {0};
+    size_t mSampleCount {0};
+    uint64_t mBitrate {0};
+};
+
+} //namespace StreamParser
@@ -0,0 +1,133 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE
+ * file the following copyright and licenses apply:
+ *
+ * Copyright (c) 2022 Nuuday.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+
+#include "StreamParser/StreamConsumer.h"
+#include "StreamParser/Buffer.h"
+
+// Layout version of the shared memory, bumped on changes
+#define PERSISTENT_TSB_VERSION     3
+#define PERSISTENT_TSB_CHANNEL_MAX 512
+
+namespace StreamParser {
+
+/**
+ * Last chunks of the TSB kept in named shared memory, so that a
+ * restarted plugin resumes the live channel without a zap delay.
+ *
+ * The chunks and their BufferMeta are mirrored into a ring behind a
+ * header recording the layout version, the chunk size and the channel.
+ * When the next instance opens the same channel, restore() replays the
+ * chunks through the pipeline ahead of the live data, which recovers
+ * the PSI/DRM state of the parsers and the last GOPs. The rest of the
+ * TSB window and the reader positions are not kept, time-shifted
+ * readers restart at live.
+ *
+ * Only the first slots, up to a limit following the RAM TSB, are used.
+ * The slot written last may be incomplete after a crash and is not
+ * replayed.
+ */
+class PersistentTsb : public StreamConsumer {
+    CLASS_NO_COPY_OR_ASSIGN(PersistentTsb);
+
+public:
+    /**
+     * @param shmName - POSIX shared memory name
+     * @param chunks  - maximum number of chunks kept
+     */
+    PersistentTsb(const char *shmName, size_t chunks);
+
+    ~PersistentTsb() override;
+
+    void post(const Buffer &buf) override;
+
+    void onOpen(const char *channelId) override;
+
+    /**
+     * Limit the chunks kept, e.g. to the RAM TSB under memory pressure.
+     * Evaluated per chunk. A change drops the chunks kept and releases
+     * the memory of the unused slots. Call before the first open.
+     *
+     * @param limit - returns the number of chunks to keep, capped to
+     *                the size given to the constructor
+     */
+    void setLimit(std::function<size_t()> limit);
+
+    /**
+     * Replay the chunks kept by the previous instance if they were
+     * received on the channel just opened. Only the first channel open
+     * restores. Called after onOpen and before the source is opened, so
+     * that live chunks do not queue up during the replay. The ingest
+     * times are shifted to end now, keeping their spacing. The first
+     * chunk kept afterwards is flagged as a discontinuity.
+     *
+     * @param post - posts a chunk to the pipeline
+     * @return number of chunks replayed
+     */
+    size_t restore(const std::function<void(const Buffer &)> &post);
+
+private:
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t chunkSize;
+        uint64_t slotSize;
+        uint64_t capacity;
+        // Slots in use
+        uint64_t limit;
+        char channel[PERSISTENT_TSB_CHANNEL_MAX];
+        // Chunks written since the channel was opened
+        uint64_t count;
+        uint64_t updateTimeUs;
+    };
+
+    struct Slot {
+        BufferMeta meta;
+        buffer_chunk chunk;
+    };
+
+    bool isValid(size_t chunks) const;
+
+    void startChannel(const char *channelId);
+
+    /**
+     * Use the first limit slots, dropping the chunks kept
+     */
+    void setSlotLimit(uint64_t limit);
+
+    Header *mHeader {nullptr};
+    Slot *mSlots {nullptr};
+    size_t mSize {0};
+
+    // The previous instance left chunks of mHeader->channel
+    bool mRestorable {false};
+    bool mRestorePending {false};
+    // Chunks posted by restore are already kept
+    bool mReplaying {false};
+    // The next chunk kept does not continue the previous one
+    bool mDiscontinuity {false};
+    std::function<size_t()> mLimit;
+    std::string mChannelId;
+};
+
+} //namespace StreamParser
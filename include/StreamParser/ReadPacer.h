@@ -0,0 +1,89 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE
+ * file the following copyright and licenses apply:
+ *
+ * Copyright (c) 2022 Nuuday.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Lowest and highest read rate, in multiples of real time
+#define READ_RATE_MIN 0.1
+#define READ_RATE_MAX 32.0
+
+namespace StreamParser {
+
+/**
+ * Token bucket pacing reads of the TSB in media time.
+ *
+ * The bucket fills with rate microseconds of media time per microsecond
+ * of wall time, up to burstUs. Reads consume the media time they cover,
+ * which may leave the bucket in debt until it refills.
+ *
+ * setRate and reset may be called from any thread, the other methods
+ * from the reading thread only.
+ */
+class ReadPacer {
+public:
+    /**
+     * @param burstUs - media time served at once after the reader paused
+     */
+    explicit ReadPacer(uint64_t burstUs);
+
+    /**
+     * @param rate - media time per wall time, 0 disables pacing
+     */
+    void setRate(double rate);
+
+    double getRate() const;
+
+    bool isEnabled() const { return getRate() > 0; }
+
+    /**
+     * Refill the bucket on the next call, e.g. after a seek
+     */
+    void reset();
+
+    /**
+     * @param nowUs - monotonic time in us
+     * @return media time that may be read now, negative while in debt
+     */
+    int64_t getCreditUs(uint64_t nowUs);
+
+    /**
+     * @param nowUs - monotonic time in us
+     * @return wall time until the bucket has credit
+     */
+    uint64_t getWaitUs(uint64_t nowUs);
+
+    /**
+     * @param mediaUs - media time read
+     */
+    void consume(uint64_t mediaUs);
+
+private:
+    void refill(uint64_t nowUs);
+
+    const uint64_t mBurstUs;
+    std::atomic<double> mRate {0};
+    std::atomic<bool> mRestart {true};
+    double mTokensUs {0};
+    uint64_t mLastUs {0};
+};
+
+} //namespace StreamParser
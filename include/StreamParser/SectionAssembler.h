@@ -0,0 +1,116 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE
+ * file the following copyright and licenses apply:
+ *
+ * Copyright (c) 2022 Nuuday.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <config_fcc.h>
+
+namespace StreamParser {
+
+/**
+ * Reassembles PSI and private sections from the TS packets of one PID.
+ *
+ * Handles pointer_field, sections spanning several packets and several
+ * sections in one packet. Sections with section_syntax_indicator set are
+ * only delivered with a valid CRC_32. A continuity counter gap drops the
+ * section in progress; collection restarts at the next payload unit start.
+ * A discontinuity_indicator resets the assembler.
+ *
+ * PSI tables are repeated many times per second. A valid section with
+ * the CRC_32 of one of the last delivered sections is taken as a
+ * repetition and skipped, so the caller does not parse it again.
+ *
+ * Usage: push() a packet, then call nextSection() until it returns false.
+ */
+class SectionAssembler {
+public:
+    struct Stats {
+        uint64_t sections {0};      // delivered sections
+        uint64_t repeated {0};      // skipped repetitions
+        uint64_t crcErrors {0};
+        uint64_t dropped {0};       // incomplete sections dropped
+    };
+
+    /**
+     * Start processing a TS packet. Sections of the previous
+     * packet not read with nextSection are dropped.
+     * @param packet - TS packet of the PID
+     */
+    void push(const unsigned char *packet);
+
+    /**
+     * Get the next complete section of the pushed packet.
+     * @param section - set to the section start (table_id)
+     * @param length - section size including the header and CRC_32
+     * @return false when the packet holds no further complete section.
+     *         The section is valid until the next call.
+     */
+    bool nextSection(const unsigned char *&section, size_t &length);
+
+    /**
+     * Drop the section in progress, forget the delivered sections and
+     * wait for the next payload unit start
+     */
+    void reset();
+
+    const Stats &getStats() const { return mStats; }
+
+private:
+    void dropSection();
+
+    /**
+     * @return true if the collected section may be delivered
+     */
+    bool checkSection();
+
+    /**
+     * @return true if the checked section repeats a recently delivered one
+     */
+    bool isRepeated();
+
+    /**
+     * Record the CRC_32 of a section about to be delivered
+     */
+    void rememberSection();
+
+    /**
+     * @return CRC_32 field of the collected section
+     */
+    uint32_t sectionCrc() const;
+
+    ByteVectorType mSection;
+    size_t mSectionLen {0};     // 0 until the section header is collected
+    bool mCollecting {false};
+    int mLastCc {-1};
+    // CRC_32 of recently delivered sections, alternating tables (ECM) share a PID
+    uint32_t mRecentCrc[2] {};
+    bool mRecentValid[2] {};
+    size_t mRecentNext {0};
+
+    // Payload of the current packet
+    const unsigned char *mPacket {nullptr};
+    size_t mPos {0};
+    size_t mStart {0};          // first section start, mEnd if none
+    size_t mLimit {0};          // end of the section in progress
+    size_t mEnd {0};
+    Stats mStats;
+};
+
+} //namespace StreamParser
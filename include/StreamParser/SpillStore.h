@@ -0,0 +1,204 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE
+ * file the following copyright and licenses apply:
+ *
+ * Copyright (c) 2022 Nuuday.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Segment written at once, a multiple of the O_DIRECT alignment
+#define SPILL_SEGMENT_SIZE (1024 * 1024)
+#define SPILL_ALIGNMENT    4096
+// Segment buffers, including the one being filled
+#define SPILL_BUFFERS      4
+
+namespace StreamParser {
+
+/**
+ * Disk tier of the TSB.
+ *
+ * The TSB data is appended in byte order and sealed into segments of
+ * SPILL_SEGMENT_SIZE, which a background thread writes with O_DIRECT to
+ * the slots of a file used as a ring. Segments are dropped if the disk
+ * falls SPILL_BUFFERS - 1 segments behind. The index of the segments on
+ * disk is keyed by the absolute byte index and the arrival time of the
+ * TSB.
+ *
+ * Reads go through the page cache, the segment following the one read
+ * is prefetched with POSIX_FADV_WILLNEED.
+ */
+class SpillStore {
+public:
+    struct Stats {
+        uint64_t storedBytes {0};
+        // Segments written and their payload
+        uint64_t writtenBytes {0};
+        uint64_t writtenSegments {0};
+        uint64_t droppedSegments {0};
+        // Written to storage by the process, see /proc/<pid>/io
+        uint64_t deviceBytes {0};
+        uint64_t readBytes {0};
+    };
+
+    /**
+     * @param path     - file of the ring, created and removed again
+     * @param maxBytes - file size, at least two segments
+     */
+    SpillStore(const std::string &path, uint64_t maxBytes);
+
+    ~SpillStore();
+
+    /**
+     * @return false if the file or the buffers could not be allocated
+     */
+    bool isOpen() const;
+
+    /**
+     * Append data. Data not continuing the previous append starts a new
+     * segment.
+     *
+     * @param data        - data
+     * @param size        - size in bytes
+     * @param byteIndex   - absolute byte index of data
+     * @param timestampUs - arrival time of data
+     */
+    void append(const unsigned char *data, size_t size, uint64_t byteIndex, uint64_t timestampUs);
+
+    /**
+     * Drop the stored data, e.g. when the byte index restarts. Waits
+     * for the append in progress.
+     */
+    void clear();
+
+    /**
+     * Read stored data, up to the end of the segment.
+     *
+     * @param data      - destination
+     * @param size      - size in bytes
+     * @param byteIndex - absolute byte index to read from
+     * @return number of bytes read, 0 if not stored
+     */
+    size_t read(char *data, size_t size, uint64_t byteIndex);
+
+    /**
+     * Get the oldest stored data.
+     *
+     * @param byteIndex - absolute byte index
+     * @param timeUs    - arrival time
+     * @return false if empty
+     */
+    bool getFront(uint64_t &byteIndex, uint64_t &timeUs);
+
+    /**
+     * @param timeUs    - arrival time
+     * @param byteIndex - interpolated absolute byte index
+     * @return false if not stored
+     */
+    bool getByteIndexForTime(uint64_t timeUs, uint64_t &byteIndex);
+
+    /**
+     * @param byteIndex - absolute byte index
+     * @param timeUs    - interpolated arrival time
+     * @return false if not stored
+     */
+    bool getTimeForByteIndex(uint64_t byteIndex, uint64_t &timeUs);
+
+    Stats getStats();
+
+    const std::string &getPath() const {
+        return mPath;
+    }
+
+    uint64_t getMaxBytes() const {
+        return mSlots * SPILL_SEGMENT_SIZE;
+    }
+
+    /**
+     * @return arrival time of the last append
+     */
+    uint64_t getLastTimeUs() const {
+        return mLastTimeUs;
+    }
+
+private:
+    SpillStore(const SpillStore&) = delete;
+    SpillStore& operator=(const SpillStore&) = delete;
+
+    struct Segment {
+        uint64_t byteIndex {0};
+        uint64_t firstTimeUs {0};
+        uint64_t lastTimeUs {0};
+        size_t slot {0};
+    };
+
+    struct Pending {
+        unsigned char *buffer;
+        Segment segment;
+        uint64_t generation;
+    };
+
+    /**
+     * Queue the current segment for writing, called with mAppendMutex held
+     */
+    void seal();
+
+    void threadLoop();
+
+    /**
+     * Segment holding a byte index, called with mMutex held
+     */
+    std::deque<Segment>::const_iterator find(uint64_t byteIndex) const;
+
+    std::string mPath;
+    size_t mSlots;
+    int mWriteFd {-1};
+    int mReadFd {-1};
+    std::vector<unsigned char *> mBuffers;
+
+    // Segment being filled, guarded by mAppendMutex. Taken before mMutex.
+    std::mutex mAppendMutex;
+    unsigned char *mCurrent {nullptr};
+    Segment mCurrentSegment;
+    size_t mCurrentSize {0};
+    uint64_t mNextByteIndex {0};
+    std::atomic<uint64_t> mLastTimeUs {0};
+
+    std::mutex mMutex;
+    std::condition_variable mCv;
+    std::vector<unsigned char *> mFree;
+    std::deque<Pending> mPending;
+    std::deque<Segment> mIndex;
+    size_t mNextSlot {0};
+    // Incremented by clear, pending segments of before are dropped
+    uint64_t mGeneration {0};
+    bool mExit {false};
+    Stats mStats;
+    uint64_t mDeviceBytesStart {0};
+    uint64_t mPrefetched {UINT64_MAX};
+
+    std::thread mThread;
+};
+
+} //namespace StreamParser
@@ -0,0 +1,161 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE
+ * file the following copyright and licenses apply:
+ *
+ * Copyright (c) 2022 Nuuday.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <array>
+#include <memory>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <config_fcc.h>
+#include "StreamParser/Buffer.h"
+#include "StreamParser/StreamConsumer.h"
+#include "StreamParser/ConsumerWorker.h"
+
+namespace StreamParser {
+
+/**
+ * Fixed consumer stage of the StreamProcessor
+ */
+class PipelineStage {
+public:
+    virtual ~PipelineStage() = default;
+
+    virtual void post(const Buffer &buf) = 0;
+
+    virtual void onEndOfStream(const char *channelId) = 0;
+
+    virtual void onOpen(const char *channelId) = 0;
+
+    /**
+     * Wait until the async consumers are done
+     */
+    virtual void join() = 0;
+
+    /**
+     * Append the queue statistics of the async consumers
+     */
+    virtual void getQueueStats(std::vector<ConsumerQueueStats> &stats) = 0;
+};
+
+/**
+ * Consumer set composed at compile time.
+ *
+ * Sync consumers are called through their static type, so the calls
+ * can be inlined and need no virtual dispatch per chunk. Async
+ * consumers are run on a ConsumerWorker as in the StreamProcessor.
+ * Consumers are called in template argument order.
+ */
+template<class... Consumers>
+class StaticPipeline final : public PipelineStage {
+    CLASS_NO_COPY_OR_ASSIGN(StaticPipeline);
+
+public:
+    explicit StaticPipeline(std::shared_ptr<Consumers>... consumers)
+            : mConsumers(std::move(consumers)...),
+              mChunkPool(ChunkPool::create(0, CHUNK_POOL_MAX_SIZE)) {
+        createWorkers(std::index_sequence_for<Consumers...>{});
+    }
+
+    void post(const Buffer &buf) override {
+        Buffer pooled;
+        postAll(buf, pooled, std::index_sequence_for<Consumers...>{});
+    }
+
+    void onEndOfStream(const char *channelId) override {
+        onEndOfStreamAll(channelId, std::index_sequence_for<Consumers...>{});
+    }
+
+    void onOpen(const char *channelId) override {
+        onOpenAll(channelId, std::index_sequence_for<Consumers...>{});
+    }
+
+    void join() override {
+        for (auto &w : mWorkers) {
+            if (w != nullptr) {
+                w->join();
+            }
+        }
+    }
+
+    void getQueueStats(std::vector<ConsumerQueueStats> &stats) override {
+        for (auto &w : mWorkers) {
+            if (w != nullptr) {
+                stats.push_back(w->getStats());
+            }
+        }
+    }
+
+private:
+    template<size_t I>
+    using ConsumerType = std::tuple_element_t<I, std::tuple<Consumers...>>;
+
+    template<size_t... I>
+    void createWorkers(std::index_sequence<I...>) {
+        ((mWorkers[I] = std::get<I>(mConsumers)->isAsync()
+                        ? std::make_unique<ConsumerWorker>(std::get<I>(mConsumers), STREAM_CONSUMER_QUEUE_SIZE)
+                        : nullptr), ...);
+    }
+
+    template<size_t... I>
+    void postAll(const Buffer &buf, Buffer &pooled, std::index_sequence<I...>) {
+        (postTo<I>(buf, pooled), ...);
+    }
+
+    template<size_t I>
+    void postTo(const Buffer &buf, Buffer &pooled) {
+        if (mWorkers[I] != nullptr) {
+            mWorkers[I]->post(pooledBuffer(buf, pooled, *mChunkPool));
+        } else {
+            auto &consumer = *std::get<I>(mConsumers);
+            consumer.ConsumerType<I>::post(buf);
+            consumer.ConsumerType<I>::join();
+        }
+    }
+
+    template<size_t... I>
+    void onEndOfStreamAll(const char *channelId, std::index_sequence<I...>) {
+        ((mWorkers[I] != nullptr ? mWorkers[I]->onEndOfStream(channelId)
+                                 : std::get<I>(mConsumers)->ConsumerType<I>::onEndOfStream(channelId)), ...);
+    }
+
+    template<size_t... I>
+    void onOpenAll(const char *channelId, std::index_sequence<I...>) {
+        ((mWorkers[I] != nullptr ? mWorkers[I]->onOpen(channelId)
+                                 : std::get<I>(mConsumers)->ConsumerType<I>::onOpen(channelId)), ...);
+    }
+
+    std::tuple<std::shared_ptr<Consumers>...> mConsumers;
+    // Worker per consumer, nullptr for sync consumers.
+    // Declared after mConsumers to stop the workers first.
+    std::array<std::unique_ptr<ConsumerWorker>, sizeof...(Consumers)> mWorkers;
+    std::shared_ptr<ChunkPool> mChunkPool;
+};
+
+/**
+ * Create a StaticPipeline of the given consumers
+ */
+template<class... Consumers>
+std::unique_ptr<PipelineStage> makeStaticPipeline(std::shared_ptr<Consumers>... consumers) {
+    return std::make_unique<StaticPipeline<Consumers...>>(std::move(consumers)...);
+}
+
+} //namespace StreamParser
@@ -0,0 +1,205 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE
+ * file the following copyright and licenses apply:
+ *
+ * Copyright (c) 2022 Nuuday.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <array>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <config_fcc.h>
+#include "StreamConsumer.h"
+#include "PSIParser.h"
+#include "PcrTracker.h"
+#include "SectionAssembler.h"
+
+// TR 101 290 limits
+#define HEALTH_PAT_MAX_INTERVAL_US  500000
+#define HEALTH_PMT_MAX_INTERVAL_US  500000
+#define HEALTH_PCR_MAX_INTERVAL_US  40000
+#define HEALTH_PCR_MAX_DELTA_US     100000
+// Consecutive sync bytes to acquire and to lose sync
+#define HEALTH_SYNC_ACQUIRE         5
+#define HEALTH_SYNC_LOSS            2
+
+namespace StreamParser {
+
+/**
+ * TR 101 290 priority 1 and 2 stream health analysis.
+ *
+ * Checks sync, continuity counters, PAT/PMT presence and repetition,
+ * section CRCs of PAT/PMT, transport_error_indicator and the PCR
+ * interval and jitter of all programs. PMT and PCR PIDs are learnt from
+ * the PAT and PMTs, other PIDs are only looked up in a PID table.
+ *
+ * Gaps signalled with BUFFER_FLAG_DISCONTINUITY (network loss, ingest and
+ * queue drops) are counted separately and restart the checks, so the
+ * error counters point at the head-end. Arrival times are interpolated
+ * from the chunk ingest times, which bounds the timing precision.
+ * PCR_accuracy_error and the PTS checks are not done.
+ *
+ * Counters are reset on channel open.
+ */
+class StreamAnalyzer : public StreamConsumer {
+    CLASS_NO_COPY_OR_ASSIGN(StreamAnalyzer);
+
+public:
+    enum Counter {
+        SYNC_LOSS,
+        SYNC_BYTE_ERROR,
+        PAT_ERROR,
+        CC_ERROR,
+        PMT_ERROR,
+        TRANSPORT_ERROR,
+        CRC_ERROR,
+        PCR_REPETITION_ERROR,
+        PCR_DISCONTINUITY_ERROR,
+        SOURCE_LOST_PACKETS,    // RTP packets lost before reception
+        DISCONTINUITIES,        // gaps in the analysed data
+        COUNTER_COUNT
+    };
+
+    // Highest values seen, in us
+    enum Maximum {
+        PAT_INTERVAL,
+        PMT_INTERVAL,
+        PCR_INTERVAL,
+        PCR_JITTER,
+        MAXIMUM_COUNT
+    };
+
+    struct Stats {
+        std::array<uint64_t, COUNTER_COUNT> total {};
+        // Last STREAM_HEALTH_WINDOW_S seconds
+        std::array<uint64_t, COUNTER_COUNT> recent {};
+        std::array<uint64_t, MAXIMUM_COUNT> max {};
+        std::array<uint64_t, MAXIMUM_COUNT> recentMax {};
+        // PID and continuity errors of the PIDs with errors
+        std::vector<std::pair<unsigned, uint64_t>> ccErrorPids;
+    };
+
+    StreamAnalyzer();
+
+    ~StreamAnalyzer() override = default;
+
+    void post(const Buffer &buf) override;
+
+    void onOpen(const char *channelId) override;
+
+    /**
+     * @param nowUs - window end on the BufferMeta::ingestTimeUs clock
+     * @return counters of the current channel
+     */
+    Stats getStats(uint64_t nowUs);
+
+private:
+    enum PidFlags : uint8_t {
+        PID_PMT = 0x01,
+        PID_PCR = 0x02
+    };
+
+    struct PidState {
+        uint8_t flags {0};
+        int8_t lastCc {-1};
+        uint8_t repeats {0};
+        uint64_t ccErrors {0};
+    };
+
+    // PAT or PMT occurrences of a PID
+    struct TableState {
+        uint64_t lastUs {0};
+        // Missing table counted for the current gap
+        bool late {false};
+        // lastUs is an occurrence, not the restart time
+        bool seen {false};
+        unsigned pcrPid {PSI_INVALID_PID};
+        uint64_t crcErrors {0};
+        SectionAssembler assembler;
+    };
+
+    struct PcrState {
+        bool valid {false};
+        uint64_t pcr {0};
+        uint64_t timeUs {0};
+    };
+
+    struct Bucket {
+        uint64_t second {0};
+        std::array<uint64_t, COUNTER_COUNT> counts {};
+        std::array<uint64_t, MAXIMUM_COUNT> max {};
+    };
+
+    void processPacket(const unsigned char *packet, uint64_t timeUs);
+
+    void checkContinuity(PidState &pid, const unsigned char *packet);
+
+    /**
+     * Check the repetition and table_id of PAT or PMT sections
+     */
+    void checkTable(TableState &table, const unsigned char *packet, unsigned tableId,
+                    Counter error, Maximum interval, uint64_t maxUs, uint64_t timeUs);
+
+    void checkPcr(unsigned pid, const unsigned char *packet, uint64_t timeUs);
+
+    /**
+     * Count tables missing for more than maxUs
+     */
+    void checkMissing(TableState &table, Counter error, uint64_t maxUs, uint64_t nowUs);
+
+    void parsePat(const unsigned char *section, size_t length);
+
+    void parsePmt(TableState &pmt, const unsigned char *section);
+
+    void updatePcrPids();
+
+    /**
+     * Restart the checks after a gap in the data
+     */
+    void restart(uint64_t nowUs);
+
+    void count(Counter counter, uint64_t n = 1);
+
+    void updateMax(Maximum maximum, uint64_t value);
+
+    Bucket &currentBucket();
+
+    std::mutex mStatsMtx;
+    PSIParser::TSStream mTsStream;
+    std::vector<PidState> mPids;
+    TableState mPat;
+    std::map<unsigned, TableState> mPmts;
+    std::map<unsigned, PcrState> mPcrs;
+
+    bool mSynced {false};
+    unsigned mSyncCount {0};
+    // Estimated packet arrival time
+    uint64_t mChunkTimeUs {0};
+    uint64_t mPacketUs {0};
+    size_t mChunkPackets {0};
+    bool mStarted {false};
+
+    std::array<uint64_t, COUNTER_COUNT> mTotal {};
+    std::array<uint64_t, MAXIMUM_COUNT> mMax {};
+    std::array<Bucket, STREAM_HEALTH_WINDOW_S> mWindow {};
+    uint64_t mNowUs {0};
+};
+
+} //namespace StreamParser
@@ -24,6 +24,14 @@
 
 namespace StreamParser {
 
+/**
+ * Queue policy of async consumers
+ */
+enum class QueuePolicy {
+    LOSSLESS,   // the caller waits while the queue is full
+    LOSSY       // buffers posted while the queue is full are dropped
+};
+
 /**
  * Base class for consumers.
  */
@@ -31,12 +39,15 @@ class StreamConsumer {
 
 public:
     /**
-     * Constructor. Async StreamConsumers will start a
-     * separate consumer thread that needs to be synchronized
-     * once stream fragment is handled.
+     * Constructor. Async StreamConsumers are run by the StreamProcessor
+     * on a separate worker thread, off the ingest thread. Sync consumers
+     * are called inline on the ingest thread.
      * @param async - asynchronous stream handling. Default is false.
+     * @param policy - queue policy of async consumers. Analysis consumers
+     *                 should be lossy to never delay the ingest thread.
      */
-    explicit StreamConsumer(const char* name, bool async = false);
+    explicit StreamConsumer(const char* name, bool async = false,
+                            QueuePolicy policy = QueuePolicy::LOSSLESS);
 
     /**
      * Post data to consumer
@@ -62,14 +73,22 @@ public:
 
     /**
      * Complete buffer processing.
-     * Implement this only for async consumers.
+     * Called after each post on the thread calling post.
      */
     virtual void join() {};
 
+    bool isAsync() const { return mAsync; }
+
+    QueuePolicy getQueuePolicy() const { return mQueuePolicy; }
+
+    const std::string &getName() const { return mName; }
+
     virtual ~StreamConsumer();
 
 private:
     std::string mName;
+    bool mAsync;
+    QueuePolicy mQueuePolicy;
 
 };
 
@@ -22,7 +22,11 @@
 #include <config_fcc.h>
 #include "StreamParser/Buffer.h"
 #include "StreamParser/StreamConsumer.h"
+#include "StreamParser/ConsumerWorker.h"
+#include "StreamParser/StaticPipeline.h"
 #include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 
 namespace StreamParser {
@@ -31,25 +35,114 @@ namespace StreamParser {
  * StreamProcessor is the central class for handling
  * received stream data.
  * The class is responsible to passing buffers to
- * the different StreamConsumers
+ * the different StreamConsumers.
+ * Sync consumers are called inline in the given order. Async consumers
+ * are run on their own ConsumerWorker and do not delay the caller
+ * unless their queue is full and the consumer is lossless.
+ *
+ * An optional fixed stage (see StaticPipeline) is called before the
+ * consumer list. It holds the consumers always present and avoids the
+ * per consumer virtual calls on the hot path.
+ *
+ * Consumers can be attached and detached while streaming. The consumer
+ * list is copy-on-write: post() takes a reference to the current list
+ * under a short lock and calls the consumers without it, updates publish
+ * a new list. detach() waits for the post in flight, if any.
  */
 class StreamProcessor {
     CLASS_NO_COPY_OR_ASSIGN(StreamProcessor);
 
 public:
-    StreamProcessor(std::initializer_list<std::shared_ptr<StreamConsumer>> consumers) {
-        for (auto it : consumers) {
-                mSCons.emplace_back(it);
-        }
-    };
+    StreamProcessor(std::initializer_list<std::shared_ptr<StreamConsumer>> consumers);
+
+    /**
+     * @param fixedStage - consumers called first, may be nullptr
+     * @param consumers - initial consumer list
+     */
+    StreamProcessor(std::unique_ptr<PipelineStage> fixedStage,
+                    std::initializer_list<std::shared_ptr<StreamConsumer>> consumers);
+
+    ~StreamProcessor();
+
     void onEndOfStream(const char* channelId);
 
     void onOpen(const char* channelId);
 
     void post(const StreamParser::Buffer& buf) const;
 
+    /**
+     * Wait until all async consumers have processed the
+     * posted buffers and events.
+     */
+    void join() const;
+
+    /**
+     * Add a consumer after the existing ones. If a stream is open,
+     * the consumer gets onOpen before the first buffer.
+     * @param consumer
+     */
+    void attach(const std::shared_ptr<StreamConsumer> &consumer);
+
+    /**
+     * Remove a consumer. If a stream is open, the consumer gets
+     * onEndOfStream. On return the consumer is not called anymore
+     * and, if async, has processed all buffers queued before.
+     * Must not be called from a consumer.
+     * @param consumer
+     * @return false if the consumer is not attached
+     */
+    bool detach(const std::shared_ptr<StreamConsumer> &consumer);
+
+    /**
+     * @return queue statistics of the async consumers
+     */
+    std::vector<ConsumerQueueStats> getQueueStats() const;
+
 private:
-    std::vector<std::shared_ptr<StreamConsumer>> mSCons;
+    struct Entry {
+        std::shared_ptr<StreamConsumer> consumer;
+        // Worker of async consumers, nullptr for sync consumers.
+        // Declared after consumer to stop the worker first.
+        std::shared_ptr<ConsumerWorker> worker;
+    };
+
+    typedef std::vector<Entry> ConsumerList;
+    typedef std::shared_ptr<const ConsumerList> ConsumerListPtr;
+
+    static Entry createEntry(const std::shared_ptr<StreamConsumer> &consumer);
+
+    /**
+     * @return reference to the current consumer list
+     */
+    ConsumerListPtr getConsumers() const;
+
+    /**
+     * Replace the consumer list. Called with mUpdateMtx held.
+     * @return the replaced list
+     */
+    ConsumerListPtr publish(ConsumerListPtr list);
+
+    /**
+     * Wait until no post() uses a replaced list anymore. Posts starting
+     * after publish() get the new list, so the wait ends once the post
+     * in flight returns.
+     */
+    void waitForPosts();
+
+    std::unique_ptr<PipelineStage> mFixedStage;
+    // Guarded by mListMtx, the list itself is immutable
+    ConsumerListPtr mConsumers;
+    mutable std::mutex mListMtx;
+    // Held by post() for its whole duration
+    mutable std::mutex mPostMtx;
+
+    // Serializes list updates and stream events
+    std::mutex mUpdateMtx;
+    bool mStreamOpen {false};
+    std::string mChannel;
+
+    // Pool for buffers posted without a pooled chunk
+    std::shared_ptr<ChunkPool> mChunkPool;
 };
 
 } //namespace StreamParser
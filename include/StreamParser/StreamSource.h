@@ -40,6 +40,11 @@ public:
 
     virtual void onOpen(const char* channelId) final;
 
+    /**
+     * @return queue statistics of the async stream consumers
+     */
+    std::vector<ConsumerQueueStats> getConsumerQueueStats() const;
+
     virtual ~StreamSource();
 
 private:
@@ -0,0 +1,110 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE
+ * file the following copyright and licenses apply:
+ *
+ * Copyright (c) 2022 Nuuday.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <vector>
+#include <config_fcc.h>
+
+// Presentation delay of the frames after their PCR
+#define TRICK_PLAY_PTS_DELAY_MS 100
+// Largest I-frame read from the TSB
+#define TRICK_PLAY_MAX_FRAME_SIZE (2 * 1024 * 1024)
+
+namespace StreamParser {
+
+/**
+ * I-frame only output stream for trick play.
+ *
+ * Each frame added is the access unit of the video PID starting at a
+ * random access point. Other PIDs are dropped. The frames get a PCR
+ * packet, continuous continuity counters and PTS/DTS of a synthetic
+ * clock advancing one frame duration per frame, so the decoder shows
+ * them at a steady rate without a flush. The first frame after reset()
+ * signals a discontinuity of the PCR, the first video packet of each
+ * frame signals the jump of the video PID. Scrambled frames are not
+ * added, their PES header cannot be rewritten.
+ *
+ * Not thread safe.
+ */
+class TrickPlayStream {
+public:
+    /**
+     * @param frameDurationUs - display time of each frame
+     */
+    explicit TrickPlayStream(uint64_t frameDurationUs);
+
+    /**
+     * Drop the pending output and start a new time base
+     */
+    void reset();
+
+    /**
+     * Append the I-frame starting at data to the output.
+     * @param data - TS packets starting with the random access point
+     * @param size - size of data
+     * @param videoPid - PID of the frame
+     * @param pcrPid - PID of the PCR packets
+     * @return false if data has no complete access unit or it is
+     *         scrambled
+     */
+    bool addFrame(const unsigned char *data, size_t size, unsigned videoPid, unsigned pcrPid);
+
+    /**
+     * Read pending output.
+     * @return bytes copied to data
+     */
+    size_t read(char *data, size_t size);
+
+    bool empty() const { return mReadPos == mOutput.size(); }
+
+    /**
+     * @return true if the last frame was not added as it is scrambled
+     */
+    bool isScrambled() const { return mScrambled; }
+
+private:
+    /**
+     * @param discontinuity - set the discontinuity_indicator if the
+     *                        packet has an adaptation field
+     */
+    unsigned char *appendPacket(const unsigned char *packet, bool discontinuity);
+
+    /**
+     * Append a packet with an adaptation field only
+     * @param pcr - carry the PCR of the next frame
+     */
+    void appendAdaptationPacket(unsigned pid, bool pcr, bool discontinuity);
+
+    void rewritePts(unsigned char *packet);
+
+    uint64_t mFrameTicks;
+    // 27 MHz clock of the next frame
+    uint64_t mClock {0};
+    bool mDiscontinuity {true};
+    bool mScrambled {false};
+    std::map<unsigned, uint8_t> mCc;
+    std::vector<const unsigned char *> mFrame;
+    std::vector<unsigned char> mOutput;
+    size_t mReadPos {0};
+};
+
+} //namespace StreamParser
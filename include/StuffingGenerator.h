@@ -0,0 +1,160 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE
+ * file the following copyright and licenses apply:
+ *
+ * Copyright (c) 2022 Nuuday.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <streamfs/config.h>
+#include "StreamParser/PcrTracker.h"
+
+/**
+ * Generates TS stuffing for periods where the ingest source is lost.
+ *
+ * The PCR PID and the bitrate are taken from the PcrTracker of the
+ * pipeline, which follows the PMT of the selected service. The
+ * generator observes the ingest stream for the last PCR value of that
+ * PID and the data following it, ahead of the tracker which only sees
+ * complete chunks. While active, it produces null packets at the
+ * bitrate, interleaved with adaptation field only packets on the PCR
+ * PID carrying PCR values extrapolated from the last observed PCR.
+ * This keeps the byte/time relation of the TSB and the player clock
+ * consistent through the outage.
+ *
+ * Without tracker the first PID carrying a PCR is used and the bitrate
+ * is measured on the wall clock.
+ *
+ * observe() is called from the consumer thread, the other methods from
+ * the monitor thread.
+ */
+class StuffingGenerator {
+public:
+    /**
+     * @param fallbackBitrate - bitrate in bits/s used until the channel
+     *                          bitrate is measured
+     */
+    explicit StuffingGenerator(uint64_t fallbackBitrate);
+
+    /**
+     * Take the PCR PID and the bitrate from the tracker.
+     * Call before the first observe().
+     */
+    void setPcrTracker(std::shared_ptr<StreamParser::PcrTracker> tracker);
+
+    /**
+     * Forget everything learned about the current channel.
+     * Call on channel change.
+     */
+    void reset();
+
+    /**
+     * Observe ingest data. Packets split across calls are ignored.
+     * @param data - TS data
+     * @param size - data size
+     * @param timeUs - monotonic reception time in microseconds
+     */
+    void observe(const uint8_t *data, uint32_t size, uint64_t timeUs);
+
+    /**
+     * Start a stuffing period.
+     * @param startTimeUs - monotonic time of the last received data.
+     *                      The gap since then is back-filled.
+     */
+    void start(uint64_t startTimeUs);
+
+    /**
+     * Stop the stuffing period
+     */
+    void stop();
+
+    bool isActive();
+
+    /**
+     * Get the number of bytes that should have been generated
+     * up to nowUs and are not generated yet. Always a multiple
+     * of TS packet size.
+     */
+    uint64_t getPendingBytes(uint64_t nowUs);
+
+    /**
+     * Fill a buffer with stuffing packets.
+     * @param dst - destination
+     * @param size - destination size. Rounded down to TS packet size.
+     * @return number of bytes written
+     */
+    uint32_t fill(uint8_t *dst, uint32_t size);
+
+    /**
+     * @return monotonic time in microseconds the next generated
+     *         byte stands in for
+     */
+    uint64_t getGeneratedTimeUs();
+
+    /**
+     * @return bitrate in bits/s used for generation
+     */
+    uint64_t getBitrate();
+
+    /**
+     * @return PCR PID or INVALID_PID if no PCR was observed
+     */
+    uint16_t getPcrPid();
+
+    /**
+     * @return number of bytes generated since construction
+     */
+    uint64_t getGeneratedBytes();
+
+    static constexpr uint16_t INVALID_PID = 0xFFFF;
+
+private:
+    uint64_t currentBitrate() const;
+    uint64_t bytesToPcrTicks(uint64_t bytes) const;
+    void writePcrPacket(uint8_t *dst, uint64_t pcr) const;
+
+    std::mutex mMutex;
+    // Null packets for bulk copy
+    std::vector<uint8_t> mNullTemplate;
+    const uint64_t mFallbackBitrate;
+    std::shared_ptr<StreamParser::PcrTracker> mPcrTracker;
+
+    // Observed stream state
+    uint16_t mPcrPid = INVALID_PID;
+    uint8_t mPcrPidCc = 0;
+    bool mPcrValid = false;
+    uint64_t mLastPcr = 0;              // 27 MHz
+    uint64_t mBytesSincePcr = 0;        // bytes following the last PCR packet
+    uint64_t mObservedBytes = 0;
+    uint64_t mFirstObserveUs = 0;
+    uint64_t mLastObserveUs = 0;
+
+    // Generation state
+    bool mActive = false;
+    uint64_t mStartUs = 0;
+    uint64_t mBitrate = 0;
+    uint64_t mPcrBase = 0;              // PCR of the first generated byte
+    uint64_t mEmittedBytes = 0;         // bytes generated in the current period
+    uint64_t mPacketsToPcr = 0;         // null packets until next PCR packet
+    // PCR packet period in packets
+    uint64_t mPcrPacketInterval = 0;
+    uint64_t mTotalGeneratedBytes = 0;
+};
@@ -19,23 +19,35 @@
 
 #pragma once
 
+#include <condition_variable>
+#include <functional>
 #include <mutex>
+#include <boost/circular_buffer.hpp>
 #include <streamfs/BufferPool.h>
 #include <streamfs/ByteBufferPool.h>
 #include "StreamParser/StreamProcessor.h"
 #include "StreamParser/BufferIndexer.h"
+#include "StreamParser/PcrTracker.h"
+#include "StreamParser/TrickPlayStream.h"
+#include "StreamParser/SpillStore.h"
+#include "StreamParser/ReadPacer.h"
 #include "HandleContext.h"
 #include "utils/TimeoutWatchdog.h"
 #include "utils/TimeIntervalMonitor.h"
 #include "PlayerStateEnum.h"
 #include "utils/CyclicEventTimer.h"
 #include "utils/MonitoredVariable.h"
+#include "utils/MemoryPressureMonitor.h"
 #ifdef TS_PACKAGE_DUMP
 #include "SocketServer.h"
 #endif
 
 #define PAUSE_POST_READ_RATE_TIMEOUT_MS 1000
 #define TRICK_PLAY_RATE_MS 350
+// Media time served at once when paced reads resume
+#define READ_PACING_BURST_MS 500
+// Longest wait of a paced read before checking the reader again
+#define READ_PACING_MAX_WAIT_MS 100
 
 //TODO: move to includes
 
@@ -50,7 +62,17 @@ public:
 
     class TsBufferProducer : public BufferProducer<buffer_chunk>
     {
+    public:
+        /**
+         * @param baseCount - chunks queued before this producer, the byte
+         *                    index continues when the ring is replaced
+         */
+        explicit TsBufferProducer(uint64_t baseCount = 0) : mBaseCount(baseCount) {}
 
+        uint64_t getBaseCount() const { return mBaseCount; }
+
+    private:
+        const uint64_t mBaseCount;
     };
 
     TimeShiftBufferConsumer(std::atomic<bool> *tsDumpEnable)
@@ -60,9 +82,12 @@ public:
         , mIsStreaming(false)
         , mIsPaused(false)
         , mPlayerState(PlayerStateEnum::StateType::UNDEF)
-        , mTrickPlaySpeed(1) {
+        , mTrickPlaySpeed(1)
+        , mTrickPlayStream(TRICK_PLAY_RATE_MS * 1000) {
         allocateBufferQueue();
-        mBufIndexer = std::make_shared<BufferIndexer>(BUFFER_POOL_SIZE, BUFFER_POOL_TAIL_SIZE, BUFFER_SAMPLING_RATIO);
+        mBufIndexer = std::make_shared<BufferIndexer>(mPoolSize, BUFFER_POOL_TAIL_SIZE, BUFFER_SAMPLING_RATIO);
+        mChunkTimes.set_capacity(mIndexSize);
+        mSpillChunk.resize(BUFFER_CHUNK_SIZE);
         mBufferReadWatchdog = std::make_shared<TimeoutWatchdog>(PAUSE_POST_READ_RATE_TIMEOUT_MS, [this](bool expired){
             // If this callback is being invoked, it means that the watchdog timer has expired or been stopped
             // The value og expired will indicate if the watchdog has expired/time-out (true) or if it has
@@ -87,18 +112,35 @@ public:
 
         mFlush = &MVar<ByteVectorType>::getVariable(kFlush0);
         mTrickPlayFile = &MVar<ByteVectorType>::getVariable(kTrickPlay0);
+
+        mMemoryPressureMonitor = std::make_shared<MemoryPressureMonitor>(TSB_MEMORY_CGROUP,
+                [this](MemoryPressureMonitor::Level level) {
+            setMemoryPressure(level);
+        });
     }
 
     ~TimeShiftBufferConsumer() override {
-        mRingBufferPool->abortAllOperations();
+        mMemoryPressureMonitor.reset();
+        interruptReads();
     }
 
     void interruptReads() {
-        mRingBufferPool->abortAllOperations();
+        std::lock_guard<std::mutex> ringGuard(mRingMtx);
+        if (mRingBufferPool) {
+            mRingBufferPool->abortAllOperations();
+        }
     }
 
     void post(const StreamParser::Buffer& buf) override;
 
+    /**
+     * Set the tracker selecting the PCR and video PIDs of the index.
+     * Without it seeks resolve against arrival time and are not
+     * snapped to random access points.
+     * @param pcrTracker - PCR tracker of the same pipeline
+     */
+    void setPcrTracker(std::shared_ptr<PcrTracker> pcrTracker);
+
     /**
      * Set trick play speed and direction.
      *
@@ -106,6 +148,11 @@ public:
      * where negative values means rewind and positive
      * values means forward.
      *
+     * When the video and its random access points are known, readData
+     * serves an I-frame only stream at the requested speed, see
+     * TrickPlayStream. The player is flushed on start and stop only.
+     * Otherwise the seek position is moved every TRICK_PLAY_RATE_MS.
+     *
      * @param speed (seconds)
      * @return - trick play started (true) or failure (false)
      */
@@ -119,7 +166,8 @@ public:
     int16_t getTrickPlaySpeed();
 
     /**
-     * Set seek time for current stream in milliseconds
+     * Set seek time for current stream in milliseconds. The position
+     * is moved back to the preceding random access point if known.
      *
      * @param seekTime (milliseconds)
      * @return - seek success (true) or failure (false)
@@ -193,7 +241,118 @@ public:
      */
     uint64_t getBufferCapacityByteSize();
 
+    /**
+     * Get the size of the ring
+     *
+     * @return ring size in chunks, including the tail
+     */
+    size_t getBufferPoolSize();
+
+    /**
+     * Get maximum buffer duration at the measured bitrate
+     *
+     * @return maximum buffer duration in milliseconds, 0 until the
+     *         bitrate is measured
+     */
+    time_t getBufferCapacityTime();
+
+    /**
+     * Set the TSB depth, applied on the next channel open.
+     *
+     * The ring is allocated to hold bytes and only reallocated on channel
+     * open if that changes. Seeks are limited to the data of the last
+     * seconds of media time, whatever the bitrate of the channel.
+     *
+     * @param seconds - depth in seconds
+     * @param bytes   - depth in bytes
+     * @return - false if out of range
+     */
+    bool setTsbSize(uint64_t seconds, uint64_t bytes);
+
+    /**
+     * Get the configured TSB depth
+     *
+     * @param seconds - depth in seconds
+     * @param bytes   - depth in bytes
+     */
+    void getTsbSize(uint64_t &seconds, uint64_t &bytes);
+
+    /**
+     * Apply a memory pressure level, called from the monitor thread.
+     *
+     * Medium pressure limits the seek window to half the ring and keeps
+     * its content. Critical pressure replaces the ring by a quarter of
+     * its size holding the newest data, the ring grows back to its full
+     * size once the pressure is gone. The new ring is filled while post
+     * continues, only the chunks posted meanwhile are copied with post
+     * blocked.
+     *
+     * @param level - memory pressure level
+     */
+    void setMemoryPressure(MemoryPressureMonitor::Level level);
+
+    /**
+     * @return memory pressure level applied to the ring
+     */
+    MemoryPressureMonitor::Level getMemoryPressure() const {
+        return mMemoryPressure;
+    }
+
+    /**
+     * Configure the disk tier, applied on the next channel open. Data
+     * leaving the RAM TSB is written to disk only if a reader has not
+     * read it yet, e.g. while paused, and read from there, see
+     * SpillStore.
+     *
+     * @param path  - file on local storage, empty to disable
+     * @param bytes - size of the file
+     * @return - false if out of range
+     */
+    bool setSpill(const std::string &path, uint64_t bytes);
+
+    /**
+     * Get the configured disk tier
+     *
+     * @param path  - file on local storage, empty if disabled
+     * @param bytes - size of the file
+     */
+    void getSpill(std::string &path, uint64_t &bytes);
+
+    /**
+     * Get the disk tier of the current channel
+     *
+     * @return disk tier or nullptr if disabled
+     */
+    std::shared_ptr<SpillStore> getSpillStore();
+
+    /**
+     * Pace the reads of the controlled reader to rate times real time,
+     * following the PCR of the TSB index. I-frame trick play is paced
+     * per frame of TRICK_PLAY_RATE_MS.
+     *
+     * @param rate - multiple of real time, 0 reads as fast as possible
+     * @return - false if out of range
+     */
+    bool setReadRate(double rate);
+
+    /**
+     * Get the read rate
+     *
+     * @return multiple of real time, 0 if reads are not paced
+     */
+    double getReadRate();
+
+    /**
+     * Replace the monotonic clock of the read pacing, used by tests
+     *
+     * @param clock - returns monotonic time in us, empty for the steady clock
+     */
+    void setPacingClock(std::function<uint64_t()> clock);
+
 private:
+    // Serializes post and the stream events with a ring resize on memory
+    // pressure. Taken before the other locks.
+    std::mutex mRingMtx;
     std::mutex mSeekMtx;
     std::mutex mParamMtx;
     std::mutex mTrickPlaySpeedMtx;
@@ -204,13 +363,71 @@ private:
     std::atomic<PlayerStateEnum::StateType> mPlayerState;
     int16_t mTrickPlaySpeed;
 
+    // I-frame trick play, guarded by mSeekMtx
+    TrickPlayStream mTrickPlayStream;
+    std::vector<unsigned char> mTrickPlayFrame;
+    int16_t mIFrameSpeed {1};
+    bool mTrickPlayStart {false};
+    std::atomic<bool> mIFrameTrickPlay {false};
+    // Stopped by readData, the speed is reset by the trick play timer
+    std::atomic<bool> mIFrameStopped {false};
+    // Byte index of the last I-frame served
+    std::atomic<uint64_t> mTrickPlayPos {0};
+
+    // Ring and its producer, replaced on resize with mRingMtx,
+    // mTrickPlaySpeedMtx and mSeekMtx held. Used with one of them held.
     std::shared_ptr<TsBufferProducer> mTsBufProd;
     std::shared_ptr<ByteBufferPool> mRingBufferPool;
     std::shared_ptr<BufferIndexer> mBufIndexer;
+    std::shared_ptr<PcrTracker> mPcrTracker;
+    // Gap since the last PCR registered in the index
+    bool mPcrDiscontinuity {true};
+    // Offset of the first packet in the next chunk and the head of
+    // the packet spanning into it, see indexChunk
+    size_t mIndexPhase {0};
+    StreamPacketT mIndexPartial {};
+    size_t mIndexPartialLen {0};
+
+    // Configured depth, guarded by mParamMtx
+    uint64_t mTsbSizeSec {TSB_MAX_DURATION_SECONDS};
+    uint64_t mTsbSizeBytes {TSB_DEFAULT_SIZE_CHUNKS * BUFFER_CHUNK_SIZE};
+    // Ring size in chunks, including the tail
+    size_t mPoolSize {TSB_DEFAULT_SIZE_CHUNKS + BUFFER_POOL_TAIL_SIZE};
+    // Ring size the BufferIndexer is sized for
+    size_t mIndexSize {TSB_DEFAULT_SIZE_CHUNKS + BUFFER_POOL_TAIL_SIZE};
+
+    // Level applied to the ring, written with mRingMtx held
+    std::atomic<MemoryPressureMonitor::Level> mMemoryPressure {MemoryPressureMonitor::NONE};
+    std::shared_ptr<MemoryPressureMonitor> mMemoryPressureMonitor;
+
+    // Configured disk tier, guarded by mParamMtx
+    std::string mSpillPath;
+    uint64_t mSpillBytes {0};
+    // Disk tier of the current channel, replaced with mRingMtx and
+    // mSeekMtx held. Used with one of them held.
+    std::shared_ptr<SpillStore> mSpillStore;
+    // Oldest position of the readers, updated with mSeekMtx held
+    std::atomic<uint64_t> mSpillFrom {UINT64_MAX};
+    // Next chunk to spill and its copy, guarded by mRingMtx
+    uint64_t mSpillNext {0};
+    std::vector<unsigned char> mSpillChunk;
+    // Arrival time of the chunks in the ring, guarded by mRingMtx
+    boost::circular_buffer<uint64_t> mChunkTimes;
+    // Arrival time of the last chunk
+    std::atomic<uint64_t> mLiveTimeUs {0};
+
+    // Pacing of the controlled reader, used with mSeekMtx held
+    ReadPacer mReadPacer {READ_PACING_BURST_MS * 1000};
+    std::condition_variable mReadPacingCv;
+    std::function<uint64_t()> mPacingClock;
+
     std::shared_ptr<TimeoutWatchdog> mBufferReadWatchdog;
     std::shared_ptr<CyclicEventTimer> mTrickPlayTimer;
 
     std::map<uint64_t, HandleContext> mHandles;
+    // Reader following seek, trick play and player state
+    uint64_t mPrimaryHandle {0};
+    bool mHasPrimary {false};
 
     TimeIntervalMonitor mPauseTimeMonitor;
 
@@ -225,6 +442,168 @@ private:
 
     void allocateBufferQueue();
 
+    /**
+     * @param poolSize  - ring size in chunks
+     * @param tsBufProd - producer queuing to the ring
+     * @return new ring
+     */
+    static std::shared_ptr<ByteBufferPool> createBufferQueue(size_t poolSize,
+                                                             const std::shared_ptr<TsBufferProducer> &tsBufProd);
+
+    /**
+     * Get the data held by the ring, which keeps all but one of its
+     * chunks. Called with mRingMtx or mSeekMtx held.
+     *
+     * @return size in bytes up to the live point
+     */
+    uint64_t getRingByteSize();
+
+    /**
+     * Read the ring at an absolute byte index. Called with mRingMtx or
+     * mSeekMtx held.
+     *
+     * @param data      - destination
+     * @param size      - size in bytes
+     * @param byteIndex - absolute byte index
+     * @return number of bytes read, 0 if released by the ring
+     */
+    size_t readRing(char *data, size_t size, uint64_t byteIndex);
+
+    /**
+     * Copy whole chunks from a ring to the producer of another one.
+     *
+     * @param ring     - source ring
+     * @param ringBase - base count of the producer of ring
+     * @param producer - destination producer
+     * @param next     - chunk index to copy next, updated
+     * @param end      - chunk index to stop at
+     * @return false if a chunk was overwritten in the source ring
+     */
+    static bool copyChunks(ByteBufferPool &ring, uint64_t ringBase, TsBufferProducer &producer,
+                           uint64_t &next, uint64_t end);
+
+    /**
+     * Replace the ring by one of poolSize chunks holding the newest data
+     * of the current one. Positions and the disk tier are kept. Takes
+     * mRingMtx, then mTrickPlaySpeedMtx and mSeekMtx for the swap.
+     *
+     * @param poolSize - ring size in chunks, including the tail
+     */
+    void replaceRing(size_t poolSize);
+
+    /**
+     * Get the ring of the TSB. Called with mRingMtx, mTrickPlaySpeedMtx
+     * or mSeekMtx held, the ring may be replaced on resize.
+     *
+     * @return ring buffer pool
+     */
+    const std::shared_ptr<ByteBufferPool> &getRingBufferPool();
+
+    /**
+     * Get the producer queuing to the ring of getRingBufferPool().
+     *
+     * @return ring producer
+     */
+    const std::shared_ptr<TsBufferProducer> &getBufferProducer();
+
+    /**
+     * Apply the configured depth on channel open. Reallocates the ring
+     * and moves all handles to its start if its size changes.
+     */
+    void resizeBuffer();
+
+    /**
+     * Limit the seek window to the ring size allowed under memory
+     * pressure. The duration limit is kept by the BufferIndexer.
+     */
+    void updateWindow();
+
+    /**
+     * Ring size in chunks for the configured depth, halved under medium
+     * and quartered under critical memory pressure.
+     *
+     * @param level - memory pressure level
+     * @return ring size in chunks, including the tail
+     */
+    size_t getTargetPoolSize(MemoryPressureMonitor::Level level);
+
+    /**
+     * Apply the configured disk tier on channel open.
+     */
+    void updateSpillStore();
+
+    /**
+     * Write the chunks leaving the RAM window to the disk tier, if a
+     * reader is behind them, e.g. while paused. Called from post.
+     */
+    void spillChunks();
+
+    /**
+     * Update mSpillFrom after a reader moved. Called with mSeekMtx held.
+     */
+    void updateSpillFrom();
+
+    /**
+     * getMaxSeekTime, called with mSeekMtx held.
+     *
+     * @return available time duration in milliseconds
+     */
+    time_t getSeekableTime();
+
+    /**
+     * Get the data available for seeks and reads, in RAM or on disk.
+     *
+     * @param live - live byte index
+     * @return size in bytes
+     */
+    uint64_t getSeekableByteSize(uint64_t live);
+
+    /**
+     * Get the byte offset of a seek time older than the RAM index from
+     * the disk tier, in arrival time.
+     *
+     * @param timeUs     - seek time in us
+     * @param byteOffset - byte offset from the live point
+     * @return false if not on disk
+     */
+    bool getSpillByteOffset(uint64_t timeUs, uint64_t &byteOffset);
+
+    /**
+     * Counterpart of getSpillByteOffset.
+     *
+     * @param byteOffset - byte offset from the live point
+     * @param timeUs     - seek time in us
+     * @return false if not on disk
+     */
+    bool getSpillTimeUs(uint64_t byteOffset, uint64_t &timeUs);
+
+    /**
+     * Wait until the pacer has credit for the controlled reader. Waits
+     * at most READ_PACING_MAX_WAIT_MS at once with mSeekMtx released.
+     *
+     * @param seekGuard - held lock of mSeekMtx
+     * @param handle    - file handle of the reader
+     * @return false if, after a wait, the reader was released or is no
+     *         longer the primary reader
+     */
+    bool waitForReadCredit(std::unique_lock<std::mutex> &seekGuard, uint64_t handle);
+
+    /**
+     * Limit a read to the media time credit of the pacer. The media time
+     * per byte is taken over the next READ_PACING_BURST_MS of the index.
+     *
+     * @param byteOffset - byte offset of the read position from the live point
+     * @param size       - requested size
+     * @param usPerByte  - media time per byte read, 0 if not paced
+     * @return size to read, at least one TS packet
+     */
+    size_t getPacedReadSize(uint64_t byteOffset, size_t size, double &usPerByte);
+
+    /**
+     * @return monotonic time of the read pacing in us, with mSeekMtx held
+     */
+    uint64_t getPacingTimeUs();
+
     /**
      * Get total virtual buffer size in bytes
      *
@@ -232,8 +611,92 @@ private:
      */
     uint64_t getTotalBufferByteCount();
 
+    /**
+     * Register the last PCR and the random access points of the
+     * newest chunk in the buffer indexer. Packets spanning two chunks
+     * are indexed at their start in the previous chunk.
+     *
+     * @param buf - buffer just queued to the TSB
+     */
+    void indexChunk(const StreamParser::Buffer& buf);
+
+    /**
+     * Find the next TS packet start in a chunk.
+     *
+     * @param data - chunk data
+     * @param pos  - offset to start the search at
+     * @return offset of the packet, BUFFER_CHUNK_SIZE if not found
+     */
+    static size_t findIndexSync(const unsigned char *data, size_t pos);
+
+    /**
+     * Seek to a time and snap to a random access point.
+     *
+     * @param seekTime - seek time in milliseconds
+     * @param forward  - snap to the following random access point
+     *                   rather than the preceding one
+     * @return - seek success (true) or failure (false)
+     */
+    bool seek(time_t seekTime, bool forward);
+
+    /**
+     * Move the read position of all handles. Called with mSeekMtx held.
+     *
+     * @param byteOffset - byte offset from the live point
+     */
+    void setSeekByteOffset(uint64_t byteOffset);
+
+    /**
+     * Start serving I-frames from the random access point preceding the
+     * read position. Called with mTrickPlaySpeedMtx held.
+     *
+     * @param speed - trick play speed
+     * @return false if the video or its random access points are unknown
+     */
+    bool startIFrameTrickPlay(int16_t speed);
+
+    /**
+     * Trick play timer step of the I-frame mode. Finishes the stop when
+     * the speed is set to 1 or readData reached the end of the TSB.
+     * Called with mTrickPlaySpeedMtx held.
+     *
+     * @return true when trick play is stopped
+     */
+    bool updateIFrameTrickPlay();
+
+    /**
+     * Add the next I-frame in the direction of play to mTrickPlayStream.
+     * Called with mSeekMtx held.
+     *
+     * @return false if trick play stopped at an end of the TSB
+     */
+    bool nextTrickPlayFrame();
+
+    /**
+     * Leave the I-frame mode and continue normal reads. Called with
+     * mSeekMtx held.
+     *
+     * @param byteOffset - byte offset from the live point to play from
+     */
+    void stopIFrameTrickPlay(uint64_t byteOffset);
+
+    /**
+     * Ask the player to flush its pipeline
+     */
+    void notifyFlush();
+
+    /**
+     * Get the context of the reader following seek, trick play and
+     * player state. Called with mSeekMtx held, the context is valid
+     * until it is released.
+     *
+     * @return context or nullptr if the reader is not open
+     */
+    HandleContext *getPrimaryContext();
+
     /**
      * Get the EPOC timestamp for the current buffer pool read position.
+     * Called with mSeekMtx held.
      *
      * @return delta time in us
      */
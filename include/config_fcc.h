@@ -50,6 +50,40 @@
 #define FEIP_NEEDS_UNICAST_SESSION 1
 #define FEIP_DEFAULT_BUFFER_COUNT  64
 
+/**
+ * Default overflow policy of the ingest buffer queue.
+ * One of OverflowPolicy::BLOCK, DROP_NEWEST or DROP_OLDEST (see BufferQueue.h).
+ * Can be changed at runtime through the ingest_overflow0 node.
+ */
+#define INGEST_DEFAULT_OVERFLOW_POLICY OverflowPolicy::BLOCK
+
+/**
+ * Number of chunks queued for each asynchronous stream consumer
+ */
+#define STREAM_CONSUMER_QUEUE_SIZE 32
+
+/**
+ * Number of chunks allocated upfront in the chunk pool shared with the stream consumers
+ */
+#define CHUNK_POOL_INITIAL_SIZE 8
+
+/**
+ * Maximum number of chunks in the chunk pool. Bounds the chunks
+ * held by the async consumer queues plus the chunk being assembled.
+ */
+#define CHUNK_POOL_MAX_SIZE (STREAM_CONSUMER_QUEUE_SIZE * 4)
+
+/**
+ * Length in seconds of the short window of the stream_health0 counters
+ */
+#define STREAM_HEALTH_WINDOW_S 10
+
+/**
+ * Bitrate in bits/s of the stuffing generated on source loss
+ * when the channel bitrate could not be measured yet.
+ */
+#define STUFFING_FALLBACK_BITRATE 8000000
+
 /**
  * QUIRK_FORCE_VBO_VM_RET_ADDRESS
  * Set to 1 to force FCC initial config
@@ -59,6 +59,30 @@ typedef std::map<ConfigVariableId, FsNode> MapConfigToFSPathType;
  */
 #define BUFFER_POOL_SIZE (((0.5 + TSB_SIZE_SEC) * 1e6 / BUFFER_CHUNK_CBR_PERIOD_USEC) + BUFFER_POOL_TAIL_SIZE)
 
+/**
+ * Default and minimum TSB size in chunks, excluding the tail. The size
+ * is set at runtime through CONFIG_F_TSB_SIZE and applied on channel open.
+ */
+#define TSB_DEFAULT_SIZE_CHUNKS ((uint64_t) (BUFFER_POOL_SIZE - BUFFER_POOL_TAIL_SIZE))
+#define TSB_MIN_SIZE_CHUNKS 16
+
+/**
+ * Memory cgroup of streamfs. The TSB shrinks under its memory pressure.
+ */
+#define TSB_MEMORY_CGROUP "/sys/fs/cgroup/memory/tsb.slice"
+
+/**
+ * Shared memory keeping the last TSB chunks across streamfs restarts,
+ * replayed if the same channel is opened within TSB_PERSIST_MAX_AGE_S.
+ * It holds TSB_PERSIST_SEC at the CBR chunk rate, enough for the PSI/DRM
+ * state and a few GOPs, and no more than the RAM TSB. The time-shift
+ * window and the reader positions are not kept.
+ */
+#define TSB_PERSIST_SHM_NAME "/streamfs_fcc_tsb"
+#define TSB_PERSIST_SEC 4
+#define TSB_PERSIST_CHUNKS ((uint64_t) (TSB_PERSIST_SEC * 1e6 / BUFFER_CHUNK_CBR_PERIOD_USEC))
+#define TSB_PERSIST_MAX_AGE_S 60
+
 /**
  * Buffer index sampling ratio
  */
@@ -83,6 +107,9 @@ typedef std::map<ConfigVariableId, FsNode> MapConfigToFSPathType;
 #define CONFIG_F_CHANNEL_SELECT_TIMESTAMP    "chan_select_timestamp0"
 #define CONFIG_F_PLAYER_STATE "player_state0"
 #define CONFIG_F_SEEK_CONTROL "seek0"
+#define CONFIG_F_TSB_SIZE "tsb_size0"
+#define CONFIG_F_TSB_SPILL "tsb_spill0"
+#define CONFIG_F_READ_RATE "read_rate0"
 #define STREAM_SRC_FILE  "stream0.ts"
 
 // FCC statistics module configs
@@ -101,6 +128,10 @@ typedef std::map<ConfigVariableId, FsNode> MapConfigToFSPathType;
 #define CONFIG_F_STAT_PERIOD_FREQ "stat_periodic_freq"
 #define CONFIG_F_STREAMFS_PID "pidfile"
 #define CONFIG_F_STREAM_STATUS "stream_status"
+#define CONFIG_F_INGEST_OVERFLOW "ingest_overflow0"
+#define CONFIG_F_CONSUMER_QUEUES "consumer_queues0"
+#define CONFIG_F_STREAM_HEALTH "stream_health0"
+#define CONFIG_F_BITRATE "bitrate0"
 #define CONFIG_FCC_PLUGIN_ID "fcc"
 
 // Compile time djb2 HASH
@@ -158,6 +189,9 @@ static config_cb_type config_handlers_g[]  __attribute__ ((unused)) = {
         {CONFIG_F_CHANNEL_SELECT_TIMESTAMP,  CHANNEL_SELECT},
         {CONFIG_F_PLAYER_STATE,              PLAYER_STATE},
         {CONFIG_F_SEEK_CONTROL,              SEEK_CONTROL},
+        {CONFIG_F_TSB_SIZE,                  SEEK_CONTROL},
+        {CONFIG_F_TSB_SPILL,                 SEEK_CONTROL},
+        {CONFIG_F_READ_RATE,                 SEEK_CONTROL},
         {CONFIG_F_STATS_SW_VERSION,          STATS_CONTROL},
         {CONFIG_F_MODEL_ID,                  STATS_CONTROL},
         {CONFIG_F_MODEL_ID,                  STATS_CONTROL},
@@ -179,5 +213,9 @@ static config_cb_type config_handlers_g[]  __attribute__ ((unused)) = {
         {CONFIG_F_STREAMFS_PID,              STATS_CONTROL},
         {CONFIG_F_STREAM_INFO_FLUSH,         SEEK_CONTROL},
         {CONFIG_F_STREAM_STATUS,               STATS_CONTROL},
+        {CONFIG_F_INGEST_OVERFLOW,           STATS_CONTROL},
+        {CONFIG_F_CONSUMER_QUEUES,           STATS_CONTROL},
+        {CONFIG_F_STREAM_HEALTH,             STATS_CONTROL},
+        {CONFIG_F_BITRATE,                   STATS_CONTROL},
         {CONFIG_F_TRICK_PLAY,               TRICK_PLAY},
 };
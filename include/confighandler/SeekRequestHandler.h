@@ -40,6 +40,12 @@ public:
     uint64_t getSize(const std::string &fileName) override;
 private:
     std::string getConfig();
+    std::string getTsbSize();
+    int writeTsbSize(const std::string &buf, size_t size);
+    std::string getSpill();
+    int writeSpill(const std::string &buf, size_t size);
+    std::string getReadRate();
+    int writeReadRate(const std::string &buf, size_t size);
     std::shared_ptr<StreamParser::TimeShiftBufferConsumer>  mTsbStreamParser;
     std::shared_ptr<MVar<ByteVectorType>::watcher_function> mCbFunc;
     MVar<ByteVectorType> *mFlush;
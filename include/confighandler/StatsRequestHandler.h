@@ -21,13 +21,18 @@
 
 #include "ConfigHandlerMVarCb.h"
 #include <MediaSourceHandler.h>
+#include "StreamParser/StreamAnalyzer.h"
+#include "StreamParser/PcrTracker.h"
 
 class MediaSourceHandler;
 
 namespace fcc {
 class StatsRequestHandler : public ConfigHandlerMVarCb<ByteVectorType> {
 public:
-    explicit StatsRequestHandler(MediaSourceHandler *mediaSourceHandler, streamfs::PluginCallbackInterface *cb);
+    StatsRequestHandler(MediaSourceHandler *mediaSourceHandler,
+                        std::shared_ptr<StreamParser::StreamAnalyzer> analyzer,
+                        std::shared_ptr<StreamParser::PcrTracker> pcrTracker,
+                        streamfs::PluginCallbackInterface *cb);
 
 public:
     int writeConfig(const std::string &fileName, const std::string &buf, size_t size) override;
@@ -44,6 +49,8 @@ private:
 
     std::mutex mStateMtx;
     MediaSourceHandler *mMSrcHandler;
+    std::shared_ptr<StreamParser::StreamAnalyzer> mAnalyzer;
+    std::shared_ptr<StreamParser::PcrTracker> mPcrTracker;
     std::string mGlobalStats;
     std::string mChannelStats;
     MVar<ByteVectorType> *mSrcLost0;
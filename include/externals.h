@@ -24,6 +24,7 @@
 #include <cstdint>
 
 #include "config_fcc.h"
+#include "BufferMeta.h"
 #include <glog/logging.h>
 #include <mutex>
 #include <stddef.h>     /* offsetof */
@@ -65,3 +66,12 @@ bq_buffer *alloc_bq_buffer(size_t size, void *context);
 void free_bq_buffer(bq_buffer *buffer);
 
 }
+
+/**
+ * Metadata of a BQ buffer allocated with alloc_bq_buffer. It is kept in
+ * front of the buffer, so that the bq_buffer layout shared with the
+ * plugins does not change.
+ * @param buffer - buffer from alloc_bq_buffer
+ * @return buffer metadata, reset on acquire
+ */
+BufferMeta &bq_buffer_meta(bq_buffer *buffer);
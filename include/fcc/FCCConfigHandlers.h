@@ -85,11 +85,15 @@ protected:
      * Init configuration handlers
      * @param tsbConsumer  - time shift consumer
      * @param mediaSourceHandler - media source handler
+     * @param analyzer - stream health analyzer
+     * @param pcrTracker - PCR tracker
      * @param cb  - callback to StreamFS interface
      */
     void initConfigHandlers(
             const std::shared_ptr<StreamParser::TimeShiftBufferConsumer>& tsbConsumer,
             MediaSourceHandler* mediaSourceHandler,
+            const std::shared_ptr<StreamParser::StreamAnalyzer>& analyzer,
+            const std::shared_ptr<StreamParser::PcrTracker>& pcrTracker,
             streamfs::PluginCallbackInterface *cb
     );
 
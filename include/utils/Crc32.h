@@ -0,0 +1,30 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE
+ * file the following copyright and licenses apply:
+ *
+ * Copyright (c) 2022 Nuuday.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * CRC-32/MPEG-2 as used by PSI sections (polynomial 0x04C11DB7,
+ * initial value 0xFFFFFFFF, no reflection, no final xor).
+ * A section including its CRC_32 field yields 0 when intact.
+ */
+uint32_t crc32Mpeg(const unsigned char *data, size_t length, uint32_t crc = 0xFFFFFFFF);
@@ -0,0 +1,85 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE
+ * file the following copyright and licenses apply:
+ *
+ * Copyright (c) 2022 Nuuday.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+// Pressure is considered cleared without notifications for this long
+#define MEMORY_PRESSURE_CLEAR_MS 10000
+
+/**
+ * Memory pressure notification of a cgroup v1 memory controller.
+ *
+ * Listens to the "medium" and "critical" memory.pressure_level events
+ * through cgroup.event_control in a separate thread. The kernel does not
+ * notify when pressure ends, so the level returns to NONE after
+ * MEMORY_PRESSURE_CLEAR_MS without events.
+ *
+ * Monitoring is disabled if the cgroup does not exist.
+ */
+class MemoryPressureMonitor
+{
+public:
+    enum Level {
+        NONE     = 0,
+        MEDIUM   = 1,
+        CRITICAL = 2
+    };
+
+    /**
+     * @param cgroupPath - path of the memory cgroup
+     * @param func       - called from the monitor thread on level changes
+     */
+    MemoryPressureMonitor(const std::string &cgroupPath, std::function<void(Level)> func);
+
+    ~MemoryPressureMonitor();
+
+    Level getLevel() const {
+        return mLevel;
+    }
+
+private:
+    MemoryPressureMonitor(const MemoryPressureMonitor&) = delete;
+    MemoryPressureMonitor& operator=(const MemoryPressureMonitor&) = delete;
+
+    /**
+     * Register an eventfd for a pressure level
+     *
+     * @return eventfd or -1 on failure
+     */
+    int subscribe(const char *level);
+
+    void setLevel(Level level);
+
+    void threadLoop();
+
+    std::string mCgroupPath;
+    std::function<void(Level)> mFunc;
+    std::atomic<Level> mLevel {NONE};
+    int mPressureFd {-1};
+    int mControlFd {-1};
+    int mMediumFd {-1};
+    int mCriticalFd {-1};
+    int mExitFd {-1};
+    std::thread mThread;
+};
@@ -26,6 +26,9 @@
 #include "version.h"
 #include "StreamParser/PSIParser.h"
 #include "StreamParser/EcmCache.h"
+#include "StreamParser/PcrTracker.h"
+#include "StreamParser/PersistentTsb.h"
+#include "StreamParser/StreamAnalyzer.h"
 #include "TimeShiftBufferConsumer.h"
 #include "fcc/FCCConfigHandlers.h"
 
@@ -52,9 +55,10 @@ int streamfs::FCCPlugin::open(std::string path) {
             it->second +=1;
         }
 
-        // TODO: support multiple clients opening stream0.ts
+        // Each reader has its own position in the TSB, the first one
+        // follows seek, trick play and player state
         if (path == STREAM_SRC_FILE && mStreamOpenCounters.find(path)->second > 1 ) {
-            LOG(ERROR) << " Opening stream0.ts multiple times will cause continuity errors!";
+            LOG(INFO) << "stream0.ts readers: " << mStreamOpenCounters.find(path)->second;
         }
 
         return 0;
@@ -146,13 +150,27 @@ streamfs::FCCPlugin::FCCPlugin(streamfs::PluginCallbackInterface *cb, Demuxer *d
     mDefferalHandler = std::make_shared<ConstDelayDefHandler>(milliseconds(CHANNEL_READ_TIMEOUT_MS));
 
     mTsbConsumer = std::make_shared<StreamParser::TimeShiftBufferConsumer>(&debugOptions->tsDumpEnable);
-
+    mPcrTracker = std::make_shared<StreamParser::PcrTracker>();
+    mTsbConsumer->setPcrTracker(mPcrTracker);
+    mStreamAnalyzer = std::make_shared<StreamParser::StreamAnalyzer>();
+    auto persistentTsb = std::make_shared<StreamParser::PersistentTsb>(TSB_PERSIST_SHM_NAME, TSB_PERSIST_CHUNKS);
+    // Shrinks with the RAM TSB and the memory pressure
+    persistentTsb->setLimit([tsb = mTsbConsumer]() {
+        return std::min<uint64_t>(TSB_PERSIST_CHUNKS >> tsb->getMemoryPressure(),
+                                  tsb->getBufferCapacityByteSize() / BUFFER_CHUNK_SIZE);
+    });
+
+    // Consumers always present are composed at compile time. Optional
+    // consumers are attached to the StreamProcessor when needed.
     auto p = new StreamParser::StreamProcessor(
-            {
-                    std::dynamic_pointer_cast<StreamParser::StreamConsumer>(mTsbConsumer),
-                    std::shared_ptr<StreamParser::StreamConsumer>(new StreamParser::EcmCache()),
-                    std::shared_ptr<StreamParser::StreamConsumer>(new StreamParser::PSIParser())
-            }
+            StreamParser::makeStaticPipeline(
+                    mTsbConsumer,
+                    mPcrTracker,
+                    persistentTsb,
+                    std::make_shared<StreamParser::EcmCache>(),
+                    std::make_shared<StreamParser::PSIParser>(),
+                    mStreamAnalyzer),
+            {}
     );
 
     mStreamProcessor.reset(p);
@@ -160,8 +178,10 @@ streamfs::FCCPlugin::FCCPlugin(streamfs::PluginCallbackInterface *cb, Demuxer *d
     mMediaSource = std::shared_ptr<MediaSourceHandler>(
             new MediaSourceHandler(demuxer, cbHandler,
                                    mDefferalHandler.get(), mStreamProcessor, &debugOptions->tsDumpEnable));
+    mMediaSource->setPersistentTsb(persistentTsb);
+    mMediaSource->setPcrTracker(mPcrTracker);
 
-    initConfigHandlers(mTsbConsumer, mMediaSource.get(), cb);
+    initConfigHandlers(mTsbConsumer, mMediaSource.get(), mStreamAnalyzer, mPcrTracker, cb);
 
     LOG(INFO) << "Loading Nokia FCC plugin. Version: v" <<
               PROJECT_MAJOR_VERSION << "."
@@ -115,7 +115,8 @@ size_t HttpDemuxerImpl::write(void *ptr, size_t size, size_t nmemb) {
         auto freeBytesInTempBuf = FEIP_BUFFER_SIZE - mCurrentOffset;
 
         if (freeBytesInTempBuf == FEIP_BUFFER_SIZE) {
-            httpBuffer[mHttpBufCount] = media_handler_http_g->acquireBuffer(0);
+            // HTTP is flow controlled by TCP. Never drop data here.
+            httpBuffer[mHttpBufCount] = media_handler_http_g->acquireBuffer(0, true);
         }
 
         auto writeLength = std::min(freeBytesInTempBuf, remaining_data);
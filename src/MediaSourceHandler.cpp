@@ -18,6 +18,7 @@
  */
 
 
+#include <array>
 #include <chrono>
 #include <memory>
 #include <utility>
@@ -39,8 +40,52 @@ char NOKIA_BUFFER_MAGIC[4] = {'n', 'k', 'i', 'a'};
 #define NO_BUFFER_RECEIVED_RECONFIGURE_THRESHOLD_MS 5000
 #define BUFFER_CHECK_PERIOD_MS 500
 
+// Stuffing injection period while the source is lost
+#define STUFFING_PERIOD_MS 40
+// Limit the stuffing buffers queued per period to leave room for real data
+#define STUFFING_MAX_BUFFERS_PER_PERIOD (FEIP_DEFAULT_BUFFER_COUNT / 2)
+
 #define NO_CHANNEL_URL "0.0.0.0:5900"
 
+#define TS_SYNC_BYTE 0x47
+
+namespace {
+
+/**
+ * Null PID packet with adaptation field only and the
+ * discontinuity_indicator set. Marks a gap in the ingest stream.
+ */
+std::array<uint8_t, TS_PACKAGE_SIZE> makeDiscontinuityPacket() {
+    std::array<uint8_t, TS_PACKAGE_SIZE> p {};
+    p.fill(0xFF);
+    p[0] = TS_SYNC_BYTE;
+    p[1] = 0x1F;
+    p[2] = 0xFF;
+    p[3] = 0x20;                    // adaptation field only, CC = 0
+    p[4] = TS_PACKAGE_SIZE - 5;     // adaptation_field_length
+    p[5] = 0x80;                    // discontinuity_indicator
+    return p;
+}
+
+const std::array<uint8_t, TS_PACKAGE_SIZE> DISCONTINUITY_PACKET = makeDiscontinuityPacket();
+
+/**
+ * Find the first TS packet start in data.
+ * A position is accepted if the sync byte repeats one packet later
+ * or if there is no data to verify against.
+ */
+uint32_t findTsPacketStart(const uint8_t *data, uint32_t size) {
+    for (uint32_t p = 0; p < TS_PACKAGE_SIZE && p < size; p++) {
+        if (data[p] == TS_SYNC_BYTE
+            && (p + TS_PACKAGE_SIZE >= size || data[p + TS_PACKAGE_SIZE] == TS_SYNC_BYTE)) {
+            return p;
+        }
+    }
+    return 0;
+}
+
+}
+
 MediaSourceHandler::MediaSourceHandler(Demuxer *dMux,
                                        std::shared_ptr<DemuxerCallbackHandler> cbHandler,
                                        ReadDefferHandler *defHandler,
@@ -61,6 +106,8 @@ MediaSourceHandler::MediaSourceHandler(Demuxer *dMux,
     mBufferSrcLostMVar = &MVar<ByteVectorType>::getVariable(kBufferSrcLost0);
     *mBufferSrcLostMVar = srcStateToMVar(mBufferSourceLost);
 
+    mFccBufferQueue.setOverflowPolicy(INGEST_DEFAULT_OVERFLOW_POLICY);
+
     for (int i = 0; i < FEIP_DEFAULT_BUFFER_COUNT; i++) {
         auto buf = alloc_bq_buffer(FEIP_BUFFER_SIZE, this);
         bufferRefs[i] = buf;
@@ -131,6 +178,19 @@ void MediaSourceHandler::pushBuffertoBQ(bq_buffer *pBuffer, int demuxId) {
 #ifdef TS_PACKAGE_DUMP
     mSocketServer.send(pBuffer->buffer, pBuffer->size);
 #endif
+    auto &meta = bq_buffer_meta(pBuffer);
+    if (meta.ingestTimeUs == 0) {
+        meta.ingestTimeUs = bufferMetaTimeNowUs();
+    }
+    if (!(meta.flags & BUFFER_FLAG_SOURCE_LOSS)) {
+        if (mPendingSourceSwitch.exchange(false)) {
+            meta.flags |= BUFFER_FLAG_SOURCE_SWITCH;
+        } else if (mBufferSourceLost) {
+            // First buffer after the source was lost
+            meta.flags |= BUFFER_FLAG_DISCONTINUITY;
+        }
+    }
+
     if (mDumpInputStreamEnabled) {
         fwrite(pBuffer->buffer, pBuffer->size, 1, mInputStreamDumpFile);
     }
@@ -146,10 +206,13 @@ void MediaSourceHandler::pushBuffertoBQ(bq_buffer *pBuffer, int demuxId) {
 
 }
 
-bq_buffer *MediaSourceHandler::acquireBuffer(int demuxId) {
+bq_buffer *MediaSourceHandler::acquireBuffer(int demuxId, bool forceBlocking) {
     UNUSED(demuxId);
     bq_buffer *res = nullptr;
-    mFccBufferQueue.acquire(&res);
+    if (!mFccBufferQueue.acquire(&res, forceBlocking)) {
+        return nullptr;
+    }
+    bq_buffer_meta(res) = {};
     return res;
 }
 
@@ -202,6 +265,8 @@ int MediaSourceHandler::open(std::string uri, uint32_t demuxer, uint32_t timeout
 
     mCurrentChannelConfig = ChannelConfig(uri);
     mCurrentUri = uri;
+    mStuffing.reset();
+    mPendingSourceSwitch = true;
 
     disconnect(feip);
 
@@ -217,9 +282,18 @@ int MediaSourceHandler::open(std::string uri, uint32_t demuxer, uint32_t timeout
 
     connect(feip);
 
-    feip->mDemuxer->open(uri);
-
-    StreamSource::onOpen(uri.c_str());
+    if (mPersistentTsb != nullptr) {
+        // Replayed before the source delivers, so that live data does not
+        // queue up meanwhile. Only the first open restores, nothing has
+        // been posted by the consumer thread yet.
+        StreamSource::onOpen(uri.c_str());
+        mRestored = restorePersistentTsb();
+        mPersistentTsb.reset();
+        feip->mDemuxer->open(uri);
+    } else {
+        feip->mDemuxer->open(uri);
+        StreamSource::onOpen(uri.c_str());
+    }
     mLastValidBufferTimeMs =
             std::chrono::duration_cast< milliseconds >(steady_clock::now().time_since_epoch());
 
@@ -229,76 +303,193 @@ finish:
 
 void MediaSourceHandler::consumerLoop() {
     bq_buffer *tmpBuf;
-    buffer_chunk chunk;
-    size_t offset = 0;
-    int count = 0;
+    uint32_t dropsBefore = 0;
 
     SLOG(INFO, LOG_DATA_SRC) << "Starting consumer thread";
 
     while (!mExitRequested) {
 
-        if (!mFccBufferQueue.consume(&tmpBuf, std::chrono::seconds(1))) {
+        if (!mFccBufferQueue.consume(&tmpBuf, std::chrono::seconds(1), &dropsBefore)) {
             continue;
         }
-        count++;
-        auto *buffStartPos = tmpBuf->buffer;
-        auto remainingInputBytes = tmpBuf->size;
-        while (remainingInputBytes > 0) {
-            uint32_t remaining_bytes = chunk.size() - offset;
-            uint32_t copy_bytes = std::min(remaining_bytes, remainingInputBytes);
 
-            memcpy(&chunk.data()[offset], buffStartPos, copy_bytes);
+        auto *data = (const uint8_t *) tmpBuf->buffer;
+        uint32_t size = tmpBuf->size;
+        BufferMeta meta = bq_buffer_meta(tmpBuf);
 
-            if (copy_bytes + offset == chunk.size()) {
-                StreamParser::Buffer b = {tmpBuf->channelInfo, &chunk};
-                post(b);
-            }
+        // Live data does not continue the replayed data
+        if (mRestored.exchange(false)) {
+            meta.flags |= BUFFER_FLAG_DISCONTINUITY;
+        }
+
+        if (dropsBefore > 0) {
+            SLOG(WARNING, LOG_DATA_SRC) << "Ingest overflow. Dropped " << dropsBefore << " buffers";
+            meta.lostPackets += dropsBefore;
+            meta.flags |= BUFFER_FLAG_DISCONTINUITY;
+        }
+
+        if (meta.flags & BUFFER_FLAG_DISCONTINUITY) {
+            insertDiscontinuity(tmpBuf->channelInfo, meta);
+            auto skip = findTsPacketStart(data, size);
+            data += skip;
+            size -= skip;
+        }
 
-            offset = (offset + copy_bytes) % chunk.size();
-            buffStartPos += copy_bytes;
-            remainingInputBytes -= copy_bytes;
+        if (meta.flags & BUFFER_FLAG_SOURCE_LOSS) {
+            alignToTsPacket();
+        } else {
+            auto nowUs = std::chrono::duration_cast<microseconds>(
+                    steady_clock::now().time_since_epoch()).count();
+            mStuffing.observe(data, size, nowUs);
         }
 
+        writeToChunk(data, size, tmpBuf->channelInfo, meta);
+
         mFccBufferQueue.release(tmpBuf);
     }
+}
+
+bool MediaSourceHandler::restorePersistentTsb() {
+    return mPersistentTsb->restore([this](const StreamParser::Buffer &b) {
+        post(b);
+    }) > 0;
+}
+
+void MediaSourceHandler::writeToChunk(const uint8_t *data, uint32_t size, const char *channelInfo,
+                                      const BufferMeta &meta) {
+    bool firstSegment = true;
+
+    while (size > 0) {
+        auto chunk = mChunk.get();
+        uint32_t remaining_bytes = chunk->size() - mChunkOffset;
+        uint32_t copy_bytes = std::min(remaining_bytes, size);
+
+        if (mChunkOffset == 0) {
+            mChunkMeta = {};
+            mChunkMeta.ingestTimeUs = meta.ingestTimeUs;
+            mChunkMeta.seqFirst = firstSegment ? meta.seqFirst : meta.seqLast;
+        }
+        // Loss and flags refer to the start of the data
+        if (firstSegment) {
+            mChunkMeta.lostPackets += meta.lostPackets;
+            mChunkMeta.flags |= meta.flags;
+        }
+        mChunkMeta.seqLast = meta.seqLast;
+        firstSegment = false;
+
+        memcpy(&chunk->data()[mChunkOffset], data, copy_bytes);
+        mTsPacketPhase = (mTsPacketPhase + copy_bytes) % TS_PACKAGE_SIZE;
+        mChunkOffset += copy_bytes;
+        data += copy_bytes;
+        size -= copy_bytes;
+
+        // The packet started in the held back chunk is complete
+        if (mPendingChunk && mChunkOffset >= TS_PACKAGE_SIZE - mPendingTail) {
+            StreamParser::Buffer b = {channelInfo, mPendingChunk.get(), mPendingMeta, std::move(mPendingChunk)};
+            post(b);
+        }
+
+        if (mChunkOffset == chunk->size()) {
+            if (mTsPacketPhase == 0) {
+                StreamParser::Buffer b = {channelInfo, chunk, mChunkMeta, std::move(mChunk)};
+                post(b);
+            } else {
+                // Held back until the packet at its end is complete, so
+                // that a gap can still drop the packet
+                mPendingChunk = std::move(mChunk);
+                mPendingMeta = mChunkMeta;
+                mPendingTail = mTsPacketPhase;
+            }
+            // The posted chunk may still be referenced by the consumers
+            mChunk = mChunkPool->acquire();
+            mChunkOffset = 0;
+        }
+    }
+}
+
+void MediaSourceHandler::insertDiscontinuity(const char *channelInfo, BufferMeta &meta) {
+    mIngestDiscontinuities++;
+    alignToTsPacket();
+    writeToChunk(DISCONTINUITY_PACKET.data(), DISCONTINUITY_PACKET.size(), channelInfo, meta);
 
-    if (mExitRequested) {
+    // The gap is reported with the marker packet
+    meta.lostPackets = 0;
+    meta.flags &= ~BUFFER_FLAG_DISCONTINUITY;
+}
+
+void MediaSourceHandler::alignToTsPacket() {
+    if (mTsPacketPhase == 0) {
         return;
     }
+
+    if (mChunkOffset >= mTsPacketPhase) {
+        mChunkOffset -= mTsPacketPhase;
+    } else {
+        // The packet starts in the held back chunk, which is written on
+        mChunk = std::move(mPendingChunk);
+        mChunkMeta = mPendingMeta;
+        mChunkOffset = mChunk.get()->size() - (mTsPacketPhase - mChunkOffset);
+    }
+    mTsPacketPhase = 0;
 }
+
 ByteVectorType MediaSourceHandler::srcStateToMVar(bool state) {
     auto result = ( state ? TRUE_STR : FALSE_STR) + "," + std::to_string(mSourceLostCounter);
     return {ByteVectorType (result.begin(), result.end())};
 }
 
 void MediaSourceHandler::dataMonitorLoop() {
+    milliseconds lastCheckTimeMs(0);
+
     do {
-        std::this_thread::sleep_for(std::chrono::milliseconds(BUFFER_CHECK_PERIOD_MS) );
+        // Run at the stuffing rate while the source is lost, so the
+        // stuffing is spread evenly instead of queued in bursts
+        std::this_thread::sleep_for(std::chrono::milliseconds(
+                mBufferSourceLost ? STUFFING_PERIOD_MS : BUFFER_CHECK_PERIOD_MS));
 
         auto currentTime =
                 std::chrono::duration_cast< milliseconds >(steady_clock::now().time_since_epoch());
+        auto diff = currentTime.count() - mLastValidBufferTimeMs.load().count();
 
-        // We are connected for longer time than NO_BUFFER_RECEIVED_THRESHOLD_MS and
-        // we got no buffers. We try to re-join
-        if (mCurrentChannelConfig.destinationIp != 0)
-        {
-            auto diff = currentTime.count() - mLastValidBufferTimeMs.load().count();
-            if (diff > NO_BUFFER_RECEIVED_RECONFIGURE_THRESHOLD_MS)
-            {
-                LOG(WARNING) << "Time since last valid buffer : " << diff;
-                mMessageHandler->pushMessage(NetworkMessage(NetworkMessage::NO_MULTICAST));
-            }
-            else if (diff > NO_BUFFER_RECEIVED_THRESHOLD_MS)
+        if (currentTime - lastCheckTimeMs >= milliseconds(BUFFER_CHECK_PERIOD_MS)) {
+            lastCheckTimeMs = currentTime;
+
+            // We are connected for longer time than NO_BUFFER_RECEIVED_THRESHOLD_MS and
+            // we got no buffers. We try to re-join
+            if (mCurrentChannelConfig.destinationIp != 0)
             {
-                if (!mBufferSourceLost) {
-                    mBufferSourceLost = true;
-                    mSourceLostCounter ++;
-                    *mBufferSrcLostMVar = srcStateToMVar(mBufferSourceLost);
+                if (diff > NO_BUFFER_RECEIVED_RECONFIGURE_THRESHOLD_MS)
+                {
+                    LOG(WARNING) << "Time since last valid buffer : " << diff;
+                    mMessageHandler->pushMessage(NetworkMessage(NetworkMessage::NO_MULTICAST));
+                }
+                else if (diff > NO_BUFFER_RECEIVED_THRESHOLD_MS)
+                {
+                    if (!mBufferSourceLost) {
+                        mBufferSourceLost = true;
+                        mSourceLostCounter ++;
+                        *mBufferSrcLostMVar = srcStateToMVar(mBufferSourceLost);
+                    }
                 }
-                injectNullBuffers();
             }
         }
 
+        if (mBufferSourceLost) {
+            // Rejoin resets mLastValidBufferTimeMs. Keep the running
+            // stuffing period, start a new one only after a channel change.
+            if (!mStuffing.isActive() && diff > NO_BUFFER_RECEIVED_THRESHOLD_MS) {
+                mStuffing.start(std::chrono::duration_cast<microseconds>(
+                        mLastValidBufferTimeMs.load()).count());
+                SLOG(WARNING, LOG_DATA_SRC) << "Source lost. Generating stuffing at "
+                                            << mStuffing.getBitrate() << " bps, PCR PID "
+                                            << mStuffing.getPcrPid();
+            }
+            injectStuffing();
+        } else if (mStuffing.isActive()) {
+            mStuffing.stop();
+            SLOG(INFO, LOG_DATA_SRC) << "Source restored. Stopped stuffing";
+        }
+
     } while (!mExitRequested);
 }
 void MediaSourceHandler::messageLoop() {
@@ -437,22 +628,29 @@ std::string MediaSourceHandler::getChannelStats(int demuxerId) {
     return sess->second->mDemuxer->getChannelStats(false);
 }
 
-void MediaSourceHandler::injectNullBuffers() {
+void MediaSourceHandler::injectStuffing() {
+    uint64_t nowUs = std::chrono::duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+    auto pending = mStuffing.getPendingBytes(nowUs);
+
+    for (int i = 0; pending > 0 && i < STUFFING_MAX_BUFFERS_PER_PERIOD; i++) {
+        // Stuffing never displaces queued stream data, whatever the
+        // overflow policy
+        bq_buffer *buf;
+        if (!mFccBufferQueue.tryAcquire(&buf)) {
+            return;
+        }
+        auto &meta = bq_buffer_meta(buf);
+        meta = {};
 
-    auto injCount = 1;
+        // Time the stuffing stands in for. Back-filled data lies in the past.
+        auto lagUs = nowUs - std::min<uint64_t>(nowUs, mStuffing.getGeneratedTimeUs());
+        meta.ingestTimeUs = bufferMetaTimeNowUs() - lagUs;
+        meta.flags |= BUFFER_FLAG_SOURCE_LOSS;
 
-    for(int i = 0; i < injCount; i ++) {
-       auto buf = acquireBuffer(0);
-       auto* b = (uint8_t* ) buf->buffer;
-       do {
-           b[0] = 0x47;
-           b[1] = 0x00 | 0x1f;
-           b[2] = 0xff;
-           b[3] = 0x10;
-           memset(&b[4], 0x00, TS_PACKAGE_SIZE - 4);
-           b += TS_PACKAGE_SIZE;
-       }   while (b < (uint8_t *) (buf->buffer + buf->size));
+        auto size = (uint32_t) std::min<uint64_t>(pending, buf->capacity);
+        buf->size = mStuffing.fill((uint8_t *) buf->buffer, size);
+        pending -= buf->size;
 
-       pushBuffertoBQ(buf, 0);
+        pushBuffertoBQ(buf, 0);
     }
 }
@@ -20,6 +20,7 @@
 
 #include "StreamParser/BufferIndexer.h"
 #include "StreamParser/ScheduledTask.h"
+#include "StreamParser/PcrTracker.h"
 #include <iostream>
 #include <glog/logging.h>
 
@@ -29,15 +30,37 @@ namespace StreamParser {
 namespace {
     bool byteOffsetSearch (uint64_t target,index_pair current) { return target < current.first; }
     bool timeSearch (uint64_t target,index_pair current) { return target < current.second; }
+
+    uint64_t ticksToUs(uint64_t ticks) { return ticks * 1000000 / PCR_CLOCK_HZ; }
+    uint64_t usToTicks(uint64_t us) { return us * PCR_CLOCK_HZ / 1000000; }
+
+    // Interpolate second from first between the samples a and b
+    uint64_t interpolate(index_pair a, index_pair b, uint64_t first) {
+        if (b.first == a.first) {
+            return a.second;
+        }
+        return a.second + (first - a.first) * (b.second - a.second) / (b.first - a.first);
+    }
+
+    index_pair swapPair(index_pair p) { return std::make_pair(p.second, p.first); }
 }
 
 BufferIndexer::BufferIndexer(uint64_t tsbSize, uint64_t  tailSize, uint8_t samplingRatio)
     : mSamplingRatio(samplingRatio)
     , mBufferCount(0)
     , mTsbSize((tsbSize-tailSize) / samplingRatio)
+    , mMaxTsbSize(mTsbSize)
     , mBufInd(tsbSize / samplingRatio)
     , mLastByteOffsetFromTimeUs(std::make_pair(0,0))
     , mLastTimeUsFromByteOffset(std::make_pair(0,0))
+    , mLastBufferCount(0)
+    , mLastTimestampUs(0)
+    , mMediaInd(tsbSize)
+    , mLastPcr(0)
+    , mLastPcrTimestampUs(0)
+    , mRapInd(tsbSize)
+    , mWindowUs(0)
+    , mWindowCount(UINT64_MAX)
 {
 }
 
@@ -45,20 +68,109 @@ BufferIndexer::~BufferIndexer() {
 }
 
 std::pair<bool, uint64_t> BufferIndexer::registerBufferCount(uint64_t bufferCount) {
-    std::lock_guard<std::mutex> mLock(mIndexMutex);
-
     uint64_t currentTime = std::chrono::duration_cast< std::chrono::microseconds >(
-            std::chrono::high_resolution_clock::now().time_since_epoch()
+            std::chrono::steady_clock::now().time_since_epoch()
     ).count();
 
+    return registerBufferCount(bufferCount, currentTime);
+}
+
+std::pair<bool, uint64_t> BufferIndexer::registerBufferCount(uint64_t bufferCount, uint64_t timestampUs) {
+    std::lock_guard<std::mutex> mLock(mIndexMutex);
+
+    if (!mBufInd.empty() && timestampUs < mBufInd.back().first) {
+        timestampUs = mBufInd.back().first;
+    }
+
+    mLastBufferCount = bufferCount;
+    mLastTimestampUs = timestampUs;
+
     if (mBufferCount++ % mSamplingRatio == 0) {
-        mBufInd.push_back(std::make_pair(currentTime, bufferCount));
+        mBufInd.push_back(std::make_pair(timestampUs, bufferCount));
+        updateTimeWindow();
         return std::make_pair(true, mBufInd.size());
     }
 
     return std::make_pair(false, mBufInd.size());
 }
 
+void BufferIndexer::registerPcr(uint64_t byteIndex, uint64_t pcr, bool discontinuity) {
+    std::lock_guard<std::mutex> mLock(mIndexMutex);
+
+    if (!mMediaInd.empty() && byteIndex <= mMediaInd.back().second) {
+        return;
+    }
+
+    uint64_t ticks = 0;
+    if (!mMediaInd.empty()) {
+        uint64_t delta = (pcr + PCR_WRAP - mLastPcr) % PCR_WRAP;
+        if (discontinuity || delta == 0 || delta > usToTicks(MEDIA_INDEX_MAX_GAP_US)) {
+            // New segment, continue with the arrival time in between
+            delta = usToTicks(mLastTimestampUs - mLastPcrTimestampUs);
+        }
+        ticks = mMediaInd.back().first + delta;
+    }
+
+    mLastPcr = pcr;
+    mLastPcrTimestampUs = mLastTimestampUs;
+    mMediaInd.push_back(std::make_pair(ticks, byteIndex));
+}
+
+void BufferIndexer::registerRandomAccessPoint(uint64_t byteIndex) {
+    std::lock_guard<std::mutex> mLock(mIndexMutex);
+
+    if (!mRapInd.empty() && byteIndex <= mRapInd.back().second) {
+        return;
+    }
+    mRapInd.push_back(std::make_pair(mLastTimestampUs, byteIndex));
+}
+
+BuffErr BufferIndexer::snapToRandomAccessPoint(uint64_t& byteOffset, bool forward) {
+    std::lock_guard<std::mutex> mLock(mIndexMutex);
+
+    if (mBufInd.empty()) {
+        return BUF_EMPTY;
+    }
+
+    if (mRapInd.empty() || byteOffset > mLastBufferCount) {
+        return BUF_OUT_OF_RANGE;
+    }
+
+    uint64_t target = mLastBufferCount - byteOffset;
+    uint64_t frontByte = getFront().second;
+    auto begin = std::lower_bound(mRapInd.begin(), mRapInd.end(), frontByte,
+                                  [](index_pair current, uint64_t t) { return current.second < t; });
+    auto it = std::upper_bound(begin, mRapInd.end(), target, timeSearch);
+
+    if (forward) {
+        if (it != begin && (it - 1)->second == target) {
+            it--;
+        }
+        if (it == mRapInd.end()) {
+            return BUF_OUT_OF_RANGE;
+        }
+    } else {
+        if (it == begin) {
+            return BUF_OUT_OF_RANGE;
+        }
+        it--;
+    }
+
+    // The seek time is not moved by more than a GOP
+    uint64_t targetTimeUs = mBufInd.back().first;
+    auto tsIt = std::upper_bound(mBufInd.begin(), mBufInd.end(), target, timeSearch);
+    if (tsIt != mBufInd.end()) {
+        targetTimeUs = tsIt->first;
+    }
+    uint64_t distanceUs = targetTimeUs > it->first ? targetTimeUs - it->first : it->first - targetTimeUs;
+    if (distanceUs > RAP_MAX_SNAP_US) {
+        return BUF_OUT_OF_RANGE;
+    }
+
+    byteOffset = mLastBufferCount - it->second;
+    return BUF_OK;
+}
+
 BuffErr BufferIndexer::getByteOffsetFromTimeUs(uint64_t time, uint64_t& byteOffset) {
     std::lock_guard<std::mutex> mLock(mIndexMutex);
 
@@ -80,6 +192,11 @@ BuffErr BufferIndexer::getByteOffsetFromTimeUs(uint64_t time, uint64_t& byteOffs
         return BUF_OK;
     }
 
+    if (getByteOffsetFromMediaTimeUs(time, byteOffset)) {
+        mLastByteOffsetFromTimeUs = std::make_pair(time, byteOffset);
+        return BUF_OK;
+    }
+
     // If seek time exceed the capture range, set the byte offset to the
     // maximum byte offset, captured in the buffer.
     if (getFront().first + time > mBufInd.back().first) {
@@ -134,6 +251,11 @@ BuffErr BufferIndexer::getTimeUsFromByteOffset(uint64_t byteOffset, uint64_t& ti
         return BUF_OK;
     }
 
+    if (getMediaTimeUsFromByteOffset(byteOffset, time)) {
+        mLastTimeUsFromByteOffset = std::make_pair(byteOffset, time);
+        return BUF_OK;
+    }
+
     // If byte offset exceed the capture range, set the time to the
     // maximum seek time, captured in the buffer.
     if (getFront().second + byteOffset > mBufInd.back().second) {
@@ -167,6 +289,51 @@ BuffErr BufferIndexer::getTimeUsFromByteOffset(uint64_t byteOffset, uint64_t& ti
     return BUF_OK;
 }
 
+BuffErr BufferIndexer::getByteSizeForTimeUs(uint64_t byteOffset, uint64_t time, uint64_t& size) {
+    std::lock_guard<std::mutex> mLock(mIndexMutex);
+
+    if (mBufInd.empty()) {
+        return BUF_EMPTY;
+    }
+
+    uint64_t startUs;
+    uint64_t endOffset;
+    if (getMediaTimeUsFromByteOffset(byteOffset, startUs)) {
+        if (startUs <= time) {
+            size = byteOffset;
+            return BUF_OK;
+        }
+        if (getByteOffsetFromMediaTimeUs(startUs - time, endOffset)) {
+            size = byteOffset > endOffset ? byteOffset - endOffset : 0;
+            return BUF_OK;
+        }
+    }
+
+    // Arrival time
+    auto begin = mBufInd.begin() + getFrontIndex();
+    if (byteOffset > mLastBufferCount || mLastBufferCount - byteOffset < begin->second) {
+        return BUF_OUT_OF_RANGE;
+    }
+
+    uint64_t byteIndex = mLastBufferCount - byteOffset;
+    auto it = std::upper_bound(begin, mBufInd.end(), byteIndex, timeSearch);
+    if (it == mBufInd.end()) {
+        size = byteOffset;
+        return BUF_OK;
+    }
+
+    uint64_t endTime = interpolate(swapPair(*(it - 1)), swapPair(*it), byteIndex) + time;
+    if (endTime >= mBufInd.back().first) {
+        size = byteOffset;
+        return BUF_OK;
+    }
+
+    auto endIt = std::upper_bound(it - 1, mBufInd.end(), endTime, byteOffsetSearch);
+    uint64_t endIndex = interpolate(*(endIt - 1), *endIt, endTime);
+    size = endIndex > byteIndex ? endIndex - byteIndex : 0;
+    return BUF_OK;
+}
+
 BuffErr BufferIndexer::getTimestampUsForByteIndex(uint64_t byteIndex, uint64_t& time) {
     std::lock_guard<std::mutex> mLock(mIndexMutex);
 
@@ -232,15 +399,90 @@ uint64_t BufferIndexer::getBufferCapacity() {
     return mTsbSize;
 }
 
+void BufferIndexer::resize(uint64_t tsbSize, uint64_t tailSize) {
+    std::lock_guard<std::mutex> lockGuard(mIndexMutex);
+    mTsbSize = (tsbSize - tailSize) / mSamplingRatio;
+    mMaxTsbSize = mTsbSize;
+    mBufInd.set_capacity(tsbSize / mSamplingRatio);
+    mMediaInd.set_capacity(tsbSize);
+    mRapInd.set_capacity(tsbSize);
+    clearIndex();
+}
+
+void BufferIndexer::setWindowSize(uint64_t chunks) {
+    std::lock_guard<std::mutex> lockGuard(mIndexMutex);
+    mTsbSize = std::max<uint64_t>(2, std::min(chunks / mSamplingRatio, mMaxTsbSize));
+}
+
+void BufferIndexer::setWindowTimeUs(uint64_t timeUs) {
+    std::lock_guard<std::mutex> lockGuard(mIndexMutex);
+    mWindowUs = timeUs;
+    updateTimeWindow();
+}
+
+void BufferIndexer::updateTimeWindow() {
+    mWindowCount = UINT64_MAX;
+    if (mWindowUs == 0 || mBufInd.empty()) {
+        return;
+    }
+
+    uint64_t frontByte;
+    uint64_t liveTicks;
+    uint64_t windowTicks = usToTicks(mWindowUs);
+    if (getLiveMediaTicks(liveTicks) && liveTicks >= windowTicks
+        && mMediaInd.front().first <= liveTicks - windowTicks) {
+        auto it = std::lower_bound(mMediaInd.begin(), mMediaInd.end(), liveTicks - windowTicks,
+                                   [](index_pair current, uint64_t target) { return current.first < target; });
+        frontByte = it != mMediaInd.end() ? it->second : mLastBufferCount;
+    } else if (mBufInd.back().first - mBufInd.front().first > mWindowUs) {
+        auto it = std::lower_bound(mBufInd.begin(), mBufInd.end(), mBufInd.back().first - mWindowUs,
+                                   [](index_pair current, uint64_t target) { return current.first < target; });
+        frontByte = it->second;
+    } else {
+        return;
+    }
+
+    auto it = std::lower_bound(mBufInd.begin(), mBufInd.end(), frontByte,
+                               [](index_pair current, uint64_t target) { return current.second < target; });
+    mWindowCount = std::max<uint64_t>(2, std::distance(it, mBufInd.end()));
+}
+
+void BufferIndexer::trimFront(uint64_t byteIndex) {
+    std::lock_guard<std::mutex> lockGuard(mIndexMutex);
+
+    // Samples of each index before byteIndex
+    auto older = [byteIndex](const boost::circular_buffer<index_pair> &ind) {
+        return std::distance(ind.begin(), std::lower_bound(ind.begin(), ind.end(), byteIndex,
+                [](index_pair current, uint64_t target) { return current.second < target; }));
+    };
+    mBufInd.erase_begin(older(mBufInd));
+    mMediaInd.erase_begin(older(mMediaInd));
+    mRapInd.erase_begin(older(mRapInd));
+    updateTimeWindow();
+}
+
 void BufferIndexer::clear() {
     std::lock_guard<std::mutex> lockGuard(mIndexMutex);
+    clearIndex();
+}
+
+void BufferIndexer::clearIndex() {
     mBufferCount = 0;
     mBufInd.clear();
+    mLastByteOffsetFromTimeUs = std::make_pair(0, 0);
+    mLastTimeUsFromByteOffset = std::make_pair(0, 0);
+    mLastBufferCount = 0;
+    mLastTimestampUs = 0;
+    mMediaInd.clear();
+    mLastPcr = 0;
+    mLastPcrTimestampUs = 0;
+    mRapInd.clear();
+    mWindowCount = UINT64_MAX;
 }
 
 inline size_t BufferIndexer::getIndexSize() const{
     uint64_t actualSize = mBufInd.size();
-    return actualSize > mTsbSize ? mTsbSize : actualSize;
+    return std::min(actualSize, std::min(mTsbSize, mWindowCount));
 }
 
 inline size_t BufferIndexer::getFrontIndex() const{
@@ -252,4 +494,71 @@ inline index_pair BufferIndexer::getFront() const{
     return mBufInd[index];
 }
 
+bool BufferIndexer::getLiveMediaTicks(uint64_t& ticks) const {
+    if (mMediaInd.size() < 2 || mLastTimestampUs - mLastPcrTimestampUs > MEDIA_INDEX_MAX_GAP_US) {
+        return false;
+    }
+
+    const auto& last = mMediaInd.back();
+    const auto& prev = mMediaInd[mMediaInd.size() - 2];
+    ticks = interpolate(swapPair(prev), swapPair(last), mLastBufferCount);
+    return true;
+}
+
+boost::circular_buffer<index_pair>::const_iterator BufferIndexer::getMediaFront() const {
+    uint64_t frontByte = getFront().second;
+    return std::lower_bound(mMediaInd.begin(), mMediaInd.end(), frontByte,
+                            [](index_pair current, uint64_t target) { return current.second < target; });
+}
+
+bool BufferIndexer::getByteOffsetFromMediaTimeUs(uint64_t time, uint64_t& byteOffset) const {
+    uint64_t liveTicks;
+    if (mBufInd.empty() || !getLiveMediaTicks(liveTicks) || usToTicks(time) > liveTicks) {
+        return false;
+    }
+
+    uint64_t target = liveTicks - usToTicks(time);
+    const auto& last = mMediaInd.back();
+    uint64_t byteIndex;
+
+    if (target >= last.first) {
+        byteIndex = interpolate(last, std::make_pair(liveTicks, mLastBufferCount), target);
+    } else {
+        auto begin = getMediaFront();
+        if (begin == mMediaInd.end() || target < begin->first) {
+            return false;
+        }
+        auto it = std::upper_bound(begin, mMediaInd.end(), target, byteOffsetSearch);
+        byteIndex = interpolate(*(it - 1), *it, target);
+    }
+
+    byteOffset = mLastBufferCount - byteIndex;
+    return true;
+}
+
+bool BufferIndexer::getMediaTimeUsFromByteOffset(uint64_t byteOffset, uint64_t& time) const {
+    uint64_t liveTicks;
+    if (mBufInd.empty() || !getLiveMediaTicks(liveTicks) || byteOffset > mLastBufferCount) {
+        return false;
+    }
+
+    uint64_t target = mLastBufferCount - byteOffset;
+    const auto& last = mMediaInd.back();
+    uint64_t ticks;
+
+    if (target >= last.second) {
+        ticks = interpolate(swapPair(last), std::make_pair(mLastBufferCount, liveTicks), target);
+    } else {
+        auto begin = getMediaFront();
+        if (begin == mMediaInd.end() || target < begin->second) {
+            return false;
+        }
+        auto it = std::upper_bound(begin, mMediaInd.end(), target, timeSearch);
+        ticks = interpolate(swapPair(*(it - 1)), swapPair(*it), target);
+    }
+
+    time = ticksToUs(liveTicks - ticks);
+    return true;
+}
+
 }
@@ -0,0 +1,121 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE
+ * file the following copyright and licenses apply:
+ *
+ * Copyright (c) 2022 Nuuday.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "StreamParser/ChunkPool.h"
+#include <glog/logging.h>
+#include <algorithm>
+
+namespace StreamParser {
+
+ChunkRef::ChunkRef(const ChunkRef &other) : mSlot(other.mSlot) {
+    if (mSlot != nullptr) {
+        mSlot->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+ChunkRef::ChunkRef(ChunkRef &&other) noexcept : mSlot(other.mSlot) {
+    other.mSlot = nullptr;
+}
+
+ChunkRef &ChunkRef::operator=(const ChunkRef &other) {
+    if (this != &other) {
+        ChunkRef tmp(other);
+        std::swap(mSlot, tmp.mSlot);
+    }
+    return *this;
+}
+
+ChunkRef &ChunkRef::operator=(ChunkRef &&other) noexcept {
+    if (this != &other) {
+        reset();
+        mSlot = other.mSlot;
+        other.mSlot = nullptr;
+    }
+    return *this;
+}
+
+ChunkRef::~ChunkRef() {
+    reset();
+}
+
+void ChunkRef::reset() {
+    if (mSlot == nullptr) {
+        return;
+    }
+
+    if (mSlot->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        // The local owner keeps the pool alive until the slot is back
+        auto owner = std::move(mSlot->owner);
+        owner->release(mSlot);
+    }
+    mSlot = nullptr;
+}
+
+std::shared_ptr<ChunkPool> ChunkPool::create(size_t initialSize, size_t maxSize) {
+    return std::shared_ptr<ChunkPool>(new ChunkPool(initialSize, maxSize));
+}
+
+ChunkPool::ChunkPool(size_t initialSize, size_t maxSize) : mMaxSize(std::max<size_t>(maxSize, 1)) {
+    for (size_t i = 0; i < initialSize && i < mMaxSize; i++) {
+        mSlots.emplace_back(new ChunkSlot());
+        mFree.push_back(mSlots.back().get());
+    }
+}
+
+ChunkRef ChunkPool::acquire() {
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    if (mFree.empty() && mSlots.size() < mMaxSize) {
+        mSlots.emplace_back(new ChunkSlot());
+        mFree.push_back(mSlots.back().get());
+        if (mSlots.size() == mMaxSize) {
+            LOG(WARNING) << "Chunk pool reached maximum size: " << mMaxSize;
+        }
+    }
+
+    mFreeCond.wait(lock, [this]() { return !mFree.empty(); });
+
+    auto slot = mFree.back();
+    mFree.pop_back();
+    lock.unlock();
+
+    slot->owner = shared_from_this();
+    slot->refs.store(1, std::memory_order_relaxed);
+    return ChunkRef(slot);
+}
+
+void ChunkPool::release(ChunkSlot *slot) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mFree.push_back(slot);
+    }
+    mFreeCond.notify_one();
+}
+
+size_t ChunkPool::getAllocatedCount() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mSlots.size();
+}
+
+size_t ChunkPool::getFreeCount() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mFree.size();
+}
+
+} //namespace StreamParser
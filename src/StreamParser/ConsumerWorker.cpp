@@ -0,0 +1,234 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE
+ * file the following copyright and licenses apply:
+ *
+ * Copyright (c) 2022 Nuuday.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "StreamParser/ConsumerWorker.h"
+#include <glog/logging.h>
+#include <algorithm>
+#include <chrono>
+
+namespace StreamParser {
+
+ConsumerWorker::ConsumerWorker(std::shared_ptr<StreamConsumer> consumer, size_t queueSize)
+        : mConsumer(std::move(consumer)),
+          mPolicy(mConsumer->getQueuePolicy()),
+          mSlots(queueSize > 0 ? queueSize : 1) {
+    mStats.name = mConsumer->getName();
+    mStats.policy = mPolicy;
+    mStats.capacity = mSlots.size();
+    mThread = std::thread(&ConsumerWorker::threadLoop, this);
+}
+
+ConsumerWorker::~ConsumerWorker() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mExitRequested = true;
+    }
+    mDataCond.notify_all();
+    mSpaceCond.notify_all();
+
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+}
+
+ConsumerWorker::Item *ConsumerWorker::reserveSlot(std::unique_lock<std::mutex> &lock) {
+    waitForSpace(lock, [this]() { return mCount < mSlots.size() || mExitRequested; });
+
+    if (mExitRequested) {
+        return nullptr;
+    }
+
+    return &mSlots[(mHead + mCount) % mSlots.size()];
+}
+
+void ConsumerWorker::post(const Buffer &buf) {
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    if (mCount == mSlots.size()) {
+        if (mPolicy == QueuePolicy::LOSSY) {
+            if (mStats.dropped++ == 0) {
+                LOG(WARNING) << mStats.name << " queue full, dropping buffers";
+            }
+            mPendingDiscontinuity = true;
+            return;
+        }
+        auto start = std::chrono::steady_clock::now();
+        reserveSlot(lock);
+        mStats.blockedCount++;
+        mStats.blockedTimeUs += std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+    }
+
+    auto item = reserveSlot(lock);
+
+    if (item == nullptr) {
+        return;
+    }
+
+    item->type = ItemType::DATA;
+    item->hasChannel = buf.channelInfo != nullptr;
+    if (item->hasChannel) {
+        // Reuses the slot's string capacity
+        item->channel.assign(buf.channelInfo);
+    }
+    item->ref = buf.ref;
+    item->meta = buf.meta;
+    if (mPendingDiscontinuity) {
+        item->meta.flags |= BUFFER_FLAG_DISCONTINUITY;
+        mPendingDiscontinuity = false;
+    }
+
+    commitSlot(lock);
+}
+
+void ConsumerWorker::queueEvent(ItemType type, const char *channelId) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    auto item = reserveSlot(lock);
+
+    if (item == nullptr) {
+        return;
+    }
+
+    item->type = type;
+    item->hasChannel = channelId != nullptr;
+    if (item->hasChannel) {
+        item->channel.assign(channelId);
+    }
+
+    commitSlot(lock);
+}
+
+void ConsumerWorker::commitSlot(std::unique_lock<std::mutex> &lock) {
+    // The worker only waits with an empty queue
+    bool wakeup = mCount++ == 0;
+    mStats.maxDepth = std::max(mStats.maxDepth, mCount);
+    lock.unlock();
+
+    if (wakeup) {
+        mDataCond.notify_one();
+    }
+}
+
+template<class Predicate>
+void ConsumerWorker::waitForSpace(std::unique_lock<std::mutex> &lock, Predicate pred) {
+    if (!pred()) {
+        mSpaceWaiters++;
+        mSpaceCond.wait(lock, pred);
+        mSpaceWaiters--;
+    }
+}
+
+void ConsumerWorker::onEndOfStream(const char *channelId) {
+    queueEvent(ItemType::END_OF_STREAM, channelId);
+}
+
+void ConsumerWorker::onOpen(const char *channelId) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        // Keep the item in progress and the stream events. Events
+        // are few and must reach the consumer in order.
+        size_t kept = mCount > 0 ? 1 : 0;
+        size_t dropped = 0;
+        for (size_t i = 1; i < mCount; i++) {
+            auto &src = mSlots[(mHead + i) % mSlots.size()];
+            if (src.type == ItemType::DATA) {
+                src.ref.reset();
+                dropped++;
+                continue;
+            }
+            auto &dst = mSlots[(mHead + kept) % mSlots.size()];
+            if (&dst != &src) {
+                std::swap(dst.type, src.type);
+                std::swap(dst.hasChannel, src.hasChannel);
+                std::swap(dst.channel, src.channel);
+            }
+            kept++;
+        }
+        mCount = kept;
+        // The next channel starts without a gap
+        mPendingDiscontinuity = false;
+
+        if (dropped > 0) {
+            LOG(INFO) << "Discarded " << dropped << " queued chunks";
+            if (mSpaceWaiters > 0) {
+                mSpaceCond.notify_all();
+            }
+        }
+    }
+
+    queueEvent(ItemType::OPEN, channelId);
+}
+
+void ConsumerWorker::join() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    waitForSpace(lock, [this]() { return mCount == 0 || mExitRequested; });
+}
+
+ConsumerQueueStats ConsumerWorker::getStats() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto stats = mStats;
+    stats.depth = mCount;
+    return stats;
+}
+
+void ConsumerWorker::threadLoop() {
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    while (true) {
+        mDataCond.wait(lock, [this]() { return mCount > 0 || mExitRequested; });
+
+        if (mExitRequested) {
+            break;
+        }
+
+        // The slot stays reserved until processed
+        auto &item = mSlots[mHead];
+        if (item.type == ItemType::DATA && item.meta.ingestTimeUs != 0) {
+            auto now = bufferMetaTimeNowUs();
+            mStats.lagUs = now > item.meta.ingestTimeUs ? now - item.meta.ingestTimeUs : 0;
+            mStats.maxLagUs = std::max(mStats.maxLagUs, mStats.lagUs);
+        }
+        lock.unlock();
+
+        const char *channel = item.hasChannel ? item.channel.c_str() : nullptr;
+        switch (item.type) {
+            case ItemType::DATA:
+                mConsumer->post({channel, item.ref.get(), item.meta, item.ref});
+                mConsumer->join();
+                // Return the chunk to the pool once no longer used
+                item.ref.reset();
+                break;
+            case ItemType::END_OF_STREAM:
+                mConsumer->onEndOfStream(channel);
+                break;
+            case ItemType::OPEN:
+                mConsumer->onOpen(channel);
+                break;
+        }
+
+        lock.lock();
+        mHead = (mHead + 1) % mSlots.size();
+        mCount--;
+        if (mSpaceWaiters > 0) {
+            mSpaceCond.notify_all();
+        }
+    }
+}
+
+} //namespace StreamParser
@@ -20,6 +20,7 @@
 
 #include "StreamParser/PSIParser.h"
 #include "StreamParser/StreamProtectionConfig.h"
+#include "ChannelConfig.h"
 #include <glog/logging.h>
 #include <confighandler/ConfigHandler.h>
 #include <iostream>
@@ -45,36 +46,32 @@ std::string toHexString(const ByteVectorType &bArray) {
 namespace StreamParser {
 
 PSIParser::~PSIParser() {
-    LOG(INFO) << "Destroy PSI parser";
-    mExitParserThread = true;
-    joinParserThread();
+    LOG(INFO) << "Destroy PSI parser. Processed buffers: " << mPacketCounter
+              << " skipped packets: " << mSkippedPackets;
 }
 
 void PSIParser::post(const StreamParser::Buffer &buf) {
-
-    // Delayed start of parser thread.
-    if (mParserThread == nullptr) {
-        mParserThread = std::make_unique<std::thread>(&PSIParser::threadLoop, this);
-    }
-
     if (buf.channelInfo == nullptr) {
         SLOG(INFO, LOG_DATA_SRC) << " Invalid channel info";
         return;
     }
 
-    std::lock_guard<std::mutex> lockGuard(mStreamMtx);
+    {
+        std::lock_guard<std::mutex> lockGuard(mStreamMtx);
 
-    if (buf.channelInfo != mChannel) {
-        clearQueue();
-        mChannel = buf.channelInfo;
+        if (buf.channelInfo != mChannel) {
+            mChannel = buf.channelInfo;
+            mPacketCounter = 0;
+        }
     }
 
-    if (mPsiParserRunning) {
-        mQueue.push(*buf.chunk);
-    }
-}
+    // Parsing continues after drm0 is set to follow PSI changes. Only
+    // PSI PIDs are parsed and repeated sections are skipped unparsed.
 
-void PSIParser::join() {
+    // Called on the StreamProcessor worker thread of this consumer
+    std::lock_guard<std::mutex> lockGuard(mConsumerMtx);
+    mPacketCounter++;
+    processChunk(*buf.chunk, buf.meta);
 }
 
 void PSIParser::notifyConfigurationChanged(const std::string &var, const ByteVectorType &value) {
@@ -86,58 +83,43 @@ void PSIParser::notifyConfigurationChanged(const std::string &var, const ByteVec
     }
 }
 
-void PSIParser::clearQueue() {
-    std::lock_guard<std::mutex> lockGuard(mConsumerMtx);
-    buffer_chunk chunk;
-    unsigned int i = 0;
-    while (mQueue.pop(chunk)) {
-        i++;
-        //Pop all data from the queue and ignore it
-    };
-
-    mPacketCounter = 0;
-    LOG(INFO) << "Discarded " << i << " chunks";
-}
-
-void PSIParser::threadLoop() {
-    buffer_chunk chunk;
-    while (!mExitParserThread) {
-
-        while (!mQueue.pop(chunk)) {
-            //TODO: We are using a non-blocking queue.
-            // Investigate if notify would be a better option here.
-            // We are not in hurry of processing the data on this thread
-            // it doesn't affect the channel switch time and getting an ECM
-            // may take seconds anyway.
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            if (mExitParserThread)
-                return;
-        }
-        if (mExitParserThread)
-            return;
-
-        mPacketCounter++;
-        processChunk(chunk);
+void PSIParser::processChunk(const buffer_chunk &array, const BufferMeta &meta) {
+    if (meta.flags & BUFFER_FLAG_DISCONTINUITY) {
+        // A section spanning the gap can not be completed
+        std::lock_guard<std::mutex> lockGuard(mPidInfoMtx);
+        resetSections();
     }
-    LOG(INFO) << "Exiting. Processed buffers: " << mPacketCounter << " exit thread: " << mExitParserThread;
-}
 
-void PSIParser::processChunk(const buffer_chunk &array) {
+    // The chunk is only referenced while processed here
     if (mTsStream.needsNewChunk()) {
-        mTsStream.insertChunk(array);
+        mTsStream.attachChunk(array);
     } else {
         LOG(ERROR) << "Continuity error, unable to insert array";
     }
 
-    static StreamPacketT packet;
+    const unsigned char *packet;
     TSStream::TSDataError state;
 
     while ((state = mTsStream.getNextPacket(packet)) != TSStream::TSDataError::NOT_ENOUGH_DATA) {
         if (state == TSStream::TSDataError::DATA_CC_ERROR) {
             LOG(INFO) << "Continuity error";
+            // Drop the rest of the chunk, it is not referenced after return
+            mTsStream.reset();
             break;
         }
-        switch (parseTsPacket(packet)) {
+        // Elementary stream packets need no parsing
+        if (mPidTable[GET_PID(packet)] == 0) {
+            mSkippedPackets++;
+            continue;
+        }
+
+        auto action = parseTsPacket(packet);
+        {
+            std::lock_guard<std::mutex> lockGuard(mPidInfoMtx);
+            updatePidTable();
+        }
+
+        switch (action) {
             case ERROR:
                 break;
             case IGNORE:
@@ -149,60 +131,104 @@ void PSIParser::processChunk(const buffer_chunk &array) {
             case DECRYPT_EVEN:
                 break;
             case NEW_ECM:
-            case NEW_ECMT:
             case NEW_PAT_PMT:
+                recordZapTiming(action);
                 // Set drm0 one time after channel switch if not already set in NokiaSocketCbHandler
                 if (mPsiParserRunning) {
-                    *mDrm = StreamProtectionConfig(StreamProtectionConfig::ConfidenceTypes::HIGH,
-                                                   mChannel,
-                                                   getCurrentEcm(),
-                                                   getCurrentPat(),
-                                                   getCurrentPmt(),
-                                                   mIsClearStream);
+                    publishProtectionConfig();
                     mPsiParserRunning = false;
                 }
-
-                LOG(INFO) << "Current ecm: " << toHexString(getCurrentEcm());
-                LOG(INFO) << "Current pmt: " << toHexString(getCurrentPmt());
-                LOG(INFO) << "Current pat: " << toHexString(getCurrentPat());
                 break;
         }
+
+        // Wait for the ECM of a new ECM PID before publishing a change
+        if (mPsiChanged && (mIsClearStream || ecmProcessed())) {
+            LOG(INFO) << "PMT changed, updating protection info";
+            mPsiChanged = false;
+            publishProtectionConfig();
+            *mPmtVar = getCurrentPmt();
+            *mPatVar = getCurrentPat();
+        }
     }
 }
 
+void PSIParser::publishProtectionConfig() {
+    *mDrm = StreamProtectionConfig(StreamProtectionConfig::ConfidenceTypes::HIGH,
+                                   mChannel,
+                                   getCurrentEcm(),
+                                   getCurrentPat(),
+                                   getCurrentPmt(),
+                                   mIsClearStream);
+
+    LOG(INFO) << "Current ecm: " << toHexString(getCurrentEcm());
+    LOG(INFO) << "Current pmt: " << toHexString(getCurrentPmt());
+    LOG(INFO) << "Current pat: " << toHexString(getCurrentPat());
+}
+
 bool PSIParser::TSStream::insertChunk(const buffer_chunk &chunk) {
-    if (mCircBuf.size() == 2)
+    if (mCount == 2)
         return false;
-    else {
-        mCircBuf.push_back(chunk);
+
+    // Use the copy storage not referenced by the queued chunk
+    auto &copy = (mCount == 1 && mChunks[0] == mCopies[0].get()) ? mCopies[1] : mCopies[0];
+    if (copy == nullptr) {
+        copy = std::make_unique<buffer_chunk>();
     }
+    *copy = chunk;
+
+    return attachChunk(*copy);
+}
+
+bool PSIParser::TSStream::attachChunk(const buffer_chunk &chunk) {
+    if (mCount == 2)
+        return false;
+
+    mChunks[mCount++] = &chunk;
     return true;
 }
 
-PSIParser::TSStream::TSDataError
-PSIParser::TSStream::getNextPacket(StreamPacketT &packet) {
+void PSIParser::TSStream::popChunk() {
+    mChunks[0] = mChunks[1];
+    mChunks[1] = nullptr;
+    mCount--;
+    mPointer = 0;
+}
+
+void PSIParser::TSStream::reset() {
+    mChunks = {};
+    mCount = 0;
+    mPointer = 0;
+    mScratchLen = 0;
+}
 
-    if (mCircBuf.size() == 0 ||
-        (mCircBuf.size() == 1 && (BUFFER_CHUNK_SIZE - mPointer) < TS_PACKAGE_SIZE)) {
+PSIParser::TSStream::TSDataError
+PSIParser::TSStream::getNextPacket(const unsigned char *&packet) {
+    if (mCount == 0) {
         return NOT_ENOUGH_DATA;
     }
 
-    if (BUFFER_CHUNK_SIZE - mPointer >= TS_PACKAGE_SIZE) {
-        std::copy(mCircBuf[0].begin() + mPointer, mCircBuf[0].begin() + mPointer + TS_PACKAGE_SIZE, packet.begin());
-        mPointer += TS_PACKAGE_SIZE;
+    const unsigned char *data = mChunks[0]->data();
 
-        if (mPointer == BUFFER_CHUNK_SIZE) {
-            mCircBuf.pop_front();
-            mPointer = 0;
-        }
-
-    } else {
-        auto firstSeq = BUFFER_CHUNK_SIZE - mPointer;
-        auto secondSeq = TS_PACKAGE_SIZE - firstSeq;
-        std::copy(mCircBuf[0].begin() + mPointer, mCircBuf[0].begin() + mPointer + firstSeq, packet.begin());
-        std::copy(mCircBuf[1].begin(), mCircBuf[1].begin() + secondSeq, packet.begin() + firstSeq);
+    if (mScratchLen > 0) {
+        // Complete the packet started in the previous chunk
+        auto secondSeq = TS_PACKAGE_SIZE - mScratchLen;
+        memcpy(mScratch.data() + mScratchLen, data, secondSeq);
+        mScratchLen = 0;
         mPointer = secondSeq;
-        mCircBuf.pop_front();
+        packet = mScratch.data();
+    } else if (BUFFER_CHUNK_SIZE - mPointer >= TS_PACKAGE_SIZE) {
+        packet = data + mPointer;
+        mPointer += TS_PACKAGE_SIZE;
+    } else {
+        // Keep the packet head, the chunk may be released
+        mScratchLen = BUFFER_CHUNK_SIZE - mPointer;
+        memcpy(mScratch.data(), data + mPointer, mScratchLen);
+        popChunk();
+        return getNextPacket(packet);
+    }
+
+    if (mPointer == BUFFER_CHUNK_SIZE) {
+        popChunk();
     }
 
     if (packet[0] != 0x47)
@@ -211,6 +237,25 @@ PSIParser::TSStream::getNextPacket(StreamPacketT &packet) {
     return OK;
 }
 
+PSIParser::TSStream::TSDataError
+PSIParser::TSStream::getNextPacket(StreamPacketT &packet) {
+    const unsigned char *view;
+    auto state = getNextPacket(view);
+
+    if (state != NOT_ENOUGH_DATA) {
+        memcpy(packet.data(), view, TS_PACKAGE_SIZE);
+    }
+    return state;
+}
+
+void PidInfo::setSection(const unsigned char *section, size_t available) {
+    size_t len = available;
+    if (available >= 3) {
+        len = std::min<size_t>(available, 3 + (((section[1] & 0x0F) << 8) | section[2]));
+    }
+    mSection.assign(section, section + len);
+}
+
 bool PidInfo::setPid(unsigned pid) {
     if (mPidValid)
         return false;
@@ -231,7 +276,8 @@ void PidInfo::reset() {
     mVersion = 0;
     mVersionValid = false;
     mPidValid = false;
-    mTsPacket.fill({0});
+    mSection.clear();
+    mAssembler.reset();
 }
 
 bool PidInfo::isNew(unsigned v) {
@@ -259,20 +305,37 @@ unsigned PidInfo::getPid() {
 }
 
 
-PSIParser::ParserActionT PSIParser::parseTsPacket(const StreamPacketT &packet) {
+void PSIParser::updatePidTable() {
+    PidTableT pids{mPat.getPid(), mCat.getPid(), mPmt.getPid(), mEcm.getPid()};
+
+    if (pids == mTablePids)
+        return;
+
+    for (auto pid: mTablePids) {
+        if (pid <= PSI_MAX_PID)
+            mPidTable[pid] = 0;
+    }
+    for (auto pid: pids) {
+        if (pid <= PSI_MAX_PID)
+            mPidTable[pid] = 1;
+    }
+    mTablePids = pids;
+}
+
+PSIParser::ParserActionT PSIParser::parseTsPacket(const unsigned char *packet) {
     PSIParser::ParserActionT action;
     unsigned pid = GET_PID(packet);
 
     std::lock_guard<std::mutex> lockGuard(mPidInfoMtx);
     if (mPat.isPid(pid)) {
-        action = parsePat(packet);
+        action = parseSections(mPat, packet, &PSIParser::parsePat);
         if ((mParserState == PSIParser::NEEDS_PAT) && patProcessed() && hasPmtPid())
             mParserState = PSIParser::NEEDS_PMT;
         return action;
     }
 
     if (mPmt.isPid(pid)) {
-        action = parsePmt(packet);
+        action = parseSections(mPmt, packet, &PSIParser::parsePmt);
         if (!pmtProcessed())
             return action;
 
@@ -302,60 +365,79 @@ PSIParser::ParserActionT PSIParser::parseTsPacket(const StreamPacketT &packet) {
         return action;
     }
     if (mEcm.isPid(pid)) {
-        action = parseEcm(packet);
+        action = parseSections(mEcm, packet, &PSIParser::parseEcm);
         if ((mParserState == PSIParser::NEEDS_PMT) && ecmProcessed())
             mParserState = PSIParser::GOT_ECM;
         return action;
     }
 
+    if (mCat.isPid(pid)) {
+        return parseSections(mCat, packet, &PSIParser::parseCat);
+    }
+
     action = ParseOther(packet);
 
     return action;
 }
 
-PSIParser::ParserActionT PSIParser::parsePat(const StreamPacketT &packet) {
+PSIParser::ParserActionT PSIParser::parseSections(PidInfo &pidInfo, const unsigned char *packet,
+                                                  SectionParserT parser) {
+    // Several sections may complete in one packet, report the most significant action
+    PSIParser::ParserActionT rv = PSIParser::IGNORE;
+    auto &assembler = pidInfo.assembler();
+    const unsigned char *section;
+    size_t length;
+
+    assembler.push(packet);
+    while (assembler.nextSection(section, length)) {
+        rv = std::max(rv, (this->*parser)(section, length));
+    }
+    return rv;
+}
+
+PSIParser::ParserActionT PSIParser::parsePat(const unsigned char *section, size_t length) {
     PSIParser::ParserActionT rv = PSIParser::ERROR;
     do {
-        if (!mPat.isPid(GET_PID(packet))) {
-            LOG(INFO) << "Ignore pat";
-            break;
-        }
-
-        unsigned offs;
-
-        if ((packet[3] & 0x30) == 0x30)
-            offs = packet[4] + 1;
-        else
-            offs = packet[4];
-
-        if (offs > 184) {
-            LOG(INFO) << "Invalid TS packet size";
+        if (section[0] != 0x0) {
+            LOG(INFO) << "Wrong header";
             break;
         }
 
-        if (packet[offs + 5] != 0x0) {
-            LOG(INFO) << "Wrong header";
+        if (length < PSI_SECTION_MIN_SIZE) {
+            LOG(INFO) << "Invalid PAT size";
             break;
         }
 
-        unsigned version = (packet[offs + 10] & 0x3E) >> 1;
+        unsigned version = (section[5] & 0x3E) >> 1;
         if (mPat.isNew(version)) {
             mPmt.reset();
             mEcm.reset();
             mPat.setVer(version);
-            int pgm = ((packet[offs + 13] << 8) + packet[offs + 14]) & 0x1FFF;
-            unsigned pmtPid;
-
-            if (pgm == 0)
-                pmtPid = ((packet[offs + 17] << 8) + packet[offs + 18]) & 0x1FFF;
-            else
-                pmtPid = ((packet[offs + 15] << 8) + packet[offs + 16]) & 0x1FFF;
+            mPrograms.clear();
+
+            unsigned firstPmtPid = PSI_INVALID_PID;
+            for (size_t p = 8; p + 4 <= length - 4; p += 4) {
+                unsigned pgm = (section[p] << 8) + section[p + 1];
+                unsigned pid = ((section[p + 2] << 8) + section[p + 3]) & 0x1FFF;
+                // program_number 0 carries the network PID
+                if (pgm == 0)
+                    continue;
+                if (firstPmtPid == PSI_INVALID_PID)
+                    firstPmtPid = pid;
+                mPrograms[pgm] = pid;
+            }
 
-            mPmt.setPid(pmtPid);
+            if (mServiceId == 0) {
+                mPmt.setPid(firstPmtPid);
+            } else if (mPrograms.count(mServiceId)) {
+                mPmt.setPid(mPrograms[mServiceId]);
+            } else {
+                LOG(ERROR) << "Service " << mServiceId << " not found in PAT version " << version;
+            }
 
-            StreamPacketT pOut;
-            std::copy(packet.data() + 5, packet.data() + packet.size(), pOut.begin());
-            mPat.setPacket(pOut);
+            LOG(INFO) << "PAT version: " << version << " programs: " << mPrograms.size()
+                      << " selected PMT PID: " << mPmt.getPid();
+            mPat.setSection(section, length);
         }
         rv = PSIParser::IGNORE;
 
@@ -364,58 +446,69 @@ PSIParser::ParserActionT PSIParser::parsePat(const StreamPacketT &packet) {
     return rv;
 }
 
-PSIParser::ParserActionT PSIParser::parsePmt(const StreamPacketT &packet) {
+PSIParser::ParserActionT PSIParser::parseCat(const unsigned char *section, size_t length) {
+    if (section[0] != 0x1 || length < PSI_SECTION_MIN_SIZE) {
+        LOG(INFO) << "Wrong header";
+        return PSIParser::ERROR;
+    }
+
+    unsigned version = (section[5] & 0x3E) >> 1;
+    if (mCat.isNew(version)) {
+        mCat.setVer(version);
+        mCat.setSection(section, length);
+
+        const unsigned char *descP = section + 8;
+        const unsigned char *end = section + length - 4;
+        while (descP + 2 <= end && descP + descP[1] + 2 <= end) {
+            if (descP[0] == 0x09 && descP[1] >= 4 && descP[2] == 0x56 && descP[3] == 0x01) {
+                LOG(INFO) << "CAT version: " << version
+                          << " EMM PID: " << (((descP[4] << 8) + descP[5]) & 0x1FFF);
+            }
+            descP += descP[1] + 2;
+        }
+    }
+    return PSIParser::IGNORE;
+}
+
+PSIParser::ParserActionT PSIParser::parsePmt(const unsigned char *section, size_t length) {
     PSIParser::ParserActionT rv = PSIParser::ERROR;
     bool descriptorFound = false;
     do {
-        if (!mPmt.isPid(GET_PID(packet))) {
-            LOG(INFO) << "Not a PID";
+        if (section[0] != 0x2) {
+            LOG(INFO) << "Wrong header";
             break;
         }
 
-        unsigned offs = 0;
-
-        if ((packet[3] & 0x30) == 0x30)
-            offs = packet[4] + 1;
-
-        if (offs > 184) {
+        if (length < PSI_SECTION_MIN_SIZE + 4) {
             LOG(INFO) << "Wrong size";
             break;
         }
 
-        if (packet[offs + 5] != 0x2) {
-            LOG(INFO) << "Wrong header";
-            break;
-        }
-
-        unsigned int section_len = ((packet[offs + 6] << 8) + packet[offs + 7]) & 0xFFF;
-        unsigned descriptorLen = ((packet[offs + 15] << 8) + packet[offs + 16]) & 0x0FFF;
+        unsigned descriptorLen = ((section[10] << 8) + section[11]) & 0x0FFF;
 
-        unsigned pLen = descriptorLen;
+        // Descriptors and stream loop end before the CRC
+        const unsigned char *end = section + length - 4;
+        const unsigned char *descP = section + 12;
 
-        if (pLen > section_len) {
-            LOG(ERROR) << "Invalid descriptor field length: " << pLen << " section size = " << section_len;
+        if (descP + descriptorLen > end) {
+            LOG(ERROR) << "Invalid descriptor field length: " << descriptorLen << " section size = " << length;
             return rv;
         }
 
-        auto remSectBytes = section_len - 9;
-
-        unsigned version = (packet[offs + 10] & 0x3E) >> 1;
+        unsigned version = (section[5] & 0x3E) >> 1;
 
         if (mPmt.isNew(version)) {
             mPmt.setVer(version);
 
-            const unsigned char *descP = packet.data() + offs + 17;
+            const unsigned char *descEnd = descP + descriptorLen;
 
-            remSectBytes -= pLen;
-
-            while (pLen > 0) {
-                if ((descP[1] + 2) > TS_PACKAGE_SIZE) {
+            while (descP + 2 <= descEnd) {
+                unsigned dtLen = descP[1] + 2;
+                if (descP + dtLen > descEnd) {
                     return PSIParser::IGNORE;
                 }
 
-                unsigned dtLen = descP[1] + 2;
-                if (descP[0] == 0x09) {
+                if (descP[0] == 0x09 && dtLen >= CA_DESC_LEN) {
                     if ((descP[2] == 0x56) && (descP[3] == 0x01)) {
                         descriptorFound = true;
                         bool accepted = false;
@@ -437,84 +530,62 @@ PSIParser::ParserActionT PSIParser::parsePmt(const StreamPacketT &packet) {
                             if (!mEcm.isPid(ecmPid)) {
                                 mEcm.reset();
                                 mEcm.setPid(ecmPid);
-                                StreamPacketT pOut = packet;
-                                std::copy(packet.begin() + 5, packet.end(), pOut.begin());
-                                mEcm.setPacket(pOut);
                             }
+                            // Every new PMT version is published, keep it even if the ECM PID is unchanged
+                            mEcm.setSection(section, length);
                             break;
                         }
                     }
                 }
-                pLen -= dtLen;
                 descP += dtLen;
             }
 
-            // Offset of stream_loop section
-            const unsigned char *streamLoopOffs = packet.data() + offs + 17 + descriptorLen;
-
-            unsigned p = 0;
             // The ECM PID may be in the stream_type loop
-            //
-            while (remSectBytes > 4) {
+            const unsigned char *streamP = descEnd;
+            bool ecmPidSet = false;
 
-                auto descr = streamLoopOffs[p]; //[= ITU-T Rec. H.222.0 | ISO/IEC 13818-1 reserved]
-                UNUSED(descr);
-                p++;
+            while (!ecmPidSet && streamP + 5 <= end) {
                 // TODO: Check that we extract the CA info from the video stream
                 // Since there is a range of codecs, we need to do multiple checks here.
                 // Audio stream may have CA info too.
-
-                // Stream PID
-                p += 2;
-
-                auto es_info_length = ((streamLoopOffs[p] << 8) + streamLoopOffs[p + 1]) & 0xFFF;
-                p += 2;
+                unsigned esInfoLength = ((streamP[3] << 8) + streamP[4]) & 0xFFF;
+                const unsigned char *esDesc = streamP + 5;
+                const unsigned char *esEnd = std::min(esDesc + esInfoLength, end);
 
                 // 0x09 - CA_descriptor
                 // 0x5601 - VMX identifier
-                auto desc_offset = 0;
-                bool ecmPidSet = false;
-                while ( desc_offset <= (es_info_length - 6)) {
-                    const auto desc_idx = p + desc_offset;
-                    if ((streamLoopOffs[desc_idx] == 0x9)
-                            && (streamLoopOffs[desc_idx + 2] == 0x56)
-                            && (streamLoopOffs[desc_idx + 3] == 0x01)) {
+                while (esDesc + CA_DESC_LEN <= esEnd) {
+                    if ((esDesc[0] == 0x9) && (esDesc[2] == 0x56) && (esDesc[3] == 0x01)) {
                         descriptorFound = true;
 
-                        auto ecmPid = ((streamLoopOffs[desc_idx + 4] << 8) + streamLoopOffs[desc_idx + 5]) & 0x1FFF;
+                        auto ecmPid = ((esDesc[4] << 8) + esDesc[5]) & 0x1FFF;
 
                         if (!mEcm.isPid(ecmPid)) {
                             mEcm.reset();
                             mEcm.setPid(ecmPid);
-                            StreamPacketT pOut;
-                            std::copy(packet.data() + 5, packet.data() + packet.size(), pOut.begin());
-                            mEcm.setPacket(pOut);
-                            ecmPidSet = true;
-                            break;
                         }
+                        mEcm.setSection(section, length);
+                        ecmPidSet = true;
+                        break;
                     }
-                    desc_offset += streamLoopOffs[ desc_idx + 1] + 2;
+                    esDesc += esDesc[1] + 2;
                 }
-                if (ecmPidSet) {
-                    break;
-                }
-                p += es_info_length;
-                remSectBytes -= es_info_length + 5;
+                streamP += 5 + esInfoLength;
             }
 
-            // Stream Type extractor
-
             mIsClearStream = !descriptorFound;
 
             rv = PSIParser::IGNORE;
 
             if (mIsClearStream) {
                 rv = PSIParser::NEW_PAT_PMT;
-                StreamPacketT pOut = packet;
-                std::copy(packet.begin() + 5, packet.end(), pOut.begin());
-                mPmt.setPacket(pOut);
+                mPmt.setSection(section, length);
                 *mIsCdmSetupDone = true;
             }
+
+            // The first PMT after open is the baseline for change detection
+            mPsiChanged = mPmtBaseline;
+            mPmtBaseline = true;
         }
 
     } while (false);
@@ -522,132 +593,44 @@ PSIParser::ParserActionT PSIParser::parsePmt(const StreamPacketT &packet) {
     return rv;
 }
 
-PSIParser::ParserActionT PSIParser::parseEcm(const StreamPacketT &packet) {
+PSIParser::ParserActionT PSIParser::parseEcm(const unsigned char *section, size_t length) {
     PSIParser::ParserActionT rv = PSIParser::ERROR;
     static int ecmCount = 0, dupEcmCount = 0;
     do {
-        if (!mEcm.isPid(GET_PID(packet)))
-            break;
-
-        if (mEcmCollectionInProgress)
-            return collectEcm(packet);
-
-        unsigned a = 0;
-        if ((packet[3] & 0x30) == 0x30)
-            a = packet[4] + 1;
-
-        if (a > 184)
-            break;
-
-        const unsigned char *table = packet.data() + 5 + a;
-        unsigned remainingBytes = TS_PACKAGE_SIZE - (5 + a);
-        if (remainingBytes < 13) {
-            LOG(WARNING) << "Invalid packet size.";
+        if (length < 13) {
+            LOG(WARNING) << "Invalid section size.";
             break;
         }
 
-        unsigned version = (table[5] & 0x3E) >> 1;
+        unsigned version = (section[5] & 0x3E) >> 1;
 
-        if (!((table[0] == 0x80) || (table[0] == 0x81))) {
-            LOG(WARNING) << "Invalid version info " << (int) table[0];
+        if (!((section[0] == 0x80) || (section[0] == 0x81))) {
+            LOG(WARNING) << "Invalid version info " << (int) section[0];
             break;
         }
 
-        if (strncmp((const char *) (table + 8), "VMECM", 5)) {
+        if (strncmp((const char *) (section + 8), "VMECM", 5)) {
             LOG(INFO) << "Ignoring ECM. Not a Verimatrix ECM";
             break;
         }
 
         ecmCount++;
 
-        mTempCollectedEcmData.resize(0);
-
-        mEcmCollectionInProgress = false;
-        mCollectedEcmDataExpected = 0;
-        mCollectedDataLength = 0;
-
-        unsigned table_len = ((table[1] & 0x0F) << 8) + table[2] + 3;
-
-        mTempCollectedEcmData.resize(table_len);
-
-        remainingBytes = std::min(table_len, remainingBytes);
-
-        memcpy(mTempCollectedEcmData.data(), table, remainingBytes);
-
-        mEcmCollectionInProgress = true;
-        mCollectedEcmDataExpected = table_len;
-        mCollectedDataLength = remainingBytes;
-
-        if (mCollectedEcmDataExpected > mCollectedDataLength) {
-            // Table not complete
-            LOG(INFO) << "Collecting ECM version: "
-                      << version
-                      << " Collected size: " << mCollectedDataLength
-                      << " Expected size: " << mCollectedEcmDataExpected;
-            rv = PSIParser::IGNORE;
-        } else {
-            if (mEcm.isNew(version)) {
-                mEcm.setVer(version);
-                rv = PSIParser::NEW_ECM;
-                mEcmTable = mTempCollectedEcmData;
-            } else {
-                dupEcmCount++;
-                rv = PSIParser::IGNORE;
-            }
-            resetCollectionState();
-        }
-
-    } while (false);
-
-    return rv;
-}
-
-PSIParser::ParserActionT PSIParser::collectEcm(const StreamPacketT &packet) {
-    PSIParser::ParserActionT result = PSIParser::ERROR;
-
-    if (!mEcm.isPid(GET_PID(packet)))
-        return result;
-
-    unsigned a = 0;
-    if ((packet[3] & 0x30) == 0x30)
-        a = packet[4] + 1;
-
-    if (a > 184)
-        return result;
-
-    auto remainingBytes = TS_PACKAGE_SIZE - (4 + a);
-    auto need = mCollectedEcmDataExpected - mCollectedDataLength;
-    unsigned version = (mTempCollectedEcmData.data()[5] & 0x3E) >> 1;
-
-    if (remainingBytes > need)
-        remainingBytes = need;
-
-    memcpy(mTempCollectedEcmData.data() + mCollectedDataLength, packet.data() + 4 + a, remainingBytes);
-
-    mCollectedDataLength += remainingBytes;
-
-    if (mCollectedDataLength == mCollectedEcmDataExpected) {
         if (mEcm.isNew(version)) {
             mEcm.setVer(version);
-            result = PSIParser::NEW_ECMT;
-            mEcmTable = mTempCollectedEcmData;
+            rv = PSIParser::NEW_ECM;
+            mEcmTable.assign(section, section + length);
         } else {
-            result = PSIParser::IGNORE;
+            dupEcmCount++;
+            rv = PSIParser::IGNORE;
         }
-        resetCollectionState();
 
-    } else {
-        LOG(INFO) << "Collecting ECM version:"
-                  << version
-                  << " collected = " << mCollectedDataLength
-                  << " expected = " << mCollectedEcmDataExpected;
-        return PSIParser::IGNORE;
-    }
+    } while (false);
 
-    return result;
+    return rv;
 }
 
-PSIParser::ParserActionT PSIParser::ParseOther(const StreamPacketT &pkt) {
+PSIParser::ParserActionT PSIParser::ParseOther(const unsigned char *pkt) {
     ParserActionT rv = PSIParser::IGNORE;
     if (TSC_ISSET(pkt)) {
         if (IS_TSC_EVEN(pkt))
@@ -658,35 +641,25 @@ PSIParser::ParserActionT PSIParser::ParseOther(const StreamPacketT &pkt) {
     return rv;
 }
 
-void PSIParser::resetCollectionState() {
-    mCollectedDataLength = 0;
-    mCollectedEcmDataExpected = 0;
-    mTempCollectedEcmData.resize(0);
-    mEcmCollectionInProgress = false;
+void PSIParser::resetSections() {
+    mPat.assembler().reset();
+    mCat.assembler().reset();
+    mPmt.assembler().reset();
+    mEcm.assembler().reset();
 }
 
 ByteVectorType PSIParser::getCurrentPmt() {
-    StreamPacketT packet;
-    PidInfo pidInfo = mIsClearStream ? mPmt : mEcm;
-    if (pidInfo.getPmtData(packet)) {
-        return ByteVectorType(packet.begin(), packet.end());
-    } else {
-        return ByteVectorType();
-    }
+    ByteVectorType section;
+    // The PMT of encrypted streams is kept with the ECM PID
+    const PidInfo &pidInfo = mIsClearStream ? mPmt : mEcm;
+    pidInfo.getPmtData(section);
+    return section;
 }
 
 ByteVectorType PSIParser::getCurrentPat() {
-    StreamPacketT packet;
-    if (mPat.getPatData(packet)) {
-        return ByteVectorType(packet.begin(), packet.end());
-    } else {
-        return ByteVectorType();
-    }
-}
-
-void PSIParser::joinParserThread() {
-    if (mParserThread != nullptr && mParserThread->joinable())
-        mParserThread->join();
+    ByteVectorType section;
+    mPat.getPatData(section);
+    return section;
 }
 
 void PSIParser::onEndOfStream(const char *channelId) {
@@ -694,18 +667,60 @@ void PSIParser::onEndOfStream(const char *channelId) {
     *mIsCdmSetupDone = false;
 }
 
+void PSIParser::recordZapTiming(ParserActionT action) {
+    std::lock_guard<std::mutex> lockGuard(mZapTimingMtx);
+    uint64_t elapsedUs = bufferMetaTimeNowUs() - mOpenTimeUs;
+
+    if (action == NEW_PAT_PMT && !mZapTiming.hasPatPmt) {
+        mZapTiming.hasPatPmt = true;
+        mZapTiming.patPmtUs = elapsedUs;
+        TRACE_EVENT(TR_FCC_SWITCH, "PSIParser PAT/PMT found", "us", elapsedUs);
+        LOG(INFO) << "PAT/PMT found " << elapsedUs / 1000 << " ms after open";
+    } else if (action == NEW_ECM && !mZapTiming.hasEcm) {
+        mZapTiming.hasEcm = true;
+        mZapTiming.ecmUs = elapsedUs;
+        TRACE_EVENT(TR_FCC_SWITCH, "PSIParser ECM found", "us", elapsedUs);
+        LOG(INFO) << "ECM found " << elapsedUs / 1000 << " ms after open";
+    }
+}
+
+std::map<unsigned, unsigned> PSIParser::getProgramMap() {
+    std::lock_guard<std::mutex> lockGuard(mPidInfoMtx);
+    return mPrograms;
+}
+
+unsigned PSIParser::getPmtPid() {
+    std::lock_guard<std::mutex> lockGuard(mPidInfoMtx);
+    return mPmt.getPid();
+}
+
+PSIParser::ZapTiming PSIParser::getZapTiming() {
+    std::lock_guard<std::mutex> lockGuard(mZapTimingMtx);
+    return mZapTiming;
+}
+
 void PSIParser::onOpen(const char *channelId) {
-    UNUSED(channelId);
-    clearQueue();
+    {
+        std::lock_guard<std::mutex> lockGuard(mZapTimingMtx);
+        mOpenTimeUs = bufferMetaTimeNowUs();
+        mZapTiming = {};
+    }
+    mPacketCounter = 0;
     { // lock this
         std::lock_guard<std::mutex> lockGuard(mPidInfoMtx);
-        resetCollectionState();
+        mServiceId = channelId != nullptr ? ChannelConfig::getServiceId(channelId) : 0;
+        mPmtBaseline = false;
+        mPsiChanged = false;
+        mPrograms.clear();
         mEcmTable.resize(0);
         mEcm.reset();
         mPmt.reset();
+        mCat.reset();
+        mCat.setPid(1);
         mPat.reset();
         mPat.setPid(0);
         mParserState = PSIParser::NEEDS_PAT;
+        updatePidTable();
     }
 }
 
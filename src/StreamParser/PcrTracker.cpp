@@ -0,0 +1,381 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE
+ * file the following copyright and licenses apply:
+ *
+ * Copyright (c) 2022 Nuuday.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "StreamParser/PcrTracker.h"
+#include "ChannelConfig.h"
+#include <glog/logging.h>
+
+// PCR deltas above this start a new PCR history
+#define PCR_MAX_GAP (PCR_CLOCK_HZ / 2)
+
+// PMT stream_type of the supported video codecs
+#define STREAM_TYPE_MPEG1_VIDEO 0x01
+#define STREAM_TYPE_MPEG2_VIDEO 0x02
+#define STREAM_TYPE_H264        0x1B
+#define STREAM_TYPE_HEVC        0x24
+
+namespace StreamParser {
+
+PcrTracker::PcrTracker() : StreamConsumer("PcrTracker") {
+}
+
+void PcrTracker::post(const Buffer &buf) {
+    std::lock_guard<std::mutex> lockGuard(mMutex);
+
+    // Stuffing repeats the last bitrate, it is not measured again
+    bool generated = buf.meta.flags & BUFFER_FLAG_SOURCE_LOSS;
+    if (generated || (buf.meta.flags & BUFFER_FLAG_DISCONTINUITY)) {
+        clearSamples();
+        mPatAssembler.reset();
+        mPmtAssembler.reset();
+    }
+
+    // The chunk is only referenced while processed here
+    if (!mTsStream.attachChunk(*buf.chunk)) {
+        LOG(ERROR) << "Unable to insert chunk";
+        return;
+    }
+
+    const unsigned char *packet;
+    PSIParser::TSStream::TSDataError state;
+
+    while ((state = mTsStream.getNextPacket(packet)) != PSIParser::TSStream::NOT_ENOUGH_DATA) {
+        if (state == PSIParser::TSStream::OK && !generated) {
+            processPacket(packet, mOffset);
+        }
+        mOffset += TS_PACKAGE_SIZE;
+    }
+}
+
+void PcrTracker::onOpen(const char *channelId) {
+    std::lock_guard<std::mutex> lockGuard(mMutex);
+
+    mTsStream.reset();
+    mServiceId = channelId != nullptr ? ChannelConfig::getServiceId(channelId) : 0;
+    mPmtPid = PSI_INVALID_PID;
+    mPcrPid = PSI_INVALID_PID;
+    mVideoPid = PSI_INVALID_PID;
+    mVideoStreamType = 0;
+    mVideoScrambled = false;
+    mPatAssembler.reset();
+    mPmtAssembler.reset();
+    mOffset = 0;
+    clearSamples();
+    mBitrate = 0;
+}
+
+uint64_t PcrTracker::getBitrate() {
+    std::lock_guard<std::mutex> lockGuard(mMutex);
+    return mBitrate;
+}
+
+unsigned PcrTracker::getPcrPid() {
+    std::lock_guard<std::mutex> lockGuard(mMutex);
+    return mPcrPid;
+}
+
+bool PcrTracker::getVideoStream(unsigned &pid, unsigned &streamType) {
+    std::lock_guard<std::mutex> lockGuard(mMutex);
+
+    if (mVideoPid == PSI_INVALID_PID) {
+        return false;
+    }
+    pid = mVideoPid;
+    streamType = mVideoStreamType;
+    return true;
+}
+
+bool PcrTracker::isVideoScrambled() {
+    std::lock_guard<std::mutex> lockGuard(mMutex);
+    return mVideoScrambled;
+}
+
+uint64_t PcrTracker::getOffset() {
+    std::lock_guard<std::mutex> lockGuard(mMutex);
+    return mOffset;
+}
+
+bool PcrTracker::getLastSample(PcrSample &last) {
+    std::lock_guard<std::mutex> lockGuard(mMutex);
+
+    if (mSampleCount == 0) {
+        return false;
+    }
+    last = sample(mSampleCount - 1);
+    return true;
+}
+
+bool PcrTracker::offsetToPcr(uint64_t offset, uint64_t &pcr) {
+    std::lock_guard<std::mutex> lockGuard(mMutex);
+
+    if (mSampleCount == 0) {
+        return false;
+    }
+
+    const auto &first = sample(0);
+    const auto &last = sample(mSampleCount - 1);
+
+    if (offset >= first.offset && offset <= last.offset) {
+        // Samples are few, a linear search is fine
+        size_t i = 1;
+        while (i < mSampleCount - 1 && sample(i).offset < offset) {
+            i++;
+        }
+        const auto &a = sample(i - 1);
+        const auto &b = i < mSampleCount ? sample(i) : a;
+        if (b.offset == a.offset) {
+            pcr = a.pcr;
+        } else {
+            pcr = a.pcr + (b.pcr - a.pcr) * (offset - a.offset) / (b.offset - a.offset);
+        }
+        return true;
+    }
+
+    if (mBitrate == 0) {
+        return false;
+    }
+
+    if (offset > last.offset) {
+        pcr = last.pcr + bytesToTicks(offset - last.offset);
+        return true;
+    }
+
+    uint64_t ticks = bytesToTicks(first.offset - offset);
+    if (ticks > first.pcr) {
+        return false;
+    }
+    pcr = first.pcr - ticks;
+    return true;
+}
+
+bool PcrTracker::readPcr(const unsigned char *packet, uint64_t &pcr, bool &discontinuity) {
+    // Adaptation field with PCR_flag
+    if (!(packet[3] & 0x20) || packet[4] < 7 || !(packet[5] & 0x10)) {
+        return false;
+    }
+
+    uint64_t base = ((uint64_t) packet[6] << 25) | ((uint64_t) packet[7] << 17) |
+                    ((uint64_t) packet[8] << 9) | ((uint64_t) packet[9] << 1) | (packet[10] >> 7);
+    pcr = base * 300 + (((packet[10] & 0x01) << 8) | packet[11]);
+    discontinuity = packet[5] & 0x80;
+    return true;
+}
+
+bool PcrTracker::isRandomAccessPoint(const unsigned char *packet, unsigned streamType) {
+    // Access units start with the PES
+    if (!(packet[1] & 0x40)) {
+        return false;
+    }
+
+    size_t pos = 4;
+    if (packet[3] & 0x20) {
+        if (packet[4] > 0 && (packet[5] & 0x40)) {
+            return true;
+        }
+        pos += 1 + packet[4];
+    }
+
+    // transport_scrambling_control, the PES is not readable
+    if (packet[3] & 0xC0) {
+        return false;
+    }
+
+    if (!(packet[3] & 0x10) || pos + 9 > TS_PACKAGE_SIZE) {
+        return false;
+    }
+
+    const unsigned char *pes = packet + pos;
+    if (pes[0] != 0x00 || pes[1] != 0x00 || pes[2] != 0x01) {
+        return false;
+    }
+    pos += 9 + pes[8];
+
+    for (; pos + 4 <= TS_PACKAGE_SIZE; pos++) {
+        if (packet[pos] != 0x00 || packet[pos + 1] != 0x00 || packet[pos + 2] != 0x01) {
+            continue;
+        }
+
+        unsigned char code = packet[pos + 3];
+        switch (streamType) {
+            case STREAM_TYPE_MPEG1_VIDEO:
+            case STREAM_TYPE_MPEG2_VIDEO:
+                // sequence_header or group_of_pictures header
+                if (code == 0xB3 || code == 0xB8) {
+                    return true;
+                }
+                break;
+            case STREAM_TYPE_H264: {
+                unsigned nalType = code & 0x1F;
+                if (nalType == 5 || nalType == 7) {
+                    return true;
+                }
+                break;
+            }
+            case STREAM_TYPE_HEVC: {
+                unsigned nalType = (code >> 1) & 0x3F;
+                if ((nalType >= 16 && nalType <= 21) || nalType == 32) {
+                    return true;
+                }
+                break;
+            }
+            default:
+                return false;
+        }
+        pos += 2;
+    }
+    return false;
+}
+
+void PcrTracker::processPacket(const unsigned char *packet, uint64_t offset) {
+    if (packet[1] & 0x80) {
+        return;
+    }
+
+    unsigned pid = GET_PID(packet);
+    const unsigned char *section;
+    size_t length;
+
+    if (pid == 0) {
+        mPatAssembler.push(packet);
+        while (mPatAssembler.nextSection(section, length)) {
+            parsePat(section, length);
+        }
+        return;
+    }
+
+    if (pid == mPmtPid) {
+        mPmtAssembler.push(packet);
+        while (mPmtAssembler.nextSection(section, length)) {
+            parsePmt(section, length);
+        }
+    }
+
+    if (pid == mVideoPid && (packet[3] & 0x10)) {
+        mVideoScrambled = packet[3] & 0xC0;
+    }
+
+    uint64_t pcr;
+    bool discontinuity;
+    if ((pid == mPcrPid || mPcrPid == PSI_INVALID_PID) && readPcr(packet, pcr, discontinuity)) {
+        mPcrPid = pid;
+        addSample(pcr, offset, discontinuity);
+    }
+}
+
+void PcrTracker::parsePat(const unsigned char *section, size_t length) {
+    if (section[0] != 0x00 || length < PSI_SECTION_MIN_SIZE) {
+        return;
+    }
+
+    unsigned pmtPid = PSI_INVALID_PID;
+    for (size_t p = 8; p + 4 <= length - 4; p += 4) {
+        unsigned program = (section[p] << 8) | section[p + 1];
+        unsigned pid = ((section[p + 2] & 0x1F) << 8) | section[p + 3];
+        // program_number 0 carries the network PID
+        if (program == 0) {
+            continue;
+        }
+        if (program == mServiceId || (mServiceId == 0 && pmtPid == PSI_INVALID_PID)) {
+            pmtPid = pid;
+        }
+    }
+
+    if (pmtPid != mPmtPid) {
+        mPmtPid = pmtPid;
+        mPmtAssembler.reset();
+    }
+}
+
+void PcrTracker::parsePmt(const unsigned char *section, size_t length) {
+    if (section[0] != 0x02 || length < PSI_SECTION_MIN_SIZE) {
+        return;
+    }
+
+    unsigned pcrPid = ((section[8] & 0x1F) << 8) | section[9];
+    if (pcrPid != mPcrPid) {
+        LOG(INFO) << "PCR PID: " << pcrPid;
+        clearSamples();
+    }
+    mPcrPid = pcrPid;
+
+    const unsigned char *end = section + length - 4;
+    const unsigned char *streamP = section + 12 + (((section[10] << 8) | section[11]) & 0xFFF);
+    unsigned videoPid = PSI_INVALID_PID;
+    unsigned videoStreamType = 0;
+
+    for (; streamP + 5 <= end; streamP += 5 + (((streamP[3] << 8) | streamP[4]) & 0xFFF)) {
+        unsigned streamType = streamP[0];
+        if (streamType == STREAM_TYPE_MPEG1_VIDEO || streamType == STREAM_TYPE_MPEG2_VIDEO ||
+            streamType == STREAM_TYPE_H264 || streamType == STREAM_TYPE_HEVC) {
+            videoPid = ((streamP[1] & 0x1F) << 8) | streamP[2];
+            videoStreamType = streamType;
+            break;
+        }
+    }
+
+    if (videoPid != mVideoPid) {
+        LOG(INFO) << "Video PID: " << videoPid << " stream_type: " << videoStreamType;
+        mVideoScrambled = false;
+    }
+    mVideoPid = videoPid;
+    mVideoStreamType = videoStreamType;
+}
+
+void PcrTracker::addSample(uint64_t pcr, uint64_t offset, bool discontinuity) {
+    if (mSampleCount > 0) {
+        const auto &last = sample(mSampleCount - 1);
+        uint64_t delta = (pcr + PCR_WRAP - last.pcr % PCR_WRAP) % PCR_WRAP;
+
+        if (discontinuity || delta == 0 || delta > PCR_MAX_GAP) {
+            clearSamples();
+        } else {
+            // Continue the scale of the history across the wrap
+            pcr = last.pcr + delta;
+        }
+    }
+
+    if (mSampleCount == mSamples.size()) {
+        mFirstSample = (mFirstSample + 1) % mSamples.size();
+        mSampleCount--;
+    }
+    mSamples[(mFirstSample + mSampleCount) % mSamples.size()] = {pcr, offset};
+    mSampleCount++;
+
+    if (mSampleCount >= 2) {
+        const auto &first = sample(0);
+        mBitrate = (offset - first.offset) * 8 * PCR_CLOCK_HZ / (pcr - first.pcr);
+    }
+}
+
+void PcrTracker::clearSamples() {
+    mFirstSample = 0;
+    mSampleCount = 0;
+}
+
+uint64_t PcrTracker::bytesToTicks(uint64_t bytes) const {
+    // Split to avoid overflow on large offsets
+    uint64_t bits = bytes * 8;
+    return (bits / mBitrate) * PCR_CLOCK_HZ + (bits % mBitrate) * PCR_CLOCK_HZ / mBitrate;
+}
+
+const PcrTracker::PcrSample &PcrTracker::sample(size_t index) const {
+    return mSamples[(mFirstSample + index) % mSamples.size()];
+}
+
+} //namespace StreamParser
@@ -0,0 +1,196 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE
+ * file the following copyright and licenses apply:
+ *
+ * Copyright (c) 2022 Nuuday.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "StreamParser/PersistentTsb.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <glog/logging.h>
+
+#define PERSISTENT_TSB_MAGIC "FCCTSB"
+
+namespace StreamParser {
+
+PersistentTsb::PersistentTsb(const char *shmName, size_t chunks) : StreamConsumer("PersistentTsb") {
+    mSize = sizeof(Header) + chunks * sizeof(Slot);
+
+    int fd = shm_open(shmName, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        LOG(ERROR) << "Unable to open shared memory " << shmName << ": " << strerror(errno);
+        return;
+    }
+
+    struct stat st {};
+    if (fstat(fd, &st) == -1 || ((size_t) st.st_size != mSize && ftruncate(fd, mSize) == -1)) {
+        LOG(ERROR) << "Unable to size shared memory " << shmName << ": " << strerror(errno);
+        close(fd);
+        return;
+    }
+
+    void *addr = mmap(nullptr, mSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        LOG(ERROR) << "Unable to map shared memory " << shmName << ": " << strerror(errno);
+        return;
+    }
+
+    mHeader = static_cast<Header *>(addr);
+    mSlots = reinterpret_cast<Slot *>(mHeader + 1);
+
+    if (isValid(chunks)) {
+        mRestorable = true;
+        LOG(INFO) << "Persistent TSB of " << mHeader->channel << ": "
+                  << std::min<uint64_t>(mHeader->count, mHeader->limit - 1) << " chunks";
+    } else {
+        memset(mHeader, 0, sizeof(Header));
+        memcpy(mHeader->magic, PERSISTENT_TSB_MAGIC, sizeof(PERSISTENT_TSB_MAGIC));
+        mHeader->version = PERSISTENT_TSB_VERSION;
+        mHeader->chunkSize = BUFFER_CHUNK_SIZE;
+        mHeader->slotSize = sizeof(Slot);
+        mHeader->capacity = chunks;
+        mHeader->limit = chunks;
+    }
+}
+
+PersistentTsb::~PersistentTsb() {
+    if (mHeader != nullptr) {
+        munmap(mHeader, mSize);
+    }
+}
+
+bool PersistentTsb::isValid(size_t chunks) const {
+    // Left by a plugin with the same layout, recently
+    if (memcmp(mHeader->magic, PERSISTENT_TSB_MAGIC, sizeof(PERSISTENT_TSB_MAGIC)) != 0 ||
+        mHeader->version != PERSISTENT_TSB_VERSION ||
+        mHeader->chunkSize != BUFFER_CHUNK_SIZE ||
+        mHeader->slotSize != sizeof(Slot) ||
+        mHeader->capacity != chunks ||
+        mHeader->limit < 2 || mHeader->limit > chunks) {
+        return false;
+    }
+
+    uint64_t count = __atomic_load_n(&mHeader->count, __ATOMIC_ACQUIRE);
+    uint64_t now = bufferMetaTimeNowUs();
+    return count > 1 && mHeader->channel[PERSISTENT_TSB_CHANNEL_MAX - 1] == '\0' &&
+           now - std::min(now, mHeader->updateTimeUs) < TSB_PERSIST_MAX_AGE_S * 1000000ULL;
+}
+
+void PersistentTsb::startChannel(const char *channelId) {
+    __atomic_store_n(&mHeader->count, 0, __ATOMIC_RELEASE);
+    strncpy(mHeader->channel, channelId, PERSISTENT_TSB_CHANNEL_MAX - 1);
+    mHeader->channel[PERSISTENT_TSB_CHANNEL_MAX - 1] = '\0';
+}
+
+void PersistentTsb::setLimit(std::function<size_t()> limit) {
+    mLimit = std::move(limit);
+}
+
+void PersistentTsb::setSlotLimit(uint64_t limit) {
+    __atomic_store_n(&mHeader->count, 0, __ATOMIC_RELEASE);
+    mHeader->limit = limit;
+
+    // Return the pages of the unused slots
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t) (mSlots + limit) + page - 1) / page * page;
+    uintptr_t end = (uintptr_t) mHeader + mSize;
+    if (start < end && madvise((void *) start, end - start, MADV_REMOVE) == -1) {
+        LOG(WARNING) << "Unable to release persistent TSB slots: " << strerror(errno);
+    }
+    LOG(INFO) << "Persistent TSB limited to " << limit << " chunks";
+}
+
+void PersistentTsb::onOpen(const char *channelId) {
+    if (mHeader == nullptr) {
+        return;
+    }
+
+    mChannelId = channelId != nullptr ? channelId : "";
+    mRestorePending = mRestorable && mChannelId == mHeader->channel;
+    mRestorable = false;
+
+    if (!mRestorePending) {
+        startChannel(mChannelId.c_str());
+    }
+}
+
+void PersistentTsb::post(const Buffer &buf) {
+    if (mHeader == nullptr || mReplaying) {
+        return;
+    }
+
+    if (mLimit) {
+        uint64_t limit = std::max<uint64_t>(2, std::min<uint64_t>(mLimit(), mHeader->capacity));
+        if (limit != mHeader->limit) {
+            setSlotLimit(limit);
+        }
+    }
+
+    uint64_t count = mHeader->count;
+    Slot &slot = mSlots[count % mHeader->limit];
+    slot.meta = buf.meta;
+    slot.chunk = *buf.chunk;
+    if (mDiscontinuity) {
+        slot.meta.flags |= BUFFER_FLAG_DISCONTINUITY;
+        mDiscontinuity = false;
+    }
+    mHeader->updateTimeUs = buf.meta.ingestTimeUs != 0 ? buf.meta.ingestTimeUs : bufferMetaTimeNowUs();
+
+    // Published after the slot is complete
+    __atomic_store_n(&mHeader->count, count + 1, __ATOMIC_RELEASE);
+}
+
+size_t PersistentTsb::restore(const std::function<void(const Buffer &)> &post) {
+    if (!mRestorePending) {
+        return 0;
+    }
+    mRestorePending = false;
+
+    // The oldest slot may have been overwritten when the writer stopped
+    uint64_t count = __atomic_load_n(&mHeader->count, __ATOMIC_ACQUIRE);
+    uint64_t chunks = std::min<uint64_t>(count, mHeader->limit - 1);
+
+    // Received before the restart, shifted to end now keeping their spacing
+    uint64_t lastTimeUs = mSlots[(count - 1) % mHeader->limit].meta.ingestTimeUs;
+    uint64_t shiftUs = bufferMetaTimeNowUs() - std::min(bufferMetaTimeNowUs(), lastTimeUs);
+
+    mReplaying = true;
+    for (uint64_t n = count - chunks; n < count; n++) {
+        Slot &slot = mSlots[n % mHeader->limit];
+        Buffer buf = {mChannelId.c_str(), &slot.chunk, slot.meta, {}};
+        if (buf.meta.ingestTimeUs != 0) {
+            buf.meta.ingestTimeUs += shiftUs;
+        }
+        buf.meta.flags &= ~BUFFER_FLAG_SOURCE_SWITCH;
+        if (n == count - chunks) {
+            buf.meta.flags |= BUFFER_FLAG_SOURCE_SWITCH;
+        }
+        post(buf);
+    }
+    mReplaying = false;
+    // Live chunks are kept after the replayed ones
+    mDiscontinuity = true;
+
+    LOG(INFO) << "Restored " << chunks << " chunks of " << mChannelId;
+    return chunks;
+}
+
+} //namespace StreamParser
@@ -0,0 +1,69 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE
+ * file the following copyright and licenses apply:
+ *
+ * Copyright (c) 2022 Nuuday.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "StreamParser/ReadPacer.h"
+#include <algorithm>
+#include <cmath>
+
+namespace StreamParser {
+
+ReadPacer::ReadPacer(uint64_t burstUs) : mBurstUs(burstUs) {
+}
+
+void ReadPacer::setRate(double rate) {
+    mRate = rate;
+    mRestart = true;
+}
+
+double ReadPacer::getRate() const {
+    return mRate;
+}
+
+void ReadPacer::reset() {
+    mRestart = true;
+}
+
+void ReadPacer::refill(uint64_t nowUs) {
+    if (mRestart.exchange(false)) {
+        mTokensUs = mBurstUs;
+    } else if (nowUs > mLastUs) {
+        mTokensUs = std::min<double>(mBurstUs, mTokensUs + getRate() * (nowUs - mLastUs));
+    }
+    mLastUs = nowUs;
+}
+
+int64_t ReadPacer::getCreditUs(uint64_t nowUs) {
+    refill(nowUs);
+    return (int64_t) mTokensUs;
+}
+
+uint64_t ReadPacer::getWaitUs(uint64_t nowUs) {
+    refill(nowUs);
+    double rate = getRate();
+    if (mTokensUs >= 1 || rate <= 0) {
+        return 0;
+    }
+    return (uint64_t) std::ceil((1 - mTokensUs) / rate);
+}
+
+void ReadPacer::consume(uint64_t mediaUs) {
+    mTokensUs -= mediaUs;
+}
+
+} //namespace StreamParser
@@ -0,0 +1,199 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE
+ * file the following copyright and licenses apply:
+ *
+ * Copyright (c) 2022 Nuuday.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "StreamParser/SectionAssembler.h"
+#include "utils/Crc32.h"
+#include "streamfs/config.h"
+#include <glog/logging.h>
+#include <algorithm>
+
+#define SECTION_HEADER_SIZE 3
+#define SECTION_CRC_SIZE    4
+
+namespace StreamParser {
+
+void SectionAssembler::push(const unsigned char *packet) {
+    mPacket = packet;
+    mPos = mStart = mLimit = mEnd = 0;
+
+    if (packet[1] & 0x80) {
+        // transport_error_indicator
+        dropSection();
+        return;
+    }
+
+    unsigned afc = (packet[3] >> 4) & 0x3;
+    int cc = packet[3] & 0x0F;
+
+    if ((afc & 0x2) && packet[4] > 0 && (packet[5] & 0x80)) {
+        // discontinuity_indicator: counter and content start over
+        reset();
+    }
+
+    if (!(afc & 0x1)) {
+        // No payload, the counter does not advance
+        return;
+    }
+
+    if (mLastCc >= 0 && cc != ((mLastCc + 1) & 0x0F)) {
+        if (cc == mLastCc) {
+            // Duplicate packet
+            return;
+        }
+        if (mCollecting) {
+            LOG(INFO) << "Continuity counter gap, dropping section";
+        }
+        dropSection();
+    }
+    mLastCc = cc;
+
+    size_t pos = 4;
+    if (afc == 0x3) {
+        pos += 1 + packet[4];
+    }
+
+    if (pos >= TS_PACKAGE_SIZE) {
+        return;
+    }
+
+    mPos = pos;
+    mStart = mLimit = mEnd = TS_PACKAGE_SIZE;
+
+    if (packet[1] & 0x40) {
+        // pointer_field: bytes up to the new section end the previous one
+        mStart = mPos + 1 + packet[mPos];
+        mPos++;
+        if (mStart > mEnd) {
+            LOG(INFO) << "Invalid pointer field";
+            dropSection();
+            mPos = mStart = mEnd;
+            return;
+        }
+        mLimit = mStart;
+    }
+}
+
+bool SectionAssembler::nextSection(const unsigned char *&section, size_t &length) {
+    while (mPos < mEnd) {
+        if (!mCollecting) {
+            mPos = std::max(mPos, mStart);
+            if (mPos == mEnd || mPacket[mPos] == 0xFF) {
+                // Stuffing up to the end of the packet
+                mPos = mEnd;
+                break;
+            }
+            mCollecting = true;
+            mSection.clear();
+            mSectionLen = 0;
+            mLimit = mEnd;
+        }
+
+        size_t need = (mSectionLen == 0 ? SECTION_HEADER_SIZE : mSectionLen) - mSection.size();
+        size_t take = std::min(need, mLimit - mPos);
+        mSection.insert(mSection.end(), mPacket + mPos, mPacket + mPos + take);
+        mPos += take;
+
+        if (mSectionLen == 0 && mSection.size() == SECTION_HEADER_SIZE) {
+            mSectionLen = SECTION_HEADER_SIZE + (((mSection[1] & 0x0F) << 8) | mSection[2]);
+            continue;
+        }
+
+        if (mSectionLen != 0 && mSection.size() == mSectionLen) {
+            mCollecting = false;
+            if (!checkSection()) {
+                continue;
+            }
+            if (isRepeated()) {
+                mStats.repeated++;
+                continue;
+            }
+            rememberSection();
+            mStats.sections++;
+            section = mSection.data();
+            length = mSection.size();
+            return true;
+        }
+
+        if (mPos == mLimit && mLimit < mEnd) {
+            // The next section starts before this one is complete
+            LOG(INFO) << "Truncated section, collected " << mSection.size() << " of " << mSectionLen;
+            dropSection();
+        }
+    }
+    return false;
+}
+
+bool SectionAssembler::checkSection() {
+    bool syntax = mSection[1] & 0x80;
+
+    if (!syntax)
+        return true;
+
+    if (mSectionLen < SECTION_HEADER_SIZE + SECTION_CRC_SIZE ||
+        crc32Mpeg(mSection.data(), mSection.size()) != 0) {
+        mStats.crcErrors++;
+        LOG(WARNING) << "CRC error in section table_id " << (int) mSection[0];
+        return false;
+    }
+    return true;
+}
+
+bool SectionAssembler::isRepeated() {
+    if (!(mSection[1] & 0x80))
+        return false;
+
+    auto crc = sectionCrc();
+    for (int i = 0; i < 2; i++) {
+        if (mRecentValid[i] && mRecentCrc[i] == crc)
+            return true;
+    }
+    return false;
+}
+
+void SectionAssembler::rememberSection() {
+    if (!(mSection[1] & 0x80))
+        return;
+
+    mRecentCrc[mRecentNext] = sectionCrc();
+    mRecentValid[mRecentNext] = true;
+    mRecentNext = (mRecentNext + 1) % 2;
+}
+
+uint32_t SectionAssembler::sectionCrc() const {
+    auto p = mSection.data() + mSectionLen - SECTION_CRC_SIZE;
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+void SectionAssembler::dropSection() {
+    if (mCollecting) {
+        mStats.dropped++;
+    }
+    mCollecting = false;
+    mSection.clear();
+    mSectionLen = 0;
+}
+
+void SectionAssembler::reset() {
+    dropSection();
+    mRecentValid[0] = mRecentValid[1] = false;
+    mLastCc = -1;
+    mPos = mStart = mLimit = mEnd = 0;
+}
+
+} //namespace StreamParser
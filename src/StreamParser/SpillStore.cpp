@@ -0,0 +1,323 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE
+ * file the following copyright and licenses apply:
+ *
+ * Copyright (c) 2022 Nuuday.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "StreamParser/SpillStore.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <unistd.h>
+#include <glog/logging.h>
+
+namespace StreamParser {
+
+namespace {
+    // Bytes the process caused to be written to storage
+    uint64_t readDeviceBytes() {
+        std::ifstream io("/proc/self/io");
+        std::string key;
+        uint64_t value;
+        while (io >> key >> value) {
+            if (key == "write_bytes:") {
+                return value;
+            }
+        }
+        return 0;
+    }
+}
+
+SpillStore::SpillStore(const std::string &path, uint64_t maxBytes)
+    : mPath(path)
+    , mSlots(maxBytes / SPILL_SEGMENT_SIZE) {
+    if (mSlots < 2) {
+        LOG(ERROR) << "Spill store of " << maxBytes << " bytes is too small";
+        return;
+    }
+
+    mWriteFd = open(mPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT | O_CLOEXEC, 0600);
+    if (mWriteFd == -1 && errno == EINVAL) {
+        // Not supported by tmpfs and some FUSE file systems
+        LOG(WARNING) << "O_DIRECT not supported for " << mPath;
+        mWriteFd = open(mPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    }
+    if (mWriteFd == -1) {
+        LOG(ERROR) << "Unable to create " << mPath << ": " << strerror(errno);
+        return;
+    }
+
+    mReadFd = open(mPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (mReadFd == -1) {
+        LOG(ERROR) << "Unable to open " << mPath << ": " << strerror(errno);
+        return;
+    }
+
+    for (int i = 0; i < SPILL_BUFFERS; i++) {
+        void *buffer;
+        if (posix_memalign(&buffer, SPILL_ALIGNMENT, SPILL_SEGMENT_SIZE) != 0) {
+            LOG(ERROR) << "Unable to allocate spill buffers";
+            return;
+        }
+        mBuffers.push_back((unsigned char *) buffer);
+    }
+    mCurrent = mBuffers[0];
+    mFree.assign(mBuffers.begin() + 1, mBuffers.end());
+
+    mDeviceBytesStart = readDeviceBytes();
+    mThread = std::thread(&SpillStore::threadLoop, this);
+
+    LOG(INFO) << "Spill store " << mPath << ": " << mSlots << " segments of " << SPILL_SEGMENT_SIZE << " bytes";
+}
+
+SpillStore::~SpillStore() {
+    if (mThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lockGuard(mMutex);
+            mExit = true;
+        }
+        mCv.notify_one();
+        mThread.join();
+    }
+
+    for (int fd : {mWriteFd, mReadFd}) {
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+    if (mWriteFd != -1) {
+        unlink(mPath.c_str());
+    }
+    for (auto buffer : mBuffers) {
+        free(buffer);
+    }
+}
+
+bool SpillStore::isOpen() const {
+    return mThread.joinable();
+}
+
+void SpillStore::append(const unsigned char *data, size_t size, uint64_t byteIndex, uint64_t timestampUs) {
+    if (!isOpen()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> appendGuard(mAppendMutex);
+
+    // Only contiguous data is sealed
+    if (mCurrentSize > 0 && byteIndex != mNextByteIndex) {
+        mCurrentSize = 0;
+    }
+
+    while (size > 0) {
+        if (mCurrentSize == 0) {
+            mCurrentSegment.byteIndex = byteIndex;
+            mCurrentSegment.firstTimeUs = timestampUs;
+        }
+
+        size_t n = std::min(size, (size_t) SPILL_SEGMENT_SIZE - mCurrentSize);
+        memcpy(mCurrent + mCurrentSize, data, n);
+        mCurrentSize += n;
+        mCurrentSegment.lastTimeUs = timestampUs;
+        data += n;
+        size -= n;
+        byteIndex += n;
+
+        if (mCurrentSize == SPILL_SEGMENT_SIZE) {
+            seal();
+        }
+    }
+
+    mNextByteIndex = byteIndex;
+    mLastTimeUs = timestampUs;
+}
+
+void SpillStore::seal() {
+    std::lock_guard<std::mutex> lockGuard(mMutex);
+    mCurrentSize = 0;
+
+    // The disk is behind, the segment is overwritten
+    if (mFree.empty()) {
+        mStats.droppedSegments++;
+        return;
+    }
+
+    mPending.push_back({mCurrent, mCurrentSegment, mGeneration});
+    mCurrent = mFree.back();
+    mFree.pop_back();
+    mCv.notify_one();
+}
+
+void SpillStore::clear() {
+    std::lock_guard<std::mutex> appendGuard(mAppendMutex);
+    std::lock_guard<std::mutex> lockGuard(mMutex);
+    mGeneration++;
+    for (auto &pending : mPending) {
+        mFree.push_back(pending.buffer);
+    }
+    mPending.clear();
+    mIndex.clear();
+    mCurrentSize = 0;
+    mLastTimeUs = 0;
+}
+
+void SpillStore::threadLoop() {
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    while (true) {
+        mCv.wait(lock, [this]() { return mExit || !mPending.empty(); });
+        if (mExit) {
+            return;
+        }
+
+        Pending pending = mPending.front();
+        mPending.pop_front();
+
+        Segment segment = pending.segment;
+        segment.slot = mNextSlot;
+        mNextSlot = (mNextSlot + 1) % mSlots;
+
+        // Readers must not find the slot while it is overwritten
+        mIndex.erase(std::remove_if(mIndex.begin(), mIndex.end(), [&segment](const Segment &s) {
+            return s.slot == segment.slot;
+        }), mIndex.end());
+
+        lock.unlock();
+        ssize_t written = pwrite(mWriteFd, pending.buffer, SPILL_SEGMENT_SIZE, (off_t) segment.slot * SPILL_SEGMENT_SIZE);
+        int error = errno;
+        lock.lock();
+
+        mFree.push_back(pending.buffer);
+
+        if (written != SPILL_SEGMENT_SIZE) {
+            LOG(ERROR) << "Spill write to " << mPath << " failed: " << strerror(error);
+            mStats.droppedSegments++;
+            continue;
+        }
+
+        mStats.writtenBytes += SPILL_SEGMENT_SIZE;
+        mStats.writtenSegments++;
+
+        if (pending.generation == mGeneration) {
+            mIndex.push_back(segment);
+        }
+    }
+}
+
+std::deque<SpillStore::Segment>::const_iterator SpillStore::find(uint64_t byteIndex) const {
+    auto it = std::upper_bound(mIndex.begin(), mIndex.end(), byteIndex, [](uint64_t target, const Segment &s) {
+        return target < s.byteIndex;
+    });
+
+    if (it == mIndex.begin()) {
+        return mIndex.end();
+    }
+    --it;
+    return byteIndex < it->byteIndex + SPILL_SEGMENT_SIZE ? it : mIndex.end();
+}
+
+size_t SpillStore::read(char *data, size_t size, uint64_t byteIndex) {
+    Segment segment;
+    bool prefetch = false;
+    size_t prefetchSlot = 0;
+    {
+        std::lock_guard<std::mutex> lockGuard(mMutex);
+        auto it = find(byteIndex);
+        if (it == mIndex.end()) {
+            return 0;
+        }
+        segment = *it;
+
+        auto next = std::next(it);
+        if (next != mIndex.end() && next->byteIndex != mPrefetched) {
+            mPrefetched = next->byteIndex;
+            prefetchSlot = next->slot;
+            prefetch = true;
+        }
+    }
+
+    if (prefetch) {
+        posix_fadvise(mReadFd, (off_t) prefetchSlot * SPILL_SEGMENT_SIZE, SPILL_SEGMENT_SIZE, POSIX_FADV_WILLNEED);
+    }
+
+    size_t offset = byteIndex - segment.byteIndex;
+    size = std::min(size, (size_t) SPILL_SEGMENT_SIZE - offset);
+    ssize_t n = pread(mReadFd, data, size, (off_t) segment.slot * SPILL_SEGMENT_SIZE + offset);
+    if (n <= 0) {
+        return 0;
+    }
+
+    // The slot may have been overwritten meanwhile
+    std::lock_guard<std::mutex> lockGuard(mMutex);
+    auto it = find(byteIndex);
+    if (it == mIndex.end() || it->slot != segment.slot || it->byteIndex != segment.byteIndex) {
+        return 0;
+    }
+    mStats.readBytes += n;
+    return n;
+}
+
+bool SpillStore::getFront(uint64_t &byteIndex, uint64_t &timeUs) {
+    std::lock_guard<std::mutex> lockGuard(mMutex);
+    if (mIndex.empty()) {
+        return false;
+    }
+    byteIndex = mIndex.front().byteIndex;
+    timeUs = mIndex.front().firstTimeUs;
+    return true;
+}
+
+bool SpillStore::getByteIndexForTime(uint64_t timeUs, uint64_t &byteIndex) {
+    std::lock_guard<std::mutex> lockGuard(mMutex);
+    if (mIndex.empty() || timeUs < mIndex.front().firstTimeUs) {
+        return false;
+    }
+
+    auto it = std::lower_bound(mIndex.begin(), mIndex.end(), timeUs, [](const Segment &s, uint64_t target) {
+        return s.lastTimeUs < target;
+    });
+    if (it == mIndex.end()) {
+        return false;
+    }
+
+    byteIndex = it->byteIndex;
+    if (timeUs > it->firstTimeUs && it->lastTimeUs > it->firstTimeUs) {
+        byteIndex += (timeUs - it->firstTimeUs) * (SPILL_SEGMENT_SIZE - 1) / (it->lastTimeUs - it->firstTimeUs);
+    }
+    return true;
+}
+
+bool SpillStore::getTimeForByteIndex(uint64_t byteIndex, uint64_t &timeUs) {
+    std::lock_guard<std::mutex> lockGuard(mMutex);
+    auto it = find(byteIndex);
+    if (it == mIndex.end()) {
+        return false;
+    }
+    timeUs = it->firstTimeUs + (byteIndex - it->byteIndex) * (it->lastTimeUs - it->firstTimeUs) / SPILL_SEGMENT_SIZE;
+    return true;
+}
+
+SpillStore::Stats SpillStore::getStats() {
+    uint64_t deviceBytes = readDeviceBytes();
+    std::lock_guard<std::mutex> lockGuard(mMutex);
+    Stats stats = mStats;
+    stats.storedBytes = mIndex.size() * SPILL_SEGMENT_SIZE;
+    stats.deviceBytes = deviceBytes - std::min(deviceBytes, mDeviceBytesStart);
+    return stats;
+}
+
+} //namespace StreamParser
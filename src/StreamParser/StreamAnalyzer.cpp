@@ -0,0 +1,427 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE
+ * file the following copyright and licenses apply:
+ *
+ * Copyright (c) 2022 Nuuday.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "StreamParser/StreamAnalyzer.h"
+#include <glog/logging.h>
+#include <algorithm>
+
+#define NULL_PACKET_PID 0x1FFF
+
+namespace {
+
+uint64_t elapsedUs(uint64_t fromUs, uint64_t toUs) {
+    return toUs > fromUs ? toUs - fromUs : 0;
+}
+
+}
+
+namespace StreamParser {
+
+StreamAnalyzer::StreamAnalyzer() : StreamConsumer("StreamAnalyzer", true, QueuePolicy::LOSSY),
+                                   mPids(PSI_MAX_PID + 1) {
+}
+
+void StreamAnalyzer::post(const Buffer &buf) {
+    std::lock_guard<std::mutex> lockGuard(mStatsMtx);
+    uint64_t timeUs = buf.meta.ingestTimeUs != 0 ? buf.meta.ingestTimeUs : bufferMetaTimeNowUs();
+    mNowUs = timeUs;
+
+    if (buf.meta.flags & BUFFER_FLAG_SOURCE_LOSS) {
+        // Generated stuffing, restart with the source
+        mStarted = false;
+        return;
+    }
+
+    count(SOURCE_LOST_PACKETS, buf.meta.lostPackets);
+    if (buf.meta.flags & BUFFER_FLAG_DISCONTINUITY) {
+        count(DISCONTINUITIES);
+        mStarted = false;
+    }
+
+    if (!mStarted) {
+        restart(timeUs);
+    } else if (mChunkPackets > 0) {
+        mPacketUs = elapsedUs(mChunkTimeUs, timeUs) / mChunkPackets;
+    }
+    mChunkTimeUs = timeUs;
+    mChunkPackets = 0;
+
+    // The chunk is only referenced while processed here
+    if (!mTsStream.attachChunk(*buf.chunk)) {
+        LOG(ERROR) << "Unable to insert chunk";
+        return;
+    }
+
+    const unsigned char *packet;
+    PSIParser::TSStream::TSDataError state;
+
+    while ((state = mTsStream.getNextPacket(packet)) != PSIParser::TSStream::NOT_ENOUGH_DATA) {
+        mNowUs = mChunkTimeUs + mChunkPackets++ * mPacketUs;
+
+        if (state == PSIParser::TSStream::DATA_CC_ERROR) {
+            count(SYNC_BYTE_ERROR);
+            if (!mSynced) {
+                mSyncCount = 0;
+            } else if (++mSyncCount >= HEALTH_SYNC_LOSS) {
+                count(SYNC_LOSS);
+                mSynced = false;
+                mSyncCount = 0;
+            }
+            continue;
+        }
+
+        if (!mSynced) {
+            if (++mSyncCount < HEALTH_SYNC_ACQUIRE) {
+                continue;
+            }
+            mSynced = true;
+        }
+        mSyncCount = 0;
+
+        processPacket(packet, mNowUs);
+    }
+
+    checkMissing(mPat, PAT_ERROR, HEALTH_PAT_MAX_INTERVAL_US, mNowUs);
+    for (auto &it : mPmts) {
+        checkMissing(it.second, PMT_ERROR, HEALTH_PMT_MAX_INTERVAL_US, mNowUs);
+    }
+}
+
+void StreamAnalyzer::onOpen(const char *channelId) {
+    UNUSED(channelId);
+    std::lock_guard<std::mutex> lockGuard(mStatsMtx);
+
+    mTsStream.reset();
+    mPids.assign(PSI_MAX_PID + 1, PidState());
+    mPat = TableState();
+    mPmts.clear();
+    mPcrs.clear();
+    mSynced = false;
+    mSyncCount = 0;
+    mStarted = false;
+    mTotal = {};
+    mMax = {};
+    mWindow = {};
+}
+
+StreamAnalyzer::Stats StreamAnalyzer::getStats(uint64_t nowUs) {
+    std::lock_guard<std::mutex> lockGuard(mStatsMtx);
+    Stats stats;
+    stats.total = mTotal;
+    stats.max = mMax;
+
+    uint64_t second = nowUs / 1000000;
+    for (const auto &bucket : mWindow) {
+        if (bucket.second > second || bucket.second + STREAM_HEALTH_WINDOW_S <= second) {
+            continue;
+        }
+        for (size_t i = 0; i < COUNTER_COUNT; i++) {
+            stats.recent[i] += bucket.counts[i];
+        }
+        for (size_t i = 0; i < MAXIMUM_COUNT; i++) {
+            stats.recentMax[i] = std::max(stats.recentMax[i], bucket.max[i]);
+        }
+    }
+
+    for (unsigned pid = 0; pid < mPids.size(); pid++) {
+        if (mPids[pid].ccErrors > 0) {
+            stats.ccErrorPids.emplace_back(pid, mPids[pid].ccErrors);
+        }
+    }
+    return stats;
+}
+
+void StreamAnalyzer::processPacket(const unsigned char *packet, uint64_t timeUs) {
+    if (packet[1] & 0x80) {
+        // The header may be corrupted as well
+        count(TRANSPORT_ERROR);
+        return;
+    }
+
+    unsigned pid = GET_PID(packet);
+    if (pid == NULL_PACKET_PID) {
+        return;
+    }
+
+    auto &state = mPids[pid];
+    checkContinuity(state, packet);
+
+    if (pid == 0) {
+        checkTable(mPat, packet, 0x00, PAT_ERROR, PAT_INTERVAL, HEALTH_PAT_MAX_INTERVAL_US, timeUs);
+    }
+
+    if (state.flags & PID_PMT) {
+        auto it = mPmts.find(pid);
+        if (it != mPmts.end()) {
+            checkTable(it->second, packet, 0x02, PMT_ERROR, PMT_INTERVAL, HEALTH_PMT_MAX_INTERVAL_US, timeUs);
+        }
+    }
+
+    if (state.flags & PID_PCR) {
+        checkPcr(pid, packet, timeUs);
+    }
+}
+
+void StreamAnalyzer::checkContinuity(PidState &pid, const unsigned char *packet) {
+    unsigned afc = (packet[3] >> 4) & 0x3;
+    int cc = packet[3] & 0x0F;
+    bool discontinuity = (afc & 0x2) && packet[4] > 0 && (packet[5] & 0x80);
+
+    if (discontinuity) {
+        pid.lastCc = cc;
+        pid.repeats = 0;
+        return;
+    }
+
+    // The counter is only incremented with payload
+    if (!(afc & 0x1)) {
+        return;
+    }
+
+    if (pid.lastCc < 0) {
+        pid.lastCc = cc;
+        return;
+    }
+
+    if (cc == pid.lastCc) {
+        // A packet may be sent twice
+        if (++pid.repeats > 1) {
+            pid.ccErrors++;
+            count(CC_ERROR);
+        }
+        return;
+    }
+
+    if (cc != ((pid.lastCc + 1) & 0x0F)) {
+        pid.ccErrors++;
+        count(CC_ERROR);
+    }
+    pid.lastCc = cc;
+    pid.repeats = 0;
+}
+
+void StreamAnalyzer::checkTable(TableState &table, const unsigned char *packet, unsigned tableId,
+                                Counter error, Maximum interval, uint64_t maxUs, uint64_t timeUs) {
+    // PSI is never scrambled
+    if (TSC_ISSET(packet)) {
+        count(error);
+        return;
+    }
+
+    table.assembler.push(packet);
+    const unsigned char *section;
+    size_t length;
+    while (table.assembler.nextSection(section, length)) {
+        if (section[0] != tableId || length < PSI_SECTION_MIN_SIZE) {
+            continue;
+        }
+        if (tableId == 0x00) {
+            parsePat(section, length);
+        } else {
+            parsePmt(table, section);
+        }
+    }
+
+    auto crcErrors = table.assembler.getStats().crcErrors;
+    count(CRC_ERROR, crcErrors - table.crcErrors);
+    table.crcErrors = crcErrors;
+
+    unsigned afc = (packet[3] >> 4) & 0x3;
+    if (!(packet[1] & 0x40) || !(afc & 0x1)) {
+        return;
+    }
+
+    // Table of the first section starting in the packet
+    size_t pos = (afc & 0x2) ? 5 + packet[4] : 4;
+    if (pos < TS_PACKAGE_SIZE) {
+        pos += 1 + packet[pos];
+    }
+    if (pos >= TS_PACKAGE_SIZE || packet[pos] == 0xFF) {
+        return;
+    }
+
+    if (packet[pos] != tableId) {
+        count(error);
+        return;
+    }
+
+    uint64_t elapsed = elapsedUs(table.lastUs, timeUs);
+    if (table.seen) {
+        updateMax(interval, elapsed);
+    }
+    if (elapsed > maxUs && !table.late) {
+        count(error);
+    }
+    table.lastUs = timeUs;
+    table.late = false;
+    table.seen = true;
+}
+
+void StreamAnalyzer::checkMissing(TableState &table, Counter error, uint64_t maxUs, uint64_t nowUs) {
+    if (!table.late && elapsedUs(table.lastUs, nowUs) > maxUs) {
+        table.late = true;
+        count(error);
+    }
+}
+
+void StreamAnalyzer::checkPcr(unsigned pid, const unsigned char *packet, uint64_t timeUs) {
+    uint64_t pcr;
+    bool discontinuity;
+    if (!PcrTracker::readPcr(packet, pcr, discontinuity)) {
+        return;
+    }
+
+    auto &state = mPcrs[pid];
+    if (state.valid && !discontinuity) {
+        // A PCR going back shows up as a large delta
+        uint64_t deltaUs = ((pcr + PCR_WRAP - state.pcr) % PCR_WRAP) * 1000000 / PCR_CLOCK_HZ;
+        if (deltaUs > HEALTH_PCR_MAX_DELTA_US) {
+            count(PCR_DISCONTINUITY_ERROR);
+        } else {
+            updateMax(PCR_INTERVAL, deltaUs);
+            if (deltaUs > HEALTH_PCR_MAX_INTERVAL_US) {
+                count(PCR_REPETITION_ERROR);
+            }
+            uint64_t arrivalUs = elapsedUs(state.timeUs, timeUs);
+            updateMax(PCR_JITTER, arrivalUs > deltaUs ? arrivalUs - deltaUs : deltaUs - arrivalUs);
+        }
+    }
+
+    state.valid = true;
+    state.pcr = pcr;
+    state.timeUs = timeUs;
+}
+
+void StreamAnalyzer::parsePat(const unsigned char *section, size_t length) {
+    std::map<unsigned, TableState> previous;
+
+    // section_number 0 starts a new program list
+    if (section[6] == 0) {
+        for (auto &it : mPmts) {
+            mPids[it.first].flags &= ~PID_PMT;
+        }
+        previous.swap(mPmts);
+    }
+
+    for (size_t i = 8; i + 4 <= length - 4; i += 4) {
+        unsigned program = (section[i] << 8) | section[i + 1];
+        unsigned pid = ((section[i + 2] & 0x1F) << 8) | section[i + 3];
+        // Network PID
+        if (program == 0 || pid == 0 || pid == NULL_PACKET_PID) {
+            continue;
+        }
+
+        // Keep the timing of PMTs still listed
+        auto node = previous.extract(pid);
+        if (!node.empty()) {
+            mPmts.insert(std::move(node));
+        } else if (mPmts.find(pid) == mPmts.end()) {
+            mPmts[pid].lastUs = mNowUs;
+        }
+        mPids[pid].flags |= PID_PMT;
+    }
+
+    updatePcrPids();
+}
+
+void StreamAnalyzer::parsePmt(TableState &pmt, const unsigned char *section) {
+    unsigned pcrPid = ((section[8] & 0x1F) << 8) | section[9];
+
+    if (pcrPid != pmt.pcrPid) {
+        pmt.pcrPid = pcrPid;
+        updatePcrPids();
+    }
+}
+
+void StreamAnalyzer::updatePcrPids() {
+    std::map<unsigned, PcrState> pcrs;
+
+    for (auto &it : mPcrs) {
+        mPids[it.first].flags &= ~PID_PCR;
+    }
+
+    for (auto &it : mPmts) {
+        unsigned pid = it.second.pcrPid;
+        // 0x1FFF: no PCR in the program
+        if (pid >= NULL_PACKET_PID) {
+            continue;
+        }
+        auto node = mPcrs.extract(pid);
+        if (!node.empty()) {
+            pcrs.insert(std::move(node));
+        } else {
+            pcrs.emplace(pid, PcrState());
+        }
+        mPids[pid].flags |= PID_PCR;
+    }
+
+    mPcrs.swap(pcrs);
+}
+
+void StreamAnalyzer::restart(uint64_t nowUs) {
+    for (auto &pid : mPids) {
+        pid.lastCc = -1;
+        pid.repeats = 0;
+    }
+
+    auto restartTable = [nowUs](TableState &table) {
+        table.lastUs = nowUs;
+        table.late = false;
+        table.seen = false;
+        table.assembler.reset();
+    };
+    restartTable(mPat);
+    for (auto &it : mPmts) {
+        restartTable(it.second);
+    }
+
+    for (auto &it : mPcrs) {
+        it.second.valid = false;
+    }
+
+    mPacketUs = 0;
+    mStarted = true;
+}
+
+void StreamAnalyzer::count(Counter counter, uint64_t n) {
+    if (n == 0) {
+        return;
+    }
+    mTotal[counter] += n;
+    currentBucket().counts[counter] += n;
+}
+
+void StreamAnalyzer::updateMax(Maximum maximum, uint64_t value) {
+    mMax[maximum] = std::max(mMax[maximum], value);
+    auto &bucket = currentBucket();
+    bucket.max[maximum] = std::max(bucket.max[maximum], value);
+}
+
+StreamAnalyzer::Bucket &StreamAnalyzer::currentBucket() {
+    uint64_t second = mNowUs / 1000000;
+    auto &bucket = mWindow[second % STREAM_HEALTH_WINDOW_S];
+
+    if (bucket.second != second) {
+        bucket = Bucket();
+        bucket.second = second;
+    }
+    return bucket;
+}
+
+} //namespace StreamParser
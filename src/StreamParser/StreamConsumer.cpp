@@ -27,8 +27,8 @@ StreamConsumer::~StreamConsumer() {
 
 }
 
-StreamConsumer::StreamConsumer(const char *name, bool async) : mName(name) {
-    UNUSED(async);
+StreamConsumer::StreamConsumer(const char *name, bool async, QueuePolicy policy)
+        : mName(name), mAsync(async), mQueuePolicy(policy) {
 }
 
 } //namespace StreamParser
@@ -19,25 +19,190 @@
 
 
 #include "StreamParser/StreamProcessor.h"
+#include <glog/logging.h>
+#include <algorithm>
+
+StreamParser::StreamProcessor::StreamProcessor(std::initializer_list<std::shared_ptr<StreamConsumer>> consumers)
+        : StreamProcessor(nullptr, consumers) {
+}
+
+StreamParser::StreamProcessor::StreamProcessor(std::unique_ptr<PipelineStage> fixedStage,
+                                               std::initializer_list<std::shared_ptr<StreamConsumer>> consumers)
+        : mFixedStage(std::move(fixedStage)),
+          mChunkPool(ChunkPool::create(0, CHUNK_POOL_MAX_SIZE)) {
+    auto list = std::make_shared<ConsumerList>();
+    for (auto &it : consumers) {
+        list->push_back(createEntry(it));
+    }
+    mConsumers = list;
+}
+
+StreamParser::StreamProcessor::~StreamProcessor() = default;
+
+StreamParser::StreamProcessor::Entry
+StreamParser::StreamProcessor::createEntry(const std::shared_ptr<StreamConsumer> &consumer) {
+    return {consumer, consumer->isAsync()
+                      ? std::make_shared<ConsumerWorker>(consumer, STREAM_CONSUMER_QUEUE_SIZE)
+                      : nullptr};
+}
+
+StreamParser::StreamProcessor::ConsumerListPtr StreamParser::StreamProcessor::getConsumers() const {
+    std::lock_guard<std::mutex> lock(mListMtx);
+    return mConsumers;
+}
+
+StreamParser::StreamProcessor::ConsumerListPtr StreamParser::StreamProcessor::publish(ConsumerListPtr list) {
+    std::lock_guard<std::mutex> lock(mListMtx);
+    mConsumers.swap(list);
+    return list;
+}
+
+void StreamParser::StreamProcessor::waitForPosts() {
+    // The post in flight holds mPostMtx, the following ones use the new list
+    std::lock_guard<std::mutex> lock(mPostMtx);
+}
 
 void StreamParser::StreamProcessor::post(const StreamParser::Buffer &buf) const {
-    for (auto &s : mSCons) {
-        s->post(buf);
+    std::lock_guard<std::mutex> postGuard(mPostMtx);
+    if (mFixedStage != nullptr) {
+        mFixedStage->post(buf);
+    }
+
+    auto consumers = getConsumers();
+    StreamParser::Buffer pooled;
+
+    for (auto &it : *consumers) {
+        if (it.worker != nullptr) {
+            it.worker->post(pooledBuffer(buf, pooled, *mChunkPool));
+        } else {
+            it.consumer->post(buf);
+            it.consumer->join();
+        }
+    }
+}
+
+void StreamParser::StreamProcessor::join() const {
+    if (mFixedStage != nullptr) {
+        mFixedStage->join();
+    }
+
+    auto consumers = getConsumers();
+    for (auto &it : *consumers) {
+        if (it.worker != nullptr) {
+            it.worker->join();
+        }
+    }
+}
+
+std::vector<StreamParser::ConsumerQueueStats> StreamParser::StreamProcessor::getQueueStats() const {
+    auto consumers = getConsumers();
+    std::vector<ConsumerQueueStats> stats;
+    if (mFixedStage != nullptr) {
+        mFixedStage->getQueueStats(stats);
+    }
+    for (auto &it : *consumers) {
+        if (it.worker != nullptr) {
+            stats.push_back(it.worker->getStats());
+        }
+    }
+    return stats;
+}
+
+void StreamParser::StreamProcessor::attach(const std::shared_ptr<StreamConsumer> &consumer) {
+    std::lock_guard<std::mutex> lock(mUpdateMtx);
+    auto entry = createEntry(consumer);
+
+    // Late joiner. Deliver the open event before any buffer.
+    if (mStreamOpen) {
+        if (entry.worker != nullptr) {
+            entry.worker->onOpen(mChannel.c_str());
+        } else {
+            consumer->onOpen(mChannel.c_str());
+        }
+    }
+
+    auto list = std::make_shared<ConsumerList>(*getConsumers());
+    list->push_back(std::move(entry));
+    // The old list holds a subset of the new one and may be released
+    // by the last reader
+    publish(list);
+
+    LOG(INFO) << "Attached stream consumer " << consumer->getName();
+}
+
+bool StreamParser::StreamProcessor::detach(const std::shared_ptr<StreamConsumer> &consumer) {
+    std::lock_guard<std::mutex> lock(mUpdateMtx);
+    auto current = getConsumers();
+
+    auto it = std::find_if(current->begin(), current->end(),
+                           [&consumer](const Entry &e) { return e.consumer == consumer; });
+    if (it == current->end()) {
+        return false;
     }
 
-    for (auto &s : mSCons) {
-        s->join();
+    auto entry = *it;
+    auto list = std::make_shared<ConsumerList>();
+    for (auto &e : *current) {
+        if (e.consumer != consumer) {
+            list->push_back(e);
+        }
     }
+    current.reset();
+
+    // The consumer is not called anymore once the posts still using
+    // the old list have returned
+    publish(list);
+    waitForPosts();
+
+    if (mStreamOpen) {
+        if (entry.worker != nullptr) {
+            entry.worker->onEndOfStream(mChannel.c_str());
+        } else {
+            consumer->onEndOfStream(mChannel.c_str());
+        }
+    }
+
+    if (entry.worker != nullptr) {
+        entry.worker->join();
+    }
+
+    LOG(INFO) << "Detached stream consumer " << consumer->getName();
+    return true;
 }
 
 void StreamParser::StreamProcessor::onEndOfStream(const char *channelId) {
-    for (auto &s : mSCons) {
-        s->onEndOfStream(channelId);
+    std::lock_guard<std::mutex> lock(mUpdateMtx);
+    mStreamOpen = false;
+
+    if (mFixedStage != nullptr) {
+        mFixedStage->onEndOfStream(channelId);
+    }
+
+    auto consumers = getConsumers();
+    for (auto &it : *consumers) {
+        if (it.worker != nullptr) {
+            it.worker->onEndOfStream(channelId);
+        } else {
+            it.consumer->onEndOfStream(channelId);
+        }
     }
 }
 
 void StreamParser::StreamProcessor::onOpen(const char *channelId) {
-    for (auto &s : mSCons) {
-        s->onOpen(channelId);
+    std::lock_guard<std::mutex> lock(mUpdateMtx);
+    mStreamOpen = true;
+    mChannel = channelId != nullptr ? channelId : "";
+
+    if (mFixedStage != nullptr) {
+        mFixedStage->onOpen(channelId);
+    }
+
+    auto consumers = getConsumers();
+    for (auto &it : *consumers) {
+        if (it.worker != nullptr) {
+            it.worker->onOpen(channelId);
+        } else {
+            it.consumer->onOpen(channelId);
+        }
     }
 }
@@ -38,4 +38,8 @@ void StreamSource::onOpen(const char *channelId) {
     mSPr->onOpen(channelId);
 }
 
+std::vector<ConsumerQueueStats> StreamSource::getConsumerQueueStats() const {
+    return mSPr->getQueueStats();
+}
+
 } // namespace StreamParser
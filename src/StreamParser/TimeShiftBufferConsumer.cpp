@@ -21,6 +21,7 @@
 #include <streamfs/ByteBufferPool.h>
 #include "TimeShiftBufferConsumer.h"
 #include <glog/logging.h>
+#include <chrono>
 
 void ByteBufferPool::pushBuffer(const buffer_chunk &buffer, bool lastBuffer, size_t lastBufferSize) {
     BufferPool::pushBuffer(buffer, lastBuffer, lastBufferSize);
@@ -38,8 +39,16 @@ public:
     explicit SampleConsumer() = default;
 };
 
+// Read pacing runs on the monotonic clock, wall clock steps must not
+// stall or burst the reader
+static uint64_t pacingNowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 void TimeShiftBufferConsumer::post(const StreamParser::Buffer &buf) {
     StreamConsumer::post(buf);
+    std::lock_guard<std::mutex> ringGuard(mRingMtx);
     /**
      * TODO: need to do more testing and validation if we will not receive
      * any buffers from the previous stream;
@@ -49,8 +58,25 @@ void TimeShiftBufferConsumer::post(const StreamParser::Buffer &buf) {
         return;
     }
 
-    mTsBufProd->queueBuffer(*buf.chunk, false, 0);
-    auto bufIndexerRetValue = mBufIndexer->registerBufferCount(getTotalBufferByteCount());
+    if (buf.meta.flags & (BUFFER_FLAG_DISCONTINUITY | BUFFER_FLAG_SOURCE_SWITCH)) {
+        LOG(INFO) << "TSB chunk after " << (buf.meta.flags & BUFFER_FLAG_SOURCE_SWITCH ? "source switch" : "discontinuity")
+                  << ", lost packets: " << buf.meta.lostPackets;
+    }
+
+    getBufferProducer()->queueBuffer(*buf.chunk, false, 0);
+
+    // Index on reception time rather than processing time, so that
+    // queuing delays and back-filled stuffing do not skew the index
+    auto bufIndexerRetValue = buf.meta.ingestTimeUs != 0
+            ? mBufIndexer->registerBufferCount(getTotalBufferByteCount(), buf.meta.ingestTimeUs)
+            : mBufIndexer->registerBufferCount(getTotalBufferByteCount());
+
+    mLiveTimeUs = buf.meta.ingestTimeUs != 0 ? buf.meta.ingestTimeUs : bufferMetaTimeNowUs();
+    mChunkTimes.push_back(mLiveTimeUs);
+    indexChunk(buf);
+    if (mSpillStore) {
+        spillChunks();
+    }
 
     if (mPlayerState == PlayerStateEnum::StateType::PAUSED) {
         if (bufIndexerRetValue.first && bufIndexerRetValue.second == 1) {
@@ -73,10 +99,14 @@ void TimeShiftBufferConsumer::post(const StreamParser::Buffer &buf) {
             // offset from the live point, the delta bytes between the live
             // point and current read position is calculated and the seek
             // offset and current read position is incremented accordingly.
+            // Only the controlled reader follows the player state.
+            // Readers add and release handles under mSeekMtx.
             std::lock_guard <std::mutex> paramLock(mParamMtx);
+            std::lock_guard <std::mutex> seekGuard(mSeekMtx);
 
+            HandleContext *primary = getPrimaryContext();
             uint64_t livePos = getTotalBufferByteCount();
-            uint64_t actualPos = mHandles.begin()->second.getCurrentReadOffset();
+            uint64_t actualPos = primary ? primary->getCurrentReadOffset() : livePos;
             uint64_t deltaBytes = 0;
 
             if (livePos > actualPos)  {
@@ -86,25 +116,165 @@ void TimeShiftBufferConsumer::post(const StreamParser::Buffer &buf) {
                 mPauseTimeMonitor.updateTimeInterval();
             }
 
-            mHandles.begin()->second.incReadOffset(deltaBytes);
-
             mSeekByteOffset += deltaBytes;
 
-            uint64_t maxSize = mBufIndexer->getIndexSizeInBytes();
+            uint64_t maxSize = getSeekableByteSize(livePos);
 
             if (maxSize < mSeekByteOffset) {
                 mSeekByteOffset = maxSize;
             }
+
+            if (primary) {
+                primary->incReadOffset(deltaBytes);
+                primary->setSeekOffset(mSeekByteOffset);
+            }
         } else {
             mPauseTimeMonitor.updateTimeInterval();
         }
     }
 }
 
+void TimeShiftBufferConsumer::setPcrTracker(std::shared_ptr<PcrTracker> pcrTracker) {
+    mPcrTracker = std::move(pcrTracker);
+}
+
+void TimeShiftBufferConsumer::indexChunk(const StreamParser::Buffer &buf) {
+    if (buf.meta.flags & (BUFFER_FLAG_DISCONTINUITY | BUFFER_FLAG_SOURCE_LOSS)) {
+        mPcrDiscontinuity = true;
+    }
+
+    if (mPcrTracker == nullptr) {
+        return;
+    }
+
+    // The tracker follows the chunks after this consumer, its PIDs
+    // are the ones of the previous chunk
+    unsigned pcrPid = mPcrTracker->getPcrPid();
+    unsigned videoPid = PSI_INVALID_PID;
+    unsigned videoStreamType = 0;
+    mPcrTracker->getVideoStream(videoPid, videoStreamType);
+
+    // Stuffing carries no media time, it is scanned for the packet phase only
+    bool generated = buf.meta.flags & BUFFER_FLAG_SOURCE_LOSS;
+    if (pcrPid == PSI_INVALID_PID && videoPid == PSI_INVALID_PID) {
+        generated = true;
+    }
+
+    // One PCR per chunk keeps the media index within the TSB capacity
+    const unsigned char *data = buf.chunk->data();
+    uint64_t chunkStart = getTotalBufferByteCount() - BUFFER_CHUNK_SIZE;
+    bool found = false;
+    bool discontinuity = false;
+    uint64_t pcr = 0;
+    uint64_t pcrIndex = 0;
+
+    auto indexPacket = [&](const unsigned char *packet, uint64_t byteIndex) {
+        if (generated) {
+            return;
+        }
+
+        unsigned pid = GET_PID(packet);
+        if (pid == videoPid && PcrTracker::isRandomAccessPoint(packet, videoStreamType)) {
+            mBufIndexer->registerRandomAccessPoint(byteIndex);
+        }
+
+        uint64_t packetPcr;
+        bool packetDiscontinuity;
+        if (pid == pcrPid && PcrTracker::readPcr(packet, packetPcr, packetDiscontinuity)) {
+            found = true;
+            discontinuity |= packetDiscontinuity;
+            pcr = packetPcr;
+            pcrIndex = byteIndex;
+        }
+    };
+
+    // Complete the packet started in the previous chunk if the next one
+    // follows at the expected position
+    size_t pos = mIndexPhase;
+    if (mIndexPartialLen > 0 && data[pos] == 0x47) {
+        memcpy(mIndexPartial.data() + mIndexPartialLen, data, pos);
+        indexPacket(mIndexPartial.data(), chunkStart - mIndexPartialLen);
+    }
+    mIndexPartialLen = 0;
+
+    while (pos + TS_PACKAGE_SIZE <= BUFFER_CHUNK_SIZE) {
+        if (data[pos] != 0x47) {
+            pos = findIndexSync(data, pos + 1);
+            continue;
+        }
+        indexPacket(data + pos, chunkStart + pos);
+        pos += TS_PACKAGE_SIZE;
+    }
+
+    // Keep the head of a packet spanning into the next chunk
+    if (pos < BUFFER_CHUNK_SIZE && data[pos] == 0x47) {
+        mIndexPartialLen = BUFFER_CHUNK_SIZE - pos;
+        memcpy(mIndexPartial.data(), data + pos, mIndexPartialLen);
+        mIndexPhase = TS_PACKAGE_SIZE - mIndexPartialLen;
+    } else {
+        mIndexPhase = 0;
+    }
+
+    if (found) {
+        mBufIndexer->registerPcr(pcrIndex, pcr, discontinuity || mPcrDiscontinuity);
+        mPcrDiscontinuity = false;
+    }
+}
+
+size_t TimeShiftBufferConsumer::findIndexSync(const unsigned char *data, size_t pos) {
+    // A sync byte followed by another one a packet later, the last
+    // packet of the chunk is accepted on its own sync byte
+    for (; pos < BUFFER_CHUNK_SIZE; pos++) {
+        if (data[pos] == 0x47 && (pos + TS_PACKAGE_SIZE >= BUFFER_CHUNK_SIZE || data[pos + TS_PACKAGE_SIZE] == 0x47)) {
+            break;
+        }
+    }
+    return pos;
+}
+
+void TimeShiftBufferConsumer::spillChunks() {
+    uint64_t liveChunk = getTotalBufferByteCount() / BUFFER_CHUNK_SIZE;
+    uint64_t ramChunks = (mBufIndexer->getIndexSizeInBytes() + BUFFER_CHUNK_SIZE - 1) / BUFFER_CHUNK_SIZE;
+    uint64_t ringChunks = std::min<uint64_t>(getRingByteSize() / BUFFER_CHUNK_SIZE, mChunkTimes.size());
+
+    // Chunks leaving the seek window, if a reader has not read them yet.
+    // They are read from the ring until they leave it, which leaves the
+    // tail of the ring for the disk write. Chunks not in the ring
+    // anymore are lost.
+    uint64_t spillFrom = mSpillFrom;
+    mSpillNext = std::max(mSpillNext, liveChunk - ringChunks);
+    for (; mSpillNext + ramChunks < liveChunk; mSpillNext++) {
+        if (spillFrom >= (mSpillNext + 1) * BUFFER_CHUNK_SIZE) {
+            continue;
+        }
+        uint64_t byteIndex = mSpillNext * BUFFER_CHUNK_SIZE;
+        if (readRing((char *) mSpillChunk.data(), BUFFER_CHUNK_SIZE, byteIndex) == BUFFER_CHUNK_SIZE) {
+            mSpillStore->append(mSpillChunk.data(), BUFFER_CHUNK_SIZE, byteIndex,
+                                mChunkTimes[mChunkTimes.size() - (liveChunk - mSpillNext)]);
+        }
+    }
+}
+
+void TimeShiftBufferConsumer::updateSpillFrom() {
+    uint64_t spillFrom = UINT64_MAX;
+    for (auto& kv : mHandles) {
+        spillFrom = std::min(spillFrom, kv.second.getPosition());
+    }
+    mSpillFrom = spillFrom;
+}
+
 bool TimeShiftBufferConsumer::setTrickPlaySpeed(int16_t speed) {
     std::lock_guard<std::mutex> paramGuard(mTrickPlaySpeedMtx);
     if (speed && speed != mTrickPlaySpeed) {
         mTrickPlaySpeed = speed;
+        if (speed != 1) {
+            if (mIFrameTrickPlay) {
+                std::lock_guard<std::mutex> seekGuard(mSeekMtx);
+                mIFrameSpeed = speed;
+            } else {
+                startIFrameTrickPlay(speed);
+            }
+        }
         mTrickPlayTimer->start();
         updateTrickPlayFile();
         return true;
@@ -121,8 +291,14 @@ bool TimeShiftBufferConsumer::updateTrickPlayPosition() {
     std::lock_guard<std::mutex> paramGuard(mTrickPlaySpeedMtx);
     bool stopTrickPlay = true;
 
+    if (mIFrameTrickPlay || mIFrameStopped) {
+        return updateIFrameTrickPlay();
+    }
+
     time_t currentSeek = getSeekTime();
     time_t newSeek = 0;
+    // Snap in the direction of play so that each step makes progress
+    bool forward = mTrickPlaySpeed > 1;
 
     if (mTrickPlaySpeed == 1) {
         newSeek = currentSeek;
@@ -154,11 +330,9 @@ bool TimeShiftBufferConsumer::updateTrickPlayPosition() {
         }
     }
 
-    mRingBufferPool->enableReadThrottling(stopTrickPlay);
-    setSeekTime(newSeek);
-    // Flush gstreamer pipeline
-    std::string sCh = "seek change";
-    *mFlush = ByteVectorType(sCh.begin(), sCh.end());
+    getRingBufferPool()->enableReadThrottling(stopTrickPlay);
+    seek(newSeek, forward);
+    notifyFlush();
 
     if (mTrickPlaySpeed == 1) {
         updateTrickPlayFile();
@@ -167,15 +341,153 @@ bool TimeShiftBufferConsumer::updateTrickPlayPosition() {
     return stopTrickPlay;
 }
 
+bool TimeShiftBufferConsumer::startIFrameTrickPlay(int16_t speed) {
+    unsigned videoPid;
+    unsigned streamType;
+    if (mPcrTracker == nullptr || !mPcrTracker->getVideoStream(videoPid, streamType)) {
+        return false;
+    }
+    if (mPcrTracker->isVideoScrambled()) {
+        LOG(INFO) << "Scrambled video, trick play by seeking";
+        return false;
+    }
+
+    std::lock_guard<std::mutex> seekGuard(mSeekMtx);
+
+    uint64_t live = getTotalBufferByteCount();
+    HandleContext *primary = getPrimaryContext();
+    uint64_t byteOffset = primary ? live - primary->getPosition() : mSeekByteOffset.load();
+
+    if (mBufIndexer->snapToRandomAccessPoint(byteOffset, false) != BUF_OK) {
+        LOG(INFO) << "No random access point, trick play by seeking";
+        return false;
+    }
+
+    mTrickPlayPos = live - byteOffset;
+    mIFrameSpeed = speed;
+    mTrickPlayStart = true;
+    mTrickPlayStream.reset();
+    mIFrameStopped = false;
+    mIFrameTrickPlay = true;
+    mReadPacer.reset();
+
+    getRingBufferPool()->enableReadThrottling(false);
+    notifyFlush();
+
+    LOG(INFO) << "I-frame trick play, speed=" << speed << " seekByteOffset=" << byteOffset;
+    return true;
+}
+
+bool TimeShiftBufferConsumer::updateIFrameTrickPlay() {
+    {
+        std::lock_guard<std::mutex> seekGuard(mSeekMtx);
+        if (mIFrameTrickPlay) {
+            if (mTrickPlaySpeed != 1) {
+                return false;
+            }
+            // Play on from the I-frame shown last
+            stopIFrameTrickPlay(getTotalBufferByteCount() - mTrickPlayPos);
+        }
+        mIFrameStopped = false;
+    }
+
+    mTrickPlaySpeed = 1;
+    getRingBufferPool()->enableReadThrottling(true);
+    notifyFlush();
+    updateTrickPlayFile();
+    return true;
+}
+
+bool TimeShiftBufferConsumer::nextTrickPlayFrame() {
+    uint64_t live = getTotalBufferByteCount();
+    uint64_t byteOffset = live - mTrickPlayPos;
+    bool forward = mIFrameSpeed > 0;
+
+    if (!mTrickPlayStart) {
+        // Media time shown per frame at the requested speed
+        uint64_t stepUs = (uint64_t) TRICK_PLAY_RATE_MS * 1000 * std::abs(mIFrameSpeed);
+        uint64_t seekUs = 0;
+        mBufIndexer->getTimeUsFromByteOffset(byteOffset, seekUs);
+
+        if (forward && seekUs <= stepUs) {
+            stopIFrameTrickPlay(0);
+            return false;
+        }
+
+        uint64_t targetOffset;
+        if (mBufIndexer->getByteOffsetFromTimeUs(forward ? seekUs - stepUs : seekUs + stepUs, targetOffset) != BUF_OK) {
+            stopIFrameTrickPlay(byteOffset);
+            return false;
+        }
+
+        // At least the next random access point in the direction of play
+        targetOffset = forward ? std::min(targetOffset, byteOffset - 1) : std::max(targetOffset, byteOffset + 1);
+        if (mBufIndexer->snapToRandomAccessPoint(targetOffset, forward) != BUF_OK) {
+            stopIFrameTrickPlay(forward ? 0 : byteOffset);
+            return false;
+        }
+
+        byteOffset = targetOffset;
+        mTrickPlayPos = live - byteOffset;
+    }
+    mTrickPlayStart = false;
+
+    unsigned videoPid = PSI_INVALID_PID;
+    unsigned streamType = 0;
+    mPcrTracker->getVideoStream(videoPid, streamType);
+    unsigned pcrPid = mPcrTracker->getPcrPid();
+
+    // The access unit may not be complete at the live point
+    size_t frameSize = std::min<uint64_t>(TRICK_PLAY_MAX_FRAME_SIZE, byteOffset);
+    mTrickPlayFrame.resize(frameSize);
+    size_t readSize = readRing((char *) mTrickPlayFrame.data(), frameSize, mTrickPlayPos);
+
+    if (!mTrickPlayStream.addFrame(mTrickPlayFrame.data(), readSize, videoPid,
+                                   pcrPid != PSI_INVALID_PID ? pcrPid : videoPid)) {
+        if (mTrickPlayStream.isScrambled()) {
+            // Trick play continues by seeking from this frame
+            LOG(INFO) << "Scrambled I-frame at " << mTrickPlayPos << ", trick play by seeking";
+            mIFrameTrickPlay = false;
+            mTrickPlayStream.reset();
+            setSeekByteOffset(byteOffset);
+            return false;
+        }
+        LOG(WARNING) << "No complete I-frame at " << mTrickPlayPos;
+        stopIFrameTrickPlay(forward ? 0 : byteOffset);
+        return false;
+    }
+    return true;
+}
+
+void TimeShiftBufferConsumer::stopIFrameTrickPlay(uint64_t byteOffset) {
+    mIFrameTrickPlay = false;
+    mIFrameStopped = true;
+    mTrickPlayStream.reset();
+    setSeekByteOffset(byteOffset);
+
+    LOG(INFO) << "I-frame trick play stopped, seekByteOffset=" << byteOffset;
+}
+
+void TimeShiftBufferConsumer::notifyFlush() {
+    // Flush gstreamer pipeline
+    std::string sCh = "seek change";
+    *mFlush = ByteVectorType(sCh.begin(), sCh.end());
+}
+
 void TimeShiftBufferConsumer::updateTrickPlayFile() {
     std::string trickPlaySpeedString = std::to_string(mTrickPlaySpeed);
     *mTrickPlayFile = ByteVectorType(trickPlaySpeedString.begin(), trickPlaySpeedString.end());
 }
 
 bool TimeShiftBufferConsumer::setSeekTime(time_t seekTime) {
+    return seek(seekTime, false);
+}
+
+bool TimeShiftBufferConsumer::seek(time_t seekTime, bool forward) {
     std::lock_guard<std::mutex> seekGuard(mSeekMtx);
 
-    uint64_t maxSeekTime = mBufIndexer->getIndexSizeInTimeUs() / 1e3;
+    uint64_t ramSeekTime = mBufIndexer->getIndexSizeInTimeUs() / 1e3;
+    uint64_t maxSeekTime = getSeekableTime();
 
     if ((uint64_t) seekTime > maxSeekTime) {
         LOG(WARNING) << __FUNCTION__ << ": seekTime=" << seekTime << " is out of range!"
@@ -184,17 +496,43 @@ bool TimeShiftBufferConsumer::setSeekTime(time_t seekTime) {
     }
 
     uint64_t byteOffset;
-    switch (mBufIndexer->getByteOffsetFromTimeUs(seekTime * 1e3, byteOffset)) {
-        case BUF_OK:
-            break;
-        case BUF_OUT_OF_RANGE:
-            LOG(WARNING) << __FUNCTION__ << " Invalid seek time";
-            return false;
-        case BUF_EMPTY:
-            LOG(WARNING) << __FUNCTION__ << " Buffer is empty";
-            return false;
+    if ((uint64_t) seekTime > ramSeekTime && getSpillByteOffset(seekTime * 1e3, byteOffset)) {
+        LOG(INFO) << __FUNCTION__ << ": seek time=" << seekTime << " on disk";
+    } else {
+        switch (mBufIndexer->getByteOffsetFromTimeUs(seekTime * 1e3, byteOffset)) {
+            case BUF_OK:
+                break;
+            case BUF_OUT_OF_RANGE:
+                LOG(WARNING) << __FUNCTION__ << " Invalid seek time";
+                return false;
+            case BUF_EMPTY:
+                LOG(WARNING) << __FUNCTION__ << " Buffer is empty";
+                return false;
+        }
+    }
+
+    // Start at a random access point, so that the player can show a
+    // picture without decoding up to a GOP first
+    if (byteOffset != 0) {
+        mBufIndexer->snapToRandomAccessPoint(byteOffset, forward);
+    }
+
+    // I-frame trick play continues from the new position
+    if (mIFrameTrickPlay) {
+        mTrickPlayPos = getTotalBufferByteCount() - byteOffset;
+        mTrickPlayStart = true;
     }
 
+    setSeekByteOffset(byteOffset);
+
+    LOG(INFO) << __FUNCTION__ << ": set seek time=" << seekTime
+              << " --> seekByteOffset=" << mSeekByteOffset
+              << " max.seek time=" << maxSeekTime;
+
+    return true;
+}
+
+void TimeShiftBufferConsumer::setSeekByteOffset(uint64_t byteOffset) {
     // Set member variables holding the current seek time and byte offset
     mSeekByteOffset = byteOffset;
 
@@ -202,12 +540,19 @@ bool TimeShiftBufferConsumer::setSeekTime(time_t seekTime) {
     mBufferReadWatchdog->clear();
     mPauseTimeMonitor.reset();
 
+    // Paced reads start with a full burst at the new position
+    mReadPacer.reset();
+    mReadPacingCv.notify_all();
+
     // Initialize the accumulated player read offset to point at
     // live position, which is at the byte offset position equal
-    // to the total buffer pool size in bytes.
-    uint64_t bufferSize = getTotalBufferByteCount();
-    for (auto& kv : mHandles) {
-        kv.second.initReadOffset(bufferSize);
+    // to the total buffer pool size in bytes. Other readers keep
+    // their position.
+    HandleContext *primary = getPrimaryContext();
+    if (primary) {
+        primary->initReadOffset(getTotalBufferByteCount());
+        primary->setSeekOffset(byteOffset);
+        updateSpillFrom();
     }
 
     // Restart buffer read watchdog if seek is initiated during
@@ -216,27 +561,34 @@ bool TimeShiftBufferConsumer::setSeekTime(time_t seekTime) {
     if (mPlayerState == PlayerStateEnum::StateType::PAUSED) {
         mBufferReadWatchdog->start();
     }
+}
 
-    LOG(INFO) << __FUNCTION__ << ": set seek time=" << seekTime
-              << " --> seekByteOffset=" << mSeekByteOffset
-              << " max.seek time=" << maxSeekTime;
-
-    return true;
+HandleContext *TimeShiftBufferConsumer::getPrimaryContext() {
+    if (!mHasPrimary) {
+        return nullptr;
+    }
+    auto ctx = mHandles.find(mPrimaryHandle);
+    return ctx != mHandles.end() ? &ctx->second : nullptr;
 }
 
 uint64_t TimeShiftBufferConsumer::getTimestampUsForCurrentByteReadIndex() {
-    uint64_t actualPos = mHandles.begin()->second.getCurrentReadOffset() - mSeekByteOffset;
+    HandleContext *primary = getPrimaryContext();
+    uint64_t actualPos = primary ? primary->getPosition() : getTotalBufferByteCount() - mSeekByteOffset;
     uint64_t time = 0;
     mBufIndexer->getTimestampUsForByteIndex(actualPos,time);
     return time;
 }
 
 time_t TimeShiftBufferConsumer::getSeekTime() {
-    std::lock_guard<std::mutex> paramGuard(mParamMtx);
+    std::lock_guard<std::mutex> seekGuard(mSeekMtx);
     uint64_t seekTime = 0;
 
-    // Get the corresponding seek time based on current seek byte offset.
-    mBufIndexer->getTimeUsFromByteOffset(mSeekByteOffset,seekTime);
+    // Get the corresponding seek time based on current seek byte offset,
+    // or on the I-frame shown during I-frame trick play.
+    uint64_t byteOffset = mIFrameTrickPlay ? getTotalBufferByteCount() - mTrickPlayPos : mSeekByteOffset.load();
+    if (mBufIndexer->getTimeUsFromByteOffset(byteOffset,seekTime) == BUF_OUT_OF_RANGE) {
+        getSpillTimeUs(byteOffset, seekTime);
+    }
     seekTime += mPauseTimeMonitor.getAccumulatedTimeInMicroSeconds();
 
     return (seekTime / 1e3);
@@ -272,11 +624,24 @@ PlayerStateEnum::StateType TimeShiftBufferConsumer::getPlayerState() const {
 }
 
 time_t TimeShiftBufferConsumer::getMaxSeekTime() {
-    return mBufIndexer->getIndexSizeInTimeUs() / 1e3;
+    std::lock_guard<std::mutex> seekGuard(mSeekMtx);
+    return getSeekableTime();
+}
+
+time_t TimeShiftBufferConsumer::getSeekableTime() {
+    uint64_t timeUs = mBufIndexer->getIndexSizeInTimeUs();
+    uint64_t spillTimeUs;
+    uint64_t byteIndex;
+
+    auto &spillStore = mSpillStore;
+    if (spillStore && spillStore->getFront(byteIndex, spillTimeUs)) {
+        timeUs = std::max(timeUs, mLiveTimeUs - std::min<uint64_t>(spillTimeUs, mLiveTimeUs));
+    }
+    return timeUs / 1e3;
 }
 
 size_t TimeShiftBufferConsumer::readData(uint64_t handle, char *data, size_t size) {
-    std::lock_guard<std::mutex> seekGuard(mSeekMtx);
+    std::unique_lock<std::mutex> seekGuard(mSeekMtx);
     auto ctx = mHandles.find(handle);
 
     if (ctx == mHandles.end()) {
@@ -284,20 +649,99 @@ size_t TimeShiftBufferConsumer::readData(uint64_t handle, char *data, size_t siz
         mHandles[handle] = tCtx;
         ctx = mHandles.find(handle);
         ctx->second.initReadOffset(getTotalBufferByteCount());
+
+        // The first reader follows seek, trick play and player state,
+        // further readers (recording, PIP) start at live
+        if (getPrimaryContext() == nullptr) {
+            mPrimaryHandle = handle;
+            mHasPrimary = true;
+            ctx->second.setSeekOffset(mSeekByteOffset);
+        }
         LOG(INFO) << "Added new context for file handle: " << handle << " readOffset = "
-        << ctx->second.getCurrentReadOffset() << " seekOffset = " << mSeekByteOffset;
+        << ctx->second.getCurrentReadOffset() << " seekOffset = " << ctx->second.getSeekOffset()
+        << (handle == mPrimaryHandle ? " (controlled)" : "");
     }
 
-    auto& hCtx = ctx->second;
+    // Catch-up and trick play at the configured multiple of real time,
+    // I-frames are paced as a whole
+    bool paced = handle == mPrimaryHandle && mReadPacer.isEnabled();
+    if (paced && (!mIFrameTrickPlay || mTrickPlayStream.empty())) {
+        if (!waitForReadCredit(seekGuard, handle)) {
+            return 0;
+        }
+        ctx = mHandles.find(handle);
+    }
+
+    bool primary = handle == mPrimaryHandle;
+    paced &= primary;
+    if (primary && mIFrameTrickPlay) {
+        if (mTrickPlayStream.empty() && nextTrickPlayFrame() && paced) {
+            mReadPacer.consume(TRICK_PLAY_RATE_MS * 1000);
+        }
+        if (!mTrickPlayStream.empty()) {
+            return mTrickPlayStream.read(data, size);
+        }
+    }
+
+    HandleContext *hCtx = &ctx->second;
+
+    // A reader left behind by the ring continues at its oldest data
+    uint64_t live = getTotalBufferByteCount();
+    uint64_t maxSize = getSeekableByteSize(live);
+    if (!primary && live - hCtx->getPosition() > maxSize) {
+        LOG(WARNING) << "Reader " << handle << " overrun by " << live - hCtx->getPosition() - maxSize << " bytes";
+        hCtx->setSeekOffset(hCtx->getCurrentReadOffset() - (live - maxSize));
+    }
+
+    uint64_t bufferPoolOffset = hCtx->getPosition();
+    size_t readSize = 0;
+
+    // Data older than the ring is read from disk, without mSeekMtx so
+    // that slow storage does not stall post
+    uint64_t ramSize = mBufIndexer->getIndexSizeInBytes();
+    if (mSpillStore && live - bufferPoolOffset > getRingByteSize()) {
+        auto spillStore = mSpillStore;
+        seekGuard.unlock();
+        readSize = spillStore->read(data, size, bufferPoolOffset);
+        seekGuard.lock();
+
+        // Released or moved by a seek meanwhile
+        ctx = mHandles.find(handle);
+        if (ctx == mHandles.end() || ctx->second.getPosition() != bufferPoolOffset) {
+            return 0;
+        }
+        hCtx = &ctx->second;
+        primary = mHasPrimary && handle == mPrimaryHandle;
+        paced &= primary;
+        live = getTotalBufferByteCount();
+        ramSize = mBufIndexer->getIndexSizeInBytes();
+
+        if (readSize == 0) {
+            // Dropped or overwritten on disk, continue at the oldest data in RAM
+            LOG(WARNING) << "Reader " << handle << " position " << bufferPoolOffset << " not on disk";
+            hCtx->setSeekOffset(hCtx->getCurrentReadOffset() - (live - ramSize));
+            if (primary) {
+                mSeekByteOffset = ramSize;
+            }
+            bufferPoolOffset = hCtx->getPosition();
+        }
+    }
 
-    uint64_t bufferPoolOffset = hCtx.getCurrentReadOffset() - mSeekByteOffset;
-    size_t readSize = mRingBufferPool->readRandomAccess(data, size, bufferPoolOffset);
+    double usPerByte = 0;
+    if (readSize == 0) {
+        if (paced) {
+            size = getPacedReadSize(live - bufferPoolOffset, size, usPerByte);
+        }
+        readSize = readRing(data, size, bufferPoolOffset);
+    }
 
     if (readSize > 0) {
-        hCtx.incReadOffset(readSize);
+        hCtx->incReadOffset(readSize);
+        mReadPacer.consume(readSize * usPerByte);
     }
+    updateSpillFrom();
 
-    if (mPlayerState == PlayerStateEnum::StateType::PAUSED) {
+    if (primary && mPlayerState == PlayerStateEnum::StateType::PAUSED) {
         mBufferReadWatchdog->restart();
     }
 
@@ -308,15 +752,77 @@ size_t TimeShiftBufferConsumer::readData(uint64_t handle, char *data, size_t siz
     return readSize;
 }
 
+bool TimeShiftBufferConsumer::waitForReadCredit(std::unique_lock<std::mutex> &seekGuard, uint64_t handle) {
+    uint64_t waitUs;
+    while (mReadPacer.isEnabled() && (waitUs = mReadPacer.getWaitUs(getPacingTimeUs())) > 0) {
+        waitUs = std::min<uint64_t>(waitUs, READ_PACING_MAX_WAIT_MS * 1000);
+        mReadPacingCv.wait_for(seekGuard, std::chrono::microseconds(waitUs));
+        // Released, or another reader took control while unlocked
+        if (mHandles.find(handle) == mHandles.end() || !mHasPrimary || handle != mPrimaryHandle) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t TimeShiftBufferConsumer::getPacedReadSize(uint64_t byteOffset, size_t size, double &usPerByte) {
+    const uint64_t windowUs = READ_PACING_BURST_MS * 1000;
+    uint64_t windowSize;
+    usPerByte = 0;
+
+    // Not paced on disk, where the TSB is not indexed, nor close to the
+    // live point, where reads follow the source
+    if (mBufIndexer->getByteSizeForTimeUs(byteOffset, windowUs, windowSize) != BUF_OK ||
+        windowSize == 0 || windowSize >= byteOffset) {
+        return size;
+    }
+
+    usPerByte = (double) windowUs / windowSize;
+    int64_t creditUs = mReadPacer.getCreditUs(getPacingTimeUs());
+    uint64_t creditSize = creditUs > 0 ? (uint64_t) (creditUs / usPerByte) : 0;
+
+    // Whole TS packets, at least one so that reads make progress
+    creditSize = std::max<uint64_t>(creditSize / TS_PACKAGE_SIZE * TS_PACKAGE_SIZE, TS_PACKAGE_SIZE);
+    return std::min<uint64_t>(size, creditSize);
+}
+
+bool TimeShiftBufferConsumer::setReadRate(double rate) {
+    if (rate != 0 && (rate < READ_RATE_MIN || rate > READ_RATE_MAX)) {
+        return false;
+    }
+
+    mReadPacer.setRate(rate);
+    mReadPacingCv.notify_all();
+    LOG(INFO) << "Read rate set to " << rate;
+    return true;
+}
+
+double TimeShiftBufferConsumer::getReadRate() {
+    return mReadPacer.getRate();
+}
+
+void TimeShiftBufferConsumer::setPacingClock(std::function<uint64_t()> clock) {
+    std::lock_guard<std::mutex> seekGuard(mSeekMtx);
+    mPacingClock = std::move(clock);
+}
+
+uint64_t TimeShiftBufferConsumer::getPacingTimeUs() {
+    return mPacingClock ? mPacingClock() : pacingNowUs();
+}
+
 void TimeShiftBufferConsumer::onEndOfStream(const char *channelId) {
     StreamConsumer::onEndOfStream(channelId);
+    std::lock_guard<std::mutex> ringGuard(mRingMtx);
     mIsStreaming = false;
-    mRingBufferPool->clearToLastRead();
+    getRingBufferPool()->clearToLastRead();
     reset();
 }
 
 void TimeShiftBufferConsumer::onOpen(const char *channelId) {
     StreamConsumer::onOpen(channelId);
+    std::lock_guard<std::mutex> ringGuard(mRingMtx);
+    resizeBuffer();
+    updateSpillStore();
     mIsStreaming = true;
 #ifdef TS_PACKAGE_DUMP
     if (mTsDumpEnable != nullptr) {
@@ -330,21 +836,232 @@ void TimeShiftBufferConsumer::onOpen(const char *channelId) {
 }
 
 void TimeShiftBufferConsumer::release(uint64_t handle) {
+    std::lock_guard<std::mutex> seekGuard(mSeekMtx);
     mHandles.erase(handle);
+    updateSpillFrom();
+    // A paced read of the handle returns at once
+    mReadPacingCv.notify_all();
 }
 
 void TimeShiftBufferConsumer::allocateBufferQueue() {
+    mTsBufProd = std::make_shared<TsBufferProducer>();
+    mRingBufferPool = createBufferQueue(mPoolSize, mTsBufProd);
+}
+
+std::shared_ptr<ByteBufferPool> TimeShiftBufferConsumer::createBufferQueue(size_t poolSize,
+                                                                          const std::shared_ptr<TsBufferProducer> &tsBufProd) {
 
     std::shared_ptr<SampleConsumer> scons = std::make_shared<SampleConsumer>();
 
     ByteBufferPool::shared_consumer_type consumer = std::dynamic_pointer_cast<BufferConsumer<buffer_chunk>>(scons);
 
-    mTsBufProd = std::make_shared<TsBufferProducer>();
+    ByteBufferPool::shared_producer_type producer = std::dynamic_pointer_cast<BufferProducer<buffer_chunk>>(tsBufProd);
+
+    return std::make_shared<ByteBufferPool>(producer, consumer, poolSize);
+}
+
+uint64_t TimeShiftBufferConsumer::getRingByteSize() {
+    auto &producer = getBufferProducer();
+    return std::min<uint64_t>(producer->getTotalBufferCount(), mPoolSize - 1) * BUFFER_CHUNK_SIZE;
+}
 
-    ByteBufferPool::shared_producer_type producer = std::dynamic_pointer_cast<BufferProducer<buffer_chunk>>(mTsBufProd);
+size_t TimeShiftBufferConsumer::readRing(char *data, size_t size, uint64_t byteIndex) {
+    uint64_t base = getBufferProducer()->getBaseCount() * BUFFER_CHUNK_SIZE;
+    if (byteIndex < base) {
+        return 0;
+    }
+    return getRingBufferPool()->readRandomAccess(data, size, byteIndex - base);
+}
+
+bool TimeShiftBufferConsumer::copyChunks(ByteBufferPool &ring, uint64_t ringBase, TsBufferProducer &producer,
+                                         uint64_t &next, uint64_t end) {
+    std::unique_ptr<buffer_chunk> chunk(new buffer_chunk);
+    for (; next < end; next++) {
+        if (ring.readRandomAccess((char *) chunk->data(), BUFFER_CHUNK_SIZE, (next - ringBase) * BUFFER_CHUNK_SIZE)
+            != BUFFER_CHUNK_SIZE) {
+            return false;
+        }
+        producer.queueBuffer(*chunk, false, 0);
+    }
+    return true;
+}
+
+void TimeShiftBufferConsumer::resizeBuffer() {
+    uint64_t seconds;
+    uint64_t bytes;
+    getTsbSize(seconds, bytes);
+    UNUSED(bytes);
+
+    mBufIndexer->setWindowTimeUs(seconds * 1000000);
+
+    // The index is sized for the ring without memory pressure, so that
+    // the ring can grow back without clearing it
+    size_t poolSize = getTargetPoolSize(mMemoryPressure);
+    size_t indexSize = getTargetPoolSize(MemoryPressureMonitor::NONE);
+    if (poolSize == mPoolSize && indexSize == mIndexSize) {
+        updateWindow();
+        return;
+    }
+
+    LOG(INFO) << "TSB resized from " << mPoolSize << " to " << poolSize << " chunks";
+
+    // Release readers blocked on the old ring
+    mRingBufferPool->abortAllOperations();
+
+    std::lock_guard<std::mutex> paramGuard(mTrickPlaySpeedMtx);
+    std::lock_guard<std::mutex> seekGuard(mSeekMtx);
+
+    // Free the old ring before allocating the new one, so that both are
+    // not held at once
+    mRingBufferPool.reset();
+
+    mPoolSize = poolSize;
+    mIndexSize = indexSize;
+    allocateBufferQueue();
+    mBufIndexer->resize(mIndexSize, BUFFER_POOL_TAIL_SIZE);
+    updateWindow();
 
-    mRingBufferPool = std::make_shared<ByteBufferPool>(producer, consumer, BUFFER_POOL_SIZE);
+    // Byte counts restart with the new ring
+    if (mSpillStore) {
+        mSpillStore->clear();
+    }
+    for (auto& kv : mHandles) {
+        kv.second.initReadOffset(0);
+        kv.second.setSeekOffset(0);
+    }
+    updateSpillFrom();
+    mSeekByteOffset = 0;
+    mIndexPhase = 0;
+    mIndexPartialLen = 0;
+    mChunkTimes.set_capacity(mIndexSize);
+    mChunkTimes.clear();
+    mSpillNext = 0;
+}
+
+void TimeShiftBufferConsumer::updateWindow() {
+    size_t poolSize = std::min(mPoolSize, getTargetPoolSize(mMemoryPressure));
+    mBufIndexer->setWindowSize(poolSize - BUFFER_POOL_TAIL_SIZE);
+
+    LOG(INFO) << "TSB window: " << (poolSize - BUFFER_POOL_TAIL_SIZE) << " chunks";
+}
+
+size_t TimeShiftBufferConsumer::getTargetPoolSize(MemoryPressureMonitor::Level level) {
+    uint64_t seconds;
+    uint64_t bytes;
+    getTsbSize(seconds, bytes);
+    UNUSED(seconds);
+
+    bytes = std::max<uint64_t>(bytes >> level, TSB_MIN_SIZE_CHUNKS * BUFFER_CHUNK_SIZE);
+    return bytes / BUFFER_CHUNK_SIZE + BUFFER_POOL_TAIL_SIZE;
+}
 
+void TimeShiftBufferConsumer::setMemoryPressure(MemoryPressureMonitor::Level level) {
+    size_t poolSize;
+    {
+        std::lock_guard<std::mutex> ringGuard(mRingMtx);
+        if (level == mMemoryPressure) {
+            return;
+        }
+        mMemoryPressure = level;
+        LOG(WARNING) << "TSB memory pressure level: " << level;
+
+        // Medium pressure only narrows the window. Critical pressure
+        // releases the oldest part of the ring, which grows back once
+        // the pressure is gone.
+        poolSize = getTargetPoolSize(level);
+        if (!(level == MemoryPressureMonitor::CRITICAL && poolSize < mPoolSize) &&
+            !(level == MemoryPressureMonitor::NONE && poolSize > mPoolSize)) {
+            updateWindow();
+            return;
+        }
+    }
+    replaceRing(poolSize);
+}
+
+void TimeShiftBufferConsumer::replaceRing(size_t poolSize) {
+    std::shared_ptr<ByteBufferPool> oldRing;
+    std::shared_ptr<TsBufferProducer> oldProducer;
+    uint64_t next;
+    uint64_t live;
+    {
+        std::lock_guard<std::mutex> ringGuard(mRingMtx);
+        oldRing = mRingBufferPool;
+        oldProducer = mTsBufProd;
+        uint64_t base = oldProducer->getBaseCount();
+        live = base + oldProducer->getTotalBufferCount();
+        // The newest chunks held by the old ring and fitting the new window
+        next = live - std::min<uint64_t>({live - base, mPoolSize - 1, poolSize - BUFFER_POOL_TAIL_SIZE});
+    }
+
+    // Allocate and fill the new ring without blocking post, the byte
+    // index continues in it
+    auto producer = std::make_shared<TsBufferProducer>(next);
+    auto ring = createBufferQueue(poolSize, producer);
+    uint64_t first = next;
+    bool copied = copyChunks(*oldRing, oldProducer->getBaseCount(), *producer, next, live);
+
+    std::lock_guard<std::mutex> ringGuard(mRingMtx);
+    if (mRingBufferPool != oldRing) {
+        LOG(INFO) << "TSB reallocated meanwhile, resize dropped";
+        return;
+    }
+    // Add the chunks posted during the copy
+    if (!copied || !copyChunks(*oldRing, oldProducer->getBaseCount(), *producer, next,
+                               getTotalBufferByteCount() / BUFFER_CHUNK_SIZE)) {
+        LOG(WARNING) << "TSB overwritten during the copy, resize dropped";
+        return;
+    }
+
+    LOG(INFO) << "TSB resized from " << mPoolSize << " to " << poolSize << " chunks, "
+              << live - first << " chunks kept";
+
+    // Release readers blocked on the old ring
+    oldRing->abortAllOperations();
+
+    std::lock_guard<std::mutex> paramGuard(mTrickPlaySpeedMtx);
+    std::lock_guard<std::mutex> seekGuard(mSeekMtx);
+
+    ring->enableReadThrottling(mTrickPlaySpeed == 1 && !mIFrameTrickPlay);
+    mRingBufferPool = ring;
+    mTsBufProd = producer;
+    mPoolSize = poolSize;
+    mBufIndexer->trimFront(first * BUFFER_CHUNK_SIZE);
+    updateWindow();
+
+    // The controlled reader continues at the oldest data left, the
+    // other readers on their next read
+    live = getTotalBufferByteCount();
+    uint64_t maxSize = getSeekableByteSize(live);
+    HandleContext *primary = getPrimaryContext();
+    uint64_t byteOffset = mIFrameTrickPlay ? live - mTrickPlayPos
+                                           : primary ? live - primary->getPosition() : mSeekByteOffset.load();
+    if (byteOffset > maxSize) {
+        LOG(WARNING) << "Controlled reader moved by " << byteOffset - maxSize << " bytes";
+        if (mIFrameTrickPlay) {
+            stopIFrameTrickPlay(maxSize);
+        } else {
+            setSeekByteOffset(maxSize);
+        }
+        notifyFlush();
+    }
+}
+
+bool TimeShiftBufferConsumer::setTsbSize(uint64_t seconds, uint64_t bytes) {
+    if (seconds == 0 || seconds > TSB_MAX_DURATION_SECONDS ||
+        bytes < TSB_MIN_SIZE_CHUNKS * BUFFER_CHUNK_SIZE || bytes > TSB_MAX_DURATION_BYTES) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> paramLock(mParamMtx);
+    mTsbSizeSec = seconds;
+    mTsbSizeBytes = bytes;
+    return true;
+}
+
+void TimeShiftBufferConsumer::getTsbSize(uint64_t &seconds, uint64_t &bytes) {
+    std::lock_guard<std::mutex> paramLock(mParamMtx);
+    seconds = mTsbSizeSec;
+    bytes = mTsbSizeBytes;
 }
 
 int64_t TimeShiftBufferConsumer::getSeekOffset() {
@@ -352,35 +1069,164 @@ int64_t TimeShiftBufferConsumer::getSeekOffset() {
 }
 
 uint64_t TimeShiftBufferConsumer::getTotalBufferByteCount() {
-    return mTsBufProd->getTotalBufferCount() * BUFFER_CHUNK_SIZE;
+    auto &producer = getBufferProducer();
+    return (producer->getBaseCount() + producer->getTotalBufferCount()) * BUFFER_CHUNK_SIZE;
 }
 
 uint64_t TimeShiftBufferConsumer::getActualBufferByteSize() {
-    return mBufIndexer->getIndexSizeInBytes();
+    std::lock_guard<std::mutex> seekGuard(mSeekMtx);
+    return getSeekableByteSize(getTotalBufferByteCount());
+}
+
+uint64_t TimeShiftBufferConsumer::getSeekableByteSize(uint64_t live) {
+    uint64_t size = mBufIndexer->getIndexSizeInBytes();
+    uint64_t byteIndex;
+    uint64_t timeUs;
+
+    auto &spillStore = mSpillStore;
+    if (spillStore && spillStore->getFront(byteIndex, timeUs) && byteIndex < live) {
+        size = std::max(size, live - byteIndex);
+    }
+    return size;
+}
+
+bool TimeShiftBufferConsumer::getSpillByteOffset(uint64_t timeUs, uint64_t &byteOffset) {
+    auto &spillStore = mSpillStore;
+    uint64_t liveTimeUs = mLiveTimeUs;
+    uint64_t byteIndex;
+
+    if (liveTimeUs < timeUs || !spillStore->getByteIndexForTime(liveTimeUs - timeUs, byteIndex)) {
+        return false;
+    }
+
+    uint64_t live = getTotalBufferByteCount();
+    if (byteIndex >= live) {
+        return false;
+    }
+    byteOffset = live - byteIndex;
+    return true;
+}
+
+bool TimeShiftBufferConsumer::getSpillTimeUs(uint64_t byteOffset, uint64_t &timeUs) {
+    auto &spillStore = mSpillStore;
+    uint64_t live = getTotalBufferByteCount();
+    uint64_t time;
+
+    if (!spillStore || byteOffset > live || !spillStore->getTimeForByteIndex(live - byteOffset, time)) {
+        return false;
+    }
+    timeUs = mLiveTimeUs - std::min<uint64_t>(time, mLiveTimeUs);
+    return true;
+}
+
+std::shared_ptr<SpillStore> TimeShiftBufferConsumer::getSpillStore() {
+    std::lock_guard<std::mutex> seekGuard(mSeekMtx);
+    return mSpillStore;
+}
+
+const std::shared_ptr<ByteBufferPool> &TimeShiftBufferConsumer::getRingBufferPool() {
+    return mRingBufferPool;
+}
+
+const std::shared_ptr<TimeShiftBufferConsumer::TsBufferProducer> &TimeShiftBufferConsumer::getBufferProducer() {
+    return mTsBufProd;
+}
+
+bool TimeShiftBufferConsumer::setSpill(const std::string &path, uint64_t bytes) {
+    if (!path.empty() && bytes < 2 * SPILL_SEGMENT_SIZE) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> paramLock(mParamMtx);
+    mSpillPath = path;
+    mSpillBytes = path.empty() ? 0 : bytes;
+    return true;
+}
+
+void TimeShiftBufferConsumer::getSpill(std::string &path, uint64_t &bytes) {
+    std::lock_guard<std::mutex> paramLock(mParamMtx);
+    path = mSpillPath;
+    bytes = mSpillBytes;
+}
+
+void TimeShiftBufferConsumer::updateSpillStore() {
+    std::string path;
+    uint64_t bytes;
+    getSpill(path, bytes);
+
+    auto spillStore = mSpillStore;
+    if (spillStore ? spillStore->getPath() == path && spillStore->getMaxBytes() == bytes / SPILL_SEGMENT_SIZE * SPILL_SEGMENT_SIZE
+                   : path.empty()) {
+        return;
+    }
+
+    // Release the old file first, the path may be the same
+    {
+        std::lock_guard<std::mutex> seekGuard(mSeekMtx);
+        mSpillStore.reset();
+    }
+    spillStore.reset();
+
+    if (!path.empty()) {
+        spillStore = std::make_shared<SpillStore>(path, bytes);
+        if (!spillStore->isOpen()) {
+            spillStore.reset();
+        }
+    }
+
+    std::lock_guard<std::mutex> seekGuard(mSeekMtx);
+    mSpillStore = spillStore;
 }
 
 uint64_t TimeShiftBufferConsumer::getBufferCapacityByteSize() {
     return (mBufIndexer->getBufferCapacity() - 1) * BUFFER_CHUNK_SIZE * BUFFER_SAMPLING_RATIO;
 }
 
+size_t TimeShiftBufferConsumer::getBufferPoolSize() {
+    std::lock_guard<std::mutex> seekGuard(mSeekMtx);
+    return mPoolSize;
+}
+
+time_t TimeShiftBufferConsumer::getBufferCapacityTime() {
+    uint64_t bitrate = mPcrTracker ? mPcrTracker->getBitrate() : 0;
+    if (bitrate == 0) {
+        return 0;
+    }
+    return getBufferCapacityByteSize() * 8 * 1000 / bitrate;
+}
+
 void TimeShiftBufferConsumer::reset() {
     TRACE_EVENT(TR_FCC_SWITCH, "reset seek");
     std::lock_guard<std::mutex> paramLock(mParamMtx);
     std::lock_guard<std::mutex> paramGuard(mTrickPlaySpeedMtx);
 
-    if (mSeekByteOffset) {
+    {
+        std::lock_guard<std::mutex> seekGuard(mSeekMtx);
         uint64_t bufferSize = getTotalBufferByteCount();
         for (auto& kv : mHandles) {
-            kv.second.initReadOffset(bufferSize);
+            if (kv.second.getSeekOffset()) {
+                kv.second.initReadOffset(bufferSize);
+                kv.second.setSeekOffset(0);
+            }
         }
-    }
+        updateSpillFrom();
 
-    mSeekByteOffset = 0;
+        mSeekByteOffset = 0;
+        mReadPacer.reset();
+    }
     mTrickPlaySpeed = 1;
+    mIFrameTrickPlay = false;
+    mIFrameStopped = false;
     updateTrickPlayFile();
-    mRingBufferPool->enableReadThrottling(true);
+    getRingBufferPool()->enableReadThrottling(true);
     mTrickPlayTimer->stop();
     mBufIndexer->clear();
+    if (mSpillStore) {
+        mSpillStore->clear();
+    }
+    mPcrDiscontinuity = true;
+    mIndexPhase = 0;
+    mIndexPartialLen = 0;
     mBufferReadWatchdog->clear();
     mPauseTimeMonitor.reset();
     mIsPaused = false;
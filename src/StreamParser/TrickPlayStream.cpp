@@ -0,0 +1,182 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE
+ * file the following copyright and licenses apply:
+ *
+ * Copyright (c) 2022 Nuuday.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "StreamParser/TrickPlayStream.h"
+#include "StreamParser/PcrTracker.h"
+#include <algorithm>
+#include <cstring>
+
+namespace StreamParser {
+
+namespace {
+    void writePcr(unsigned char *p, uint64_t pcr) {
+        uint64_t base = (pcr / 300) % (1ULL << 33);
+        unsigned ext = pcr % 300;
+        p[0] = base >> 25;
+        p[1] = base >> 17;
+        p[2] = base >> 9;
+        p[3] = base >> 1;
+        p[4] = ((base & 0x01) << 7) | 0x7E | (ext >> 8);
+        p[5] = ext;
+    }
+
+    void writeTimestamp(unsigned char *p, unsigned prefix, uint64_t ts) {
+        p[0] = (prefix << 4) | ((ts >> 29) & 0x0E) | 0x01;
+        p[1] = ts >> 22;
+        p[2] = ((ts >> 14) & 0xFE) | 0x01;
+        p[3] = ts >> 7;
+        p[4] = ((ts << 1) & 0xFE) | 0x01;
+    }
+}
+
+TrickPlayStream::TrickPlayStream(uint64_t frameDurationUs)
+    : mFrameTicks(frameDurationUs * PCR_CLOCK_HZ / 1000000) {
+}
+
+void TrickPlayStream::reset() {
+    mDiscontinuity = true;
+    mScrambled = false;
+    mCc.clear();
+    mOutput.clear();
+    mReadPos = 0;
+}
+
+bool TrickPlayStream::addFrame(const unsigned char *data, size_t size, unsigned videoPid, unsigned pcrPid) {
+    // The access unit ends at the next payload unit start of the PID
+    bool complete = false;
+    mFrame.clear();
+    mScrambled = false;
+
+    for (size_t pos = 0; pos + TS_PACKAGE_SIZE <= size; pos += TS_PACKAGE_SIZE) {
+        const unsigned char *packet = data + pos;
+        if (packet[0] != 0x47 || (packet[1] & 0x80) || GET_PID(packet) != videoPid) {
+            continue;
+        }
+        if (packet[1] & 0x40) {
+            if (!mFrame.empty()) {
+                complete = true;
+                break;
+            }
+        } else if (mFrame.empty()) {
+            return false;
+        }
+        // transport_scrambling_control
+        if (packet[3] & 0xC0) {
+            mScrambled = true;
+            return false;
+        }
+        mFrame.push_back(packet);
+    }
+
+    if (!complete) {
+        return false;
+    }
+
+    if (empty()) {
+        mOutput.clear();
+        mReadPos = 0;
+    }
+
+    // The time base restarts after reset() only, the video PID jumps
+    // with each frame. A first video packet without adaptation field
+    // gets the indicator from a packet of its own.
+    bool videoAdaptation = (mFrame[0][3] & 0x20) && mFrame[0][4] > 0;
+    appendAdaptationPacket(pcrPid, true, mDiscontinuity || pcrPid == videoPid);
+    if (pcrPid != videoPid && !videoAdaptation) {
+        appendAdaptationPacket(videoPid, false, true);
+    }
+    mDiscontinuity = false;
+
+    for (size_t i = 0; i < mFrame.size(); i++) {
+        unsigned char *packet = appendPacket(mFrame[i], i == 0 && pcrPid != videoPid);
+        if (i == 0) {
+            rewritePts(packet);
+        }
+    }
+
+    mClock = (mClock + mFrameTicks) % PCR_WRAP;
+    return true;
+}
+
+size_t TrickPlayStream::read(char *data, size_t size) {
+    size_t readSize = std::min(size, mOutput.size() - mReadPos);
+    memcpy(data, mOutput.data() + mReadPos, readSize);
+    mReadPos += readSize;
+    return readSize;
+}
+
+unsigned char *TrickPlayStream::appendPacket(const unsigned char *source, bool discontinuity) {
+    size_t pos = mOutput.size();
+    mOutput.insert(mOutput.end(), source, source + TS_PACKAGE_SIZE);
+    unsigned char *packet = mOutput.data() + pos;
+
+    // Packets without payload repeat the counter
+    uint8_t &cc = mCc[GET_PID(packet)];
+    if (packet[3] & 0x10) {
+        cc = (cc + 1) & 0x0F;
+    }
+    packet[3] = (packet[3] & 0xF0) | cc;
+
+    if ((packet[3] & 0x20) && packet[4] > 0) {
+        packet[5] = (packet[5] & 0x7F) | (discontinuity ? 0x80 : 0x00);
+        if (packet[4] >= 7 && (packet[5] & 0x10)) {
+            writePcr(packet + 6, mClock);
+        }
+    }
+    return packet;
+}
+
+void TrickPlayStream::appendAdaptationPacket(unsigned pid, bool pcr, bool discontinuity) {
+    unsigned char packet[TS_PACKAGE_SIZE];
+    memset(packet, 0xFF, sizeof(packet));
+    packet[0] = 0x47;
+    packet[1] = (pid >> 8) & 0x1F;
+    packet[2] = pid;
+    packet[3] = 0x20;
+    packet[4] = TS_PACKAGE_SIZE - 5;
+    packet[5] = pcr ? 0x10 : 0x00;
+    appendPacket(packet, discontinuity);
+}
+
+void TrickPlayStream::rewritePts(unsigned char *packet) {
+    size_t pos = 4;
+    if (packet[3] & 0x20) {
+        pos += 1 + packet[4];
+    }
+    if (pos + 19 > TS_PACKAGE_SIZE) {
+        return;
+    }
+
+    unsigned char *pes = packet + pos;
+    if (pes[0] != 0x00 || pes[1] != 0x00 || pes[2] != 0x01) {
+        return;
+    }
+
+    // Decoded and shown at once, DTS equals PTS
+    uint64_t pts = (mClock / 300 + TRICK_PLAY_PTS_DELAY_MS * 90) % (1ULL << 33);
+    unsigned flags = pes[7] >> 6;
+    if (flags == 2) {
+        writeTimestamp(pes + 9, 0x2, pts);
+    } else if (flags == 3) {
+        writeTimestamp(pes + 9, 0x3, pts);
+        writeTimestamp(pes + 14, 0x1, pts);
+    }
+}
+
+} //namespace StreamParser
@@ -0,0 +1,262 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE
+ * file the following copyright and licenses apply:
+ *
+ * Copyright (c) 2022 Nuuday.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "StuffingGenerator.h"
+
+#define TS_SYNC_BYTE 0x47
+#define TS_NULL_PID 0x1FFF
+
+// Number of null packets in the bulk copy template
+#define NULL_TEMPLATE_PACKETS 64
+
+// Interval between generated PCR packets
+#define STUFFING_PCR_INTERVAL_MS 40
+
+// Minimum observation time before the wall clock bitrate is used
+#define MIN_OBSERVE_TIME_US 1000000
+
+using StreamParser::PCR_CLOCK_HZ;
+using StreamParser::PCR_WRAP;
+using StreamParser::PcrTracker;
+
+StuffingGenerator::StuffingGenerator(uint64_t fallbackBitrate) :
+        mNullTemplate(NULL_TEMPLATE_PACKETS * TS_PACKAGE_SIZE, 0xFF),
+        mFallbackBitrate(fallbackBitrate) {
+    for (size_t p = 0; p < mNullTemplate.size(); p += TS_PACKAGE_SIZE) {
+        mNullTemplate[p] = TS_SYNC_BYTE;
+        mNullTemplate[p + 1] = TS_NULL_PID >> 8;
+        mNullTemplate[p + 2] = TS_NULL_PID & 0xFF;
+        mNullTemplate[p + 3] = 0x10; // payload only, CC = 0
+    }
+}
+
+void StuffingGenerator::setPcrTracker(std::shared_ptr<StreamParser::PcrTracker> tracker) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mPcrTracker = std::move(tracker);
+}
+
+void StuffingGenerator::reset() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mPcrPid = INVALID_PID;
+    mPcrPidCc = 0;
+    mPcrValid = false;
+    mLastPcr = 0;
+    mBytesSincePcr = 0;
+    mObservedBytes = 0;
+    mFirstObserveUs = 0;
+    mLastObserveUs = 0;
+    mActive = false;
+}
+
+void StuffingGenerator::observe(const uint8_t *data, uint32_t size, uint64_t timeUs) {
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    if (mObservedBytes == 0) {
+        mFirstObserveUs = timeUs;
+    }
+    mLastObserveUs = timeUs;
+    mObservedBytes += size;
+
+    // The tracker selects the PCR PID of the service once the PMT is known
+    unsigned trackerPid = mPcrTracker ? mPcrTracker->getPcrPid() : PSI_INVALID_PID;
+    if (trackerPid != PSI_INVALID_PID && trackerPid != mPcrPid) {
+        mPcrPid = trackerPid;
+        mPcrValid = false;
+    }
+
+    uint32_t p = 0;
+    while (p + TS_PACKAGE_SIZE <= size) {
+        const uint8_t *pkt = data + p;
+
+        if (pkt[0] != TS_SYNC_BYTE) {
+            p++;
+            continue;
+        }
+
+        uint16_t pid = ((pkt[1] & 0x1F) << 8) | pkt[2];
+        uint64_t pcr;
+        bool discontinuity;
+        bool hasPcr = PcrTracker::readPcr(pkt, pcr, discontinuity);
+
+        if (hasPcr && mPcrPid == INVALID_PID) {
+            mPcrPid = pid;
+        }
+
+        if (pid == mPcrPid) {
+            mPcrPidCc = pkt[3] & 0x0F;
+        }
+
+        if (hasPcr && pid == mPcrPid) {
+            mLastPcr = pcr;
+            mPcrValid = true;
+            mBytesSincePcr = 0;
+        } else {
+            mBytesSincePcr += TS_PACKAGE_SIZE;
+        }
+
+        p += TS_PACKAGE_SIZE;
+    }
+}
+
+uint64_t StuffingGenerator::currentBitrate() const {
+    uint64_t pcrBitrate = mPcrTracker ? mPcrTracker->getBitrate() : 0;
+    if (pcrBitrate > 0) {
+        return pcrBitrate;
+    }
+
+    auto observedUs = mLastObserveUs - mFirstObserveUs;
+    if (mObservedBytes > 0 && observedUs >= MIN_OBSERVE_TIME_US) {
+        return mObservedBytes * 8 * 1000000 / observedUs;
+    }
+
+    return mFallbackBitrate;
+}
+
+void StuffingGenerator::start(uint64_t startTimeUs) {
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    if (mActive) {
+        return;
+    }
+
+    mActive = true;
+    mStartUs = startTimeUs;
+    mBitrate = std::max<uint64_t>(currentBitrate(), TS_PACKAGE_SIZE * 8);
+    mEmittedBytes = 0;
+    mPacketsToPcr = 0;
+    mPcrPacketInterval = std::max<uint64_t>(1,
+            mBitrate * STUFFING_PCR_INTERVAL_MS / (1000 * 8 * TS_PACKAGE_SIZE));
+
+    if (mPcrValid) {
+        // PCR of the byte following the last observed one
+        auto offset = mBytesSincePcr + TS_PACKAGE_SIZE;
+        mPcrBase = (mLastPcr + bytesToPcrTicks(offset)) % PCR_WRAP;
+    }
+}
+
+void StuffingGenerator::stop() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mActive = false;
+}
+
+bool StuffingGenerator::isActive() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mActive;
+}
+
+uint64_t StuffingGenerator::getPendingBytes(uint64_t nowUs) {
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    if (!mActive || nowUs <= mStartUs) {
+        return 0;
+    }
+
+    uint64_t due = (nowUs - mStartUs) * mBitrate / 8000000;
+    due -= due % TS_PACKAGE_SIZE;
+
+    return due > mEmittedBytes ? due - mEmittedBytes : 0;
+}
+
+uint64_t StuffingGenerator::bytesToPcrTicks(uint64_t bytes) const {
+    // Split to avoid overflow on long outages
+    uint64_t bits = bytes * 8;
+    return (bits / mBitrate) * PCR_CLOCK_HZ + (bits % mBitrate) * PCR_CLOCK_HZ / mBitrate;
+}
+
+void StuffingGenerator::writePcrPacket(uint8_t *dst, uint64_t pcr) const {
+    uint64_t base = pcr / 300;
+    uint64_t ext = pcr % 300;
+
+    memset(dst, 0xFF, TS_PACKAGE_SIZE);
+    dst[0] = TS_SYNC_BYTE;
+    dst[1] = (mPcrPid >> 8) & 0x1F;
+    dst[2] = mPcrPid & 0xFF;
+    // Adaptation field only. The continuity counter does not
+    // increment for packets without payload.
+    dst[3] = 0x20 | mPcrPidCc;
+    dst[4] = TS_PACKAGE_SIZE - 5;
+    dst[5] = 0x10; // PCR_flag
+    dst[6] = base >> 25;
+    dst[7] = base >> 17;
+    dst[8] = base >> 9;
+    dst[9] = base >> 1;
+    dst[10] = ((base & 0x01) << 7) | 0x7E | ((ext >> 8) & 0x01);
+    dst[11] = ext & 0xFF;
+}
+
+uint32_t StuffingGenerator::fill(uint8_t *dst, uint32_t size) {
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    bool withPcr = mPcrValid && mPcrPid != INVALID_PID;
+    uint64_t packets = size / TS_PACKAGE_SIZE;
+    uint8_t *p = dst;
+
+    while (packets > 0) {
+        if (withPcr && mPacketsToPcr == 0) {
+            uint64_t offset = mEmittedBytes + (p - dst);
+            writePcrPacket(p, (mPcrBase + bytesToPcrTicks(offset)) % PCR_WRAP);
+            p += TS_PACKAGE_SIZE;
+            packets--;
+            mPacketsToPcr = mPcrPacketInterval - 1;
+            continue;
+        }
+
+        uint64_t run = std::min<uint64_t>(packets, NULL_TEMPLATE_PACKETS);
+        if (withPcr) {
+            run = std::min(run, mPacketsToPcr);
+            mPacketsToPcr -= run;
+        }
+
+        memcpy(p, mNullTemplate.data(), run * TS_PACKAGE_SIZE);
+        p += run * TS_PACKAGE_SIZE;
+        packets -= run;
+    }
+
+    auto written = (uint32_t) (p - dst);
+    mEmittedBytes += written;
+    mTotalGeneratedBytes += written;
+
+    return written;
+}
+
+uint64_t StuffingGenerator::getGeneratedTimeUs() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mActive) {
+        return 0;
+    }
+    return mStartUs + mEmittedBytes * 8 * 1000000 / mBitrate;
+}
+
+uint64_t StuffingGenerator::getBitrate() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mActive ? mBitrate : currentBitrate();
+}
+
+uint16_t StuffingGenerator::getPcrPid() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mPcrPid;
+}
+
+uint64_t StuffingGenerator::getGeneratedBytes() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mTotalGeneratedBytes;
+}
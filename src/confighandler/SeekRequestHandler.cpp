@@ -18,6 +18,7 @@
  */
 
 #include <MediaSourceHandler.h>
+#include <sstream>
 #include <utility>
 #include "confighandler/SeekRequestHandler.h"
 
@@ -28,9 +29,20 @@ static MapConfigToFSPathType ConfigMAP_SeekRequestHandler = {
 };
 
 int fcc::SeekRequestHandler::writeConfig(const std::string &fileName, const std::string &buf, size_t size) {
-    UNUSED(fileName);
-
     std::lock_guard<std::mutex> lockGuard(mStateMtx);
+
+    if (fileName == CONFIG_F_TSB_SIZE) {
+        return writeTsbSize(buf, size);
+    }
+
+    if (fileName == CONFIG_F_TSB_SPILL) {
+        return writeSpill(buf, size);
+    }
+
+    if (fileName == CONFIG_F_READ_RATE) {
+        return writeReadRate(buf, size);
+    }
+
     try {
         auto seekValue = std::stoull(buf);
         LOG(INFO) << "SeekRequestHandler::writeConfig : seekValue (Time): " << seekValue;
@@ -49,8 +61,79 @@ int fcc::SeekRequestHandler::writeConfig(const std::string &fileName, const std:
 
 }
 
+int fcc::SeekRequestHandler::writeTsbSize(const std::string &buf, size_t size) {
+    try {
+        size_t pos;
+        auto seconds = std::stoull(buf, &pos);
+        if (pos >= buf.size() || buf[pos] != CONFIG_ITEMS_SEPARATOR[0]) {
+            LOG(WARNING) << "Invalid TSB size: " << buf;
+            return -1;
+        }
+        auto bytes = std::stoull(buf.substr(pos + 1));
+        LOG(INFO) << "SeekRequestHandler::writeTsbSize : " << seconds << " s, " << bytes << " bytes";
+        if (!mTsbStreamParser->setTsbSize(seconds, bytes)) {
+            LOG(WARNING) << "Invalid TSB size: " << seconds << " s, " << bytes << " bytes";
+            return -1;
+        }
+        return size;
+    } catch (const std::logic_error &e) {
+        LOG(ERROR) << "Invalid argument: " << e.what();
+        return -1;
+    }
+}
+
+int fcc::SeekRequestHandler::writeSpill(const std::string &buf, size_t size) {
+    // <path>,<bytes> enables, anything without a size disables
+    std::string value = buf.substr(0, buf.find_last_not_of(" \n\r\t") + 1);
+    std::string path;
+    uint64_t bytes = 0;
+
+    auto pos = value.find_last_of(CONFIG_ITEMS_SEPARATOR);
+    if (pos != std::string::npos) {
+        try {
+            path = value.substr(0, pos);
+            bytes = std::stoull(value.substr(pos + 1));
+        } catch (const std::logic_error &e) {
+            LOG(ERROR) << "Invalid argument: " << e.what();
+            return -1;
+        }
+    }
+
+    LOG(INFO) << "SeekRequestHandler::writeSpill : " << (path.empty() ? "disabled" : path) << ", " << bytes << " bytes";
+    if (!mTsbStreamParser->setSpill(path, bytes)) {
+        LOG(WARNING) << "Invalid TSB spill: " << value;
+        return -1;
+    }
+    return size;
+}
+
+int fcc::SeekRequestHandler::writeReadRate(const std::string &buf, size_t size) {
+    try {
+        auto rate = std::stod(buf);
+        LOG(INFO) << "SeekRequestHandler::writeReadRate : " << rate;
+        if (!mTsbStreamParser->setReadRate(rate)) {
+            LOG(WARNING) << "Invalid read rate: " << rate;
+            return -1;
+        }
+        return size;
+    } catch (const std::logic_error &e) {
+        LOG(ERROR) << "Invalid argument: " << e.what();
+        return -1;
+    }
+}
+
 std::string fcc::SeekRequestHandler::readConfig(const std::string &fileName) {
-    UNUSED(fileName);
+    if (fileName == CONFIG_F_TSB_SIZE) {
+        return getTsbSize();
+    }
+
+    if (fileName == CONFIG_F_TSB_SPILL) {
+        return getSpill();
+    }
+
+    if (fileName == CONFIG_F_READ_RATE) {
+        return getReadRate();
+    }
 
     return getConfig();
 }
@@ -64,16 +147,58 @@ fcc::SeekRequestHandler::SeekRequestHandler(std::shared_ptr<StreamParser::TimeSh
 }
 
 uint64_t fcc::SeekRequestHandler::getSize(const std::string &fileName) {
-    UNUSED(fileName);
+    if (fileName == CONFIG_F_TSB_SIZE) {
+        return getTsbSize().size();
+    }
+    if (fileName == CONFIG_F_TSB_SPILL) {
+        return getSpill().size();
+    }
+    if (fileName == CONFIG_F_READ_RATE) {
+        return getReadRate().size();
+    }
     return getConfig().size();
 }
 
+std::string fcc::SeekRequestHandler::getSpill() {
+    std::string path;
+    uint64_t bytes;
+    mTsbStreamParser->getSpill(path, bytes);
+
+    StreamParser::SpillStore::Stats stats;
+    auto spillStore = mTsbStreamParser->getSpillStore();
+    if (spillStore) {
+        stats = spillStore->getStats();
+    }
+
+    return path + CONFIG_ITEMS_SEPARATOR + std::to_string(bytes) + CONFIG_ITEMS_SEPARATOR +
+           std::to_string(stats.storedBytes) + CONFIG_ITEMS_SEPARATOR +
+           std::to_string(stats.writtenBytes) + CONFIG_ITEMS_SEPARATOR +
+           std::to_string(stats.deviceBytes) + CONFIG_ITEMS_SEPARATOR +
+           std::to_string(stats.writtenSegments) + CONFIG_ITEMS_SEPARATOR +
+           std::to_string(stats.droppedSegments) + CONFIG_ITEMS_SEPARATOR +
+           std::to_string(stats.readBytes);
+}
+
+std::string fcc::SeekRequestHandler::getReadRate() {
+    std::ostringstream rate;
+    rate << mTsbStreamParser->getReadRate();
+    return rate.str();
+}
+
+std::string fcc::SeekRequestHandler::getTsbSize() {
+    uint64_t seconds;
+    uint64_t bytes;
+    mTsbStreamParser->getTsbSize(seconds, bytes);
+    return std::to_string(seconds) + CONFIG_ITEMS_SEPARATOR + std::to_string(bytes);
+}
+
 std::string fcc::SeekRequestHandler::getConfig() {
     std::lock_guard<std::mutex> lockGuard(mStateMtx);
     return std::to_string(mTsbStreamParser->getSeekTime() / SECONDS_TO_MILLISECONDS) + CONFIG_ITEMS_SEPARATOR +
            std::to_string(mTsbStreamParser->getMaxSeekTime() / SECONDS_TO_MILLISECONDS) + CONFIG_ITEMS_SEPARATOR +
            std::to_string(mTsbStreamParser->getSeekOffset()) + CONFIG_ITEMS_SEPARATOR +
            std::to_string(mTsbStreamParser->getActualBufferByteSize()) + CONFIG_ITEMS_SEPARATOR +
-           std::to_string((mTsbStreamParser->getBufferCapacityByteSize()));
+           std::to_string((mTsbStreamParser->getBufferCapacityByteSize())) + CONFIG_ITEMS_SEPARATOR +
+           std::to_string(mTsbStreamParser->getBufferCapacityTime() / SECONDS_TO_MILLISECONDS);
 }
 
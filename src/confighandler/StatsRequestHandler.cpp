@@ -22,23 +22,74 @@
 #include "version.h"
 #include "confighandler/StatsRequestHandler.h"
 #include <unistd.h>
+#include <algorithm>
+
+static const std::map<StreamParser::QueuePolicy, std::string> QueuePolicyNames = {
+        {StreamParser::QueuePolicy::LOSSLESS, "lossless"},
+        {StreamParser::QueuePolicy::LOSSY,    "lossy"}
+};
 
 static std::map<ConfigVariableId, const char *> ConfigMAP_StreamConfigs = {
         {kBufferSrcLost0, CONFIG_F_STREAM_STATUS}
 };
 
-int fcc::StatsRequestHandler::writeConfig(const std::string &fileName, const std::string &buf, size_t size) {
+static const std::vector<std::pair<StreamParser::StreamAnalyzer::Counter, std::string>> HealthCounterNames = {
+        {StreamParser::StreamAnalyzer::SYNC_LOSS,               "sync_loss"},
+        {StreamParser::StreamAnalyzer::SYNC_BYTE_ERROR,         "sync_byte_error"},
+        {StreamParser::StreamAnalyzer::PAT_ERROR,               "pat_error"},
+        {StreamParser::StreamAnalyzer::CC_ERROR,                "cc_error"},
+        {StreamParser::StreamAnalyzer::PMT_ERROR,               "pmt_error"},
+        {StreamParser::StreamAnalyzer::TRANSPORT_ERROR,         "transport_error"},
+        {StreamParser::StreamAnalyzer::CRC_ERROR,               "crc_error"},
+        {StreamParser::StreamAnalyzer::PCR_REPETITION_ERROR,    "pcr_repetition_error"},
+        {StreamParser::StreamAnalyzer::PCR_DISCONTINUITY_ERROR, "pcr_discontinuity_error"},
+        {StreamParser::StreamAnalyzer::SOURCE_LOST_PACKETS,     "source_lost_packets"},
+        {StreamParser::StreamAnalyzer::DISCONTINUITIES,         "discontinuities"}
+};
 
-    UNUSED(size);
-    UNUSED(buf);
+// Maxima are kept in us
+struct HealthMaximumName {
+    StreamParser::StreamAnalyzer::Maximum maximum;
+    std::string name;
+    uint64_t divisor;
+};
 
-    LOG(WARNING) << "TODO. Write not implemented for:" << fileName;
+static const std::vector<HealthMaximumName> HealthMaximumNames = {
+        {StreamParser::StreamAnalyzer::PAT_INTERVAL, "pat_interval_max_ms", 1000},
+        {StreamParser::StreamAnalyzer::PMT_INTERVAL, "pmt_interval_max_ms", 1000},
+        {StreamParser::StreamAnalyzer::PCR_INTERVAL, "pcr_interval_max_ms", 1000},
+        {StreamParser::StreamAnalyzer::PCR_JITTER,   "pcr_jitter_max_us",   1}
+};
+
+static const std::map<OverflowPolicy, std::string> OverflowPolicyNames = {
+        {OverflowPolicy::BLOCK,       "block"},
+        {OverflowPolicy::DROP_NEWEST, "drop_newest"},
+        {OverflowPolicy::DROP_OLDEST, "drop_oldest"}
+};
+
+int fcc::StatsRequestHandler::writeConfig(const std::string &fileName, const std::string &buf, size_t size) {
 
     switch (hashStr(fileName.c_str())) {
 
         case hashStr(CONFIG_F_STATS_SW_VERSION):
             return -1;
+
+        case hashStr(CONFIG_F_INGEST_OVERFLOW): {
+            std::string policyName(buf);
+            policyName.erase(std::remove(policyName.begin(), policyName.end(), '\n'), policyName.end());
+            for (const auto &it : OverflowPolicyNames) {
+                if (it.second == policyName) {
+                    LOG(INFO) << "Setting ingest overflow policy to " << policyName;
+                    mMSrcHandler->setIngestOverflowPolicy(it.first);
+                    return size;
+                }
+            }
+            LOG(WARNING) << "Invalid ingest overflow policy: " << policyName;
+            return -1;
+        }
     }
+
+    LOG(WARNING) << "TODO. Write not implemented for:" << fileName;
     return -1;
 
 }
@@ -48,9 +99,13 @@ std::string fcc::StatsRequestHandler::readConfig(const std::string &fileName) {
 }
 
 fcc::StatsRequestHandler::StatsRequestHandler(MediaSourceHandler *mediaSourceHandler,
+                                              std::shared_ptr<StreamParser::StreamAnalyzer> analyzer,
+                                              std::shared_ptr<StreamParser::PcrTracker> pcrTracker,
                                               streamfs::PluginCallbackInterface *cb)
         : ConfigHandlerMVarCb<ByteVectorType>(cb),
-          mMSrcHandler(mediaSourceHandler) {
+          mMSrcHandler(mediaSourceHandler),
+          mAnalyzer(std::move(analyzer)),
+          mPcrTracker(std::move(pcrTracker)) {
     mCbFunc = MVar<ByteVectorType>::getWatcher(this, ConfigMAP_StreamConfigs);
     mSrcLost0 = &MVar<ByteVectorType>::getVariable(kBufferSrcLost0);
 }
@@ -78,9 +133,60 @@ std::string fcc::StatsRequestHandler::getConfig(const std::string &fileName) {
             mChannelStats = mMSrcHandler->getChannelStats(0);
             return mChannelStats;
 
-       case hashStr(CONFIG_F_STREAM_STATUS):
+       case hashStr(CONFIG_F_STREAM_STATUS): {
           auto tmp = mSrcLost0->getValue();
           return  std::string(tmp.begin(), tmp.end());
+       }
+
+        case hashStr(CONFIG_F_INGEST_OVERFLOW): {
+            auto stats = mMSrcHandler->getIngestOverflowStats();
+            return OverflowPolicyNames.at(mMSrcHandler->getIngestOverflowPolicy()) + CONFIG_ITEMS_SEPARATOR +
+                   std::to_string(stats.blockedCount) + CONFIG_ITEMS_SEPARATOR +
+                   std::to_string(stats.blockedTimeUs / 1000) + CONFIG_ITEMS_SEPARATOR +
+                   std::to_string(stats.droppedNewest) + CONFIG_ITEMS_SEPARATOR +
+                   std::to_string(stats.droppedOldest) + CONFIG_ITEMS_SEPARATOR +
+                   std::to_string(mMSrcHandler->getIngestDiscontinuityCount());
+        }
+
+        case hashStr(CONFIG_F_CONSUMER_QUEUES): {
+            std::string res;
+            for (const auto &stats : mMSrcHandler->getConsumerQueueStats()) {
+                res += stats.name + CONFIG_ITEMS_SEPARATOR +
+                       QueuePolicyNames.at(stats.policy) + CONFIG_ITEMS_SEPARATOR +
+                       std::to_string(stats.depth) + CONFIG_ITEMS_SEPARATOR +
+                       std::to_string(stats.maxDepth) + CONFIG_ITEMS_SEPARATOR +
+                       std::to_string(stats.capacity) + CONFIG_ITEMS_SEPARATOR +
+                       std::to_string(stats.lagUs / 1000) + CONFIG_ITEMS_SEPARATOR +
+                       std::to_string(stats.maxLagUs / 1000) + CONFIG_ITEMS_SEPARATOR +
+                       std::to_string(stats.dropped) + CONFIG_ITEMS_SEPARATOR +
+                       std::to_string(stats.blockedCount) + CONFIG_ITEMS_SEPARATOR +
+                       std::to_string(stats.blockedTimeUs / 1000) + "\n";
+            }
+            return res;
+        }
+
+        case hashStr(CONFIG_F_BITRATE):
+            return std::to_string(mPcrTracker->getBitrate()) + "\n";
+
+        case hashStr(CONFIG_F_STREAM_HEALTH): {
+            auto stats = mAnalyzer->getStats(bufferMetaTimeNowUs());
+            std::string res;
+            for (const auto &it : HealthCounterNames) {
+                res += it.second + CONFIG_ITEMS_SEPARATOR +
+                       std::to_string(stats.total[it.first]) + CONFIG_ITEMS_SEPARATOR +
+                       std::to_string(stats.recent[it.first]) + "\n";
+            }
+            for (const auto &it : HealthMaximumNames) {
+                res += it.name + CONFIG_ITEMS_SEPARATOR +
+                       std::to_string(stats.max[it.maximum] / it.divisor) + CONFIG_ITEMS_SEPARATOR +
+                       std::to_string(stats.recentMax[it.maximum] / it.divisor) + "\n";
+            }
+            for (const auto &it : stats.ccErrorPids) {
+                res += "cc_error_pid_" + std::to_string(it.first) + CONFIG_ITEMS_SEPARATOR +
+                       std::to_string(it.second) + "\n";
+            }
+            return res;
+        }
     }
 
     return "NOT IMPLEMENTED";
@@ -19,6 +19,8 @@
 
 
 
+#include <chrono>
+
 #include "externals.h"
 
 extern "C" {
@@ -34,18 +36,20 @@ bq_buffer *alloc_bq_buffer(size_t size, void *context) {
 
     static uint64_t counter = 0;
     counter++;
-    auto result = (bq_buffer *) malloc(sizeof(struct bq_buffer));
+    auto block = (char *) malloc(sizeof(BufferMeta) + sizeof(struct bq_buffer));
 
-    if (result == nullptr) {
+    if (block == nullptr) {
         LOG(ERROR) << "Failed to allocate bq_buffer";
         return nullptr;
     }
+    auto result = (bq_buffer *) (block + sizeof(BufferMeta));
 
     result->context = context;
     result->id = counter;
     strncpy(result->magic, NOKIA_BUFFER_MAGIC, 4);
     result->size = size;
     result->capacity = size;
+    bq_buffer_meta(result) = {};
 
     return result;
 }
@@ -53,9 +57,10 @@ bq_buffer *alloc_bq_buffer(size_t size, void *context) {
 void free_bq_buffer(bq_buffer *buffer) {
     if (buffer == nullptr) {
         LOG(WARNING) << "Can't free null buffer";
+        return;
     }
 
-    free(buffer);
+    free(reinterpret_cast<char *>(buffer) - sizeof(BufferMeta));
 }
 
 bq_buffer *fcc_buffer_to_bq_buffer(int8_t *buffer) {
@@ -68,3 +73,13 @@ bq_buffer *fcc_buffer_to_bq_buffer(int8_t *buffer) {
 }
 
 }
+
+BufferMeta &bq_buffer_meta(bq_buffer *buffer) {
+    return *reinterpret_cast<BufferMeta *>(reinterpret_cast<char *>(buffer) - sizeof(BufferMeta));
+}
+
+uint64_t bufferMetaTimeNowUs() {
+    // Same clock as the BufferIndexer timestamps
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
@@ -30,7 +30,10 @@
 
 void streamfs::FCCConfigHandlers::initConfigHandlers(
         const std::shared_ptr<StreamParser::TimeShiftBufferConsumer> &tsbConsumer,
-        MediaSourceHandler *mediaSourceHandler, streamfs::PluginCallbackInterface *cb) {
+        MediaSourceHandler *mediaSourceHandler,
+        const std::shared_ptr<StreamParser::StreamAnalyzer> &analyzer,
+        const std::shared_ptr<StreamParser::PcrTracker> &pcrTracker,
+        streamfs::PluginCallbackInterface *cb) {
 
     /**
      * Init configuration handlers
@@ -46,7 +49,7 @@ void streamfs::FCCConfigHandlers::initConfigHandlers(
             std::dynamic_pointer_cast<StreamParser::TimeShiftBufferConsumer>(tsbConsumer),
             cb);
 
-    mStatsRequestHandler = std::make_shared<fcc::StatsRequestHandler>(mediaSourceHandler, cb);
+    mStatsRequestHandler = std::make_shared<fcc::StatsRequestHandler>(mediaSourceHandler, analyzer, pcrTracker, cb);
     mStreamInfoRequestHandler = std::make_shared<fcc::StreamInfoRequestHandler>(mediaSourceHandler, cb);
     mProtectionInfoRequestHandler = std::make_shared<fcc::ProtectionInfoRequestHandler>(cb);
     mCdmStatusHandler = std::make_shared<fcc::CdmStatusHandler>(cb);
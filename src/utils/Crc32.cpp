@@ -0,0 +1,69 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE
+ * file the following copyright and licenses apply:
+ *
+ * Copyright (c) 2022 Nuuday.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "utils/Crc32.h"
+#include <array>
+
+namespace {
+
+using CrcTables = std::array<std::array<uint32_t, 256>, 8>;
+
+// Slicing-by-8 tables. Table k advances the CRC of a byte by k more zero bytes.
+constexpr CrcTables makeTables() {
+    CrcTables t {};
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i << 24;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+        }
+        t[0][i] = crc;
+    }
+    for (size_t k = 1; k < t.size(); k++) {
+        for (uint32_t i = 0; i < 256; i++) {
+            t[k][i] = (t[k - 1][i] << 8) ^ t[0][t[k - 1][i] >> 24];
+        }
+    }
+    return t;
+}
+
+constexpr CrcTables kTables = makeTables();
+
+inline uint32_t loadBe32(const unsigned char *p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+}
+
+uint32_t crc32Mpeg(const unsigned char *data, size_t length, uint32_t crc) {
+    while (length >= 8) {
+        uint32_t hi = crc ^ loadBe32(data);
+        uint32_t lo = loadBe32(data + 4);
+        crc = kTables[7][hi >> 24] ^ kTables[6][(hi >> 16) & 0xFF] ^
+              kTables[5][(hi >> 8) & 0xFF] ^ kTables[4][hi & 0xFF] ^
+              kTables[3][lo >> 24] ^ kTables[2][(lo >> 16) & 0xFF] ^
+              kTables[1][(lo >> 8) & 0xFF] ^ kTables[0][lo & 0xFF];
+        data += 8;
+        length -= 8;
+    }
+
+    while (length--) {
+        crc = (crc << 8) ^ kTables[0][(crc >> 24) ^ *data++];
+    }
+    return crc;
+}
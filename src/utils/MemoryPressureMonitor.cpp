@@ -0,0 +1,128 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE
+ * file the following copyright and licenses apply:
+ *
+ * Copyright (c) 2022 Nuuday.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "utils/MemoryPressureMonitor.h"
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <glog/logging.h>
+
+MemoryPressureMonitor::MemoryPressureMonitor(const std::string &cgroupPath, std::function<void(Level)> func)
+    : mCgroupPath(cgroupPath)
+    , mFunc(std::move(func)) {
+    mPressureFd = open((mCgroupPath + "/memory.pressure_level").c_str(), O_RDONLY | O_CLOEXEC);
+    mControlFd = open((mCgroupPath + "/cgroup.event_control").c_str(), O_WRONLY | O_CLOEXEC);
+
+    if (mPressureFd == -1 || mControlFd == -1) {
+        LOG(INFO) << "Memory pressure of " << mCgroupPath << " not monitored: " << strerror(errno);
+        return;
+    }
+
+    mMediumFd = subscribe("medium");
+    mCriticalFd = subscribe("critical");
+    mExitFd = eventfd(0, EFD_CLOEXEC);
+
+    if (mMediumFd == -1 || mCriticalFd == -1 || mExitFd == -1) {
+        LOG(ERROR) << "Unable to subscribe to memory pressure of " << mCgroupPath;
+        return;
+    }
+
+    mThread = std::thread(&MemoryPressureMonitor::threadLoop, this);
+}
+
+MemoryPressureMonitor::~MemoryPressureMonitor() {
+    if (mThread.joinable()) {
+        uint64_t exit = 1;
+        if (write(mExitFd, &exit, sizeof(exit)) == sizeof(exit)) {
+            mThread.join();
+        } else {
+            mThread.detach();
+        }
+    }
+
+    for (int fd : {mMediumFd, mCriticalFd, mExitFd, mControlFd, mPressureFd}) {
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+}
+
+int MemoryPressureMonitor::subscribe(const char *level) {
+    int evFd = eventfd(0, EFD_CLOEXEC);
+    if (evFd == -1) {
+        return -1;
+    }
+
+    std::string line = std::to_string(evFd) + " " + std::to_string(mPressureFd) + " " + level;
+    if (write(mControlFd, line.c_str(), line.size() + 1) == -1) {
+        close(evFd);
+        return -1;
+    }
+    return evFd;
+}
+
+void MemoryPressureMonitor::setLevel(Level level) {
+    if (mLevel.exchange(level) != level) {
+        LOG(INFO) << "Memory pressure of " << mCgroupPath << ": " << level;
+        mFunc(level);
+    }
+}
+
+void MemoryPressureMonitor::threadLoop() {
+    pollfd fds[] = {
+            {mMediumFd, POLLIN, 0},
+            {mCriticalFd, POLLIN, 0},
+            {mExitFd, POLLIN, 0}
+    };
+
+    while (true) {
+        int ret = poll(fds, 3, mLevel == NONE ? -1 : MEMORY_PRESSURE_CLEAR_MS);
+        if (ret == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG(ERROR) << "Memory pressure poll failed: " << strerror(errno);
+            return;
+        }
+
+        if (ret == 0) {
+            setLevel(NONE);
+            continue;
+        }
+
+        if (fds[2].revents) {
+            return;
+        }
+
+        uint64_t count;
+        bool critical = false;
+        for (int i = 0; i < 2; i++) {
+            if (fds[i].revents & POLLIN) {
+                critical |= i == 1;
+                if (read(fds[i].fd, &count, sizeof(count)) != sizeof(count)) {
+                    LOG(ERROR) << "Unable to read memory pressure event";
+                }
+            }
+        }
+        // Medium listeners are also notified of critical pressure
+        setLevel(critical ? CRITICAL : MEDIUM);
+    }
+}
@@ -0,0 +1,96 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE
+ * file the following copyright and licenses apply:
+ *
+ * Copyright (c) 2022 Nuuday.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Compares the chunk dispatch rate of the dynamic StreamProcessor
+ * consumer list and of a StaticPipeline with the same consumers.
+ *
+ * Usage: pipeline_benchmark [chunk count]
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+#include "StreamParser/StreamProcessor.h"
+#include "StreamParser/StaticPipeline.h"
+
+using namespace StreamParser;
+
+namespace {
+
+/**
+ * Light sync consumer, so the dispatch cost dominates
+ */
+class SyncPacketCounter : public StreamConsumer {
+public:
+    SyncPacketCounter() : StreamConsumer("SyncPacketCounter", false) {}
+
+    void post(const Buffer &buf) override {
+        // Count TS sync bytes at the packet starts
+        for (size_t i = 0; i < buf.chunk->size(); i += TS_PACKAGE_SIZE) {
+            mCount += (*buf.chunk)[i] == 0x47;
+        }
+    }
+
+    uint64_t mCount {0};
+};
+
+template<class Processor>
+double run(Processor &processor, uint64_t chunks) {
+    buffer_chunk chunk;
+    chunk.fill(0x47);
+    Buffer buf = {"benchmark", &chunk, {}};
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < chunks; i++) {
+        processor.post(buf);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    return chunks / elapsed.count();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    uint64_t chunks = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+
+    auto c1 = std::make_shared<SyncPacketCounter>();
+    auto c2 = std::make_shared<SyncPacketCounter>();
+    auto c3 = std::make_shared<SyncPacketCounter>();
+
+    StreamProcessor dynamicProcessor({c1, c2, c3});
+    double dynamicRate = run(dynamicProcessor, chunks);
+
+    StaticPipeline<SyncPacketCounter, SyncPacketCounter, SyncPacketCounter> pipeline(c1, c2, c3);
+    double staticRate = run(pipeline, chunks);
+
+    StreamProcessor combinedProcessor(makeStaticPipeline(c1, c2, c3), {});
+    double combinedRate = run(combinedProcessor, chunks);
+
+    printf("chunks:                     %llu\n", (unsigned long long) chunks);
+    printf("dynamic StreamProcessor:    %.0f chunks/s\n", dynamicRate);
+    printf("StaticPipeline:             %.0f chunks/s\n", staticRate);
+    printf("StreamProcessor with stage: %.0f chunks/s\n", combinedRate);
+    printf("packets counted:            %llu\n", (unsigned long long) (c1->mCount + c2->mCount + c3->mCount));
+
+    return 0;
+}
@@ -18,9 +18,17 @@
  */
 
 #include <fstream>
+#include <thread>
 #include <boost/algorithm/hex.hpp>
 #include "psi_tests.h"
 #include "StreamParser/PSIParser.h"
+#include "StreamParser/SectionAssembler.h"
+#include "StreamParser/PcrTracker.h"
+#include "StreamParser/StreamAnalyzer.h"
+#include "StreamParser/TrickPlayStream.h"
+#include "TimeShiftBufferConsumer.h"
+#include "ChannelConfig.h"
+#include "utils/Crc32.h"
 
 // clear samples
 #define CLEAR1_TS "clear1.ts"
@@ -113,6 +121,10 @@ public:
         return byteArrayAsHex(mDrm->getValue().ecm());
     }
 
+    StreamParser::PSIParser::ZapTiming getZapTiming() {
+        return mParser.getZapTiming();
+    }
+
     void validateCLEAR1() {
         openStream(CLEAR1_TS);
         std::this_thread::sleep_for(std::chrono::milliseconds(500));
@@ -120,6 +132,8 @@ public:
         ASSERT_EQ(getPat().substr(0,32), "00B00D00A1C5000005BEE1E053232CEA");
         ASSERT_EQ(getPmt().substr(0,126), "02B03C05BEC50000E3E8F00024E3E8F011380F0160000000B000000000005D9F1F1F0FE7D0F0085006F0000000000006EBB8F007560564616E09007F085E5C");
         ASSERT_EQ(getEcm(), "");
+        ASSERT_TRUE(getZapTiming().hasPatPmt);
+        ASSERT_FALSE(getZapTiming().hasEcm);
     }
 
     void validateCLEAR2() {
@@ -138,6 +152,7 @@ public:
         ASSERT_EQ(getPat().substr(0,32), "00B00D00D5C500000898E064BB887179");
         ASSERT_EQ(getPmt().substr(0,124), "02B03B0898C70000E065F0036501011BE065F00B0E03C035B609045601E0660FE0C9F0160A0464616E007C035880030E03C000F009045601E066EACEF414");
         ASSERT_EQ(getEcm(), "80B0695601E50000564D45434D02000200002200212B8D8056516036BA4EFF48C199B948C7F8E0C2A0A4F569F5AD8F58A5223F8DBB84DBCAE438EF2CDCA3DD178CC29D3673F041F2380783208FC6A93D6DF1DE3342EA6F9E415149A5152545894AC934DBD32D5E71413981EB");
+        ASSERT_TRUE(getZapTiming().hasEcm);
     }
 
     void validateENCRYPTED2() {
@@ -214,6 +229,1039 @@ TEST(PSIParser, GetPacketOk) {
     ASSERT_EQ(stream.getNextPacket(packet), StreamParser::PSIParser::TSStream::NOT_ENOUGH_DATA);
 }
 
+TEST(PSIParser, AttachChunkReuse) {
+    const size_t numberOfChunks = 4;
+    std::vector<unsigned char> data(numberOfChunks * BUFFER_CHUNK_SIZE);
+    const size_t packageCount = data.size() / TS_PACKAGE_SIZE;
+
+    for (size_t i = 0; i < packageCount; i++) {
+        data[i * TS_PACKAGE_SIZE] = 0x47;
+        for (size_t k = 1; k < TS_PACKAGE_SIZE; k++) {
+            data[i * TS_PACKAGE_SIZE + k] = (i + k) & 0xFF;
+        }
+    }
+
+    // Attached chunks are not copied. A consumed chunk is overwritten
+    // with the next one, as done with reused source chunks.
+    StreamParser::PSIParser::TSStream stream;
+    buffer_chunk chunk;
+    const unsigned char *packet;
+    size_t packetId = 0;
+
+    for (size_t c = 0; c < numberOfChunks; c++) {
+        ASSERT_TRUE(stream.needsNewChunk());
+        std::copy(data.begin() + c * BUFFER_CHUNK_SIZE, data.begin() + (c + 1) * BUFFER_CHUNK_SIZE, chunk.begin());
+        ASSERT_TRUE(stream.attachChunk(chunk));
+
+        while (stream.getNextPacket(packet) == StreamParser::PSIParser::TSStream::OK) {
+            ASSERT_EQ(memcmp(packet, data.data() + packetId * TS_PACKAGE_SIZE, TS_PACKAGE_SIZE), 0);
+            packetId++;
+        }
+        chunk.fill(0xFF);
+    }
+
+    ASSERT_EQ(packetId, packageCount);
+}
+
+// Build a section with syntax indicator and a valid CRC_32
+ByteVectorType makeSection(unsigned char tableId, size_t length) {
+    ByteVectorType section(length);
+    section[0] = tableId;
+    section[1] = 0xB0 | (((length - 3) >> 8) & 0x0F);
+    section[2] = (length - 3) & 0xFF;
+    for (size_t i = 3; i < length - 4; i++) {
+        section[i] = i & 0xFF;
+    }
+    auto crc = crc32Mpeg(section.data(), length - 4);
+    for (int i = 0; i < 4; i++) {
+        section[length - 4 + i] = (crc >> (24 - 8 * i)) & 0xFF;
+    }
+    return section;
+}
+
+// Split sections into TS packets of one PID. With share, a section
+// starts directly after the previous one, else in a new packet.
+std::vector<StreamParser::StreamPacketT> packetize(const std::vector<ByteVectorType> &sections, bool share,
+                                                   unsigned pid = 0x20) {
+    std::vector<ByteVectorType> streams;
+    std::vector<std::vector<size_t>> starts;
+
+    for (auto &section: sections) {
+        if (streams.empty() || !share) {
+            streams.emplace_back();
+            starts.emplace_back();
+        }
+        starts.back().push_back(streams.back().size());
+        streams.back().insert(streams.back().end(), section.begin(), section.end());
+    }
+
+    std::vector<StreamParser::StreamPacketT> packets;
+    for (size_t i = 0; i < streams.size(); i++) {
+        auto &stream = streams[i];
+        size_t pos = 0;
+        while (pos < stream.size()) {
+            StreamParser::StreamPacketT packet;
+            packet.fill(0xFF);
+            packet[0] = 0x47;
+            packet[1] = (pid >> 8) & 0x1F;
+            packet[2] = pid & 0xFF;
+            packet[3] = 0x10 | (packets.size() & 0x0F);
+
+            size_t payload = 4;
+            for (auto start: starts[i]) {
+                if (start >= pos && start < pos + TS_PACKAGE_SIZE - 5) {
+                    packet[1] |= 0x40;
+                    packet[payload++] = start - pos;
+                    break;
+                }
+            }
+            size_t take = std::min(stream.size() - pos, TS_PACKAGE_SIZE - payload);
+            memcpy(packet.data() + payload, stream.data() + pos, take);
+            pos += take;
+            packets.push_back(packet);
+        }
+    }
+    return packets;
+}
+
+// Build a long form section with the given body after the 8 byte header
+ByteVectorType makePsiSection(unsigned char tableId, unsigned tableIdExt, unsigned version,
+                              const ByteVectorType &body) {
+    size_t length = 8 + body.size() + 4;
+    ByteVectorType section {tableId, (unsigned char) (0xB0 | (((length - 3) >> 8) & 0x0F)),
+                            (unsigned char) ((length - 3) & 0xFF),
+                            (unsigned char) (tableIdExt >> 8), (unsigned char) tableIdExt,
+                            (unsigned char) (0xC1 | ((version & 0x1F) << 1)), 0x00, 0x00};
+    section.insert(section.end(), body.begin(), body.end());
+    auto crc = crc32Mpeg(section.data(), section.size());
+    for (int i = 0; i < 4; i++) {
+        section.push_back((crc >> (24 - 8 * i)) & 0xFF);
+    }
+    return section;
+}
+
+// Chunk starting with the given packets, padded with null packets
+void fillPsiChunk(buffer_chunk &chunk, const std::vector<StreamParser::StreamPacketT> &packets) {
+    for (size_t i = 0; i + TS_PACKAGE_SIZE <= chunk.size(); i += TS_PACKAGE_SIZE) {
+        unsigned char null[4] = {0x47, 0x1F, 0xFF, 0x10};
+        memcpy(chunk.data() + i, null, sizeof(null));
+    }
+    for (size_t i = 0; i < packets.size(); i++) {
+        memcpy(chunk.data() + i * TS_PACKAGE_SIZE, packets[i].data(), TS_PACKAGE_SIZE);
+    }
+}
+
+// Adaptation field only packet carrying a 27 MHz PCR
+StreamParser::StreamPacketT makePcrPacket(unsigned pid, uint64_t pcr) {
+    StreamParser::StreamPacketT packet;
+    packet.fill(0xFF);
+    uint64_t base = (pcr / 300) % (1ULL << 33);
+    uint64_t ext = pcr % 300;
+    unsigned char header[] = {0x47, (unsigned char) ((pid >> 8) & 0x1F), (unsigned char) pid, 0x20, 7, 0x10,
+                              (unsigned char) (base >> 25), (unsigned char) (base >> 17),
+                              (unsigned char) (base >> 9), (unsigned char) (base >> 1),
+                              (unsigned char) (((base & 1) << 7) | 0x7E | (ext >> 8)), (unsigned char) ext};
+    memcpy(packet.data(), header, sizeof(header));
+    return packet;
+}
+
+TEST(PSIParser, Crc32Mpeg) {
+    const char *check = "123456789";
+    ASSERT_EQ(crc32Mpeg((const unsigned char *) check, 9), 0x0376E6E7u);
+
+    auto section = makeSection(0x02, 1021);
+    ASSERT_EQ(crc32Mpeg(section.data(), section.size()), 0u);
+    section[500] ^= 0x01;
+    ASSERT_NE(crc32Mpeg(section.data(), section.size()), 0u);
+}
+
+TEST(PSIParser, SectionAssembler) {
+    std::vector<ByteVectorType> sections {makeSection(0x02, 400), makeSection(0x00, 16), makeSection(0x80, 60)};
+    StreamParser::SectionAssembler assembler;
+    const unsigned char *section;
+    size_t length;
+
+    // Multi packet sections and several sections in one packet
+    std::vector<ByteVectorType> received;
+    for (auto &packet: packetize(sections, true)) {
+        assembler.push(packet.data());
+        while (assembler.nextSection(section, length)) {
+            received.emplace_back(section, section + length);
+        }
+    }
+    ASSERT_EQ(received, sections);
+
+    // A corrupted section is not delivered
+    sections[0][200] ^= 0x01;
+    received.clear();
+    assembler.reset();
+    for (auto &packet: packetize(sections, false)) {
+        assembler.push(packet.data());
+        while (assembler.nextSection(section, length)) {
+            received.emplace_back(section, section + length);
+        }
+    }
+    ASSERT_EQ(received.size(), 2u);
+    ASSERT_EQ(assembler.getStats().crcErrors, 1u);
+
+    // A lost packet drops the section in progress
+    sections[0][200] ^= 0x01;
+    auto packets = packetize(sections, false);
+    packets.erase(packets.begin() + 1);
+    received.clear();
+    assembler.reset();
+    for (auto &packet: packets) {
+        assembler.push(packet.data());
+        while (assembler.nextSection(section, length)) {
+            received.emplace_back(section, section + length);
+        }
+    }
+    ASSERT_EQ(received.size(), 2u);
+    ASSERT_EQ(received[0], sections[1]);
+
+    // Repetitions are skipped
+    auto repeated = assembler.getStats().repeated;
+    received.clear();
+    for (auto &packet: packets) {
+        assembler.push(packet.data());
+        while (assembler.nextSection(section, length)) {
+            received.emplace_back(section, section + length);
+        }
+    }
+    ASSERT_EQ(received.size(), 0u);
+    ASSERT_EQ(assembler.getStats().repeated, repeated + 2u);
+
+    // A discontinuity_indicator drops the section in progress and
+    // forgets the delivered sections
+    StreamParser::StreamPacketT discontinuity;
+    discontinuity.fill(0xFF);
+    unsigned char header[] = {0x47, 0x00, 0x00, 0x20, TS_PACKAGE_SIZE - 5, 0x80};
+    memcpy(discontinuity.data(), header, sizeof(header));
+    auto dropped = assembler.getStats().dropped;
+    assembler.push(packets[0].data());
+    ASSERT_FALSE(assembler.nextSection(section, length));
+    assembler.push(discontinuity.data());
+    ASSERT_EQ(assembler.getStats().dropped, dropped + 1);
+
+    received.clear();
+    for (auto &packet: packets) {
+        assembler.push(packet.data());
+        while (assembler.nextSection(section, length)) {
+            received.emplace_back(section, section + length);
+        }
+    }
+    ASSERT_EQ(received.size(), 2u);
+    ASSERT_EQ(received[0], sections[1]);
+
+    // A corrupted section carrying a recent CRC_32 is no repetition
+    auto crcErrors = assembler.getStats().crcErrors;
+    repeated = assembler.getStats().repeated;
+    sections[2][10] ^= 0x01;
+    received.clear();
+    for (auto &packet: packetize({sections[2]}, false)) {
+        assembler.push(packet.data());
+        while (assembler.nextSection(section, length)) {
+            received.emplace_back(section, section + length);
+        }
+    }
+    ASSERT_EQ(received.size(), 0u);
+    ASSERT_EQ(assembler.getStats().crcErrors, crcErrors + 1);
+    ASSERT_EQ(assembler.getStats().repeated, repeated);
+}
+
+TEST(PSIParser, ServiceSelection) {
+    // Network PID and three services
+    auto pat = makePsiSection(0x00, 1, 0, {0x00, 0x00, 0xE0, 0x10,
+                                           0x00, 0x01, 0xE1, 0x00,
+                                           0x00, 0x02, 0xE2, 0x00,
+                                           0x00, 0x03, 0xE3, 0x00});
+    buffer_chunk chunk;
+    fillPsiChunk(chunk, packetize({pat}, false, 0));
+
+    StreamParser::PSIParser parser;
+    std::vector<std::pair<std::string, unsigned>> channels {
+            {"239.0.0.1:5000", 0x100},
+            {"239.0.0.1:5000/?sourceIp=10.0.0.1&serviceId=3", 0x300},
+            {"239.0.0.1:5000/?serviceId=7", PSI_INVALID_PID}};
+
+    for (auto &channel: channels) {
+        parser.onOpen(channel.first.c_str());
+        parser.notifyConfigurationChanged(CONFIG_F_FCC_STREAM_INFO_ECM, ByteVectorType());
+        parser.post({channel.first.c_str(), &chunk});
+
+        ASSERT_EQ(parser.getProgramMap().size(), 3);
+        ASSERT_EQ(parser.getPmtPid(), channel.second);
+    }
+
+    // Malformed service ids select the first service
+    ASSERT_EQ(ChannelConfig::getServiceId("239.0.0.1:5000/?serviceId=65535"), 0xFFFF);
+    for (auto uri: {"239.0.0.1:5000/?serviceId=3x", "239.0.0.1:5000/?serviceId=+3",
+                    "239.0.0.1:5000/?serviceId= 3", "239.0.0.1:5000/?serviceId=-1",
+                    "239.0.0.1:5000/?serviceId=65536", "239.0.0.1:5000/?serviceId=0"}) {
+        ASSERT_EQ(ChannelConfig::getServiceId(uri), 0) << uri;
+    }
+}
+
+TEST(PSIParser, PmtChange) {
+    auto &drm = MVar<StreamProtectionConfig>::getVariable(kDrm0);
+    auto &pmt0 = MVar<ByteVectorType>::getVariable(kPmt0);
+    auto pat = makePsiSection(0x00, 1, 0, {0x00, 0x01, 0xE1, 0x00});
+    // Clear service, video on 0x101 then audio added on 0x102
+    auto pmtV1 = makePsiSection(0x02, 1, 1, {0xE1, 0x01, 0xF0, 0x00,
+                                             0x1B, 0xE1, 0x01, 0xF0, 0x00});
+    auto pmtV2 = makePsiSection(0x02, 1, 2, {0xE1, 0x01, 0xF0, 0x00,
+                                             0x1B, 0xE1, 0x01, 0xF0, 0x00,
+                                             0x0F, 0xE1, 0x02, 0xF0, 0x00});
+
+    auto packets = packetize({pat}, false, 0);
+    auto pmtPackets = packetize({pmtV1}, false, 0x100);
+    packets.insert(packets.end(), pmtPackets.begin(), pmtPackets.end());
+
+    buffer_chunk chunk;
+    fillPsiChunk(chunk, packets);
+
+    const char *channel = "239.0.0.2:5000";
+    StreamParser::PSIParser parser;
+    parser.onOpen(channel);
+    parser.notifyConfigurationChanged(CONFIG_F_FCC_STREAM_INFO_ECM, ByteVectorType());
+    parser.post({channel, &chunk});
+    ASSERT_EQ(drm.getValue().pmt(), pmtV1);
+
+    // Repeated tables do not update drm0
+    pmt0 = ByteVectorType();
+    parser.post({channel, &chunk});
+    ASSERT_EQ(pmt0.getValue(), ByteVectorType());
+
+    // New PMT version after drm0 was set
+    pmtPackets = packetize({pmtV2}, false, 0x100);
+    pmtPackets[0][3] = 0x11;
+    fillPsiChunk(chunk, pmtPackets);
+    parser.post({channel, &chunk});
+    ASSERT_EQ(drm.getValue().pmt(), pmtV2);
+    ASSERT_EQ(pmt0.getValue(), pmtV2);
+}
+
+TEST(PSIParser, PmtChangeEncrypted) {
+    auto &drm = MVar<StreamProtectionConfig>::getVariable(kDrm0);
+    auto &pmt0 = MVar<ByteVectorType>::getVariable(kPmt0);
+    auto pat = makePsiSection(0x00, 1, 0, {0x00, 0x01, 0xE1, 0x00});
+    // VMX service with the ECM on 0x110, audio added on 0x102 keeping the ECM PID
+    auto pmtV1 = makePsiSection(0x02, 1, 1, {0xE1, 0x01, 0xF0, 0x06,
+                                             0x09, 0x04, 0x56, 0x01, 0xE1, 0x10,
+                                             0x1B, 0xE1, 0x01, 0xF0, 0x00});
+    auto pmtV2 = makePsiSection(0x02, 1, 2, {0xE1, 0x01, 0xF0, 0x06,
+                                             0x09, 0x04, 0x56, 0x01, 0xE1, 0x10,
+                                             0x1B, 0xE1, 0x01, 0xF0, 0x00,
+                                             0x0F, 0xE1, 0x02, 0xF0, 0x00});
+    auto ecm = makePsiSection(0x80, 0x5601, 0, {'V', 'M', 'E', 'C', 'M', 0x02, 0x00, 0x02});
+
+    auto packets = packetize({pat}, false, 0);
+    auto pmtPackets = packetize({pmtV1}, false, 0x100);
+    auto ecmPackets = packetize({ecm}, false, 0x110);
+    packets.insert(packets.end(), pmtPackets.begin(), pmtPackets.end());
+    packets.insert(packets.end(), ecmPackets.begin(), ecmPackets.end());
+
+    buffer_chunk chunk;
+    fillPsiChunk(chunk, packets);
+
+    const char *channel = "239.0.0.3:5000";
+    StreamParser::PSIParser parser;
+    parser.onOpen(channel);
+    parser.notifyConfigurationChanged(CONFIG_F_FCC_STREAM_INFO_ECM, ByteVectorType());
+    parser.post({channel, &chunk});
+    ASSERT_FALSE(drm.getValue().isClearStream());
+    ASSERT_EQ(drm.getValue().pmt(), pmtV1);
+    ASSERT_EQ(drm.getValue().ecm(), ecm);
+
+    // New PMT version with the same ECM PID. The ECM is still valid.
+    pmt0 = ByteVectorType();
+    pmtPackets = packetize({pmtV2}, false, 0x100);
+    pmtPackets[0][3] = 0x11;
+    fillPsiChunk(chunk, pmtPackets);
+    parser.post({channel, &chunk});
+    ASSERT_EQ(drm.getValue().pmt(), pmtV2);
+    ASSERT_EQ(pmt0.getValue(), pmtV2);
+}
+
+TEST(StreamAnalyzer, StreamHealth) {
+    using StreamParser::StreamAnalyzer;
+    using StreamParser::StreamPacketT;
+
+    // PMT on 0x100, PCR on 0x101 and video on 0x200
+    auto pat = packetize({makePsiSection(0x00, 1, 0, {0x00, 0x01, 0xE1, 0x00})}, false, 0)[0];
+    auto pmt = packetize({makePsiSection(0x02, 1, 0, {0xE1, 0x01, 0xF0, 0x00,
+                                                      0x1B, 0xE2, 0x00, 0xF0, 0x00})}, false, 0x100)[0];
+    StreamPacketT video;
+    video.fill(0xAA);
+    video[0] = 0x47;
+    video[1] = 0x02;
+    video[2] = 0x00;
+    video[3] = 0x10;
+    StreamPacketT null;
+    null.fill(0xFF);
+    null[0] = 0x47;
+    null[1] = 0x1F;
+    null[2] = 0xFF;
+    null[3] = 0x10;
+
+    std::array<uint8_t, PSI_MAX_PID + 1> cc {};
+    auto next = [&cc](StreamPacketT packet) {
+        packet[3] = (packet[3] & 0xF0) | (cc[GET_PID(packet)]++ & 0x0F);
+        return packet;
+    };
+
+    StreamAnalyzer analyzer;
+    buffer_chunk chunk;
+    uint64_t timeUs = 1000000000;
+    uint64_t pcrUs = 0;
+
+    // One chunk every 30 ms, starting with packets for sync acquisition
+    auto send = [&](bool tables, uint32_t flags = 0, uint32_t lost = 0,
+                    const std::vector<StreamPacketT> &extra = {}) {
+        std::vector<StreamPacketT> packets(HEALTH_SYNC_ACQUIRE, null);
+        if (tables) {
+            packets.push_back(next(pat));
+            packets.push_back(next(pmt));
+        }
+        packets.push_back(makePcrPacket(0x101, pcrUs * 27));
+        packets.push_back(next(video));
+        packets.insert(packets.end(), extra.begin(), extra.end());
+        fillPsiChunk(chunk, packets);
+        analyzer.post({"", &chunk, {timeUs, 0, 0, lost, flags}});
+        timeUs += 30000;
+        pcrUs += 30000;
+    };
+
+    analyzer.onOpen("");
+    for (int i = 0; i < 10; i++) {
+        send(true);
+    }
+    auto stats = analyzer.getStats(timeUs);
+    for (auto count: stats.total) {
+        ASSERT_EQ(count, 0);
+    }
+    ASSERT_EQ(stats.max[StreamAnalyzer::PCR_INTERVAL], 30000);
+    ASSERT_GE(stats.max[StreamAnalyzer::PAT_INTERVAL], 30000);
+    ASSERT_LT(stats.max[StreamAnalyzer::PAT_INTERVAL], 35000);
+    ASSERT_LT(stats.max[StreamAnalyzer::PCR_JITTER], 5000);
+
+    // Lost video packet
+    cc[0x200]++;
+    send(true);
+    // PAT and PMT missing for 630 ms, counted once
+    for (int i = 0; i < 20; i++) {
+        send(false);
+    }
+    send(true);
+    // PCR jump
+    pcrUs += 200000;
+    send(true);
+    // Network loss is no stream error
+    cc[0x200] += 5;
+    pcrUs += 500000;
+    send(true, BUFFER_FLAG_DISCONTINUITY, 3);
+    // Transport error and two packets without sync byte
+    auto tei = video;
+    tei[1] |= 0x80;
+    auto noSync = null;
+    noSync[0] = 0x00;
+    send(true, 0, 0, {tei, noSync, noSync});
+
+    stats = analyzer.getStats(timeUs);
+    std::array<uint64_t, StreamAnalyzer::COUNTER_COUNT> expected {};
+    expected[StreamAnalyzer::SYNC_LOSS] = 1;
+    expected[StreamAnalyzer::SYNC_BYTE_ERROR] = 2;
+    expected[StreamAnalyzer::PAT_ERROR] = 1;
+    expected[StreamAnalyzer::CC_ERROR] = 1;
+    expected[StreamAnalyzer::PMT_ERROR] = 1;
+    expected[StreamAnalyzer::TRANSPORT_ERROR] = 1;
+    expected[StreamAnalyzer::PCR_DISCONTINUITY_ERROR] = 1;
+    expected[StreamAnalyzer::SOURCE_LOST_PACKETS] = 3;
+    expected[StreamAnalyzer::DISCONTINUITIES] = 1;
+    ASSERT_EQ(stats.total, expected);
+    ASSERT_EQ(stats.recent, expected);
+    ASSERT_GE(stats.max[StreamAnalyzer::PAT_INTERVAL], 630000);
+    ASSERT_GE(stats.max[StreamAnalyzer::PMT_INTERVAL], 630000);
+    ASSERT_EQ(stats.ccErrorPids.size(), 1);
+    ASSERT_EQ(stats.ccErrorPids[0].first, 0x200);
+
+    // Short window
+    stats = analyzer.getStats(timeUs + STREAM_HEALTH_WINDOW_S * 1000000);
+    ASSERT_EQ(stats.total, expected);
+    ASSERT_EQ(stats.recent, (std::array<uint64_t, StreamAnalyzer::COUNTER_COUNT> {}));
+
+    // Reset with the channel
+    analyzer.onOpen("");
+    ASSERT_EQ(analyzer.getStats(timeUs).total, (std::array<uint64_t, StreamAnalyzer::COUNTER_COUNT> {}));
+}
+
+TEST(PcrTracker, BitrateAndMapping) {
+    using StreamParser::PcrTracker;
+    using StreamParser::PCR_CLOCK_HZ;
+    using StreamParser::PCR_WRAP;
+
+    auto pat = packetize({makePsiSection(0x00, 1, 0, {0x00, 0x01, 0xE1, 0x00,
+                                                      0x00, 0x02, 0xE2, 0x00})}, false, 0)[0];
+    auto pmt1 = packetize({makePsiSection(0x02, 1, 0, {0xE1, 0x01, 0xF0, 0x00})}, false, 0x100)[0];
+    auto pmt2 = packetize({makePsiSection(0x02, 2, 0, {0xE2, 0x01, 0xF0, 0x00})}, false, 0x200)[0];
+
+    // One chunk per 30 ms. The PCR of service 2 wraps after 5 chunks.
+    const uint64_t chunkTicks = 30 * 27000;
+    const uint64_t start2 = PCR_WRAP - 5 * chunkTicks;
+    const uint64_t pcrOffset = 4 * TS_PACKAGE_SIZE;
+    buffer_chunk chunk;
+    PcrTracker tracker;
+    auto send = [&](uint64_t k, uint32_t flags = 0) {
+        fillPsiChunk(chunk, {pat, pmt1, pmt2, makePcrPacket(0x101, k * chunkTicks),
+                             makePcrPacket(0x201, (start2 + k * chunkTicks) % PCR_WRAP)});
+        tracker.post({"", &chunk, {0, 0, 0, 0, flags}});
+    };
+
+    tracker.onOpen("239.0.0.1:5000/?serviceId=2");
+    ASSERT_EQ(tracker.getBitrate(), 0);
+    for (uint64_t k = 0; k < 10; k++) {
+        send(k);
+    }
+    ASSERT_EQ(tracker.getPcrPid(), 0x201);
+    ASSERT_EQ(tracker.getOffset(), 10 * BUFFER_CHUNK_SIZE);
+    uint64_t bitrate = BUFFER_CHUNK_SIZE * 8 * PCR_CLOCK_HZ / chunkTicks;
+    ASSERT_EQ(tracker.getBitrate(), bitrate);
+
+    PcrTracker::PcrSample last;
+    ASSERT_TRUE(tracker.getLastSample(last));
+    ASSERT_EQ(last.offset, 9 * BUFFER_CHUNK_SIZE + pcrOffset);
+    ASSERT_EQ(last.pcr, start2 + 9 * chunkTicks);
+
+    // Interpolated across the wrap, extrapolated after the last PCR
+    uint64_t pcr;
+    ASSERT_TRUE(tracker.offsetToPcr(4 * BUFFER_CHUNK_SIZE + pcrOffset + BUFFER_CHUNK_SIZE / 2, pcr));
+    ASSERT_EQ(pcr, start2 + 4 * chunkTicks + chunkTicks / 2);
+    ASSERT_TRUE(tracker.offsetToPcr(last.offset + BUFFER_CHUNK_SIZE, pcr));
+    ASSERT_NEAR(pcr, last.pcr + chunkTicks, 1);
+
+    // A gap drops the history, the bitrate is kept
+    send(20, BUFFER_FLAG_DISCONTINUITY);
+    ASSERT_TRUE(tracker.getLastSample(last));
+    ASSERT_EQ(last.pcr, (start2 + 20 * chunkTicks) % PCR_WRAP);
+    ASSERT_EQ(tracker.getBitrate(), bitrate);
+    ASSERT_TRUE(tracker.offsetToPcr(last.offset - BUFFER_CHUNK_SIZE, pcr));
+    ASSERT_NEAR(pcr, last.pcr - chunkTicks, 1);
+
+    // First service without serviceId
+    tracker.onOpen("239.0.0.1:5000");
+    send(0);
+    ASSERT_EQ(tracker.getPcrPid(), 0x101);
+}
+
+TEST(PcrTracker, RandomAccessPoint) {
+    using StreamParser::PcrTracker;
+
+    auto pat = packetize({makePsiSection(0x00, 1, 0, {0x00, 0x01, 0xE1, 0x00})}, false, 0)[0];
+    // AAC audio before H.264 video
+    auto pmt = packetize({makePsiSection(0x02, 1, 0, {0xE1, 0x01, 0xF0, 0x00,
+                                                      0x0F, 0xE1, 0x02, 0xF0, 0x00,
+                                                      0x1B, 0xE1, 0x01, 0xF0, 0x00})}, false, 0x100)[0];
+    buffer_chunk chunk;
+    PcrTracker tracker;
+    unsigned pid;
+    unsigned streamType;
+
+    tracker.onOpen("");
+    ASSERT_FALSE(tracker.getVideoStream(pid, streamType));
+    fillPsiChunk(chunk, {pat, pmt});
+    tracker.post({"", &chunk, {}});
+    ASSERT_TRUE(tracker.getVideoStream(pid, streamType));
+    ASSERT_EQ(pid, 0x101);
+    ASSERT_EQ(streamType, 0x1B);
+
+    // PES with PTS, access unit delimiter and the first slice
+    auto pes = [](unsigned char nal) {
+        StreamParser::StreamPacketT packet;
+        packet.fill(0xFF);
+        unsigned char data[] = {0x47, 0x41, 0x01, 0x10,
+                                0x00, 0x00, 0x01, 0xE0, 0x00, 0x00, 0x80, 0x80, 0x05, 0x21, 0x00, 0x01, 0x00, 0x01,
+                                0x00, 0x00, 0x00, 0x01, 0x09, 0xF0, 0x00, 0x00, 0x00, 0x01, nal};
+        memcpy(packet.data(), data, sizeof(data));
+        return packet;
+    };
+
+    ASSERT_TRUE(PcrTracker::isRandomAccessPoint(pes(0x65).data(), 0x1B));
+    ASSERT_FALSE(PcrTracker::isRandomAccessPoint(pes(0x41).data(), 0x1B));
+    ASSERT_TRUE(PcrTracker::isRandomAccessPoint(pes(0x26).data(), 0x24));
+    ASSERT_FALSE(PcrTracker::isRandomAccessPoint(pes(0x02).data(), 0x24));
+    ASSERT_TRUE(PcrTracker::isRandomAccessPoint(pes(0xB3).data(), 0x02));
+
+    // random_access_indicator, only on a PES start
+    auto packet = pes(0x41);
+    unsigned char adaptation[] = {0x47, 0x41, 0x01, 0x30, 0x01, 0x40};
+    memcpy(packet.data(), adaptation, sizeof(adaptation));
+    ASSERT_TRUE(PcrTracker::isRandomAccessPoint(packet.data(), 0x1B));
+    packet[1] = 0x01;
+    ASSERT_FALSE(PcrTracker::isRandomAccessPoint(packet.data(), 0x1B));
+
+    // The payload of scrambled packets is not parsed
+    auto scrambled = pes(0x65);
+    scrambled[3] |= 0x80;
+    ASSERT_FALSE(PcrTracker::isRandomAccessPoint(scrambled.data(), 0x1B));
+    ASSERT_FALSE(tracker.isVideoScrambled());
+    fillPsiChunk(chunk, {scrambled});
+    tracker.post({"", &chunk, {}});
+    ASSERT_TRUE(tracker.isVideoScrambled());
+    fillPsiChunk(chunk, {pes(0x41)});
+    tracker.post({"", &chunk, {}});
+    ASSERT_FALSE(tracker.isVideoScrambled());
+}
+
+TEST(TrickPlayStream, IFrames) {
+    using StreamParser::PcrTracker;
+
+    // I-frame start with PCR, PTS and DTS, an audio packet, the rest of
+    // the I-frame and the start of the next access unit
+    auto video = [](bool start, unsigned cc) {
+        StreamParser::StreamPacketT packet;
+        packet.fill(0xAA);
+        unsigned char header[] = {0x47, (unsigned char) (start ? 0x41 : 0x01), 0x01, (unsigned char) (0x10 | cc)};
+        memcpy(packet.data(), header, sizeof(header));
+        return packet;
+    };
+    auto rap = makePcrPacket(0x101, 123456789);
+    rap[1] |= 0x40;
+    rap[3] = 0x35;
+    unsigned char pes[] = {0x00, 0x00, 0x01, 0xE0, 0x00, 0x00, 0x80, 0xC0, 0x0A,
+                           0x31, 0x00, 0x01, 0x00, 0x01, 0x11, 0x00, 0x01, 0x00, 0x01};
+    memcpy(rap.data() + 12, pes, sizeof(pes));
+    auto audio = video(true, 0);
+    audio[2] = 0x02;
+
+    std::vector<unsigned char> data;
+    for (const auto &packet: {rap, audio, video(false, 6), video(true, 7)}) {
+        data.insert(data.end(), packet.begin(), packet.end());
+    }
+
+    auto pts = [](const unsigned char *p) {
+        return ((uint64_t) (p[0] & 0x0E) << 29) | (p[1] << 22) | ((p[2] & 0xFE) << 14) | (p[3] << 7) | (p[4] >> 1);
+    };
+
+    StreamParser::TrickPlayStream stream(350000);
+    const uint64_t frameTicks = 350 * 27000;
+    std::vector<unsigned char> out(10 * TS_PACKAGE_SIZE);
+
+    // An access unit is only taken complete and from its start
+    ASSERT_FALSE(stream.addFrame(data.data(), 3 * TS_PACKAGE_SIZE, 0x101, 0x101));
+    ASSERT_FALSE(stream.addFrame(data.data() + 2 * TS_PACKAGE_SIZE, 2 * TS_PACKAGE_SIZE, 0x101, 0x101));
+    ASSERT_TRUE(stream.empty());
+
+    for (uint64_t frame = 0; frame < 2; frame++) {
+        ASSERT_TRUE(stream.addFrame(data.data(), data.size(), 0x101, 0x101));
+        // Read in two parts
+        ASSERT_EQ(stream.read((char *) out.data(), 100), 100);
+        ASSERT_EQ(stream.read((char *) out.data() + 100, out.size()), 3 * TS_PACKAGE_SIZE - 100);
+        ASSERT_TRUE(stream.empty());
+
+        // PCR packet and the two video packets, counters continue
+        const unsigned char *pcrPacket = out.data();
+        const unsigned char *first = out.data() + TS_PACKAGE_SIZE;
+        const unsigned char *second = out.data() + 2 * TS_PACKAGE_SIZE;
+        ASSERT_EQ(pcrPacket[3], 0x20 | (2 * frame));
+        ASSERT_EQ(first[3] & 0x0F, 2 * frame + 1);
+        ASSERT_EQ(second[3] & 0x0F, 2 * frame + 2);
+        ASSERT_EQ(GET_PID(second), 0x101);
+        // On the video PID, the PCR packet starts each jump
+        ASSERT_NE(pcrPacket[5] & 0x80, 0);
+
+        uint64_t pcr;
+        bool discontinuity;
+        ASSERT_TRUE(PcrTracker::readPcr(pcrPacket, pcr, discontinuity));
+        ASSERT_EQ(pcr, frame * frameTicks);
+        ASSERT_TRUE(PcrTracker::readPcr(first, pcr, discontinuity));
+        ASSERT_EQ(pcr, frame * frameTicks);
+        ASSERT_FALSE(discontinuity);
+
+        const unsigned char *firstPes = first + 12;
+        uint64_t expectedPts = frame * frameTicks / 300 + TRICK_PLAY_PTS_DELAY_MS * 90;
+        ASSERT_EQ(pts(firstPes + 9), expectedPts);
+        ASSERT_EQ(pts(firstPes + 14), expectedPts);
+        ASSERT_EQ(firstPes[9] >> 4, 0x3);
+        ASSERT_EQ(firstPes[14] >> 4, 0x1);
+    }
+
+    // A new time base is signalled after reset, the counters restart
+    stream.reset();
+    ASSERT_TRUE(stream.addFrame(data.data(), data.size(), 0x101, 0x101));
+    ASSERT_EQ(stream.read((char *) out.data(), out.size()), 3 * TS_PACKAGE_SIZE);
+    ASSERT_NE(out[5] & 0x80, 0);
+    ASSERT_EQ(out[3], 0x20);
+
+    // PCR on its own PID: the time base continues, the first video
+    // packet signals the jump
+    stream.reset();
+    for (uint64_t frame = 0; frame < 2; frame++) {
+        ASSERT_TRUE(stream.addFrame(data.data(), data.size(), 0x101, 0x100));
+        ASSERT_EQ(stream.read((char *) out.data(), out.size()), 3 * TS_PACKAGE_SIZE);
+        ASSERT_EQ(GET_PID(out.data()), 0x100);
+        ASSERT_EQ((out[5] & 0x80) != 0, frame == 0);
+        ASSERT_NE(out[TS_PACKAGE_SIZE + 5] & 0x80, 0);
+        ASSERT_EQ(out[2 * TS_PACKAGE_SIZE + 3], 0x10 | (2 * frame + 2));
+    }
+
+    // Without adaptation field, a packet of its own carries the indicator
+    std::vector<unsigned char> plain;
+    for (const auto &packet: {video(true, 0), video(false, 1), video(true, 2)}) {
+        plain.insert(plain.end(), packet.begin(), packet.end());
+    }
+    stream.reset();
+    ASSERT_TRUE(stream.addFrame(plain.data(), plain.size(), 0x101, 0x100));
+    ASSERT_EQ(stream.read((char *) out.data(), out.size()), 4 * TS_PACKAGE_SIZE);
+    const unsigned char *marker = out.data() + TS_PACKAGE_SIZE;
+    ASSERT_EQ(GET_PID(marker), 0x101);
+    ASSERT_EQ(marker[3], 0x20);
+    ASSERT_EQ(marker[5], 0x80);
+    ASSERT_EQ(out[2 * TS_PACKAGE_SIZE + 3], 0x11);
+
+    // Scrambled frames are not added
+    stream.reset();
+    ASSERT_FALSE(stream.isScrambled());
+    data[3] |= 0x80;
+    ASSERT_FALSE(stream.addFrame(data.data(), data.size(), 0x101, 0x100));
+    ASSERT_TRUE(stream.isScrambled());
+    ASSERT_TRUE(stream.empty());
+}
+
+// TS stream of packets starting skip bytes into the first chunk, so
+// that packets span the chunk boundaries. packetAt builds the packet
+// starting at a byte index.
+ByteVectorType makeShiftedStream(size_t chunks, size_t skip,
+                                 const std::function<StreamParser::StreamPacketT(uint64_t)> &packetAt) {
+    ByteVectorType stream(skip, 0xFF);
+    while (stream.size() < chunks * BUFFER_CHUNK_SIZE) {
+        auto packet = packetAt(stream.size());
+        stream.insert(stream.end(), packet.begin(), packet.end());
+    }
+    stream.resize(chunks * BUFFER_CHUNK_SIZE);
+    return stream;
+}
+
+// Start index of the packet holding byteIndex
+uint64_t packetStart(uint64_t byteIndex, size_t skip) {
+    return skip + (byteIndex - skip) / TS_PACKAGE_SIZE * TS_PACKAGE_SIZE;
+}
+
+// Post a stream to the TSB, one chunk per chunkUs of arrival time
+void postToTsb(StreamParser::TimeShiftBufferConsumer &tsb, const ByteVectorType &stream, uint64_t chunkUs) {
+    buffer_chunk chunk;
+    for (size_t i = 0; i < stream.size() / BUFFER_CHUNK_SIZE; i++) {
+        memcpy(chunk.data(), stream.data() + i * BUFFER_CHUNK_SIZE, BUFFER_CHUNK_SIZE);
+        tsb.post({"", &chunk, {1000000 + i * chunkUs, 0, 0, 0, 0}});
+    }
+}
+
+TEST(TimeShiftBufferConsumer, SpanningPcrPacket) {
+    using StreamParser::PcrTracker;
+
+    auto pat = packetize({makePsiSection(0x00, 1, 0, {0x00, 0x01, 0xE1, 0x00})}, false, 0)[0];
+    auto pmt = packetize({makePsiSection(0x02, 1, 0, {0xE1, 0x01, 0xF0, 0x00,
+                                                      0x1B, 0xE1, 0x01, 0xF0, 0x00})}, false, 0x100)[0];
+    buffer_chunk chunk;
+    auto tracker = std::make_shared<PcrTracker>();
+    tracker->onOpen("");
+    fillPsiChunk(chunk, {pat, pmt});
+    tracker->post({"", &chunk, {}});
+
+    StreamParser::TimeShiftBufferConsumer tsb(nullptr);
+    tsb.setPcrTracker(tracker);
+    tsb.onOpen("");
+
+    // One PCR per 100 ms in the packet holding the first byte of each
+    // chunk. Arrival time runs at 200 ms per chunk.
+    const size_t skip = (BUFFER_CHUNK_SIZE + TS_PACKAGE_SIZE / 2) % TS_PACKAGE_SIZE;
+    const size_t chunks = 12;
+    StreamParser::StreamPacketT nullPacket;
+    nullPacket.fill(0xFF);
+    nullPacket[0] = 0x47;
+    nullPacket[1] = 0x1F;
+    auto pcrIndex = [&](uint64_t k) { return packetStart(k * BUFFER_CHUNK_SIZE, skip); };
+    auto stream = makeShiftedStream(chunks, skip, [&](uint64_t byteIndex) {
+        uint64_t k = (byteIndex + TS_PACKAGE_SIZE - 1) / BUFFER_CHUNK_SIZE;
+        if (k > 0 && byteIndex == pcrIndex(k)) {
+            return makePcrPacket(0x101, k * 100 * 27000);
+        }
+        return nullPacket;
+    });
+    postToTsb(tsb, stream, 200000);
+
+    // The seek resolves in media time, 300 ms are three chunks
+    ASSERT_TRUE(tsb.setSeekTime(300));
+    ASSERT_NEAR(tsb.getSeekOffset(), 3 * BUFFER_CHUNK_SIZE, 2);
+}
+
+TEST(TimeShiftBufferConsumer, SpanningRandomAccessPoint) {
+    using StreamParser::PcrTracker;
+
+    auto pat = packetize({makePsiSection(0x00, 1, 0, {0x00, 0x01, 0xE1, 0x00})}, false, 0)[0];
+    auto pmt = packetize({makePsiSection(0x02, 1, 0, {0xE1, 0x01, 0xF0, 0x00,
+                                                      0x1B, 0xE1, 0x01, 0xF0, 0x00})}, false, 0x100)[0];
+    buffer_chunk chunk;
+    auto tracker = std::make_shared<PcrTracker>();
+    tracker->onOpen("");
+    fillPsiChunk(chunk, {pat, pmt});
+    tracker->post({"", &chunk, {}});
+
+    StreamParser::TimeShiftBufferConsumer tsb(nullptr);
+    tsb.setPcrTracker(tracker);
+    tsb.onOpen("");
+
+    // PCR in the middle of each chunk, an IDR with random_access_indicator
+    // in the packet holding the first byte of chunk 6
+    const size_t skip = (BUFFER_CHUNK_SIZE + TS_PACKAGE_SIZE / 2) % TS_PACKAGE_SIZE;
+    const size_t chunks = 12;
+    StreamParser::StreamPacketT nullPacket;
+    nullPacket.fill(0xFF);
+    nullPacket[0] = 0x47;
+    nullPacket[1] = 0x1F;
+    StreamParser::StreamPacketT idrPacket;
+    idrPacket.fill(0xFF);
+    unsigned char idr[] = {0x47, 0x41, 0x01, 0x30, 0x01, 0x40,
+                           0x00, 0x00, 0x01, 0xE0, 0x00, 0x00, 0x80, 0x80, 0x05, 0x21, 0x00, 0x01, 0x00, 0x01,
+                           0x00, 0x00, 0x00, 0x01, 0x09, 0xF0, 0x00, 0x00, 0x00, 0x01, 0x65};
+    memcpy(idrPacket.data(), idr, sizeof(idr));
+
+    uint64_t rapIndex = packetStart(6 * BUFFER_CHUNK_SIZE, skip);
+    auto stream = makeShiftedStream(chunks, skip, [&](uint64_t byteIndex) {
+        uint64_t k = byteIndex / BUFFER_CHUNK_SIZE;
+        if (byteIndex == rapIndex) {
+            return idrPacket;
+        }
+        if (byteIndex == packetStart(k * BUFFER_CHUNK_SIZE + BUFFER_CHUNK_SIZE / 2, skip)) {
+            return makePcrPacket(0x101, k * 100 * 27000);
+        }
+        return nullPacket;
+    });
+    postToTsb(tsb, stream, 200000);
+
+    // Snapped back from three chunks before the live point to the IDR
+    ASSERT_TRUE(tsb.setSeekTime(300));
+    ASSERT_EQ(tsb.getSeekOffset(), chunks * BUFFER_CHUNK_SIZE - rapIndex);
+}
+
+TEST(TimeShiftBufferConsumer, IndependentHandles) {
+    StreamParser::TimeShiftBufferConsumer tsb(nullptr);
+    tsb.onOpen("");
+
+    // Chunk i is filled with i, one chunk per 100 ms
+    ByteVectorType stream;
+    for (unsigned i = 0; i < 10; i++) {
+        stream.insert(stream.end(), BUFFER_CHUNK_SIZE, i);
+    }
+    postToTsb(tsb, stream, 100000);
+    auto post = [&](unsigned i) {
+        buffer_chunk chunk;
+        chunk.fill(i);
+        tsb.post({"", &chunk, {1000000 + i * 100000, 0, 0, 0, 0}});
+    };
+
+    // The first reader is controlled, the second stays at live
+    std::vector<char> data(TS_PACKAGE_SIZE);
+    ASSERT_EQ(tsb.readData(1, data.data(), data.size()), 0);
+    ASSERT_EQ(tsb.readData(2, data.data(), data.size()), 0);
+    ASSERT_TRUE(tsb.setSeekTime(300));
+    uint64_t seekOffset = tsb.getSeekOffset();
+    ASSERT_GT(seekOffset, 0);
+    ASSERT_EQ(tsb.readData(1, data.data(), data.size()), data.size());
+    ASSERT_EQ(data[0], 10 - (seekOffset + BUFFER_CHUNK_SIZE - 1) / BUFFER_CHUNK_SIZE);
+    ASSERT_EQ(tsb.readData(2, data.data(), data.size()), 0);
+
+    // Paused, the controlled reader keeps its position while live moves on
+    tsb.setPlayerState(PlayerStateEnum::StateType::PAUSED);
+    std::this_thread::sleep_for(std::chrono::milliseconds(PAUSE_POST_READ_RATE_TIMEOUT_MS + 200));
+    post(10);
+    ASSERT_EQ(tsb.getSeekOffset(), seekOffset + BUFFER_CHUNK_SIZE - data.size());
+    ASSERT_EQ(tsb.readData(2, data.data(), data.size()), data.size());
+    ASSERT_EQ(data[0], 10);
+
+    // Release of the controlled reader while ingest is running
+    std::thread ingest([&]() {
+        for (unsigned i = 11; i < 40; i++) {
+            post(i);
+        }
+    });
+    tsb.release(1);
+    ingest.join();
+    seekOffset = tsb.getSeekOffset();
+    post(40);
+    ASSERT_EQ(tsb.getSeekOffset(), seekOffset);
+
+    // The other reader continues where it was, a new reader is controlled
+    ASSERT_EQ(tsb.readData(2, data.data(), data.size()), data.size());
+    ASSERT_EQ(data[0], 10);
+    ASSERT_EQ(tsb.readData(3, data.data(), data.size()), data.size());
+    ASSERT_EQ(data[0], 41 - (seekOffset + BUFFER_CHUNK_SIZE - 1) / BUFFER_CHUNK_SIZE);
+    tsb.setPlayerState(PlayerStateEnum::StateType::PLAYING);
+}
+
+TEST(TimeShiftBufferConsumer, PacedReads) {
+    StreamParser::TimeShiftBufferConsumer tsb(nullptr);
+    std::atomic<uint64_t> nowUs {1000000};
+    tsb.setPacingClock([&]() { return nowUs.load(); });
+    tsb.onOpen("");
+
+    // Chunk i is filled with i, one chunk per 100 ms
+    ByteVectorType stream;
+    for (unsigned i = 0; i < 30; i++) {
+        stream.insert(stream.end(), BUFFER_CHUNK_SIZE, i);
+    }
+    postToTsb(tsb, stream, 100000);
+
+    std::vector<char> data(BUFFER_CHUNK_SIZE);
+    ASSERT_EQ(tsb.readData(1, data.data(), data.size()), 0);
+    ASSERT_TRUE(tsb.setSeekTime(2500));
+    ASSERT_TRUE(tsb.setReadRate(1));
+
+    // A burst of 500 ms is served, further reads wait for the clock
+    std::atomic<uint64_t> readBytes {0};
+    std::atomic<bool> done {false};
+    std::thread reader([&]() {
+        std::vector<char> buf(BUFFER_CHUNK_SIZE);
+        while (readBytes < 8 * BUFFER_CHUNK_SIZE) {
+            readBytes += tsb.readData(1, buf.data(), buf.size());
+        }
+        done = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(3 * READ_PACING_MAX_WAIT_MS));
+    ASSERT_FALSE(done);
+    ASSERT_LE(readBytes, 5 * BUFFER_CHUNK_SIZE + TS_PACKAGE_SIZE);
+    nowUs += 1000000;
+    reader.join();
+    ASSERT_LE(readBytes, 10 * BUFFER_CHUNK_SIZE + 2 * TS_PACKAGE_SIZE);
+
+    // A waiting read stops when the reader is no longer the primary one
+    size_t result = 1;
+    done = false;
+    reader = std::thread([&]() {
+        std::vector<char> buf(BUFFER_CHUNK_SIZE);
+        while ((result = tsb.readData(1, buf.data(), buf.size())) > 0) {
+        }
+        done = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(3 * READ_PACING_MAX_WAIT_MS));
+    ASSERT_FALSE(done);
+    tsb.release(1);
+    reader.join();
+    ASSERT_EQ(result, 0u);
+}
+
+TEST(TimeShiftBufferConsumer, MemoryPressure) {
+    const uint64_t chunks = 64;
+    StreamParser::TimeShiftBufferConsumer tsb(nullptr);
+    ASSERT_TRUE(tsb.setTsbSize(TSB_MAX_DURATION_SECONDS, chunks * BUFFER_CHUNK_SIZE));
+    tsb.onOpen("");
+    ASSERT_EQ(tsb.getBufferPoolSize(), chunks + BUFFER_POOL_TAIL_SIZE);
+
+    auto windowBytes = [](uint64_t poolChunks) {
+        return (poolChunks / BUFFER_SAMPLING_RATIO - 1) * BUFFER_SAMPLING_RATIO * BUFFER_CHUNK_SIZE;
+    };
+    // Chunk i is filled with i, one chunk per 100 ms
+    ByteVectorType stream;
+    for (unsigned i = 0; i < 2 * chunks; i++) {
+        stream.insert(stream.end(), BUFFER_CHUNK_SIZE, i);
+    }
+    postToTsb(tsb, stream, 100000);
+    ASSERT_EQ(tsb.getBufferCapacityByteSize(), windowBytes(chunks));
+    ASSERT_GT(tsb.getActualBufferByteSize(), windowBytes(chunks / 2));
+
+    // The controlled reader plays from the oldest data
+    std::vector<char> data(TS_PACKAGE_SIZE);
+    ASSERT_EQ(tsb.readData(1, data.data(), data.size()), 0);
+    ASSERT_TRUE(tsb.setSeekTime(tsb.getMaxSeekTime()));
+    ASSERT_EQ(tsb.readData(1, data.data(), data.size()), data.size());
+    ASSERT_EQ((unsigned char) data[0], 2 * chunks - tsb.getSeekOffset() / BUFFER_CHUNK_SIZE);
+
+    // Medium pressure halves the window and keeps the ring
+    tsb.setMemoryPressure(MemoryPressureMonitor::MEDIUM);
+    ASSERT_EQ(tsb.getBufferPoolSize(), chunks + BUFFER_POOL_TAIL_SIZE);
+    ASSERT_EQ(tsb.getBufferCapacityByteSize(), windowBytes(chunks / 2));
+    ASSERT_LE(tsb.getActualBufferByteSize(), windowBytes(chunks / 2));
+    ASSERT_GT(tsb.getActualBufferByteSize(), 0);
+    ASSERT_LE(tsb.getMaxSeekTime(), chunks / 2 * 100);
+
+    // Critical pressure keeps the newest quarter in a smaller ring, the
+    // controlled reader continues at its oldest data
+    tsb.setMemoryPressure(MemoryPressureMonitor::CRITICAL);
+    ASSERT_EQ(tsb.getBufferPoolSize(), chunks / 4 + BUFFER_POOL_TAIL_SIZE);
+    ASSERT_EQ(tsb.getBufferCapacityByteSize(), windowBytes(chunks / 4));
+    uint64_t keptBytes = tsb.getActualBufferByteSize();
+    ASSERT_LE(keptBytes, windowBytes(chunks / 4));
+    ASSERT_GT(keptBytes, 0);
+    ASSERT_EQ(tsb.getSeekOffset(), keptBytes);
+    ASSERT_EQ(tsb.readData(1, data.data(), data.size()), data.size());
+    ASSERT_EQ((unsigned char) data[0], 2 * chunks - keptBytes / BUFFER_CHUNK_SIZE);
+
+    // Posts continue in the new ring
+    auto post = [&](unsigned i) {
+        buffer_chunk chunk;
+        chunk.fill(i);
+        tsb.post({"", &chunk, {1000000 + i * 100000, 0, 0, 0, 0}});
+    };
+    post(2 * chunks);
+    ASSERT_TRUE(tsb.setSeekTime(0));
+    ASSERT_EQ(tsb.getSeekOffset(), 0);
+
+    // Without pressure the ring grows back and keeps the data
+    tsb.setMemoryPressure(MemoryPressureMonitor::NONE);
+    ASSERT_EQ(tsb.getBufferPoolSize(), chunks + BUFFER_POOL_TAIL_SIZE);
+    ASSERT_EQ(tsb.getBufferCapacityByteSize(), windowBytes(chunks));
+    ASSERT_GE(tsb.getActualBufferByteSize(), keptBytes);
+    ASSERT_TRUE(tsb.setSeekTime(tsb.getMaxSeekTime()));
+    ASSERT_EQ(tsb.readData(1, data.data(), data.size()), data.size());
+    ASSERT_EQ((unsigned char) data[0], 2 * chunks + 1 - tsb.getSeekOffset() / BUFFER_CHUNK_SIZE);
+    for (unsigned i = 2 * chunks + 1; i < 4 * chunks; i++) {
+        post(i);
+    }
+    ASSERT_GT(tsb.getActualBufferByteSize(), windowBytes(chunks / 2));
+}
+
+TEST(TimeShiftBufferConsumer, SpillOnDemand) {
+    StreamParser::TimeShiftBufferConsumer tsb(nullptr);
+    ASSERT_TRUE(tsb.setTsbSize(TSB_MAX_DURATION_SECONDS, TSB_MIN_SIZE_CHUNKS * BUFFER_CHUNK_SIZE));
+    ASSERT_TRUE(tsb.setSpill("/tmp/fcc_tsb_spill_test.bin", 32 * SPILL_SEGMENT_SIZE));
+    tsb.onOpen("");
+    auto spillStore = tsb.getSpillStore();
+    ASSERT_NE(spillStore, nullptr);
+
+    // Chunk i is filled with i, one chunk per 100 ms
+    auto post = [&](unsigned i) {
+        buffer_chunk chunk;
+        chunk.fill(i);
+        tsb.post({"", &chunk, {1000000 + i * 100000, 0, 0, 0, 0}});
+    };
+
+    // Nothing is written to disk while the reader follows live
+    std::vector<char> data(BUFFER_CHUNK_SIZE);
+    ASSERT_EQ(tsb.readData(1, data.data(), data.size()), 0);
+    unsigned n = 0;
+    for (; n < 4 * TSB_MIN_SIZE_CHUNKS; n++) {
+        post(n);
+        ASSERT_EQ(tsb.readData(1, data.data(), data.size()), data.size());
+    }
+    ASSERT_EQ(spillStore->getStats().writtenBytes, 0);
+
+    // The chunks the reader has not read yet go to disk as they leave the
+    // seek window, until the reader is behind the whole ring
+    const unsigned behind = n;
+    for (; n < behind + BUFFER_POOL_TAIL_SIZE + 2 * TSB_MIN_SIZE_CHUNKS; n++) {
+        post(n);
+    }
+    for (int i = 0; i < 500 && spillStore->getStats().writtenSegments < 2; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_GE(spillStore->getStats().writtenSegments, 2);
+    ASSERT_GT(tsb.getMaxSeekTime(), TSB_MIN_SIZE_CHUNKS * 100);
+
+    // The reader continues from disk where it was
+    ASSERT_GT(tsb.readData(1, data.data(), data.size()), 0);
+    ASSERT_EQ((unsigned char) data[0], behind);
+    ASSERT_GT(spillStore->getStats().readBytes, 0);
+}
+
 TEST(PSIParser, RandomPackets) {
     const uint32_t packageCount = BUFFER_CHUNK_SIZE;
     const uint32_t numberOfChunks = TS_PACKAGE_SIZE;
@@ -24,9 +24,19 @@
 #include "glog/logging.h"
 #include "utils/ConstDelayDefHandler.h"
 #include <thread>
+#include <set>
+#include <fstream>
+#include <sys/mman.h>
 #include <streamfs/ByteBufferPool.h>
 #include "utils/MonitoredVariable.h"
 #include "utils/TimeIntervalMonitor.h"
+#include "utils/MemoryPressureMonitor.h"
+#include "StreamParser/SpillStore.h"
+#include "StreamParser/PersistentTsb.h"
+#include "StreamParser/ReadPacer.h"
+#include "BufferQueue.h"
+#include "StuffingGenerator.h"
+#include "StreamParser/StreamProcessor.h"
 
 debug_options_t dDebugOptions{0xff,0};
 
@@ -416,7 +426,7 @@ TEST(BufferIndexer, bisectionSearchTest) {
         struct refData {
             uint64_t timeUs;      // seek time [us] reference value
             uint64_t bufferCount; // buffer count reference value
-            uint64_t timestampUs; // EPOC timestamp [us] reference value
+            uint64_t timestampUs; // steady_clock timestamp [us] reference value
         };
         // Reference vector containing the refData objects
         std::vector<refData> refVector;
@@ -428,7 +438,7 @@ TEST(BufferIndexer, bisectionSearchTest) {
             currentBufferCount += buffer_size;
             currentTimeUs += period_us;
             uint64_t timestampUs = std::chrono::duration_cast< std::chrono::microseconds >(
-                    std::chrono::high_resolution_clock::now().time_since_epoch()
+                    std::chrono::steady_clock::now().time_since_epoch()
             ).count();
             refVector.push_back({currentTimeUs, currentBufferCount, timestampUs});
             bIdx.registerBufferCount(currentBufferCount);
@@ -525,6 +535,487 @@ TEST(BufferIndexer, rotationTest) {
     ASSERT_NEAR(10, buf, 19);
 }
 
+TEST(BufferIndexer, ingestTimestampTest) {
+    StreamParser::BufferIndexer bIdx(10, 0, 1);
+    uint64_t buf;
+
+    // Register using ingest timestamps, 100ms apart
+    for (uint64_t n = 1; n <= 5; ++n) {
+        bIdx.registerBufferCount(n * 1000, 1000000 + n * 100000);
+    }
+    ASSERT_EQ(bIdx.getIndexSizeInTimeUs(), 400000);
+
+    // Out of order timestamps are clamped to keep the index monotonic
+    bIdx.registerBufferCount(6000, 1000000);
+    ASSERT_EQ(bIdx.getIndexSizeInTimeUs(), 400000);
+    ASSERT_EQ(bIdx.getIndexSizeInBytes(), 5000);
+
+    ASSERT_EQ(bIdx.getTimestampUsForByteIndex(3000, buf), StreamParser::BUF_OK);
+    ASSERT_EQ(buf, 1300000);
+}
+
+TEST(BufferIndexer, windowSizeTest) {
+    StreamParser::BufferIndexer bIdx(100, 10, 1);
+    uint64_t buf;
+
+    // 100ms chunks of 1000 bytes
+    for (uint64_t n = 1; n <= 100; ++n) {
+        bIdx.registerBufferCount(n * 1000, n * 100000);
+    }
+    ASSERT_EQ(bIdx.getBufferCapacity(), 90);
+    ASSERT_EQ(bIdx.getByteOffsetFromTimeUs(8e6, buf), StreamParser::BUF_OK);
+
+    // A window limits seeks without dropping the index
+    bIdx.setWindowSize(20);
+    ASSERT_EQ(bIdx.getBufferCapacity(), 20);
+    ASSERT_EQ(bIdx.getByteOffsetFromTimeUs(1e6, buf), StreamParser::BUF_OK);
+    ASSERT_EQ(bIdx.getByteOffsetFromTimeUs(8e6, buf), StreamParser::BUF_OUT_OF_RANGE);
+
+    // Capped to the TSB size
+    bIdx.setWindowSize(1000);
+    ASSERT_EQ(bIdx.getBufferCapacity(), 90);
+    ASSERT_EQ(bIdx.getByteOffsetFromTimeUs(8e6, buf), StreamParser::BUF_OK);
+
+    // Resizing clears the index
+    bIdx.resize(40, 10);
+    ASSERT_EQ(bIdx.getBufferCapacity(), 30);
+    ASSERT_EQ(bIdx.getByteOffsetFromTimeUs(0, buf), StreamParser::BUF_EMPTY);
+
+    for (uint64_t n = 1; n <= 100; ++n) {
+        bIdx.registerBufferCount(n * 1000, n * 100000);
+    }
+    ASSERT_EQ(bIdx.getByteOffsetFromTimeUs(2e6, buf), StreamParser::BUF_OK);
+    ASSERT_EQ(bIdx.getByteOffsetFromTimeUs(4e6, buf), StreamParser::BUF_OUT_OF_RANGE);
+}
+
+TEST(BufferIndexer, timeWindowTest) {
+    StreamParser::BufferIndexer bIdx(1000, 0, 1);
+    uint64_t buf;
+    uint64_t timeUs = 1000000;
+    uint64_t pcr = 0;
+
+    // 1000 byte chunks with one PCR each, 40ms of media for the first
+    // 100 chunks and 10ms for the next 100
+    bIdx.setWindowTimeUs(2000000);
+    for (uint64_t n = 0; n < 200; ++n) {
+        uint64_t chunkUs = n < 100 ? 40000 : 10000;
+        timeUs += chunkUs;
+        bIdx.registerBufferCount((n + 1) * 1000, timeUs);
+        bIdx.registerPcr(n * 1000, pcr, false);
+        pcr += chunkUs * 27;
+    }
+
+    // 1s at each bitrate
+    ASSERT_NEAR(bIdx.getIndexSizeInBytes(), 125000, 2000);
+    ASSERT_EQ(bIdx.getByteOffsetFromTimeUs(1500000, buf), StreamParser::BUF_OK);
+    ASSERT_NEAR(buf, 112500, 2000);
+    ASSERT_EQ(bIdx.getByteOffsetFromTimeUs(3000000, buf), StreamParser::BUF_OUT_OF_RANGE);
+
+    // Arrival time without PCRs
+    bIdx.clear();
+    for (uint64_t n = 1; n <= 100; ++n) {
+        bIdx.registerBufferCount(n * 1000, n * 100000);
+    }
+    ASSERT_EQ(bIdx.getIndexSizeInTimeUs(), 2000000);
+
+    // No limit
+    bIdx.setWindowTimeUs(0);
+    ASSERT_EQ(bIdx.getIndexSizeInTimeUs(), 9900000);
+}
+
+TEST(BufferIndexer, trimFrontTest) {
+    StreamParser::BufferIndexer bIdx(100, 0, 1);
+    uint64_t buf;
+
+    for (uint64_t n = 1; n <= 100; ++n) {
+        bIdx.registerBufferCount(n * 1000, n * 100000);
+        bIdx.registerRandomAccessPoint(n * 1000 - 500);
+    }
+    ASSERT_EQ(bIdx.getIndexSizeInBytes(), 99000);
+
+    // The newest 20 chunks are kept
+    bIdx.trimFront(80000);
+    ASSERT_EQ(bIdx.getIndexSizeInBytes(), 20000);
+    ASSERT_EQ(bIdx.getIndexSizeInTimeUs(), 2000000);
+    ASSERT_EQ(bIdx.getByteOffsetFromTimeUs(3000000, buf), StreamParser::BUF_OUT_OF_RANGE);
+
+    // Random access points before the kept data are not found
+    buf = 19000;
+    ASSERT_EQ(bIdx.snapToRandomAccessPoint(buf, false), StreamParser::BUF_OK);
+    ASSERT_EQ(buf, 19500);
+    buf = 19900;
+    ASSERT_NE(bIdx.snapToRandomAccessPoint(buf, false), StreamParser::BUF_OK);
+
+    // Registration continues
+    bIdx.registerBufferCount(101000, 10100000);
+    ASSERT_EQ(bIdx.getIndexSizeInBytes(), 21000);
+}
+
+TEST(BufferIndexer, mediaTimeTest) {
+    StreamParser::BufferIndexer bIdx(300, 0, 1);
+    const uint64_t chunkSize = 1000;
+    const uint64_t chunkMediaUs = 40000;
+    const uint64_t chunks = 250;
+    uint64_t buf;
+    uint64_t timeUs = 1000000;
+    uint64_t pcr = StreamParser::PCR_WRAP - 3 * StreamParser::PCR_CLOCK_HZ;
+
+    // One PCR per chunk, 40ms of media each. The first 50 chunks arrive
+    // in a burst, the PCR wraps after 3s and jumps at chunk 150.
+    for (uint64_t n = 0; n < chunks; ++n) {
+        timeUs += n < 50 ? 1000 : chunkMediaUs;
+        bIdx.registerBufferCount((n + 1) * chunkSize, timeUs);
+        bool discontinuity = n == 150;
+        if (discontinuity) {
+            pcr = 12345;
+        }
+        bIdx.registerPcr(n * chunkSize + 100, pcr, discontinuity);
+        pcr = (pcr + chunkMediaUs * 27) % StreamParser::PCR_WRAP;
+    }
+
+    // Media time of the live point, extrapolated past the last PCR
+    uint64_t liveUs = (chunks - 1) * chunkMediaUs + (chunkSize - 100) * chunkMediaUs / chunkSize;
+
+    // Seeks land within one PCR interval of the media position, also
+    // beyond the range covered by arrival time
+    for (uint64_t seekS = 1; seekS <= 9; ++seekS) {
+        uint64_t targetUs = liveUs - seekS * 1000000;
+        uint64_t expectedOffset = chunks * chunkSize - (100 + targetUs * chunkSize / chunkMediaUs);
+
+        ASSERT_EQ(bIdx.getByteOffsetFromTimeUs(seekS * 1000000, buf), StreamParser::BUF_OK);
+        ASSERT_NEAR(expectedOffset, buf, chunkSize);
+
+        ASSERT_EQ(bIdx.getTimeUsFromByteOffset(buf, timeUs), StreamParser::BUF_OK);
+        ASSERT_NEAR(seekS * 1000000, timeUs, chunkMediaUs);
+    }
+
+    // Arrival time is used again once cleared
+    bIdx.clear();
+    bIdx.registerBufferCount(chunkSize, 1000000);
+    bIdx.registerBufferCount(2 * chunkSize, 2000000);
+    ASSERT_EQ(bIdx.getByteOffsetFromTimeUs(1000000, buf), StreamParser::BUF_OK);
+    ASSERT_EQ(buf, chunkSize);
+}
+
+TEST(BufferIndexer, randomAccessPointTest) {
+    StreamParser::BufferIndexer bIdx(200, 0, 1);
+    uint64_t offset;
+
+    // 100ms chunks of 1000 bytes, a random access point every 10 chunks
+    for (uint64_t n = 1; n <= 50; ++n) {
+        bIdx.registerBufferCount(n * 1000, n * 100000);
+        if (n % 10 == 0) {
+            bIdx.registerRandomAccessPoint(n * 1000 - 500);
+        }
+    }
+
+    // Snapped to the preceding or following random access point
+    offset = 50000 - 25000;
+    ASSERT_EQ(bIdx.snapToRandomAccessPoint(offset, false), StreamParser::BUF_OK);
+    ASSERT_EQ(offset, 50000 - 19500);
+    offset = 50000 - 25000;
+    ASSERT_EQ(bIdx.snapToRandomAccessPoint(offset, true), StreamParser::BUF_OK);
+    ASSERT_EQ(offset, 50000 - 29500);
+
+    // A random access point is kept
+    ASSERT_EQ(bIdx.snapToRandomAccessPoint(offset, false), StreamParser::BUF_OK);
+    ASSERT_EQ(offset, 50000 - 29500);
+
+    // Nothing before the first one
+    offset = 50000 - 5000;
+    ASSERT_EQ(bIdx.snapToRandomAccessPoint(offset, false), StreamParser::BUF_OUT_OF_RANGE);
+    ASSERT_EQ(offset, 50000 - 5000);
+
+    // Not snapped further than RAP_MAX_SNAP_US
+    for (uint64_t n = 51; n <= 120; ++n) {
+        bIdx.registerBufferCount(n * 1000, n * 100000);
+    }
+    offset = 120000 - 110000;
+    ASSERT_EQ(bIdx.snapToRandomAccessPoint(offset, false), StreamParser::BUF_OUT_OF_RANGE);
+    offset = 120000 - 53000;
+    ASSERT_EQ(bIdx.snapToRandomAccessPoint(offset, false), StreamParser::BUF_OK);
+    ASSERT_EQ(offset, 120000 - 49500);
+}
+
+TEST(BufferIndexer, pacedByteSizeTest) {
+    StreamParser::BufferIndexer bIdx(200, 0, 1);
+    uint64_t size;
+
+    ASSERT_EQ(bIdx.getByteSizeForTimeUs(0, 100000, size), StreamParser::BUF_EMPTY);
+
+    // 100ms chunks of 1000 bytes in arrival time
+    for (uint64_t n = 1; n <= 50; ++n) {
+        bIdx.registerBufferCount(n * 1000, n * 100000);
+    }
+    ASSERT_EQ(bIdx.getByteSizeForTimeUs(20000, 500000, size), StreamParser::BUF_OK);
+    ASSERT_EQ(size, 5000);
+    ASSERT_EQ(bIdx.getByteSizeForTimeUs(20500, 50000, size), StreamParser::BUF_OK);
+    ASSERT_EQ(size, 500);
+
+    // Limited by the live point
+    ASSERT_EQ(bIdx.getByteSizeForTimeUs(3000, 500000, size), StreamParser::BUF_OK);
+    ASSERT_EQ(size, 3000);
+
+    // Older than the index
+    ASSERT_EQ(bIdx.getByteSizeForTimeUs(60000, 500000, size), StreamParser::BUF_OUT_OF_RANGE);
+
+    // Media time once PCRs are registered, 40ms per chunk
+    bIdx.clear();
+    uint64_t pcr = 0;
+    for (uint64_t n = 0; n < 50; ++n) {
+        bIdx.registerBufferCount((n + 1) * 1000, 1000000 + n * 100000);
+        bIdx.registerPcr(n * 1000, pcr, false);
+        pcr += 40000 * 27;
+    }
+    ASSERT_EQ(bIdx.getByteSizeForTimeUs(20000, 400000, size), StreamParser::BUF_OK);
+    ASSERT_NEAR(size, 10000, 1);
+}
+
+TEST(SpillStore, writeReadTest) {
+    const std::string path = "/tmp/fcc_spill_test.bin";
+    const size_t chunkSize = 188 * 7 * 16;
+    const uint64_t totalSize = SPILL_SEGMENT_SIZE * 9 / 2;
+    auto pattern = [](uint64_t i) { return (unsigned char) (i * 7 + i / 251); };
+
+    // Room for three segments
+    StreamParser::SpillStore store(path, 3 * SPILL_SEGMENT_SIZE);
+    ASSERT_TRUE(store.isOpen());
+
+    // 1ms per chunk
+    std::vector<unsigned char> chunk(chunkSize);
+    for (uint64_t byteIndex = 0; byteIndex < totalSize; byteIndex += chunkSize) {
+        for (size_t i = 0; i < chunkSize; i++) {
+            chunk[i] = pattern(byteIndex + i);
+        }
+        store.append(chunk.data(), chunkSize, byteIndex, 1000000 + byteIndex / chunkSize * 1000);
+
+        // Segments are dropped if the disk falls behind, let it drain
+        uint64_t sealed = (byteIndex + chunkSize) / SPILL_SEGMENT_SIZE;
+        for (int i = 0; i < 500 && store.getStats().writtenSegments < sealed; i++) {
+            std::this_thread::sleep_for(10ms);
+        }
+    }
+
+    auto stats = store.getStats();
+    ASSERT_EQ(stats.writtenSegments, 4);
+    ASSERT_EQ(stats.droppedSegments, 0);
+    ASSERT_EQ(stats.storedBytes, 3 * SPILL_SEGMENT_SIZE);
+
+    // The first segment is overwritten, the last one is not sealed
+    uint64_t byteIndex;
+    uint64_t timeUs;
+    ASSERT_TRUE(store.getFront(byteIndex, timeUs));
+    ASSERT_EQ(byteIndex, SPILL_SEGMENT_SIZE);
+
+    std::vector<char> data(4096);
+    ASSERT_EQ(store.read(data.data(), data.size(), 100), 0);
+    ASSERT_EQ(store.read(data.data(), data.size(), 4 * SPILL_SEGMENT_SIZE + 100), 0);
+
+    // Reads stop at the end of a segment
+    uint64_t readIndex = 2 * SPILL_SEGMENT_SIZE - 1000;
+    ASSERT_EQ(store.read(data.data(), data.size(), readIndex), 1000);
+    ASSERT_EQ(store.read(data.data(), data.size(), readIndex + 1000), data.size());
+    for (size_t i = 0; i < data.size(); i++) {
+        ASSERT_EQ((unsigned char) data[i], pattern(readIndex + 1000 + i));
+    }
+
+    // Arrival time and byte index map onto each other
+    uint64_t time;
+    ASSERT_TRUE(store.getTimeForByteIndex(3 * SPILL_SEGMENT_SIZE, time));
+    ASSERT_TRUE(store.getByteIndexForTime(time, byteIndex));
+    ASSERT_NEAR(byteIndex, 3 * SPILL_SEGMENT_SIZE, chunkSize);
+    ASSERT_FALSE(store.getByteIndexForTime(1000000, byteIndex));
+
+    store.clear();
+    ASSERT_FALSE(store.getFront(byteIndex, timeUs));
+    ASSERT_EQ(store.read(data.data(), data.size(), readIndex), 0);
+}
+
+TEST(SpillStore, concurrentClearTest) {
+    const std::string path = "/tmp/fcc_spill_clear_test.bin";
+    const size_t chunkSize = 188 * 7 * 16;
+    const uint64_t totalSize = SPILL_SEGMENT_SIZE * 8;
+    auto pattern = [](uint64_t i) { return (unsigned char) (i * 7 + i / 251); };
+
+    StreamParser::SpillStore store(path, 4 * SPILL_SEGMENT_SIZE);
+    ASSERT_TRUE(store.isOpen());
+
+    // Cleared while the appending thread fills a segment
+    std::atomic<bool> done {false};
+    std::thread appender([&]() {
+        std::vector<unsigned char> chunk(chunkSize);
+        for (uint64_t byteIndex = 0; byteIndex < totalSize; byteIndex += chunkSize) {
+            for (size_t i = 0; i < chunkSize; i++) {
+                chunk[i] = pattern(byteIndex + i);
+            }
+            store.append(chunk.data(), chunkSize, byteIndex, 1000000 + byteIndex / chunkSize * 1000);
+            std::this_thread::sleep_for(1ms);
+        }
+        done = true;
+    });
+    while (!done) {
+        store.clear();
+        std::this_thread::sleep_for(20ms);
+    }
+    appender.join();
+
+    // Segments stored after a clear hold the data of their byte index
+    uint64_t byteIndex;
+    uint64_t timeUs;
+    std::vector<char> data(4096);
+    if (store.getFront(byteIndex, timeUs)) {
+        ASSERT_EQ(store.read(data.data(), data.size(), byteIndex), data.size());
+        for (size_t i = 0; i < data.size(); i++) {
+            ASSERT_EQ((unsigned char) data[i], pattern(byteIndex + i));
+        }
+    }
+}
+
+TEST(PersistentTsb, restoreTest) {
+    const char *shmName = "/fcc_persistent_tsb_test";
+    const size_t chunks = 8;
+    shm_unlink(shmName);
+
+    // Ten chunks received 40 ms apart, the last one 10 s ago
+    const uint64_t periodUs = 40000;
+    {
+        StreamParser::PersistentTsb tsb(shmName, chunks);
+        tsb.onOpen("239.0.0.1:5900");
+        ASSERT_EQ(tsb.restore([](const StreamParser::Buffer &) {}), 0);
+
+        buffer_chunk chunk {};
+        uint64_t firstTimeUs = bufferMetaTimeNowUs() - 10000000 - 9 * periodUs;
+        for (unsigned n = 0; n < 10; n++) {
+            chunk.fill(n);
+            BufferMeta meta {};
+            meta.ingestTimeUs = firstTimeUs + n * periodUs;
+            meta.seqFirst = n;
+            meta.flags = n == 0 ? BUFFER_FLAG_SOURCE_SWITCH : 0;
+            tsb.post({"239.0.0.1:5900", &chunk, meta, {}});
+        }
+    }
+
+    // Same channel, the oldest slot is not replayed
+    for (int i = 0; i < 2; i++) {
+        StreamParser::PersistentTsb tsb(shmName, chunks);
+        tsb.onOpen("239.0.0.1:5900");
+
+        std::vector<unsigned> restored;
+        uint64_t startUs = bufferMetaTimeNowUs();
+        uint64_t lastTimeUs = 0;
+        ASSERT_EQ(tsb.restore([&](const StreamParser::Buffer &buf) {
+            ASSERT_EQ((*buf.chunk)[0], buf.meta.seqFirst);
+            ASSERT_EQ((*buf.chunk)[BUFFER_CHUNK_SIZE - 1], buf.meta.seqFirst);
+            ASSERT_EQ(buf.meta.flags == BUFFER_FLAG_SOURCE_SWITCH, restored.empty());
+            // Re-stamped, same spacing
+            if (!restored.empty()) {
+                ASSERT_EQ(buf.meta.ingestTimeUs - lastTimeUs, periodUs);
+            }
+            lastTimeUs = buf.meta.ingestTimeUs;
+            restored.push_back(buf.meta.seqFirst);
+            // Replayed chunks are not kept again
+            tsb.post(buf);
+        }), chunks - 1);
+        ASSERT_EQ(restored, std::vector<unsigned>({3, 4, 5, 6, 7, 8, 9}));
+        // The last one ends now
+        ASSERT_GE(lastTimeUs, startUs);
+        ASSERT_LE(lastTimeUs, bufferMetaTimeNowUs());
+        ASSERT_EQ(tsb.restore([](const StreamParser::Buffer &) {}), 0);
+    }
+
+    // Another channel is not restored and drops the kept chunks
+    for (int i = 0; i < 2; i++) {
+        StreamParser::PersistentTsb tsb(shmName, chunks);
+        tsb.onOpen("239.0.0.2:5900");
+        ASSERT_EQ(tsb.restore([](const StreamParser::Buffer &) {}), 0);
+    }
+
+    shm_unlink(shmName);
+}
+
+TEST(PersistentTsb, limitTest) {
+    const char *shmName = "/fcc_persistent_tsb_limit_test";
+    const char *channel = "239.0.0.1:5900";
+    const size_t chunks = 8;
+    size_t limit = chunks;
+    shm_unlink(shmName);
+
+    auto post = [channel](StreamParser::PersistentTsb &tsb, unsigned first, unsigned last) {
+        buffer_chunk chunk {};
+        for (unsigned n = first; n < last; n++) {
+            chunk.fill(n);
+            BufferMeta meta {};
+            meta.ingestTimeUs = bufferMetaTimeNowUs();
+            meta.seqFirst = n;
+            tsb.post({channel, &chunk, meta, {}});
+        }
+    };
+
+    // A lower limit drops the chunks kept
+    {
+        StreamParser::PersistentTsb tsb(shmName, chunks);
+        tsb.setLimit([&limit]() { return limit; });
+        tsb.onOpen(channel);
+        post(tsb, 0, 10);
+        limit = 4;
+        post(tsb, 10, 16);
+    }
+
+    // Live chunks kept after a replay do not continue it
+    for (auto expected : {std::vector<unsigned>({13, 14, 15}), std::vector<unsigned>({15, 16, 17})}) {
+        StreamParser::PersistentTsb tsb(shmName, chunks);
+        tsb.setLimit([&limit]() { return limit; });
+        tsb.onOpen(channel);
+
+        std::vector<unsigned> restored;
+        ASSERT_EQ(tsb.restore([&](const StreamParser::Buffer &buf) {
+            if (buf.meta.seqFirst == 16) {
+                ASSERT_EQ(buf.meta.flags, BUFFER_FLAG_DISCONTINUITY);
+            } else if (!restored.empty()) {
+                ASSERT_EQ(buf.meta.flags, 0);
+            }
+            restored.push_back(buf.meta.seqFirst);
+        }), limit - 1);
+        ASSERT_EQ(restored, expected);
+        post(tsb, 16, 18);
+    }
+
+    shm_unlink(shmName);
+}
+
+TEST(ReadPacer, tokenBucketTest) {
+    StreamParser::ReadPacer pacer(500000);
+    uint64_t now = 1000000;
+
+    ASSERT_FALSE(pacer.isEnabled());
+    ASSERT_EQ(pacer.getWaitUs(now), 0);
+
+    // Starts with a full burst
+    pacer.setRate(2);
+    ASSERT_TRUE(pacer.isEnabled());
+    ASSERT_EQ(pacer.getCreditUs(now), 500000);
+
+    // In debt, refilled at twice real time
+    pacer.consume(700000);
+    ASSERT_EQ(pacer.getCreditUs(now), -200000);
+    ASSERT_EQ(pacer.getWaitUs(now), 100001);
+    now += 100001;
+    ASSERT_EQ(pacer.getWaitUs(now), 0);
+
+    // Not refilled beyond the burst
+    now += 10000000;
+    ASSERT_EQ(pacer.getCreditUs(now), 500000);
+
+    // Reset refills right away
+    pacer.consume(900000);
+    pacer.reset();
+    ASSERT_EQ(pacer.getCreditUs(now), 500000);
+
+    pacer.setRate(0);
+    pacer.consume(900000);
+    ASSERT_EQ(pacer.getWaitUs(now), 0);
+}
+
 TEST(TimeIntervalMonitor, unitTest) {
     const uint64_t tolerance_us = 10e3;
     TimeIntervalMonitor timer;
@@ -574,3 +1065,482 @@ TEST(TimeIntervalMonitor, unitTest) {
     // Test that the accumulated time is now ~850ms
     ASSERT_NEAR(850e3, timer.getAccumulatedTimeInMicroSeconds(), tolerance_us);
 }
+
+TEST(MemoryPressureMonitor, subscriptionTest) {
+    // Disabled without the cgroup
+    {
+        MemoryPressureMonitor monitor("/nonexistent/tsb.slice", [](MemoryPressureMonitor::Level) {});
+        ASSERT_EQ(monitor.getLevel(), MemoryPressureMonitor::NONE);
+    }
+
+    // Subscribes to the medium and critical levels of a cgroup
+    char dir[] = "/tmp/fcc_cgroup_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    std::string pressureFile = std::string(dir) + "/memory.pressure_level";
+    std::string controlFile = std::string(dir) + "/cgroup.event_control";
+    fclose(fopen(pressureFile.c_str(), "w"));
+    fclose(fopen(controlFile.c_str(), "w"));
+    {
+        MemoryPressureMonitor monitor(dir, [](MemoryPressureMonitor::Level) {});
+        ASSERT_EQ(monitor.getLevel(), MemoryPressureMonitor::NONE);
+    }
+
+    std::ifstream control(controlFile);
+    std::string content((std::istreambuf_iterator<char>(control)), std::istreambuf_iterator<char>());
+    ASSERT_NE(content.find(" medium"), std::string::npos);
+    ASSERT_NE(content.find(" critical"), std::string::npos);
+
+    unlink(pressureFile.c_str());
+    unlink(controlFile.c_str());
+    rmdir(dir);
+}
+
+TEST(BufferQueue, dropNewestPolicyTest) {
+    BufferQueue<int, 2> bq;
+    int bufs[2] = {0, 1};
+    int *buf = nullptr;
+    uint32_t drops = 0;
+
+    bq.release(&bufs[0]);
+    bq.release(&bufs[1]);
+    bq.setOverflowPolicy(OverflowPolicy::DROP_NEWEST);
+
+    // Fill up the consumer queue
+    ASSERT_TRUE(bq.acquire(&buf, false));
+    bq.queue(buf);
+    ASSERT_TRUE(bq.acquire(&buf, false));
+    bq.queue(buf);
+
+    // No free buffer left. The acquire must fail without blocking.
+    ASSERT_FALSE(bq.acquire(&buf, false));
+    ASSERT_FALSE(bq.acquire(&buf, false));
+    ASSERT_EQ(bq.getOverflowStats().droppedNewest, 2);
+
+    // Drops are reported on the first buffer queued after the drop
+    ASSERT_TRUE(bq.consume(&buf, std::chrono::seconds(1), &drops));
+    ASSERT_EQ(drops, 0);
+    bq.release(buf);
+    ASSERT_TRUE(bq.acquire(&buf, false));
+    bq.queue(buf);
+    ASSERT_TRUE(bq.consume(&buf, std::chrono::seconds(1), &drops));
+    ASSERT_EQ(drops, 0);
+    ASSERT_TRUE(bq.consume(&buf, std::chrono::seconds(1), &drops));
+    ASSERT_EQ(drops, 2);
+}
+
+TEST(BufferQueue, dropOldestPolicyTest) {
+    BufferQueue<int, 2> bq;
+    int bufs[2] = {0, 1};
+    int *buf = nullptr;
+    uint32_t drops = 0;
+
+    bq.release(&bufs[0]);
+    bq.release(&bufs[1]);
+    bq.setOverflowPolicy(OverflowPolicy::DROP_OLDEST);
+
+    ASSERT_TRUE(bq.acquire(&buf, false));
+    bq.queue(buf);
+    ASSERT_TRUE(bq.acquire(&buf, false));
+    bq.queue(buf);
+
+    // The oldest queued buffer is reclaimed
+    ASSERT_TRUE(bq.acquire(&buf, false));
+    ASSERT_EQ(buf, &bufs[0]);
+    ASSERT_EQ(bq.getOverflowStats().droppedOldest, 1);
+    bq.queue(buf);
+
+    // The buffer following the reclaimed one carries the drop
+    ASSERT_TRUE(bq.consume(&buf, std::chrono::seconds(1), &drops));
+    ASSERT_EQ(buf, &bufs[1]);
+    ASSERT_EQ(drops, 1);
+    ASSERT_TRUE(bq.consume(&buf, std::chrono::seconds(1), &drops));
+    ASSERT_EQ(buf, &bufs[0]);
+    ASSERT_EQ(drops, 0);
+}
+
+TEST(BufferQueue, tryAcquireTest) {
+    BufferQueue<int, 2> bq;
+    int bufs[2] = {0, 1};
+    int *buf = nullptr;
+
+    bq.release(&bufs[0]);
+    bq.release(&bufs[1]);
+    bq.setOverflowPolicy(OverflowPolicy::DROP_OLDEST);
+
+    ASSERT_TRUE(bq.tryAcquire(&buf));
+    bq.queue(buf);
+    ASSERT_TRUE(bq.tryAcquire(&buf));
+    bq.queue(buf);
+
+    // Queued buffers are not reclaimed and nothing is counted
+    buf = nullptr;
+    ASSERT_FALSE(bq.tryAcquire(&buf));
+    ASSERT_EQ(buf, nullptr);
+    auto stats = bq.getOverflowStats();
+    ASSERT_EQ(stats.droppedOldest, 0);
+    ASSERT_EQ(stats.droppedNewest, 0);
+
+    ASSERT_TRUE(bq.consume(&buf, std::chrono::seconds(1)));
+    ASSERT_EQ(buf, &bufs[0]);
+    ASSERT_TRUE(bq.consume(&buf, std::chrono::seconds(1)));
+    ASSERT_EQ(buf, &bufs[1]);
+}
+
+static void writeTestPacket(uint8_t *p, uint16_t pid, uint8_t cc, bool withPcr, uint64_t pcr) {
+    memset(p, 0xFF, TS_PACKAGE_SIZE);
+    p[0] = 0x47;
+    p[1] = (pid >> 8) & 0x1F;
+    p[2] = pid & 0xFF;
+    if (withPcr) {
+        uint64_t base = pcr / 300;
+        uint64_t ext = pcr % 300;
+        p[3] = 0x30 | cc;
+        p[4] = 7;
+        p[5] = 0x10;
+        p[6] = base >> 25;
+        p[7] = base >> 17;
+        p[8] = base >> 9;
+        p[9] = base >> 1;
+        p[10] = ((base & 0x01) << 7) | 0x7E | ((ext >> 8) & 0x01);
+        p[11] = ext & 0xFF;
+    } else {
+        p[3] = 0x10 | cc;
+    }
+}
+
+static uint64_t readTestPcr(const uint8_t *p) {
+    uint64_t base = ((uint64_t) p[6] << 25) | ((uint64_t) p[7] << 17)
+                    | ((uint64_t) p[8] << 9) | ((uint64_t) p[9] << 1) | (p[10] >> 7);
+    return base * 300 + (((p[10] & 0x01) << 8) | p[11]);
+}
+
+TEST(StuffingGenerator, pcrContinuityTest) {
+    // One PCR packet followed by 99 packets every 40ms => 3.76 Mbit/s
+    const uint16_t pcrPid = 0x100;
+    const uint64_t pcrStep = 27000000 / 25;
+    const uint64_t bitrate = 100 * TS_PACKAGE_SIZE * 8 * 25;
+    auto tracker = std::make_shared<StreamParser::PcrTracker>();
+    StuffingGenerator gen(1000000);
+    std::vector<uint8_t> interval(100 * TS_PACKAGE_SIZE);
+    std::vector<uint8_t> stream;
+    uint64_t pcr = 1000;
+    uint8_t cc = 0;
+
+    gen.setPcrTracker(tracker);
+    tracker->onOpen("");
+    ASSERT_EQ(gen.getPcrPid(), StuffingGenerator::INVALID_PID);
+    ASSERT_EQ(gen.getBitrate(), 1000000);
+
+    for (int n = 0; n < 50; n++) {
+        writeTestPacket(interval.data(), pcrPid, cc, true, pcr);
+        for (int k = 1; k < 100; k++) {
+            writeTestPacket(&interval[k * TS_PACKAGE_SIZE], 0x101, k & 0x0F, false, 0);
+        }
+        gen.observe(interval.data(), interval.size(), n * 40000);
+        pcr += pcrStep;
+        cc = (cc + 1) & 0x0F;
+
+        // The tracker only gets complete chunks, behind the generator
+        stream.insert(stream.end(), interval.begin(), interval.end());
+        if (stream.size() >= BUFFER_CHUNK_SIZE) {
+            buffer_chunk chunk;
+            memcpy(chunk.data(), stream.data(), BUFFER_CHUNK_SIZE);
+            stream.erase(stream.begin(), stream.begin() + BUFFER_CHUNK_SIZE);
+            tracker->post({"", &chunk, {}});
+        }
+    }
+    uint64_t lastPcr = pcr - pcrStep;
+    uint8_t lastCc = (cc - 1) & 0x0F;
+
+    // Bitrate of the tracker, PCR of the last observed packet
+    ASSERT_EQ(tracker->getBitrate(), bitrate);
+    ASSERT_EQ(gen.getPcrPid(), pcrPid);
+    ASSERT_EQ(gen.getBitrate(), bitrate);
+
+    // One second of stuffing
+    gen.start(0);
+    ASSERT_TRUE(gen.isActive());
+    auto pending = gen.getPendingBytes(1000000);
+    ASSERT_EQ(pending, bitrate / 8);
+
+    std::vector<uint8_t> out(pending);
+    ASSERT_EQ(gen.fill(out.data(), out.size()), pending);
+    ASSERT_EQ(gen.getPendingBytes(1000000), 0);
+
+    // A PCR packet every 40ms continuing the observed PCR timeline.
+    // The continuity counter of adaptation only packets is unchanged.
+    for (size_t n = 0; n < pending / TS_PACKAGE_SIZE; n++) {
+        const uint8_t *p = &out[n * TS_PACKAGE_SIZE];
+        ASSERT_EQ(p[0], 0x47);
+        uint16_t pid = ((p[1] & 0x1F) << 8) | p[2];
+        if (n % 100 == 0) {
+            ASSERT_EQ(pid, pcrPid);
+            ASSERT_EQ(p[3], 0x20 | lastCc);
+            ASSERT_EQ(readTestPcr(p), lastPcr + (n / 100 + 1) * pcrStep);
+        } else {
+            ASSERT_EQ(pid, 0x1FFF);
+        }
+    }
+
+    gen.stop();
+    ASSERT_EQ(gen.getPendingBytes(2000000), 0);
+}
+
+class RecordingConsumer : public StreamParser::StreamConsumer {
+public:
+    explicit RecordingConsumer(bool async, std::chrono::milliseconds delay = 0ms,
+                               StreamParser::QueuePolicy policy = StreamParser::QueuePolicy::LOSSLESS)
+            : StreamConsumer("Recording", async, policy), mDelay(delay) {}
+
+    void post(const StreamParser::Buffer &buf) override {
+        std::this_thread::sleep_for(mDelay);
+        std::lock_guard<std::mutex> lock(mMutex);
+        mEvents.push_back("data" + std::to_string((*buf.chunk)[0]) +
+                          ((buf.meta.flags & BUFFER_FLAG_DISCONTINUITY) ? "*" : ""));
+        mThreads.insert(std::this_thread::get_id());
+    }
+
+    void onOpen(const char *channelId) override {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mEvents.push_back(std::string("open:") + channelId);
+    }
+
+    void onEndOfStream(const char *channelId) override {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mEvents.push_back(std::string("eos:") + channelId);
+    }
+
+    std::vector<std::string> events() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mEvents;
+    }
+
+    std::set<std::thread::id> threads() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mThreads;
+    }
+
+private:
+    std::chrono::milliseconds mDelay;
+    std::mutex mMutex;
+    std::vector<std::string> mEvents;
+    std::set<std::thread::id> mThreads;
+};
+
+TEST(StreamProcessor, asyncConsumerTest) {
+    auto syncCons = std::make_shared<RecordingConsumer>(false);
+    auto asyncCons = std::make_shared<RecordingConsumer>(true);
+    StreamParser::StreamProcessor proc({syncCons, asyncCons});
+    buffer_chunk chunk;
+
+    for (int n = 0; n < 10; n++) {
+        chunk[0] = n;
+        proc.post({"ch", &chunk, {}});
+    }
+    proc.join();
+
+    // Async consumers get a copy of every chunk, in order, on a worker thread
+    auto events = asyncCons->events();
+    ASSERT_EQ(events.size(), 10);
+    for (int n = 0; n < 10; n++) {
+        ASSERT_EQ(events[n], "data" + std::to_string(n));
+    }
+    ASSERT_EQ(syncCons->events(), events);
+    ASSERT_EQ(syncCons->threads().count(std::this_thread::get_id()), 1);
+    ASSERT_EQ(asyncCons->threads().count(std::this_thread::get_id()), 0);
+}
+
+TEST(StreamProcessor, asyncConsumerOpenDiscardsTest) {
+    auto asyncCons = std::make_shared<RecordingConsumer>(true, 50ms);
+    StreamParser::StreamProcessor proc({asyncCons});
+    buffer_chunk chunk;
+
+    for (int n = 0; n < 5; n++) {
+        chunk[0] = n;
+        proc.post({"ch1", &chunk, {}});
+    }
+    // Chunks of the previous channel not yet processed are discarded
+    proc.onOpen("ch2");
+    chunk[0] = 9;
+    proc.post({"ch2", &chunk, {}});
+    proc.join();
+
+    auto events = asyncCons->events();
+    ASSERT_LT(events.size(), 7);
+    ASSERT_EQ(events[events.size() - 2], "open:ch2");
+    ASSERT_EQ(events.back(), "data9");
+}
+
+TEST(StreamProcessor, lossyConsumerTest) {
+    auto syncCons = std::make_shared<RecordingConsumer>(false);
+    auto lossyCons = std::make_shared<RecordingConsumer>(true, 5ms, StreamParser::QueuePolicy::LOSSY);
+    StreamParser::StreamProcessor proc({syncCons, lossyCons});
+    buffer_chunk chunk;
+    const int count = STREAM_CONSUMER_QUEUE_SIZE * 2;
+
+    // A slow lossy consumer drops instead of blocking the sync consumers
+    for (int n = 0; n < count; n++) {
+        chunk[0] = n;
+        proc.post({"ch1", &chunk, {}});
+    }
+    ASSERT_EQ(syncCons->events().size(), count);
+
+    // The buffer following dropped buffers is flagged
+    proc.join();
+    chunk[0] = 100;
+    proc.post({"ch1", &chunk, {}});
+    proc.join();
+    ASSERT_EQ(lossyCons->events().back(), "data100*");
+
+    auto stats = proc.getQueueStats();
+    ASSERT_EQ(stats.size(), 1);
+    ASSERT_EQ(stats[0].policy, StreamParser::QueuePolicy::LOSSY);
+    ASSERT_EQ(stats[0].depth, 0);
+    ASSERT_EQ(stats[0].maxDepth, STREAM_CONSUMER_QUEUE_SIZE);
+    ASSERT_GT(stats[0].dropped, 0);
+    ASSERT_EQ(stats[0].dropped + lossyCons->events().size(), count + 1);
+    ASSERT_EQ(stats[0].blockedCount, 0);
+}
+
+TEST(StreamProcessor, attachDetachTest) {
+    auto syncCons = std::make_shared<RecordingConsumer>(false);
+    auto asyncCons = std::make_shared<RecordingConsumer>(true);
+    StreamParser::StreamProcessor proc({});
+    buffer_chunk chunk;
+
+    proc.onOpen("ch1");
+    chunk[0] = 1;
+    proc.post({"ch1", &chunk, {}});
+
+    // Late joiners get the open event before the first buffer
+    proc.attach(syncCons);
+    proc.attach(asyncCons);
+    chunk[0] = 2;
+    proc.post({"ch1", &chunk, {}});
+    proc.join();
+    std::vector<std::string> expected = {"open:ch1", "data2"};
+    ASSERT_EQ(syncCons->events(), expected);
+    ASSERT_EQ(asyncCons->events(), expected);
+
+    // Detached consumers get end of stream and no further buffers
+    ASSERT_TRUE(proc.detach(asyncCons));
+    ASSERT_FALSE(proc.detach(asyncCons));
+    chunk[0] = 3;
+    proc.post({"ch1", &chunk, {}});
+    proc.join();
+    expected.emplace_back("eos:ch1");
+    ASSERT_EQ(asyncCons->events(), expected);
+    ASSERT_EQ(syncCons->events().back(), "data3");
+    ASSERT_TRUE(proc.getQueueStats().empty());
+}
+
+TEST(StreamProcessor, attachWhileStreamingTest) {
+    auto syncCons = std::make_shared<RecordingConsumer>(false);
+    StreamParser::StreamProcessor proc({syncCons});
+    std::atomic<bool> done {false};
+
+    proc.onOpen("ch1");
+    std::thread ingest([&proc, &done]() {
+        buffer_chunk chunk;
+        chunk[0] = 0;
+        while (!done) {
+            proc.post({"ch1", &chunk, {}});
+        }
+    });
+
+    for (int n = 0; n < 100; n++) {
+        auto cons = std::make_shared<RecordingConsumer>(n % 2 == 0);
+        proc.attach(cons);
+        ASSERT_TRUE(proc.detach(cons));
+        auto events = cons->events();
+        ASSERT_EQ(events.front(), "open:ch1");
+        ASSERT_EQ(events.back(), "eos:ch1");
+    }
+    done = true;
+    ingest.join();
+    ASSERT_GT(syncCons->events().size(), 1);
+}
+
+TEST(StreamProcessor, detachWithOverlappingPostsTest) {
+    // Posts from two threads through a slow consumer always overlap, so
+    // there is never a moment without a post in flight
+    auto slowCons = std::make_shared<RecordingConsumer>(false, 2ms);
+    StreamParser::StreamProcessor proc({slowCons});
+    std::atomic<bool> done {false};
+
+    proc.onOpen("ch1");
+    auto ingest = [&proc, &done]() {
+        buffer_chunk chunk;
+        chunk[0] = 0;
+        while (!done) {
+            proc.post({"ch1", &chunk, {}});
+        }
+    };
+    std::thread ingest1(ingest);
+    std::thread ingest2(ingest);
+
+    for (int n = 0; n < 20; n++) {
+        auto cons = std::make_shared<RecordingConsumer>(false);
+        proc.attach(cons);
+        ASSERT_TRUE(proc.detach(cons));
+        auto count = cons->events().size();
+        std::this_thread::sleep_for(5ms);
+        ASSERT_EQ(cons->events().size(), count);
+        ASSERT_EQ(cons->events().back(), "eos:ch1");
+    }
+    done = true;
+    ingest1.join();
+    ingest2.join();
+}
+
+TEST(StreamProcessor, staticPipelineTest) {
+    auto syncCons = std::make_shared<RecordingConsumer>(false);
+    auto asyncCons = std::make_shared<RecordingConsumer>(true);
+    auto dynamicCons = std::make_shared<RecordingConsumer>(false);
+    StreamParser::StreamProcessor proc(StreamParser::makeStaticPipeline(syncCons, asyncCons), {dynamicCons});
+    buffer_chunk chunk;
+
+    proc.onOpen("ch1");
+    chunk[0] = 1;
+    proc.post({"ch1", &chunk, {}});
+    proc.onEndOfStream("ch1");
+    proc.join();
+
+    std::vector<std::string> expected = {"open:ch1", "data1", "eos:ch1"};
+    ASSERT_EQ(syncCons->events(), expected);
+    ASSERT_EQ(asyncCons->events(), expected);
+    ASSERT_EQ(dynamicCons->events(), expected);
+    ASSERT_EQ(proc.getQueueStats().size(), 1);
+}
+
+TEST(ChunkPool, sharedChunkTest) {
+    auto pool = StreamParser::ChunkPool::create(1, 2);
+    auto asyncCons = std::make_shared<RecordingConsumer>(true);
+    StreamParser::StreamProcessor proc({asyncCons});
+
+    auto ref = pool->acquire();
+    (*ref.get())[0] = 7;
+    ASSERT_EQ(pool->getFreeCount(), 0);
+
+    proc.post({"ch1", ref.get(), {}, ref});
+    ref.reset();
+    proc.join();
+
+    // The chunk is returned to the pool once the consumer is done
+    ASSERT_EQ(asyncCons->events().back(), "data7");
+    ASSERT_EQ(pool->getFreeCount(), 1);
+    ASSERT_EQ(pool->getAllocatedCount(), 1);
+
+    // Pool grows on demand up to the maximum size
+    auto ref1 = pool->acquire();
+    auto ref2 = pool->acquire();
+    ASSERT_NE(ref1.get(), ref2.get());
+    ASSERT_EQ(pool->getAllocatedCount(), 2);
+
+    // Handles keep the chunk valid after the pool is dropped
+    auto copy = ref1;
+    pool.reset();
+    ref1.reset();
+    (*copy.get())[0] = 1;
+    ASSERT_EQ((*copy.get())[0], 1);
+}